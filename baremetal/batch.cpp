@@ -0,0 +1,163 @@
+#include "batch.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+// How often a blocked reader checks whether the run was stopped
+#define BATCH_POLL_MS 100
+
+static std::atomic<bool> batch_stopped(false);
+
+// Bounded line queue between the reader thread and the executor
+typedef struct {
+    std::mutex lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<std::string> lines;
+    bool eof;
+    bool failed;
+} LineQueue;
+
+// Skip blank lines and '#' comments (this also covers a '#!' shebang line)
+static bool is_command_line(const char *line) {
+    while (*line && isspace((unsigned char)*line)) line++;
+    return *line && *line != '#';
+}
+
+static void run_line(const char *line, BatchLineHandler handler) {
+    if (is_command_line(line)) {
+        handler(line);
+    }
+}
+
+int batch_run_string(const char *script, BatchLineHandler handler) {
+    batch_stopped = false;
+
+    std::string current;
+    char quote = 0;
+    for (const char *p = script; ; p++) {
+        char c = *p;
+        bool split = (c == '\0' || c == '\n' || (c == ';' && !quote));
+        if (split) {
+            run_line(current.c_str(), handler);
+            current.clear();
+            if (c == '\0' || batch_stopped) break;
+            continue;
+        }
+
+        // A quote opens only at the start of a word, so the apostrophe in
+        // "don't" is an ordinary character
+        if (quote) {
+            if (c == quote) quote = 0;
+        } else if ((c == '"' || c == '\'') &&
+                   (current.empty() || isspace((unsigned char)current.back()))) {
+            quote = c;
+        }
+        current += c;
+    }
+    return 0;
+}
+
+static void queue_push(LineQueue *queue, const std::string &line) {
+    std::unique_lock<std::mutex> guard(queue->lock);
+    while (queue->lines.size() >= BATCH_QUEUE_DEPTH && !batch_stopped) {
+        queue->not_full.wait(guard);
+    }
+    queue->lines.push_back(line);
+    queue->not_empty.notify_one();
+}
+
+static void queue_finish(LineQueue *queue, bool failed) {
+    std::lock_guard<std::mutex> guard(queue->lock);
+    queue->eof = true;
+    queue->failed = failed;
+    queue->not_empty.notify_one();
+}
+
+// Reader side of the pipeline: split the input into lines
+static void reader_thread(int fd, LineQueue *queue) {
+    char chunk[BATCH_MAX_LINE];
+    std::string partial;
+    bool failed = false;
+
+    while (!batch_stopped) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        int ready = poll(&pfd, 1, BATCH_POLL_MS);
+        if (ready < 0 && errno != EINTR) {
+            failed = true;
+            break;
+        }
+        if (ready <= 0) continue;
+
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            failed = true;
+            break;
+        }
+        if (n == 0) break;
+
+        for (ssize_t i = 0; i < n; i++) {
+            if (chunk[i] == '\n' || partial.size() >= BATCH_MAX_LINE - 1) {
+                queue_push(queue, partial);
+                partial.clear();
+                if (chunk[i] == '\n') continue;
+            }
+            partial += chunk[i];
+        }
+    }
+
+    if (!partial.empty() && !batch_stopped) {
+        queue_push(queue, partial);
+    }
+    queue_finish(queue, failed);
+}
+
+int batch_run_fd(int fd, BatchLineHandler handler) {
+    batch_stopped = false;
+
+    LineQueue queue;
+    queue.eof = false;
+    queue.failed = false;
+
+    std::thread reader(reader_thread, fd, &queue);
+
+    while (!batch_stopped) {
+        std::string line;
+        {
+            std::unique_lock<std::mutex> guard(queue.lock);
+            while (queue.lines.empty() && !queue.eof) {
+                queue.not_empty.wait(guard);
+            }
+            if (queue.lines.empty()) break;
+            line.swap(queue.lines.front());
+            queue.lines.pop_front();
+            queue.not_full.notify_one();
+        }
+        run_line(line.c_str(), handler);
+    }
+
+    // Wake a reader blocked on a full queue so it can see the stop
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.not_full.notify_all();
+    }
+    reader.join();
+
+    return queue.failed ? -1 : 0;
+}
+
+void batch_stop(void) {
+    batch_stopped = true;
+}
@@ -0,0 +1,31 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// Non-interactive command runner for MINUX
+// Feeds commands from a string, script file or stdin to a line handler
+// without starting ncurses
+
+// Maximum length of one script line (longer lines are split)
+#define BATCH_MAX_LINE 4096
+
+// Lines read ahead of the command currently executing
+#define BATCH_QUEUE_DEPTH 64
+
+typedef void (*BatchLineHandler)(const char *line);
+
+// Run every command in a string. Commands are separated by newlines or
+// by ';' outside of quotes. A ' or " starts a quote only at the start of
+// a word (after a separator or whitespace) and the same character ends
+// it; anywhere else it is an ordinary character, so "echo don't; ls" is
+// two commands. Returns 0 on success.
+int batch_run_string(const char *script, BatchLineHandler handler);
+
+// Run commands read from a file descriptor. A reader thread keeps the
+// queue filled while the current command executes. Returns 0 on
+// success or -1 if reading failed.
+int batch_run_fd(int fd, BatchLineHandler handler);
+
+// Stop after the command currently executing (used by 'exit')
+void batch_stop(void);
+
+#endif // BATCH_H
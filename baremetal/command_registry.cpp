@@ -0,0 +1,243 @@
+#include "command_registry.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+// Seeds tried per table size before the table is doubled
+#define REGISTRY_MAX_SEEDS 1024
+
+// A slot value meaning "no command hashes here"
+#define REGISTRY_EMPTY_SLOT 0xFFFF
+
+// BK-tree node - children are keyed by their edit distance to this node
+typedef struct {
+    int spec_index;
+    std::vector<std::pair<int, int> > children;  // (distance, node index)
+} BKNode;
+
+static const CommandSpec *registry_specs = NULL;
+static int registry_size = 0;
+
+// Perfect hash table: slot -> index into registry_specs
+static uint16_t *hash_slots = NULL;
+static uint32_t hash_mask = 0;
+static uint32_t hash_seed = 0;
+
+static std::vector<BKNode> bk_nodes;
+
+// FNV-1a, seeded so a collision-free layout can be searched for
+static uint32_t hash_name(const char *name, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    // Final avalanche so low bits depend on every byte
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
+
+static bool try_build_table(uint32_t table_size, uint32_t seed) {
+    for (uint32_t i = 0; i < table_size; i++) {
+        hash_slots[i] = REGISTRY_EMPTY_SLOT;
+    }
+    for (int i = 0; i < registry_size; i++) {
+        uint32_t slot = hash_name(registry_specs[i].name, seed) & (table_size - 1);
+        if (hash_slots[slot] != REGISTRY_EMPTY_SLOT) {
+            return false;
+        }
+        hash_slots[slot] = (uint16_t)i;
+    }
+    return true;
+}
+
+static void bk_insert(int spec_index) {
+    if (bk_nodes.empty()) {
+        BKNode root;
+        root.spec_index = spec_index;
+        bk_nodes.push_back(root);
+        return;
+    }
+
+    const char *name = registry_specs[spec_index].name;
+    int node = 0;
+    while (1) {
+        int dist = levenshtein_distance(name, registry_specs[bk_nodes[node].spec_index].name);
+        if (dist == 0) {
+            return;  // Duplicate name, first registration wins
+        }
+
+        int next = -1;
+        for (size_t i = 0; i < bk_nodes[node].children.size(); i++) {
+            if (bk_nodes[node].children[i].first == dist) {
+                next = bk_nodes[node].children[i].second;
+                break;
+            }
+        }
+
+        if (next < 0) {
+            BKNode child;
+            child.spec_index = spec_index;
+            bk_nodes.push_back(child);
+            bk_nodes[node].children.push_back(std::make_pair(dist, (int)bk_nodes.size() - 1));
+            return;
+        }
+        node = next;
+    }
+}
+
+int registry_init(const CommandSpec *specs) {
+    registry_destroy();
+
+    registry_specs = specs;
+    registry_size = 0;
+    while (specs[registry_size].name != NULL) {
+        registry_size++;
+    }
+    if (registry_size >= REGISTRY_EMPTY_SLOT) {
+        return -1;
+    }
+
+    // Start with a table at least twice the command count and grow until a
+    // seed gives every name its own slot
+    uint32_t table_size = 8;
+    while (table_size < (uint32_t)registry_size * 2) {
+        table_size <<= 1;
+    }
+
+    bool built = false;
+    while (!built) {
+        free(hash_slots);
+        hash_slots = (uint16_t *)malloc(table_size * sizeof(uint16_t));
+        if (!hash_slots) {
+            return -1;
+        }
+        for (uint32_t seed = 0; seed < REGISTRY_MAX_SEEDS; seed++) {
+            if (try_build_table(table_size, seed)) {
+                hash_seed = seed;
+                hash_mask = table_size - 1;
+                built = true;
+                break;
+            }
+        }
+        if (!built) {
+            table_size <<= 1;
+        }
+    }
+
+    // Build the suggestion tree once so misses don't scan every command
+    bk_nodes.reserve(registry_size);
+    for (int i = 0; i < registry_size; i++) {
+        bk_insert(i);
+    }
+
+    return 0;
+}
+
+void registry_destroy(void) {
+    free(hash_slots);
+    hash_slots = NULL;
+    hash_mask = 0;
+    hash_seed = 0;
+    registry_specs = NULL;
+    registry_size = 0;
+    bk_nodes.clear();
+}
+
+const CommandSpec *registry_lookup(const char *name) {
+    if (!hash_slots || !name) {
+        return NULL;
+    }
+
+    uint16_t index = hash_slots[hash_name(name, hash_seed) & hash_mask];
+    if (index == REGISTRY_EMPTY_SLOT) {
+        return NULL;
+    }
+
+    const CommandSpec *spec = &registry_specs[index];
+    return strcmp(spec->name, name) == 0 ? spec : NULL;
+}
+
+const CommandSpec *registry_suggest(const char *name) {
+    if (bk_nodes.empty() || !name) {
+        return NULL;
+    }
+
+    int best_index = -1;
+    int best_distance = REGISTRY_SUGGEST_DISTANCE + 1;
+
+    // Iterative BK-tree search: only children whose edge distance lies within
+    // [dist - tolerance, dist + tolerance] can hold a match
+    std::vector<int> stack;
+    stack.push_back(0);
+    while (!stack.empty()) {
+        int node = stack.back();
+        stack.pop_back();
+
+        int spec_index = bk_nodes[node].spec_index;
+        int dist = levenshtein_distance(name, registry_specs[spec_index].name);
+        if (dist < best_distance || (dist == best_distance && spec_index < best_index)) {
+            best_distance = dist;
+            best_index = spec_index;
+        }
+
+        for (size_t i = 0; i < bk_nodes[node].children.size(); i++) {
+            int edge = bk_nodes[node].children[i].first;
+            if (edge >= dist - REGISTRY_SUGGEST_DISTANCE && edge <= dist + REGISTRY_SUGGEST_DISTANCE) {
+                stack.push_back(bk_nodes[node].children[i].second);
+            }
+        }
+    }
+
+    return best_index >= 0 ? &registry_specs[best_index] : NULL;
+}
+
+int registry_check_args(const CommandSpec *spec, int argc) {
+    int nargs = argc - 1;
+    if (nargs < spec->min_args) {
+        return 0;
+    }
+    if (spec->max_args >= 0 && nargs > spec->max_args) {
+        return 0;
+    }
+    return 1;
+}
+
+int registry_count(void) {
+    return registry_size;
+}
+
+const CommandSpec *registry_at(int index) {
+    if (index < 0 || index >= registry_size) {
+        return NULL;
+    }
+    return &registry_specs[index];
+}
+
+// Levenshtein distance keeping only two rows of the DP matrix
+int levenshtein_distance(const char *s1, const char *s2) {
+    int len1 = strlen(s1);
+    int len2 = strlen(s2);
+    std::vector<int> prev(len2 + 1), curr(len2 + 1);
+
+    for (int j = 0; j <= len2; j++)
+        prev[j] = j;
+
+    for (int i = 1; i <= len1; i++) {
+        curr[0] = i;
+        for (int j = 1; j <= len2; j++) {
+            int cost = (s1[i-1] == s2[j-1]) ? 0 : 1;
+            int deletion = prev[j] + 1;
+            int insertion = curr[j-1] + 1;
+            int substitution = prev[j-1] + cost;
+            curr[j] = std::min(std::min(deletion, insertion), substitution);
+        }
+        prev.swap(curr);
+    }
+
+    return prev[len2];
+}
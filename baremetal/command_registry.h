@@ -0,0 +1,48 @@
+#ifndef COMMAND_REGISTRY_H
+#define COMMAND_REGISTRY_H
+
+// Command registry for MINUX
+// Builds a collision-free hash table over the builtin command table at startup
+// so dispatch is a single hash + strcmp, and keeps a BK-tree of command names
+// for "did you mean" suggestions on a miss.
+
+// Maximum edit distance for a suggestion to be offered
+#define REGISTRY_SUGGEST_DISTANCE 2
+
+// Command flags
+#define COMMAND_INTERACTIVE 0x1  // Needs the TUI, refused in batch mode
+#define COMMAND_ASYNC 0x2        // May run on the worker pool: writes only through out_printw
+
+// Handler signature: argv[0] is the command name, raw_args is everything
+// after the name with leading whitespace removed (never NULL)
+typedef void (*CommandHandler)(int argc, char **argv, const char *raw_args);
+
+// Command table entry
+typedef struct {
+    const char *name;
+    CommandHandler handler;
+    int min_args;           // Minimum arguments after the name
+    int max_args;           // Maximum arguments after the name (-1 = unlimited)
+    const char *usage;      // Shown when the argument count is out of range
+    const char *help;       // One-line description for 'help'
+    int flags;              // COMMAND_* flags
+} CommandSpec;
+
+// Registry lifecycle - specs must stay valid until registry_destroy()
+// and be terminated by an entry with a NULL name
+int registry_init(const CommandSpec *specs);
+void registry_destroy(void);
+
+// Lookup functions
+const CommandSpec *registry_lookup(const char *name);
+const CommandSpec *registry_suggest(const char *name);
+int registry_check_args(const CommandSpec *spec, int argc);
+
+// Iteration in registration order (used by 'help')
+int registry_count(void);
+const CommandSpec *registry_at(int index);
+
+// Edit distance helper shared with the suggestion tree
+int levenshtein_distance(const char *s1, const char *s2);
+
+#endif // COMMAND_REGISTRY_H
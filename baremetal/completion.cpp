@@ -0,0 +1,415 @@
+#include "completion.h"
+#include "command_registry.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+// Directory entry as seen by path completion
+typedef struct {
+    std::string name;
+    bool is_dir;
+} DirItem;
+
+// Cached listing of one directory
+typedef struct {
+    std::string path;
+    std::vector<DirItem> items;     // Sorted by name
+    int wd;                         // inotify watch, -1 when checked by mtime
+    struct timespec mtime;
+    bool valid;
+    unsigned long last_used;
+} DirListing;
+
+// A candidate and where its short form starts
+typedef struct {
+    std::string text;
+    size_t display;
+} Match;
+
+static const CompletionWords *word_table = NULL;
+static std::vector<DirListing> listings;
+static unsigned long use_clock = 0;
+static int notify_fd = -1;
+
+static std::vector<Match> matches;
+static std::string common;
+
+static bool item_less(const DirItem &a, const DirItem &b) {
+    return a.name < b.name;
+}
+
+static bool match_less(const Match &a, const Match &b) {
+    return a.text < b.text;
+}
+
+static bool match_equal(const Match &a, const Match &b) {
+    return a.text == b.text;
+}
+
+static bool starts_with(const std::string &s, const std::string &prefix) {
+    return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+static void add_match(const std::string &text, size_t display) {
+    Match m;
+    m.text = text;
+    m.display = display;
+    matches.push_back(m);
+}
+
+static struct timespec dir_mtime(const struct stat *st) {
+#ifdef __APPLE__
+    return st->st_mtimespec;
+#else
+    return st->st_mtim;
+#endif
+}
+
+static void remove_watch(size_t index) {
+#ifdef __linux__
+    int wd = listings[index].wd;
+    if (wd < 0 || notify_fd < 0) {
+        return;
+    }
+    // Two paths naming the same directory share a watch descriptor
+    for (size_t i = 0; i < listings.size(); i++) {
+        if (i != index && listings[i].wd == wd) {
+            return;
+        }
+    }
+    inotify_rm_watch(notify_fd, wd);
+#else
+    (void)index;
+#endif
+}
+
+// Mark every listing whose directory changed since it was read
+static void drain_events(void) {
+#ifdef __linux__
+    if (notify_fd < 0) {
+        return;
+    }
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (1) {
+        ssize_t n = read(notify_fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        for (char *p = buf; p < buf + n; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            for (size_t i = 0; i < listings.size(); i++) {
+                if ((ev->mask & IN_Q_OVERFLOW) || listings[i].wd == ev->wd) {
+                    listings[i].valid = false;
+                    if (ev->mask & IN_IGNORED) {
+                        listings[i].wd = -1;  // Directory is gone, watch removed by the kernel
+                    }
+                }
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+#endif
+}
+
+static void read_listing(DirListing *listing) {
+    listing->items.clear();
+    listing->valid = false;
+
+#ifdef __linux__
+    // Watch before reading so a change during the read still invalidates
+    if (notify_fd >= 0 && listing->wd < 0) {
+        listing->wd = inotify_add_watch(notify_fd, listing->path.c_str(),
+                                        IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                        IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+    }
+#endif
+
+    struct stat st;
+    if (stat(listing->path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return;
+    }
+    listing->mtime = dir_mtime(&st);
+
+    DIR *dir = opendir(listing->path.c_str());
+    if (!dir) {
+        return;
+    }
+
+    int dfd = dirfd(dir);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        DirItem item;
+        item.name = entry->d_name;
+        item.is_dir = entry->d_type == DT_DIR;
+        // Symlinks and filesystems without d_type need a stat to tell
+        if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+            struct stat est;
+            item.is_dir = fstatat(dfd, entry->d_name, &est, 0) == 0 && S_ISDIR(est.st_mode);
+        }
+        listing->items.push_back(item);
+    }
+    closedir(dir);
+
+    std::sort(listing->items.begin(), listing->items.end(), item_less);
+    listing->valid = true;
+}
+
+// Cached listing for a directory, re-read only when it has changed
+static const DirListing *get_listing(const std::string &path) {
+    drain_events();
+
+    size_t index = listings.size();
+    for (size_t i = 0; i < listings.size(); i++) {
+        if (listings[i].path == path) {
+            index = i;
+            break;
+        }
+    }
+
+    if (index == listings.size()) {
+        if (listings.size() >= COMPLETION_CACHE_DIRS) {
+            size_t oldest = 0;
+            for (size_t i = 1; i < listings.size(); i++) {
+                if (listings[i].last_used < listings[oldest].last_used) {
+                    oldest = i;
+                }
+            }
+            remove_watch(oldest);
+            listings.erase(listings.begin() + oldest);
+            index = listings.size();
+        }
+
+        DirListing listing;
+        listing.path = path;
+        listing.wd = -1;
+        listing.valid = false;
+        listing.mtime.tv_sec = 0;
+        listing.mtime.tv_nsec = 0;
+        listings.push_back(listing);
+    }
+
+    DirListing *listing = &listings[index];
+    listing->last_used = ++use_clock;
+
+    if (listing->valid && listing->wd < 0) {
+        // No watch for this directory - fall back to its modification time
+        struct stat st;
+        struct timespec mtime;
+        if (stat(path.c_str(), &st) != 0) {
+            listing->valid = false;
+        } else {
+            mtime = dir_mtime(&st);
+            if (mtime.tv_sec != listing->mtime.tv_sec || mtime.tv_nsec != listing->mtime.tv_nsec) {
+                listing->valid = false;
+            }
+        }
+    }
+
+    if (!listing->valid) {
+        read_listing(listing);
+    }
+    return listing;
+}
+
+// Turn the directory part of a word into a path the cache can key on
+static std::string resolve_dir(const std::string &dir_part, const char *cwd) {
+    std::string path;
+    if (dir_part.empty()) {
+        path = cwd;
+    } else if (dir_part[0] == '~' && (dir_part.size() == 1 || dir_part[1] == '/')) {
+        const char *home = getenv("HOME");
+        path = std::string(home ? home : "") + dir_part.substr(1);
+    } else if (dir_part[0] == '/') {
+        path = dir_part;
+    } else {
+        path = std::string(cwd) + "/" + dir_part;
+    }
+
+    while (path.size() > 1 && path[path.size() - 1] == '/') {
+        path.erase(path.size() - 1);
+    }
+    return path.empty() ? "/" : path;
+}
+
+static void complete_paths(const std::string &word, const char *cwd) {
+    if (word == "~") {
+        add_match("~/", 0);
+        return;
+    }
+
+    size_t slash = word.rfind('/');
+    std::string dir_part = slash == std::string::npos ? "" : word.substr(0, slash + 1);
+    std::string base = word.substr(dir_part.size());
+
+    const DirListing *listing = get_listing(resolve_dir(dir_part, cwd));
+
+    // Items are sorted, so every match sits in one run starting at the base
+    DirItem key;
+    key.name = base;
+    key.is_dir = false;
+    std::vector<DirItem>::const_iterator it =
+        std::lower_bound(listing->items.begin(), listing->items.end(), key, item_less);
+    for (; it != listing->items.end() && starts_with(it->name, base); ++it) {
+        if (it->name[0] == '.' && (base.empty() || base[0] != '.')) {
+            continue;  // Hidden unless asked for
+        }
+        add_match(dir_part + it->name + (it->is_dir ? "/" : ""), dir_part.size());
+    }
+}
+
+// Command names, using only the first word of multi-word names
+static void complete_commands(const std::string &word) {
+    for (int i = 0; i < registry_count(); i++) {
+        std::string name = registry_at(i)->name;
+        name = name.substr(0, name.find(' '));
+        if (starts_with(name, word)) {
+            add_match(name, 0);
+        }
+    }
+}
+
+// Next word of multi-word command names like "test camera"
+static bool complete_command_words(const std::string &context, const std::string &word) {
+    bool found = false;
+    for (int i = 0; i < registry_count(); i++) {
+        std::string name = registry_at(i)->name;
+        if (name.size() <= context.size() || !starts_with(name, context) || name[context.size()] != ' ') {
+            continue;
+        }
+        found = true;
+        std::string next = name.substr(context.size() + 1);
+        next = next.substr(0, next.find(' '));
+        if (starts_with(next, word)) {
+            add_match(next, 0);
+        }
+    }
+    return found;
+}
+
+int completion_init(const CompletionWords *table) {
+    completion_shutdown();
+    word_table = table;
+
+#ifdef __linux__
+    notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    return 0;
+}
+
+void completion_shutdown(void) {
+#ifdef __linux__
+    if (notify_fd >= 0) {
+        close(notify_fd);  // Drops every watch with it
+    }
+#endif
+    notify_fd = -1;
+    listings.clear();
+    matches.clear();
+    common.clear();
+    word_table = NULL;
+}
+
+int completion_complete(const char *line, int pos, const char *cwd, int *word_start) {
+    matches.clear();
+    common.clear();
+
+    int start = pos;
+    while (start > 0 && !isspace((unsigned char)line[start - 1])) {
+        start--;
+    }
+    *word_start = start;
+
+    std::string word(line + start, pos - start);
+
+    // Words before the one being completed, joined by single spaces
+    std::string context;
+    for (int i = 0; i < start; ) {
+        while (i < start && isspace((unsigned char)line[i])) i++;
+        int end = i;
+        while (end < start && !isspace((unsigned char)line[end])) end++;
+        if (end > i) {
+            if (!context.empty()) context += ' ';
+            context.append(line + i, end - i);
+        }
+        i = end;
+    }
+
+    if (context.empty()) {
+        if (word.find('/') != std::string::npos || (!word.empty() && word[0] == '~')) {
+            complete_paths(word, cwd);
+        } else {
+            complete_commands(word);
+        }
+    } else {
+        bool handled = complete_command_words(context, word);
+        for (const CompletionWords *entry = word_table; entry && entry->prefix; entry++) {
+            if (context != entry->prefix) {
+                continue;
+            }
+            if (!(entry->flags & COMPLETION_PATHS)) {
+                handled = true;
+            }
+            for (const char *const *w = entry->words; *w; w++) {
+                if (starts_with(*w, word)) {
+                    add_match(*w, 0);
+                }
+            }
+        }
+        if (!handled) {
+            complete_paths(word, cwd);
+        }
+    }
+
+    std::sort(matches.begin(), matches.end(), match_less);
+    matches.erase(std::unique(matches.begin(), matches.end(), match_equal), matches.end());
+
+    if (!matches.empty()) {
+        common = matches[0].text;
+        for (size_t i = 1; i < matches.size(); i++) {
+            size_t n = 0;
+            while (n < common.size() && n < matches[i].text.size() && common[n] == matches[i].text[n]) {
+                n++;
+            }
+            common.erase(n);
+        }
+    }
+
+    return (int)matches.size();
+}
+
+int completion_count(void) {
+    return (int)matches.size();
+}
+
+const char *completion_match(int index) {
+    if (index < 0 || index >= (int)matches.size()) {
+        return NULL;
+    }
+    return matches[index].text.c_str();
+}
+
+const char *completion_display(int index) {
+    if (index < 0 || index >= (int)matches.size()) {
+        return NULL;
+    }
+    return matches[index].text.c_str() + matches[index].display;
+}
+
+const char *completion_common(void) {
+    return common.c_str();
+}
@@ -0,0 +1,38 @@
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+// Tab completion for MINUX
+// Completes command names from the registry, subcommands from a word table
+// and filesystem paths. Directory listings are cached per directory and
+// invalidated through inotify (or the directory mtime where inotify is not
+// available), so repeated Tab presses don't re-read large directories.
+
+// Completion settings
+#define COMPLETION_CACHE_DIRS 32    // Directory listings kept in the cache
+#define COMPLETION_PATHS 0x1        // Also offer paths after this prefix
+
+// Words offered after a command prefix such as "todo" or "play scale"
+typedef struct {
+    const char *prefix;
+    const char *const *words;       // NULL-terminated
+    int flags;                      // COMPLETION_* flags
+} CompletionWords;
+
+// Completion lifecycle - the table must stay valid until completion_shutdown()
+// and be terminated by an entry with a NULL prefix
+int completion_init(const CompletionWords *table);
+void completion_shutdown(void);
+
+// Complete the word that ends at 'pos' in 'line', resolving relative paths
+// against 'cwd'. Returns the number of candidates and stores the offset
+// where the word being completed starts in *word_start.
+int completion_complete(const char *line, int pos, const char *cwd, int *word_start);
+
+// Candidates from the last completion_complete() call, sorted. Each match is
+// the full replacement for the word; directories end in '/'.
+int completion_count(void);
+const char *completion_match(int index);
+const char *completion_display(int index);  // Short form for listing
+const char *completion_common(void);        // Longest prefix shared by all matches
+
+#endif // COMPLETION_H
@@ -0,0 +1,240 @@
+#include "dir_model.h"
+#include "dir_view.h"
+#include "fs_list.h"
+#include <ctype.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+static struct timespec dir_mtime(const struct stat *st) {
+#ifdef __APPLE__
+    return st->st_mtimespec;
+#else
+    return st->st_mtim;
+#endif
+}
+
+static void clear_entries(DirModel *model) {
+    model->names.clear();
+    model->name_at.clear();
+    model->kind.clear();
+    model->size.clear();
+    model->owner.clear();
+    model->modified.clear();
+    model->dead = 0;
+}
+
+static void unwatch(DirModel *model) {
+    if (model->watch && model->wd >= 0) {
+        fs_watch_remove(model->watch, model->wd);
+    }
+    model->wd = -1;
+}
+
+static unsigned char kind_of(const struct stat *st) {
+    if (S_ISDIR(st->st_mode)) {
+        return DIR_MODEL_DIR;
+    }
+    return (st->st_mode & S_IXUSR) ? DIR_MODEL_EXEC : DIR_MODEL_FILE;
+}
+
+static void append_entry(DirModel *model, size_t at, const char *name, unsigned char kind, const struct stat *st) {
+    model->name_at.insert(model->name_at.begin() + at, model->names.size());
+    model->names += name;
+    model->names += '\0';
+    model->kind.insert(model->kind.begin() + at, kind);
+    model->size.insert(model->size.begin() + at, st ? st->st_size : 0);
+    model->owner.insert(model->owner.begin() + at, st ? st->st_uid : (uid_t)-1);
+    model->modified.insert(model->modified.begin() + at, st ? st->st_mtime : 0);
+}
+
+static int load(DirModel *model) {
+    clear_entries(model);
+    model->error = 0;
+
+    // Watch before reading so a change during the read still counts
+    if (model->watch && model->wd < 0) {
+        model->wd = fs_watch_add(model->watch, model->path.c_str(), FS_WATCH_DIR);
+    }
+
+    struct stat st;
+    if (stat(model->path.c_str(), &st) == 0) {
+        model->mtime = dir_mtime(&st);
+    }
+
+    FsListing list;
+    if (fs_list_read(model->path.c_str(), FS_LIST_STAT | FS_LIST_HIDDEN | FS_LIST_DOTS | FS_LIST_FOLLOW, &list) != 0) {
+        model->error = errno;
+        return -1;
+    }
+    fs_list_sort(&list);
+
+    model->name_at.reserve(list.count);
+    model->kind.reserve(list.count);
+    model->size.reserve(list.count);
+    model->owner.reserve(list.count);
+    model->modified.reserve(list.count);
+    for (size_t i = 0; i < list.count; i++) {
+        const FsEntry *entry = fs_list_at(&list, i);
+        unsigned char kind = DIR_MODEL_FILE;
+        if (fs_entry_is_dir(entry)) {
+            kind = DIR_MODEL_DIR;
+        } else if (entry->has_stat) {
+            kind = kind_of(&entry->st);
+        }
+        append_entry(model, model->name_at.size(), fs_entry_name(&list, entry), kind,
+                     entry->has_stat ? &entry->st : NULL);
+    }
+    fs_list_free(&list);
+    return 0;
+}
+
+// Display order, as fs_list_sort() has it: directories first, then
+// case-insensitively by name, then by name
+static bool entry_less(bool a_dir, const char *a, bool b_dir, const char *b) {
+    if (a_dir != b_dir) {
+        return a_dir;
+    }
+    const unsigned char *x = (const unsigned char *)a;
+    const unsigned char *y = (const unsigned char *)b;
+    while (*x && tolower(*x) == tolower(*y)) {
+        x++;
+        y++;
+    }
+    if (tolower(*x) != tolower(*y)) {
+        return tolower(*x) < tolower(*y);
+    }
+    return strcmp(a, b) < 0;
+}
+
+// Where an entry belongs
+static size_t position(const DirModel *model, bool is_dir, const char *name) {
+    size_t lo = 0, hi = model->name_at.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entry_less(model->kind[mid] == DIR_MODEL_DIR, dir_model_name(model, mid), is_dir, name)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void remove_entry(DirModel *model, size_t i) {
+    model->dead += strlen(dir_model_name(model, i)) + 1;
+    model->name_at.erase(model->name_at.begin() + i);
+    model->kind.erase(model->kind.begin() + i);
+    model->size.erase(model->size.begin() + i);
+    model->owner.erase(model->owner.begin() + i);
+    model->modified.erase(model->modified.begin() + i);
+}
+
+// Stat one entry again and put it where it now belongs, or drop it
+static void patch(DirModel *model, const char *name) {
+    long at = dir_model_find(model, name);
+    if (at >= 0) {
+        remove_entry(model, (size_t)at);
+    }
+
+    // As the listing engine does it: what a symlink points to, else the link
+    std::string full = model->path + "/" + name;
+    struct stat st;
+    if (stat(full.c_str(), &st) != 0 && lstat(full.c_str(), &st) != 0) {
+        return;
+    }
+    unsigned char kind = kind_of(&st);
+    append_entry(model, position(model, kind == DIR_MODEL_DIR, name), name, kind, &st);
+}
+
+void dir_model_init(DirModel *model, FsWatch *watch) {
+    model->path.clear();
+    model->error = 0;
+    clear_entries(model);
+    model->watch = watch;
+    model->wd = -1;
+    memset(&model->mtime, 0, sizeof(model->mtime));
+}
+
+void dir_model_close(DirModel *model) {
+    unwatch(model);
+    clear_entries(model);
+}
+
+int dir_model_open(DirModel *model, const char *path) {
+    if (model->path != path) {
+        unwatch(model);
+        model->path = path;
+    }
+    return load(model);
+}
+
+bool dir_model_update(DirModel *model) {
+    if (model->wd < 0) {
+        // No watch - fall back to the directory's mtime
+        struct stat st;
+        struct timespec mtime = {0, 0};
+        if (stat(model->path.c_str(), &st) == 0) {
+            mtime = dir_mtime(&st);
+        }
+        if (mtime.tv_sec == model->mtime.tv_sec && mtime.tv_nsec == model->mtime.tv_nsec && model->error == 0) {
+            return false;
+        }
+        load(model);
+        return true;
+    }
+
+    bool reload = model->watch->overflow;
+    std::vector<std::string> names;
+    for (size_t i = 0; i < model->watch->events.size() && !reload; i++) {
+        const FsWatchEvent &event = model->watch->events[i];
+        if (event.wd != model->wd) {
+            continue;
+        }
+        if (event.what == FS_EVENT_GONE) {
+            reload = true;  // Deleted or moved - whatever is at path now gets a new watch
+        } else if (!event.name.empty()) {
+            names.push_back(event.name);
+        }
+    }
+
+    if (!reload) {
+        std::sort(names.begin(), names.end());
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+        reload = names.size() > DIR_MODEL_PATCH_MAX;
+    }
+    if (reload) {
+        unwatch(model);
+        load(model);
+        return true;
+    }
+
+    for (size_t i = 0; i < names.size(); i++) {
+        patch(model, names[i].c_str());
+    }
+
+    // Drop the names of removed entries once they are most of the buffer
+    dir_view_compact_names(&model->names, &model->name_at, &model->dead);
+    return !names.empty();
+}
+
+size_t dir_model_count(const DirModel *model) {
+    return model->name_at.size();
+}
+
+const char *dir_model_name(const DirModel *model, size_t i) {
+    return model->names.c_str() + model->name_at[i];
+}
+
+long dir_model_find(const DirModel *model, const char *name) {
+    // It may have changed between file and directory since it was read
+    for (int is_dir = 1; is_dir >= 0; is_dir--) {
+        size_t at = position(model, is_dir != 0, name);
+        if (at < model->name_at.size() && strcmp(dir_model_name(model, at), name) == 0) {
+            return (long)at;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,63 @@
+#ifndef DIR_MODEL_H
+#define DIR_MODEL_H
+
+// Directory model for MINUX
+// One directory as the explorer shows it, read once with the listing engine
+// into parallel arrays in display order. Changes reported by a file system
+// watch are patched in place - only the entries they name are statted
+// again - so neither moving the selection nor a file appearing costs a
+// rescan. Without inotify the directory's mtime is compared instead.
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "fs_watch.h"
+
+// Directory model settings
+#define DIR_MODEL_PATCH_MAX 256         // Entries changed at once before it's cheaper to read everything
+
+// Entry kinds
+#define DIR_MODEL_FILE 0
+#define DIR_MODEL_DIR 1                 // Including symlinks to directories
+#define DIR_MODEL_EXEC 2                // File with the owner's execute bit
+
+typedef struct {
+    std::string path;
+    int error;                          // errno of the last failed read, else 0
+
+    // One element per entry - directories first, then by name
+    std::string names;                  // NUL-terminated, back to back
+    std::vector<size_t> name_at;
+    std::vector<unsigned char> kind;
+    std::vector<off_t> size;
+    std::vector<uid_t> owner;           // (uid_t)-1 if the entry couldn't be statted
+    std::vector<time_t> modified;
+
+    FsWatch *watch;                     // The caller's, may be NULL
+    int wd;                             // Watch on path, -1 when checked by mtime
+    struct timespec mtime;
+    size_t dead;                        // Bytes of names no longer referenced
+} DirModel;
+
+// The model watches its directory through watch, which the caller waits on
+// (and may share with other watches)
+void dir_model_init(DirModel *model, FsWatch *watch);
+void dir_model_close(DirModel *model);
+
+// Show path. Returns 0, or -1 with errno set and the model empty.
+int dir_model_open(DirModel *model, const char *path);
+
+// Apply the events collected in the watch (the caller clears them after).
+// Returns true if the model changed; check model->error afterwards in case
+// the directory went away.
+bool dir_model_update(DirModel *model);
+
+size_t dir_model_count(const DirModel *model);
+const char *dir_model_name(const DirModel *model, size_t i);
+
+// Index of the entry called name, or -1
+long dir_model_find(const DirModel *model, const char *name);
+
+#endif // DIR_MODEL_H
@@ -0,0 +1,252 @@
+#include "dir_view.h"
+#include "text_search.h"
+#include <ctype.h>
+#include <string.h>
+#include <algorithm>
+
+static const char *name_of(const DirColumns *columns, uint32_t i) {
+    return columns->names + columns->name_at[i];
+}
+
+static int fold_compare(const char *a, const char *b) {
+    const unsigned char *x = (const unsigned char *)a;
+    const unsigned char *y = (const unsigned char *)b;
+    while (*x && tolower(*x) == tolower(*y)) {
+        x++;
+        y++;
+    }
+    return tolower(*x) - tolower(*y);
+}
+
+// Extension without the dot, or "" (a leading dot alone doesn't make one)
+static const char *extension(const char *name) {
+    const char *dot = strrchr(name, '.');
+    return (dot && dot != name) ? dot + 1 : "";
+}
+
+// The first 8 bytes of text, case-folded, as an integer that orders like
+// the text does. Sets *more if the text goes on past them.
+static uint64_t fold_prefix(const char *text, unsigned char *more) {
+    uint64_t key = 0;
+    int i = 0;
+    for (; i < 8 && text[i]; i++) {
+        key = (key << 8) | (unsigned char)tolower((unsigned char)text[i]);
+    }
+    *more = i == 8 && text[8] != '\0';
+    return key << (8 * (8 - i));
+}
+
+// One entry as the sort sees it
+typedef struct {
+    uint64_t key;                       // Size, time, or the start of a string key
+    uint32_t tie;                       // Name rank, for equal keys
+    uint32_t entry;
+    unsigned char group;                // 0 for directories, which come first
+    unsigned char more;                 // The string key is longer than key holds
+} SortItem;
+
+static bool key_less(const SortItem &a, const SortItem &b) {
+    return a.key < b.key;
+}
+
+// Sort items by name, given that they agree on the first depth bytes:
+// by the next 8, then run by run of equal ones on the 8 after that
+static void sort_names(SortItem *items, size_t count, const DirColumns *columns, size_t depth) {
+    for (size_t i = 0; i < count; i++) {
+        items[i].key = fold_prefix(name_of(columns, items[i].entry) + depth, &items[i].more);
+    }
+    std::sort(items, items + count, key_less);
+
+    for (size_t start = 0; start < count; ) {
+        size_t end = start + 1;
+        bool more = items[start].more;
+        while (end < count && items[end].key == items[start].key) {
+            more = more || items[end].more;
+            end++;
+        }
+        if (end - start > 1) {
+            if (more) {
+                sort_names(items + start, end - start, columns, depth + 8);
+            } else {
+                // Equal but for case
+                std::sort(items + start, items + end, [columns](const SortItem &x, const SortItem &y) {
+                    return strcmp(name_of(columns, x.entry), name_of(columns, y.entry)) < 0;
+                });
+            }
+        }
+        start = end;
+    }
+}
+
+// Number the entries in name order
+static void rank_names(DirView *view, const DirColumns *columns) {
+    size_t count = columns->count;
+    view->name_rank.resize(count);
+    if (columns->name_ordered) {
+        for (size_t i = 0; i < count; i++) {
+            view->name_rank[i] = (uint32_t)i;
+        }
+        return;
+    }
+
+    std::vector<SortItem> items(count);
+    for (size_t i = 0; i < count; i++) {
+        items[i].entry = (uint32_t)i;
+    }
+    if (count > 0) {
+        sort_names(&items[0], count, columns, 0);
+    }
+    for (size_t i = 0; i < count; i++) {
+        view->name_rank[items[i].entry] = (uint32_t)i;
+    }
+}
+
+// Put view->sorted in order by the key, using the name ranks
+static void sort_entries(DirView *view, const DirColumns *columns) {
+    size_t count = columns->count;
+    std::vector<SortItem> items(count);
+    for (size_t i = 0; i < count; i++) {
+        SortItem &item = items[i];
+        item.entry = (uint32_t)i;
+        item.tie = view->name_rank[i];
+        item.group = columns->kind[i] == columns->dir_kind ? 0 : 1;
+        item.more = 0;
+        if (view->key == DIR_VIEW_SIZE) {
+            item.key = (uint64_t)columns->size[i];
+        } else if (view->key == DIR_VIEW_MTIME) {
+            item.key = (uint64_t)(int64_t)columns->mtime[i] ^ (1ULL << 63);  // Before 1970 sorts first
+        } else if (view->key == DIR_VIEW_EXT) {
+            item.key = fold_prefix(extension(name_of(columns, (uint32_t)i)), &item.more);
+        } else {
+            item.key = 0;
+        }
+    }
+
+    std::sort(items.begin(), items.end(), [columns](const SortItem &a, const SortItem &b) {
+        if (a.group != b.group) {
+            return a.group < b.group;
+        }
+        if (a.key != b.key) {
+            return a.key < b.key;
+        }
+        if (a.more | b.more) {
+            int c = fold_compare(extension(name_of(columns, a.entry)), extension(name_of(columns, b.entry)));
+            if (c != 0) {
+                return c < 0;
+            }
+        }
+        return a.tie < b.tie;
+    });
+
+    view->sorted.resize(count);
+    size_t dirs = 0;
+    for (size_t i = 0; i < count; i++) {
+        view->sorted[i] = items[i].entry;
+        dirs += items[i].group == 0;
+    }
+
+    // Every key is distinct with its tie, so reversing each group is the
+    // descending order - directories still first
+    if (view->descending) {
+        std::reverse(view->sorted.begin(), view->sorted.begin() + dirs);
+        std::reverse(view->sorted.begin() + dirs, view->sorted.end());
+    }
+}
+
+// Keep the entries of from whose name contains the filter
+static void filter_rows(DirView *view, const DirColumns *columns, const std::vector<uint32_t> &from) {
+    std::vector<uint32_t> rows;
+    if (view->filter.empty()) {
+        rows = from;
+    } else {
+        const char *needle = view->filter.c_str();
+        size_t needle_len = view->filter.size();
+        rows.reserve(from.size());
+        for (size_t i = 0; i < from.size(); i++) {
+            const char *name = name_of(columns, from[i]);
+            if (text_find(name, strlen(name), needle, needle_len, true) >= 0) {
+                rows.push_back(from[i]);
+            }
+        }
+    }
+    view->rows.swap(rows);
+}
+
+void dir_view_init(DirView *view) {
+    view->key = DIR_VIEW_NAME;
+    view->descending = false;
+    view->filter.clear();
+    view->name_rank.clear();
+    view->sorted.clear();
+    view->rows.clear();
+}
+
+void dir_view_sort(DirView *view, const DirColumns *columns) {
+    rank_names(view, columns);
+    dir_view_set_key(view, columns, view->key, view->descending);
+}
+
+void dir_view_set_key(DirView *view, const DirColumns *columns, int key, bool descending) {
+    view->key = key;
+    view->descending = descending;
+    if (key == DIR_VIEW_NAME && columns->name_ordered && !descending) {
+        // Already in order
+        view->sorted.resize(columns->count);
+        for (size_t i = 0; i < columns->count; i++) {
+            view->sorted[i] = (uint32_t)i;
+        }
+    } else {
+        sort_entries(view, columns);
+    }
+    filter_rows(view, columns, view->sorted);
+}
+
+void dir_view_filter(DirView *view, const DirColumns *columns, const char *filter) {
+    std::string lowered = filter;
+    for (size_t i = 0; i < lowered.size(); i++) {
+        lowered[i] = (char)tolower((unsigned char)lowered[i]);
+    }
+
+    // A name containing the new filter contains the old one too, so the
+    // rows already shown are all that need looking at
+    bool narrowing = lowered.find(view->filter) != std::string::npos;
+    view->filter = lowered;
+    if (narrowing) {
+        filter_rows(view, columns, view->rows);
+    } else {
+        filter_rows(view, columns, view->sorted);
+    }
+}
+
+long dir_view_row(const DirView *view, uint32_t entry) {
+    for (size_t i = 0; i < view->rows.size(); i++) {
+        if (view->rows[i] == entry) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+const char *dir_view_key_name(int key) {
+    switch (key) {
+        case DIR_VIEW_SIZE: return "size";
+        case DIR_VIEW_MTIME: return "modified";
+        case DIR_VIEW_EXT: return "extension";
+        default: return "name";
+    }
+}
+
+void dir_view_compact_names(std::string *names, std::vector<size_t> *name_at, size_t *dead) {
+    if (*dead < DIR_VIEW_ARENA_SLACK || *dead < names->size() / 2) {
+        return;
+    }
+    std::string live;
+    live.reserve(names->size() - *dead);
+    for (size_t i = 0; i < name_at->size(); i++) {
+        const char *name = names->c_str() + (*name_at)[i];
+        (*name_at)[i] = live.size();
+        live.append(name, strlen(name) + 1);
+    }
+    names->swap(live);
+    *dead = 0;
+}
@@ -0,0 +1,74 @@
+#ifndef DIR_VIEW_H
+#define DIR_VIEW_H
+
+// Directory view for MINUX
+// The order and filter an explorer shows a listing in, kept as a vector of
+// entry indices over columns the listing already holds (names, sizes,
+// times), so neither sorting nor filtering touches the file system. Each
+// entry's place in name order is worked out once per listing, 8 bytes of
+// name at a time, so a sort only compares flat integer keys. A filter that
+// only grows narrows the rows already shown; anything else filters the
+// sorted entries again.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+// Name arena settings
+#define DIR_VIEW_ARENA_SLACK 4096       // Bytes of dead names kept before an arena is compacted
+
+// Sort keys (directories always come first)
+#define DIR_VIEW_NAME 0
+#define DIR_VIEW_SIZE 1
+#define DIR_VIEW_MTIME 2
+#define DIR_VIEW_EXT 3                  // Extension, then name
+#define DIR_VIEW_KEYS 4
+
+// The listing as the view reads it - one element per entry
+typedef struct {
+    size_t count;
+    const char *names;                  // NUL-terminated names back to back
+    const size_t *name_at;
+    const unsigned char *kind;          // Entries with kind == dir_kind are directories
+    unsigned char dir_kind;
+    const off_t *size;
+    const time_t *mtime;
+    bool name_ordered;                  // Entries are already directories first, then by name
+} DirColumns;
+
+typedef struct {
+    int key;                            // DIR_VIEW_*
+    bool descending;
+    std::string filter;                 // Lowercased; entries whose name contains it
+    std::vector<uint32_t> name_rank;    // Each entry's place in name order
+    std::vector<uint32_t> sorted;       // Every entry in sort order
+    std::vector<uint32_t> rows;         // The entries shown: sorted, then filtered
+} DirView;
+
+void dir_view_init(DirView *view);
+
+// Sort every entry again after the listing changed, and filter the result
+// with the current filter
+void dir_view_sort(DirView *view, const DirColumns *columns);
+
+// Change the sort key or direction of an unchanged listing
+void dir_view_set_key(DirView *view, const DirColumns *columns, int key, bool descending);
+
+// Show only entries whose name contains filter (ignoring case; empty for all)
+void dir_view_filter(DirView *view, const DirColumns *columns, const char *filter);
+
+// Row showing entry, or -1 if it is filtered out
+long dir_view_row(const DirView *view, uint32_t entry);
+
+// "name", "size", "modified" or "extension"
+const char *dir_view_key_name(int key);
+
+// Copy the live names of a listing's arena (as in DirColumns, one offset
+// per entry) into a new one once the dead bytes of removed entries are
+// most of it, updating the offsets and clearing *dead
+void dir_view_compact_names(std::string *names, std::vector<size_t> *name_at, size_t *dead);
+
+#endif // DIR_VIEW_H
@@ -0,0 +1,327 @@
+#include "du.h"
+#include "walker.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+
+// A file with more than one link, counted once per scan
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    unsigned long long bytes;
+} DuLink;
+
+// A directory's entries, which change only when its mtime does
+typedef struct {
+    std::vector<std::string> subdirs;
+    std::vector<std::string> files;     // Everything else
+} DuListing;
+
+// What a directory holds directly, totalled afresh each scan
+typedef struct {
+    unsigned long long own_bytes;       // Without the files in links
+    unsigned long own_files;
+    std::vector<DuLink> links;
+} DuDir;
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    long long mtime_sec;
+    long mtime_nsec;
+} DuKey;
+
+struct DuKeyHash {
+    size_t operator()(const DuKey &k) const {
+        size_t h = std::hash<unsigned long long>()((unsigned long long)k.ino);
+        h ^= std::hash<unsigned long long>()((unsigned long long)k.dev) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        h ^= std::hash<long long>()(k.mtime_sec * 1000000000LL + k.mtime_nsec) + (h << 6) + (h >> 2);
+        return h;
+    }
+};
+
+struct DuKeyEqual {
+    bool operator()(const DuKey &a, const DuKey &b) const {
+        return a.dev == b.dev && a.ino == b.ino && a.mtime_sec == b.mtime_sec && a.mtime_nsec == b.mtime_nsec;
+    }
+};
+
+// Process-wide, shared by every scan; pool threads fill it while reading
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::unordered_map<DuKey, DuListing, DuKeyHash, DuKeyEqual> cache;
+
+typedef struct {
+    DuNode *current;
+    std::atomic<unsigned long> dirs;
+    std::atomic<unsigned long> cached;
+    unsigned long next_progress;
+    DuProgress progress;
+    void *ctx;
+
+    // Own totals of the directories read in this scan by (dev, ino), so the
+    // visitor finds them even if a directory changes during the scan
+    pthread_mutex_t lock;
+    std::unordered_map<unsigned long long, DuDir> own;
+    std::unordered_set<unsigned long long> linked;  // Visitor thread only
+} DuScan;
+
+static DuKey key_of(const struct stat *st) {
+    DuKey key;
+    key.dev = st->st_dev;
+    key.ino = st->st_ino;
+    key.mtime_sec = (long long)st->st_mtime;
+#ifdef __linux__
+    key.mtime_nsec = st->st_mtim.tv_nsec;
+#else
+    key.mtime_nsec = 0;
+#endif
+    return key;
+}
+
+static unsigned long long scan_key(dev_t dev, ino_t ino) {
+    return ((unsigned long long)dev << 40) ^ (unsigned long long)ino;
+}
+
+static void add_file(DuDir *dir, const struct stat *st) {
+    unsigned long long bytes = (unsigned long long)st->st_blocks * 512;
+    if (st->st_nlink > 1) {
+        DuLink link = {st->st_dev, st->st_ino, bytes};
+        dir->links.push_back(link);
+    } else {
+        dir->own_bytes += bytes;
+        dir->own_files++;
+    }
+}
+
+// WalkReader - answers unchanged directories from the cache with just their
+// subdirectories (statted, so the walker can descend) and a stat of each
+// file, as files grow without their directory changing; reads the rest
+static int du_read(int fd, int list_flags, FsListing *list, void *ctx) {
+    DuScan *scan = (DuScan *)ctx;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+    DuKey key = key_of(&st);
+    scan->dirs++;
+
+    DuListing listing;
+    bool hit = false;
+    pthread_mutex_lock(&cache_lock);
+    auto it = cache.find(key);
+    if (it != cache.end()) {
+        listing = it->second;
+        hit = true;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    DuDir dir;
+    dir.own_bytes = (unsigned long long)st.st_blocks * 512;
+    dir.own_files = 0;
+    if (hit) {
+        scan->cached++;
+        memset(list, 0, sizeof(*list));
+        for (size_t i = 0; i < listing.subdirs.size(); i++) {
+            if (fs_list_add(list, fd, listing.subdirs[i].c_str(), DT_DIR, list_flags) != 0) {
+                fs_list_free(list);
+                return -1;
+            }
+        }
+        for (size_t i = 0; i < listing.files.size(); i++) {
+            struct stat file_st;
+            if (fstatat(fd, listing.files[i].c_str(), &file_st, AT_SYMLINK_NOFOLLOW) == 0) {
+                add_file(&dir, &file_st);
+            }
+        }
+    } else {
+        if (fs_list_read_fd(fd, list_flags, list) != 0) {
+            return -1;
+        }
+        for (size_t i = 0; i < list->count; i++) {
+            const FsEntry *entry = &list->entries[i];
+            if (fs_entry_is_dir(entry)) {
+                listing.subdirs.push_back(fs_entry_name(list, entry));
+            } else {
+                listing.files.push_back(fs_entry_name(list, entry));
+                if (entry->has_stat) {
+                    add_file(&dir, &entry->st);
+                }
+            }
+        }
+        pthread_mutex_lock(&cache_lock);
+        cache[key] = listing;
+        pthread_mutex_unlock(&cache_lock);
+    }
+
+    pthread_mutex_lock(&scan->lock);
+    scan->own[scan_key(st.st_dev, st.st_ino)] = dir;
+    pthread_mutex_unlock(&scan->lock);
+    return 0;
+}
+
+// Add a finished directory's own totals and pass its sums up
+static void finish(DuScan *scan, DuNode *node, dev_t dev, ino_t ino) {
+    DuDir dir;
+    bool found = false;
+    pthread_mutex_lock(&scan->lock);
+    auto it = scan->own.find(scan_key(dev, ino));
+    if (it != scan->own.end()) {
+        dir.own_bytes = it->second.own_bytes;
+        dir.own_files = it->second.own_files;
+        dir.links.swap(it->second.links);
+        scan->own.erase(it);
+        found = true;
+    }
+    pthread_mutex_unlock(&scan->lock);
+
+    if (found) {
+        node->own_bytes = dir.own_bytes;
+        node->own_files = dir.own_files;
+        for (size_t i = 0; i < dir.links.size(); i++) {
+            const DuLink &link = dir.links[i];
+            if (scan->linked.insert(scan_key(link.dev, link.ino)).second) {
+                node->own_bytes += link.bytes;
+                node->own_files++;
+            }
+        }
+    }
+
+    node->bytes += node->own_bytes;
+    node->files += node->own_files;
+    if (node->parent) {
+        node->parent->bytes += node->bytes;
+        node->parent->files += node->files;
+        node->parent->dirs += node->dirs + 1;
+    }
+}
+
+static int du_visit(const WalkItem *item, void *ctx) {
+    DuScan *scan = (DuScan *)ctx;
+
+    switch (item->event) {
+        case WALK_ENTRY: {
+            if (!fs_entry_is_dir(item->entry)) {
+                return WALK_CONTINUE;  // Counted in the directory's own totals
+            }
+            DuNode *node = new DuNode();
+            node->name = item->name;
+            node->parent = scan->current;
+            scan->current->children.push_back(node);
+            scan->current = node;
+
+            unsigned long dirs = scan->dirs.load();
+            if (scan->progress && dirs >= scan->next_progress) {
+                DuStats stats = {dirs, scan->cached.load()};
+                scan->progress(&stats, scan->ctx);
+                scan->next_progress = dirs + DU_PROGRESS_EVERY;
+            }
+            break;
+        }
+        case WALK_ERROR:
+            scan->current->error = item->error;
+            break;
+        case WALK_LEAVE: {
+            DuNode *node = scan->current;
+            finish(scan, node, item->entry->st.st_dev, item->entry->st.st_ino);
+            scan->current = node->parent;
+            break;
+        }
+    }
+    return WALK_CONTINUE;
+}
+
+DuNode *du_scan(const char *path, int (*stop)(void), DuProgress progress, void *ctx, DuStats *stats) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    if (cache.size() > DU_CACHE_MAX) {
+        cache.clear();
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    DuNode *root = new DuNode();
+    root->name = path;
+    root->parent = NULL;
+
+    DuScan scan;
+    scan.current = root;
+    scan.dirs.store(0);
+    scan.cached.store(0);
+    scan.next_progress = DU_PROGRESS_EVERY;
+    scan.progress = progress;
+    scan.ctx = ctx;
+    pthread_mutex_init(&scan.lock, NULL);
+
+    WalkOptions options = {WALK_STAT | WALK_HIDDEN, 0, stop, du_read};
+    int result = walk_tree(path, &options, du_visit, &scan);
+    int saved = errno;
+    if (result == 0) {
+        finish(&scan, root, st.st_dev, st.st_ino);
+    }
+    pthread_mutex_destroy(&scan.lock);
+
+    if (stats) {
+        stats->dirs = scan.dirs.load();
+        stats->cached = scan.cached.load();
+    }
+    if (result != 0) {
+        du_free(root);
+        errno = result > 0 ? ECANCELED : saved;
+        return NULL;
+    }
+    du_sort(root, DU_SORT_SIZE);
+    return root;
+}
+
+void du_free(DuNode *node) {
+    for (size_t i = 0; i < node->children.size(); i++) {
+        du_free(node->children[i]);
+    }
+    delete node;
+}
+
+void du_sort(DuNode *node, int order) {
+    if (order == DU_SORT_NAME) {
+        std::sort(node->children.begin(), node->children.end(), [](const DuNode *a, const DuNode *b) {
+            return strcasecmp(a->name.c_str(), b->name.c_str()) < 0;
+        });
+    } else {
+        std::sort(node->children.begin(), node->children.end(), [](const DuNode *a, const DuNode *b) {
+            if (a->bytes != b->bytes) {
+                return a->bytes > b->bytes;
+            }
+            return strcasecmp(a->name.c_str(), b->name.c_str()) < 0;
+        });
+    }
+    for (size_t i = 0; i < node->children.size(); i++) {
+        du_sort(node->children[i], order);
+    }
+}
+
+void du_format_size(unsigned long long bytes, char *buf, size_t len) {
+    static const char units[] = "BKMGTP";
+    double value = (double)bytes;
+    int unit = 0;
+    while (value >= 1024 && unit < 5) {
+        value /= 1024;
+        unit++;
+    }
+    if (unit == 0) {
+        snprintf(buf, len, "%lluB", bytes);
+    } else if (value < 10) {
+        snprintf(buf, len, "%.1f%c", value, units[unit]);
+    } else {
+        snprintf(buf, len, "%.0f%c", value, units[unit]);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef DU_H
+#define DU_H
+
+// Disk usage for MINUX
+// Totals the space used below a directory on the parallel walker. Each
+// directory's listing (the names of its files and subdirectories) is
+// cached under (dev, ino, mtime), so a rescan only re-reads directories
+// whose entries changed. The files themselves are statted on every scan,
+// as a file that grows in place doesn't touch its directory's mtime.
+// Files with several links are counted once per scan.
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Disk usage settings
+#define DU_CACHE_MAX 262144             // Directories remembered before the cache starts over
+#define DU_PROGRESS_EVERY 256           // Directories between progress callbacks
+
+// Child orders for du_sort()
+#define DU_SORT_SIZE 0
+#define DU_SORT_NAME 1
+
+typedef struct DuNode {
+    std::string name;
+    unsigned long long bytes;           // Disk usage of everything below, including own_bytes
+    unsigned long long own_bytes;       // The directory itself and the files directly in it
+    unsigned long files;                // Files below
+    unsigned long own_files;
+    unsigned long dirs;                 // Directories below
+    int error;                          // errno if the directory couldn't be read, else 0
+    struct DuNode *parent;
+    std::vector<struct DuNode *> children;
+} DuNode;
+
+typedef struct {
+    unsigned long dirs;                 // Directories read so far
+    unsigned long cached;               // ...of those, answered from the cache
+} DuStats;
+
+typedef void (*DuProgress)(const DuStats *stats, void *ctx);
+
+// Scan path. Returns the tree (sorted by size), or NULL with errno set if
+// path can't be read or stop() ended the scan (ECANCELED). progress may be
+// NULL; it and stop() are called on the calling thread.
+DuNode *du_scan(const char *path, int (*stop)(void), DuProgress progress, void *ctx, DuStats *stats);
+void du_free(DuNode *node);
+
+// Order the children of node and everything below it
+void du_sort(DuNode *node, int order);
+
+// "1.5G", "320K", "12B"
+void du_format_size(unsigned long long bytes, char *buf, size_t len);
+
+#endif // DU_H
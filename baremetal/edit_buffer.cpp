@@ -0,0 +1,531 @@
+#include "edit_buffer.h"
+#include "file_save.h"
+#include <string.h>
+#include <algorithm>
+
+struct EditNode {
+    EditPiece piece;
+    uint32_t priority;                  // Above both children's
+    EditNode *left;
+    EditNode *right;
+    uint64_t bytes;                     // Of the whole subtree
+    uint64_t newlines;
+};
+
+static uint64_t node_bytes(const EditNode *node) {
+    return node ? node->bytes : 0;
+}
+
+static uint64_t node_newlines(const EditNode *node) {
+    return node ? node->newlines : 0;
+}
+
+static void update(EditNode *node) {
+    node->bytes = node_bytes(node->left) + node->piece.len + node_bytes(node->right);
+    node->newlines = node_newlines(node->left) + node->piece.newlines + node_newlines(node->right);
+}
+
+static EditNode *new_node(EditBuffer *buffer, const EditPiece &piece) {
+    // xorshift32
+    uint32_t x = buffer->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    buffer->seed = x;
+
+    EditNode *node = new EditNode;
+    node->piece = piece;
+    node->priority = x;
+    node->left = NULL;
+    node->right = NULL;
+    update(node);
+    return node;
+}
+
+static void free_nodes(EditNode *node) {
+    if (!node) {
+        return;
+    }
+    free_nodes(node->left);
+    free_nodes(node->right);
+    delete node;
+}
+
+// Up to *len bytes of a piece's text from from, valid until the map is
+// read again or more text is added
+static const char *piece_text(EditBuffer *buffer, const EditPiece &piece, uint64_t from, size_t *len) {
+    if (piece.source == EDIT_BUFFER_ADDED) {
+        return buffer->added.data() + piece.start + from;
+    }
+    return file_map_span(&buffer->map, piece.start + from, len);
+}
+
+static uint64_t count_newlines(EditBuffer *buffer, const EditPiece &piece, uint64_t from, uint64_t len) {
+    uint64_t count = 0;
+    while (len > 0) {
+        size_t n = (size_t)len;
+        const char *text = piece_text(buffer, piece, from, &n);
+        if (n == 0) {
+            break;
+        }
+        const char *end = text + n;
+        while ((text = (const char *)memchr(text, '\n', end - text)) != NULL) {
+            count++;
+            text++;
+        }
+        from += n;
+        len -= n;
+    }
+    return count;
+}
+
+// Offset in the piece just past its k-th newline (from 1)
+static uint64_t piece_newline(EditBuffer *buffer, const EditPiece &piece, uint64_t k) {
+    uint64_t from = 0;
+    while (from < piece.len) {
+        size_t n = (size_t)(piece.len - from);
+        const char *text = piece_text(buffer, piece, from, &n);
+        if (n == 0) {
+            break;
+        }
+        const char *end = text + n;
+        for (const char *at = text; (at = (const char *)memchr(at, '\n', end - at)) != NULL; at++) {
+            if (--k == 0) {
+                return from + (at - text) + 1;
+            }
+        }
+        from += n;
+    }
+    return piece.len;
+}
+
+static void append_piece(EditBuffer *buffer, const EditPiece &piece, uint64_t from, uint64_t len, std::string *text) {
+    while (len > 0) {
+        size_t n = (size_t)len;
+        const char *part = piece_text(buffer, piece, from, &n);
+        if (n == 0) {
+            break;
+        }
+        text->append(part, n);
+        from += n;
+        len -= n;
+    }
+}
+
+static EditNode *join(EditNode *a, EditNode *b) {
+    if (!a) {
+        return b;
+    }
+    if (!b) {
+        return a;
+    }
+    if (a->priority > b->priority) {
+        a->right = join(a->right, b);
+        update(a);
+        return a;
+    }
+    b->left = join(a, b->left);
+    update(b);
+    return b;
+}
+
+// Split the pieces under node into the first offset bytes and the rest,
+// cutting the piece offset falls inside in two
+static void split(EditBuffer *buffer, EditNode *node, uint64_t offset, EditNode **left, EditNode **right) {
+    if (!node) {
+        *left = NULL;
+        *right = NULL;
+        return;
+    }
+    uint64_t before = node_bytes(node->left);
+    if (offset <= before) {
+        split(buffer, node->left, offset, left, &node->left);
+        update(node);
+        *right = node;
+    } else if (offset >= before + node->piece.len) {
+        split(buffer, node->right, offset - before - node->piece.len, &node->right, right);
+        update(node);
+        *left = node;
+    } else {
+        // Count the newlines in the shorter part
+        uint64_t cut = offset - before;
+        EditPiece rest = node->piece;
+        rest.start += cut;
+        rest.len -= cut;
+        if (cut <= rest.len) {
+            node->piece.newlines = count_newlines(buffer, node->piece, 0, cut);
+            rest.newlines -= node->piece.newlines;
+        } else {
+            rest.newlines = count_newlines(buffer, node->piece, cut, rest.len);
+            node->piece.newlines -= rest.newlines;
+        }
+        node->piece.len = cut;
+
+        EditNode *after = node->right;
+        node->right = NULL;
+        update(node);
+        *left = node;
+        *right = join(new_node(buffer, rest), after);
+    }
+}
+
+static void collect(const EditNode *node, std::vector<EditPiece> *pieces) {
+    if (!node) {
+        return;
+    }
+    collect(node->left, pieces);
+    pieces->push_back(node->piece);
+    collect(node->right, pieces);
+}
+
+static uint64_t pieces_len(const std::vector<EditPiece> &pieces) {
+    uint64_t len = 0;
+    for (size_t i = 0; i < pieces.size(); i++) {
+        len += pieces[i].len;
+    }
+    return len;
+}
+
+static uint64_t pieces_newlines(const std::vector<EditPiece> &pieces) {
+    uint64_t newlines = 0;
+    for (size_t i = 0; i < pieces.size(); i++) {
+        newlines += pieces[i].newlines;
+    }
+    return newlines;
+}
+
+// Grow the last piece under node by piece if it ends where piece starts
+static bool extend_last(EditNode *node, const EditPiece &piece) {
+    if (!node) {
+        return false;
+    }
+    if (node->right) {
+        if (!extend_last(node->right, piece)) {
+            return false;
+        }
+    } else if (node->piece.source != piece.source || node->piece.start + node->piece.len != piece.start) {
+        return false;
+    } else {
+        node->piece.len += piece.len;
+        node->piece.newlines += piece.newlines;
+    }
+    update(node);
+    return true;
+}
+
+static void insert_pieces(EditBuffer *buffer, uint64_t offset, const std::vector<EditPiece> &pieces) {
+    EditNode *left, *right;
+    split(buffer, buffer->root, offset, &left, &right);
+    for (size_t i = 0; i < pieces.size(); i++) {
+        // Pieces of the file stay short enough to look inside cheaply
+        if (pieces[i].source == EDIT_BUFFER_FILE || !extend_last(left, pieces[i])) {
+            left = join(left, new_node(buffer, pieces[i]));
+        }
+    }
+    buffer->root = join(left, right);
+}
+
+static void remove_pieces(EditBuffer *buffer, uint64_t offset, uint64_t len, std::vector<EditPiece> *removed) {
+    EditNode *left, *middle, *right;
+    split(buffer, buffer->root, offset, &left, &right);
+    split(buffer, right, len, &middle, &right);
+    if (removed) {
+        collect(middle, removed);
+    }
+    free_nodes(middle);
+    buffer->root = join(left, right);
+}
+
+// A new change makes the undone ones unreachable
+static void forget_undone(EditBuffer *buffer) {
+    if (buffer->saved > (long)buffer->done) {
+        buffer->saved = -1;
+    }
+    buffer->history.resize(buffer->done);
+}
+
+// The last change, if the next one may be merged into it
+static EditChange *open_change(EditBuffer *buffer) {
+    if (buffer->history.empty() || buffer->saved == (long)buffer->done) {
+        return NULL;
+    }
+    return &buffer->history.back();
+}
+
+static void add_change(EditBuffer *buffer, const EditChange &change) {
+    buffer->history.push_back(change);
+    if (buffer->history.size() > EDIT_BUFFER_HISTORY) {
+        buffer->history.erase(buffer->history.begin());
+        if (buffer->saved >= 0) {
+            buffer->saved--;
+        }
+    }
+    buffer->done = buffer->history.size();
+}
+
+void edit_buffer_init(EditBuffer *buffer) {
+    buffer->map.fd = -1;
+    buffer->map.size = 0;
+    buffer->map.data = NULL;
+    buffer->map.window = NULL;
+    buffer->map.index = NULL;
+    buffer->mapped = false;
+    buffer->added.clear();
+    buffer->root = NULL;
+    buffer->history.clear();
+    buffer->done = 0;
+    buffer->saved = 0;
+    buffer->seed = 2463534242u;
+}
+
+int edit_buffer_open(EditBuffer *buffer, const char *path) {
+    edit_buffer_init(buffer);
+    // The pieces below count the newlines, so the map needs no index
+    if (file_map_open(&buffer->map, path, FILE_MAP_NO_INDEX) != 0) {
+        return -1;
+    }
+    buffer->mapped = true;
+
+    for (uint64_t at = 0; at < buffer->map.size; at += EDIT_BUFFER_PIECE) {
+        EditPiece piece;
+        piece.start = at;
+        piece.len = std::min((uint64_t)EDIT_BUFFER_PIECE, buffer->map.size - at);
+        piece.source = EDIT_BUFFER_FILE;
+        piece.newlines = count_newlines(buffer, piece, 0, piece.len);
+        buffer->root = join(buffer->root, new_node(buffer, piece));
+    }
+    return 0;
+}
+
+void edit_buffer_free(EditBuffer *buffer) {
+    free_nodes(buffer->root);
+    buffer->root = NULL;
+    if (buffer->mapped) {
+        file_map_close(&buffer->map);
+        buffer->mapped = false;
+    }
+    buffer->added.clear();
+    buffer->history.clear();
+    buffer->done = 0;
+    buffer->saved = 0;
+}
+
+uint64_t edit_buffer_length(const EditBuffer *buffer) {
+    return node_bytes(buffer->root);
+}
+
+long edit_buffer_lines(EditBuffer *buffer) {
+    return (long)node_newlines(buffer->root) + 1;
+}
+
+uint64_t edit_buffer_line_start(EditBuffer *buffer, long line) {
+    if (line <= 0) {
+        return 0;
+    }
+    uint64_t k = (uint64_t)line;
+    if (k > node_newlines(buffer->root)) {
+        return node_bytes(buffer->root);
+    }
+
+    // Down to the piece holding the k-th newline
+    uint64_t base = 0;
+    EditNode *node = buffer->root;
+    while (node) {
+        uint64_t left = node_newlines(node->left);
+        if (k <= left) {
+            node = node->left;
+            continue;
+        }
+        k -= left;
+        base += node_bytes(node->left);
+        if (k <= node->piece.newlines) {
+            return base + piece_newline(buffer, node->piece, k);
+        }
+        k -= node->piece.newlines;
+        base += node->piece.len;
+        node = node->right;
+    }
+    return base;
+}
+
+long edit_buffer_line_of(EditBuffer *buffer, uint64_t offset) {
+    uint64_t line = 0;
+    EditNode *node = buffer->root;
+    while (node) {
+        uint64_t before = node_bytes(node->left);
+        if (offset < before) {
+            node = node->left;
+            continue;
+        }
+        line += node_newlines(node->left);
+        offset -= before;
+        if (offset < node->piece.len) {
+            line += count_newlines(buffer, node->piece, 0, offset);
+            break;
+        }
+        line += node->piece.newlines;
+        offset -= node->piece.len;
+        node = node->right;
+    }
+    return (long)line;
+}
+
+static void read_range(EditBuffer *buffer, EditNode *node, uint64_t offset, uint64_t len, std::string *text) {
+    if (!node || len == 0) {
+        return;
+    }
+    uint64_t before = node_bytes(node->left);
+    if (offset < before) {
+        uint64_t part = std::min(len, before - offset);
+        read_range(buffer, node->left, offset, part, text);
+        offset += part;
+        len -= part;
+    }
+    if (len == 0) {
+        return;
+    }
+    offset -= before;
+    if (offset < node->piece.len) {
+        uint64_t part = std::min(len, node->piece.len - offset);
+        append_piece(buffer, node->piece, offset, part, text);
+        offset = 0;
+        len -= part;
+    } else {
+        offset -= node->piece.len;
+    }
+    read_range(buffer, node->right, offset, len, text);
+}
+
+void edit_buffer_read(EditBuffer *buffer, uint64_t offset, uint64_t len, std::string *text) {
+    text->clear();
+    read_range(buffer, buffer->root, offset, len, text);
+}
+
+void edit_buffer_line(EditBuffer *buffer, long line, std::string *text) {
+    uint64_t start = edit_buffer_line_start(buffer, line);
+    uint64_t end = edit_buffer_length(buffer);
+    if ((uint64_t)line < node_newlines(buffer->root)) {
+        end = edit_buffer_line_start(buffer, line + 1) - 1;
+    }
+    edit_buffer_read(buffer, start, end - start, text);
+}
+
+void edit_buffer_insert(EditBuffer *buffer, uint64_t offset, const char *text, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    EditPiece piece;
+    piece.start = buffer->added.size();
+    piece.len = len;
+    piece.source = EDIT_BUFFER_ADDED;
+    piece.newlines = 0;
+    for (const char *at = text; (at = (const char *)memchr(at, '\n', text + len - at)) != NULL; at++) {
+        piece.newlines++;
+    }
+    buffer->added.append(text, len);
+
+    std::vector<EditPiece> pieces(1, piece);
+    insert_pieces(buffer, offset, pieces);
+
+    // Typing on from where the last insert ended, within a line, is one change
+    forget_undone(buffer);
+    EditChange *last = open_change(buffer);
+    if (last && last->removed.empty() && last->added.size() == 1 && piece.newlines == 0 &&
+        last->added[0].newlines == 0 && offset == last->offset + last->added[0].len &&
+        last->added[0].start + last->added[0].len == piece.start) {
+        last->added[0].len += piece.len;
+        return;
+    }
+    EditChange change;
+    change.offset = offset;
+    change.added = pieces;
+    add_change(buffer, change);
+}
+
+void edit_buffer_erase(EditBuffer *buffer, uint64_t offset, uint64_t len) {
+    uint64_t length = edit_buffer_length(buffer);
+    if (offset >= length || len == 0) {
+        return;
+    }
+    len = std::min(len, length - offset);
+    std::vector<EditPiece> removed;
+    remove_pieces(buffer, offset, len, &removed);
+
+    // Deleting on backwards or forwards from the last delete, within a line,
+    // is one change
+    forget_undone(buffer);
+    EditChange *last = open_change(buffer);
+    if (last && last->added.empty() && !last->removed.empty() &&
+        pieces_newlines(removed) == 0 && pieces_newlines(last->removed) == 0) {
+        if (offset + len == last->offset) {
+            last->removed.insert(last->removed.begin(), removed.begin(), removed.end());
+            last->offset = offset;
+            return;
+        }
+        if (offset == last->offset) {
+            last->removed.insert(last->removed.end(), removed.begin(), removed.end());
+            return;
+        }
+    }
+    EditChange change;
+    change.offset = offset;
+    change.removed = removed;
+    add_change(buffer, change);
+}
+
+bool edit_buffer_undo(EditBuffer *buffer, uint64_t *start, uint64_t *end) {
+    if (buffer->done == 0) {
+        return false;
+    }
+    const EditChange &change = buffer->history[--buffer->done];
+    remove_pieces(buffer, change.offset, pieces_len(change.added), NULL);
+    insert_pieces(buffer, change.offset, change.removed);
+    *start = change.offset;
+    *end = change.offset + pieces_len(change.removed);
+    return true;
+}
+
+bool edit_buffer_redo(EditBuffer *buffer, uint64_t *start, uint64_t *end) {
+    if (buffer->done == buffer->history.size()) {
+        return false;
+    }
+    const EditChange &change = buffer->history[buffer->done++];
+    remove_pieces(buffer, change.offset, pieces_len(change.removed), NULL);
+    insert_pieces(buffer, change.offset, change.added);
+    *start = change.offset;
+    *end = change.offset + pieces_len(change.added);
+    return true;
+}
+
+bool edit_buffer_modified(const EditBuffer *buffer) {
+    return buffer->saved != (long)buffer->done;
+}
+
+int edit_buffer_save(EditBuffer *buffer, const char *path) {
+    FileSave save;
+    if (file_save_begin(&save, path) != 0) {
+        return -1;
+    }
+    std::vector<EditPiece> pieces;
+    collect(buffer->root, &pieces);
+    for (size_t i = 0; i < pieces.size(); ) {
+        if (pieces[i].source == EDIT_BUFFER_ADDED) {
+            file_save_write(&save, buffer->added.data() + pieces[i].start, (size_t)pieces[i].len);
+            i++;
+            continue;
+        }
+
+        // Pieces of the file that still follow on from each other are one copy
+        uint64_t start = pieces[i].start;
+        uint64_t end = start + pieces[i].len;
+        for (i++; i < pieces.size() && pieces[i].source == EDIT_BUFFER_FILE && pieces[i].start == end; i++) {
+            end += pieces[i].len;
+        }
+        file_save_copy(&save, buffer->map.fd, start, end - start);
+    }
+    if (file_save_commit(&save) != 0) {
+        return -1;
+    }
+    buffer->saved = (long)buffer->done;
+    return 0;
+}
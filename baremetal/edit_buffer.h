@@ -0,0 +1,102 @@
+#ifndef EDIT_BUFFER_H
+#define EDIT_BUFFER_H
+
+// Edit buffer for MINUX
+// The text of a file being edited, kept as a piece table: the file itself,
+// mapped and never copied, plus an append-only buffer of everything typed,
+// with the text a sequence of pieces of one or the other. The pieces are
+// held in a treap in text order, each node summing the bytes and newlines
+// below it, so finding a line or an offset and inserting or deleting text
+// cost O(log n) in the number of pieces however big the file is. The file
+// is cut into pieces of at most EDIT_BUFFER_PIECE bytes when it is opened,
+// which keeps looking inside any one piece cheap.
+//
+// Each change is kept as the pieces it removed and the pieces it added -
+// a few records whatever its size - and undoing or redoing it swaps one
+// set for the other. Runs of typing or deleting merge into one change,
+// and past EDIT_BUFFER_HISTORY changes the oldest are forgotten.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "file_map.h"
+
+// Edit buffer settings
+#define EDIT_BUFFER_PIECE 65536         // Largest piece the file is cut into
+#define EDIT_BUFFER_HISTORY 10000       // Changes kept for undo
+
+// Where a piece's text is
+#define EDIT_BUFFER_FILE 0
+#define EDIT_BUFFER_ADDED 1
+
+typedef struct {
+    uint64_t start;                     // Offset in the file or the added text
+    uint64_t len;
+    uint64_t newlines;
+    unsigned char source;               // EDIT_BUFFER_FILE or EDIT_BUFFER_ADDED
+} EditPiece;
+
+// One change: at offset, removed was replaced by added
+typedef struct {
+    uint64_t offset;
+    std::vector<EditPiece> removed;
+    std::vector<EditPiece> added;
+} EditChange;
+
+typedef struct EditNode EditNode;
+
+typedef struct {
+    FileMap map;
+    bool mapped;                        // False for a file that doesn't exist yet
+    std::string added;                  // Everything typed, only ever appended to
+    EditNode *root;
+    std::vector<EditChange> history;
+    size_t done;                        // Changes in history not undone
+    long saved;                         // done when last saved, or -1 if that is forgotten
+    uint32_t seed;                      // For node priorities
+} EditBuffer;
+
+// An empty buffer, for a new file
+void edit_buffer_init(EditBuffer *buffer);
+
+// Map path and cut it into pieces. Returns 0, or -1 with errno set (the
+// buffer is then empty).
+int edit_buffer_open(EditBuffer *buffer, const char *path);
+void edit_buffer_free(EditBuffer *buffer);
+
+uint64_t edit_buffer_length(const EditBuffer *buffer);
+
+// Lines, counting a last one without a newline but not an empty one after it
+long edit_buffer_lines(EditBuffer *buffer);
+
+// Offset line (from 0) starts at
+uint64_t edit_buffer_line_start(EditBuffer *buffer, long line);
+
+// Line holding offset, from 0
+long edit_buffer_line_of(EditBuffer *buffer, uint64_t offset);
+
+// Line's text without its newline
+void edit_buffer_line(EditBuffer *buffer, long line, std::string *text);
+
+// len bytes of text from offset
+void edit_buffer_read(EditBuffer *buffer, uint64_t offset, uint64_t len, std::string *text);
+
+void edit_buffer_insert(EditBuffer *buffer, uint64_t offset, const char *text, size_t len);
+void edit_buffer_erase(EditBuffer *buffer, uint64_t offset, uint64_t len);
+
+// Undo or redo the last change. Returns false if there is none, else sets
+// *start and *end to where the text it put back is.
+bool edit_buffer_undo(EditBuffer *buffer, uint64_t *start, uint64_t *end);
+bool edit_buffer_redo(EditBuffer *buffer, uint64_t *start, uint64_t *end);
+
+// Whether the text differs from what was opened or last saved
+bool edit_buffer_modified(const EditBuffer *buffer);
+
+// Write the text to path through a temporary file (file_save.h). Text
+// still in the mapped file is copied from it in the kernel. The buffer
+// keeps the old file mapped, so editing, undo and redo carry on after a
+// save. Returns 0, or -1 with errno set.
+int edit_buffer_save(EditBuffer *buffer, const char *path);
+
+#endif // EDIT_BUFFER_H
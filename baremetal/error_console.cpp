@@ -12,6 +12,8 @@
 #include <ncurses.h>
 #include <panel.h>
 #include <menu.h>
+#include <pthread.h>
+#include <atomic>
 #include <cstring>
 #include <cstdlib>
 
@@ -24,19 +26,29 @@ static int max(int a, int b) {
     return (a > b) ? a : b;
 }
 
+// Messages logged without a console (batch mode), counted per level
+static int headless_counts[ERROR_DEBUG + 1];
+
+// The console is drawn by the thread that created it. Messages logged on
+// other threads are pushed onto a lock-free stack and added to the console
+// by error_console_flush_pending().
+static pthread_t owner_thread;
+static std::atomic<ErrorMessage *> pending_messages(NULL);
+
+static const char *level_name(ErrorLevel level) {
+    return level == ERROR_SUCCESS ? "SUCCESS" :
+           level == ERROR_INFO ? "INFO" :
+           level == ERROR_WARNING ? "WARNING" :
+           level == ERROR_CRITICAL ? "CRITICAL" : "UNKNOWN";
+}
+
 static void write_to_log_file(const char *log_path, const char *timestamp, 
                             ErrorLevel level, const char *source, const char *message) {
     FILE *fp = fopen(log_path, "a");
     if (!fp) return;
 
-    const char *level_str = 
-        level == ERROR_SUCCESS ? "SUCCESS" :
-        level == ERROR_INFO ? "INFO" :
-        level == ERROR_WARNING ? "WARNING" :
-        level == ERROR_CRITICAL ? "CRITICAL" : "UNKNOWN";
-
     fprintf(fp, "[%s] <%s> %s: %s\n", 
-            timestamp, level_str, source, message);
+            timestamp, level_name(level), source, message);
     fclose(fp);
 }
 
@@ -77,6 +89,7 @@ ErrorConsole* error_console_init(void) {
 
     ErrorConsole *console = (ErrorConsole *)malloc(sizeof(ErrorConsole));
     if (!console) return NULL;
+    owner_thread = pthread_self();
 
     // Initialize console state
     console->messages = NULL;
@@ -271,27 +284,8 @@ void error_console_handle_input(ErrorConsole *console, int ch) {
     }
 }
 
-void log_error(ErrorConsole *console, ErrorLevel level, const char *source,
-               const char *format, ...) {
-    ErrorMessage *msg = (ErrorMessage *)malloc(sizeof(ErrorMessage));
-    if (!msg) return;
-
-    // Get current timestamp
-    time_t now = time(NULL);
-    strftime(msg->timestamp, sizeof(msg->timestamp), "%Y-%m-%d %H:%M:%S",
-             localtime(&now));
-
-    // Format message
-    va_list args;
-    va_start(args, format);
-    vsnprintf(msg->message, sizeof(msg->message), format, args);
-    va_end(args);
-
-    msg->level = level;
-    strncpy(msg->source, source, sizeof(msg->source) - 1);
-    msg->source[sizeof(msg->source) - 1] = '\0';
-    msg->next = NULL;
-
+// Append a formatted message, log it and update the display
+static void add_message(ErrorConsole *console, ErrorMessage *msg) {
     // Add to message list
     if (!console->messages) {
         console->messages = msg;
@@ -306,7 +300,7 @@ void log_error(ErrorConsole *console, ErrorLevel level, const char *source,
 
     // Write to log file if path is available
     if (console->log_path) {
-        write_to_log_file(console->log_path, msg->timestamp, level, source, msg->message);
+        write_to_log_file(console->log_path, msg->timestamp, msg->level, msg->source, msg->message);
     }
 
     // Auto-scroll if at bottom
@@ -315,7 +309,7 @@ void log_error(ErrorConsole *console, ErrorLevel level, const char *source,
     }
 
     // Show console automatically for critical errors
-    if (level == ERROR_CRITICAL && !console->is_visible) {
+    if (msg->level == ERROR_CRITICAL && !console->is_visible) {
         error_console_toggle(console);
     } else if (console->is_visible) {
         refresh_console(console);
@@ -325,6 +319,80 @@ void log_error(ErrorConsole *console, ErrorLevel level, const char *source,
     update_status_bar_error(console);
 }
 
+void log_error(ErrorConsole *console, ErrorLevel level, const char *source,
+               const char *format, ...) {
+    // Without a console (batch mode) messages go straight to stderr
+    if (!console) {
+        char message[MAX_ERROR_LENGTH];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(message, sizeof(message), format, args);
+        va_end(args);
+
+        headless_counts[level]++;
+        fprintf(stderr, "minux: <%s> %s: %s\n", level_name(level), source, message);
+        return;
+    }
+
+    ErrorMessage *msg = (ErrorMessage *)malloc(sizeof(ErrorMessage));
+    if (!msg) return;
+
+    // Get current timestamp
+    time_t now = time(NULL);
+    struct tm tm_now;
+    strftime(msg->timestamp, sizeof(msg->timestamp), "%Y-%m-%d %H:%M:%S",
+             localtime_r(&now, &tm_now));
+
+    // Format message
+    va_list args;
+    va_start(args, format);
+    vsnprintf(msg->message, sizeof(msg->message), format, args);
+    va_end(args);
+
+    msg->level = level;
+    strncpy(msg->source, source, sizeof(msg->source) - 1);
+    msg->source[sizeof(msg->source) - 1] = '\0';
+    msg->next = NULL;
+
+    if (!pthread_equal(pthread_self(), owner_thread)) {
+        msg->next = pending_messages.load(std::memory_order_relaxed);
+        while (!pending_messages.compare_exchange_weak(msg->next, msg, std::memory_order_release,
+                                                       std::memory_order_relaxed)) {
+        }
+        return;
+    }
+
+    add_message(console, msg);
+}
+
+void error_console_flush_pending(ErrorConsole *console) {
+    ErrorMessage *msg = pending_messages.exchange(NULL, std::memory_order_acquire);
+    if (!msg || !console) {
+        // Without a console there is nowhere to show them
+        while (msg) {
+            ErrorMessage *next = msg->next;
+            free(msg);
+            msg = next;
+        }
+        return;
+    }
+
+    // The stack holds the newest message first
+    ErrorMessage *ordered = NULL;
+    while (msg) {
+        ErrorMessage *next = msg->next;
+        msg->next = ordered;
+        ordered = msg;
+        msg = next;
+    }
+    while (ordered) {
+        ErrorMessage *next = ordered->next;
+        ordered->next = NULL;
+        add_message(console, ordered);
+        ordered = next;
+    }
+}
+
 void error_console_destroy(ErrorConsole *console) {
     if (!console) return;
 
@@ -343,6 +411,10 @@ void error_console_destroy(ErrorConsole *console) {
 }
 
 int get_error_count(ErrorConsole *console, ErrorLevel level) {
+    if (!console) {
+        return headless_counts[level];
+    }
+
     int count = 0;
     ErrorMessage *current = console->messages;
     while (current) {
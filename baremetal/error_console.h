@@ -70,11 +70,16 @@ typedef struct ErrorConsole {
 } ErrorConsole;
 
 // Console functions - modern API
+// log_error and get_error_count accept a NULL console (batch mode):
+// messages are written to stderr and counted per level. log_error may be
+// called from any thread; messages from threads other than the one that
+// created the console appear at the next error_console_flush_pending().
 ErrorConsole* error_console_init(void);
 void error_console_destroy(ErrorConsole *console);
 void error_console_toggle(ErrorConsole *console);
 void error_console_handle_input(ErrorConsole *console, int ch);
 void log_error(ErrorConsole *console, ErrorLevel level, const char *source, const char *format, ...);
+void error_console_flush_pending(ErrorConsole *console);
 int get_error_count(ErrorConsole *console, ErrorLevel level);
 const char* get_last_error_message(ErrorConsole *console);
 
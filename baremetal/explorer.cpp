@@ -10,8 +10,16 @@
 #include <ctype.h>
 #include <time.h>
 #include <locale.h>
+#include <limits.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "fs_watch.h"
+#include "dir_view.h"
+#include "file_map.h"
+#include "file_save.h"
+#include "view_search.h"
 
-#define MAX_ITEMS 1024
 #define MAX_PATH 4096
 #define MAX_NAME_LENGTH 255
 #define MAX_TABS 10
@@ -31,12 +39,15 @@ void draw_ascii_box(WINDOW *win);
 typedef struct {
     char name[MAX_NAME_LENGTH];
     char path[MAX_PATH];
-    char *content;
+    FileMap *map;  // The file, mapped and indexed in the background
+    ViewSearch *search;  // Searched in the background, NULL until it is
+    char *content;  // Text of a tab without a file (help)
     size_t content_size;
     int scroll_pos;
     int cursor_x;
     int cursor_y;
     int modified;
+    int wd;  // Watch on path, -1 if none
 } Tab;
 
 typedef struct {
@@ -45,11 +56,21 @@ typedef struct {
     int active;
 } TabBar;
 
+// A directory panel. Item names live back to back in one arena that is
+// cleared, not freed, between directories, so it only grows to the largest
+// listing seen. Items are kept in the order they were read, with their
+// kind, size and time alongside, and shown in the order of the view.
 typedef struct {
     WINDOW *win;
-    char items[MAX_ITEMS][MAX_NAME_LENGTH + 1];
+    std::string names;              // Every item NUL-terminated, with a '/' after directories
+    std::vector<size_t> items;      // Offset of each item in names
+    std::vector<unsigned char> kind;    // 1 for directories
+    std::vector<off_t> size;
+    std::vector<time_t> mtime;
+    DirView view;                   // Rows shown, as item indices
+    size_t dead;                    // Bytes of names no longer referenced
     int count;
-    int selected;
+    int selected;                   // Row, not item
     int start;
     int scroll_pos;
 } Panel;
@@ -93,6 +114,17 @@ clock_t status_message_time = 0;
 Menu menus[4];  // File, Edit, View, Help
 int active_menu = -1;
 char current_path[MAX_PATH];  // Move current_path to global scope
+bool filtering = false;  // Typed keys go to the panel's filter
+bool search_regex = false;  // Tab searches take a regex rather than plain text
+bool search_waiting = false;  // The active tab jumps to a match once the search gets there
+bool search_forward = true;
+long search_from = 0;
+
+// File system watch for the directory shown and the open tabs
+FsWatch watcher;
+int dir_wd = -1;
+char watched_path[MAX_PATH] = "";
+time_t watched_mtime = 0;  // Checked instead when inotify isn't available
 
 int safe_path_join(char *dest, size_t dest_size, const char *path1, const char *path2) {
     // First try with snprintf to get the required length
@@ -149,6 +181,22 @@ void draw_status_bar(const char *path) {
 
     // Show current path on the left with no unicode
     mvwprintw(status_bar, 0, 1, " [DIR] %s ", path);  // Removed folder emoji, using [DIR] instead
+    const DirView *view = &file_panel.view;
+    wprintw(status_bar, " [sort: %s%s]", dir_view_key_name(view->key), view->descending ? ", reversed" : "");
+    if (filtering || !view->filter.empty()) {
+        wprintw(status_bar, " [filter: %s%s] %d of %d", view->filter.c_str(), filtering ? "_" : "",
+                (int)view->rows.size(), file_panel.count);
+    }
+    if (tab_bar.active >= 0 && tab_bar.tabs[tab_bar.active].search) {
+        const ViewSearch *search = tab_bar.tabs[tab_bar.active].search;
+        bool searched;
+        long matches = view_search_count(search, &searched);
+        wprintw(status_bar, " [search: %s, %ld %s", search->text.c_str(), matches, matches == 1 ? "line" : "lines");
+        if (!searched) {
+            wprintw(status_bar, ", %d%%", view_search_progress(search));
+        }
+        wprintw(status_bar, "]");
+    }
 
     // Show cursor position on the right
     if (tab_bar.active >= 0) {
@@ -209,19 +257,29 @@ void draw_tabs() {
     refresh();
 }
 
+// Map the tab's file - nothing is read until it is shown, so any size opens
 void load_file_content(Tab *tab) {
-    FILE *file = fopen(tab->path, "r");
-    if (!file) return;
-
-    fseek(file, 0, SEEK_END);
-    tab->content_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    tab->map = new FileMap;
+    if (file_map_open(tab->map, tab->path, 0) != 0) {
+        delete tab->map;
+        tab->map = NULL;
+    }
+}
 
-    tab->content = (char *)malloc(tab->content_size + 1);
-    fread(tab->content, 1, tab->content_size, file);
-    tab->content[tab->content_size] = '\0';
-    
-    fclose(file);
+void free_file_content(Tab *tab) {
+    if (tab->search) {
+        view_search_stop(tab->search);
+        delete tab->search;
+        tab->search = NULL;
+    }
+    if (tab->map) {
+        file_map_close(tab->map);
+        delete tab->map;
+        tab->map = NULL;
+    }
+    free(tab->content);
+    tab->content = NULL;
+    tab->content_size = 0;
 }
 
 void open_file_in_tab(const char *path) {
@@ -236,16 +294,70 @@ void open_file_in_tab(const char *path) {
     tab->cursor_x = 0;
     tab->cursor_y = 0;
     tab->modified = 0;
+    tab->wd = fs_watch_add(&watcher, path, FS_WATCH_FILE);
+    tab->search = NULL;
+    tab->content = NULL;
+    tab->content_size = 0;
     
     load_file_content(tab);
     
     tab_bar.active = tab_bar.count++;
 }
 
+// Show the matches of pattern in a line drawn from column 1 in reverse
+// video. Tabs were expanded by curses, to every 8th column of the window.
+static void mark_matches(WINDOW *win, int y, const char *text, size_t len, const TextPattern *pattern) {
+    int width = getmaxx(win) - 1;
+    int x = 1;
+    size_t done = 0;  // Bytes of text x accounts for
+    size_t from = 0;
+    size_t start, match_len;
+    while (from < len && text_pattern_match(pattern, text + from, len - from, &start, &match_len)) {
+        start += from;
+        for (; done < start; done++) {
+            x = text[done] == '\t' ? (x + 8) & ~7 : x + 1;
+        }
+        int match_x = x;
+        for (; done < start + match_len; done++) {
+            x = text[done] == '\t' ? (x + 8) & ~7 : x + 1;
+        }
+        if (match_x >= width) {
+            break;
+        }
+        mvwchgat(win, y, match_x, std::min(x, width) - match_x, A_REVERSE, 0, NULL);
+        if (!pattern->literal) {
+            break;  // ^ would match again further on
+        }
+        from = start + std::max(match_len, (size_t)1);
+    }
+}
+
 void draw_file_content(WINDOW *win, Tab *tab) {
     wclear(win);
     draw_ascii_box(win);  // Use ASCII box instead of box(win, 0, 0)
 
+    if (tab->map) {
+        // Only the lines on screen are looked at
+        int rows = getmaxy(win) - 2;
+        int y = 0;
+        const char *text;
+        size_t len;
+        while (y < rows && file_map_line(tab->map, tab->scroll_pos + y, &text, &len)) {
+            int shown = len < 255 ? (int)len : 255;
+            mvwprintw(win, y + 1, 1, "%-*.*s", getmaxx(win) - 2, std::min(shown, getmaxx(win) - 2), text);
+            if (tab->search && !tab->search->text.empty()) {
+                mark_matches(win, y + 1, text, shown, &tab->search->pattern);
+            }
+            y++;
+        }
+        if (tab->map->size == 0) {
+            mvwprintw(win, 1, 1, "Empty file");
+        }
+        wmove(win, tab->cursor_y - tab->scroll_pos + 1, tab->cursor_x + 1);
+        wrefresh(win);
+        return;
+    }
+
     if (!tab->content) {
         mvwprintw(win, 1, 1, "Empty file");
         wrefresh(win);
@@ -317,7 +429,7 @@ void handle_mouse() {
         // Handle file panel clicks
         if (event.x < screen_width / 2) {
             int clicked_index = event.y - 3 + file_panel.scroll_pos;
-            if (clicked_index >= 0 && clicked_index < file_panel.count) {
+            if (clicked_index >= 0 && clicked_index < (int)file_panel.view.rows.size()) {
                 file_panel.selected = clicked_index;
             }
         }
@@ -347,15 +459,134 @@ void draw_ascii_box(WINDOW *win) {
     }
 }
 
+static const char *panel_item(const Panel *panel, int i) {
+    return panel->names.c_str() + panel->items[i];
+}
+
+// Empty the panel, keeping the arena's memory for the next directory
+static void panel_clear(Panel *panel) {
+    panel->names.clear();
+    panel->items.clear();
+    panel->kind.clear();
+    panel->size.clear();
+    panel->mtime.clear();
+    panel->dead = 0;
+    panel->count = 0;
+}
+
+// Store an item at index at (count appends)
+static void panel_set(Panel *panel, int at, const char *name, const struct stat *st) {
+    bool is_dir = S_ISDIR(st->st_mode);
+    size_t offset = panel->names.size();
+    panel->names += name;
+    if (is_dir) {
+        panel->names += '/';
+    }
+    panel->names += '\0';
+
+    if (at == panel->count) {
+        panel->items.push_back(offset);
+        panel->kind.push_back(0);
+        panel->size.push_back(0);
+        panel->mtime.push_back(0);
+        panel->count++;
+    } else {
+        panel->dead += strlen(panel_item(panel, at)) + 1;
+        panel->items[at] = offset;
+    }
+    panel->kind[at] = is_dir ? 1 : 0;
+    panel->size[at] = st->st_size;
+    panel->mtime[at] = st->st_mtime;
+}
+
+static void panel_remove(Panel *panel, int at) {
+    panel->dead += strlen(panel_item(panel, at)) + 1;
+    panel->items.erase(panel->items.begin() + at);
+    panel->kind.erase(panel->kind.begin() + at);
+    panel->size.erase(panel->size.begin() + at);
+    panel->mtime.erase(panel->mtime.begin() + at);
+    panel->count--;
+
+    // Drop the names of removed items once they are most of the arena
+    dir_view_compact_names(&panel->names, &panel->items, &panel->dead);
+}
+
+static DirColumns panel_columns(const Panel *panel) {
+    DirColumns columns;
+    columns.count = panel->count;
+    columns.names = panel->names.c_str();
+    columns.name_at = panel->items.data();
+    columns.kind = panel->kind.data();
+    columns.dir_kind = 1;
+    columns.size = panel->size.data();
+    columns.mtime = panel->mtime.data();
+    columns.name_ordered = false;  // Read in directory order
+    return columns;
+}
+
+// Item under the selection, or NULL if no rows are shown
+static const char *panel_selected(const Panel *panel) {
+    if (panel->selected < 0 || panel->selected >= (int)panel->view.rows.size()) {
+        return NULL;
+    }
+    return panel_item(panel, panel->view.rows[panel->selected]);
+}
+
+// Select the row showing item, if any still does
+static void panel_select(Panel *panel, const std::string &item) {
+    for (size_t i = 0; i < panel->view.rows.size(); i++) {
+        if (item == panel_item(panel, panel->view.rows[i])) {
+            panel->selected = (int)i;
+            break;
+        }
+    }
+}
+
+// Sort and filter the items again after the listing changed
+static void panel_sort(Panel *panel) {
+    DirColumns columns = panel_columns(panel);
+    dir_view_sort(&panel->view, &columns);
+}
+
+// Format the sort column for an item: its time when sorting by time,
+// else its size
+static void panel_detail(const Panel *panel, int item, char *buf, size_t size) {
+    if (panel->view.key == DIR_VIEW_MTIME) {
+        struct tm *tm = localtime(&panel->mtime[item]);
+        if (!tm || strftime(buf, size, "%Y-%m-%d %H:%M", tm) == 0) {
+            snprintf(buf, size, "?");
+        }
+    } else if (panel->kind[item] == 1) {
+        snprintf(buf, size, "<DIR>");
+    } else {
+        double bytes = (double)panel->size[item];
+        const char *units = "BKMGT";
+        int unit = 0;
+        while (bytes >= 1024 && unit < 4) {
+            bytes /= 1024;
+            unit++;
+        }
+        if (unit == 0) {
+            snprintf(buf, size, "%d B", (int)bytes);
+        } else {
+            snprintf(buf, size, "%.1f %c", bytes, units[unit]);
+        }
+    }
+}
+
 void draw_panel(Panel *panel, int width, int height, int startx, int is_active) {
     (void)startx;  // Explicitly mark parameter as unused
     
+    // Rows past the end may hold entries that have since gone
+    werase(panel->win);
+    
     // Use our ASCII box instead of ncurses box()
     draw_ascii_box(panel->win);
     
     int max_display = height - 2;
     
-    if (panel->selected >= panel->count) panel->selected = panel->count - 1;
+    int rows = (int)panel->view.rows.size();
+    if (panel->selected >= rows) panel->selected = rows - 1;
     if (panel->selected < 0) panel->selected = 0;
     
     if (panel->selected >= panel->start + max_display)
@@ -363,8 +594,12 @@ void draw_panel(Panel *panel, int width, int height, int startx, int is_active)
     if (panel->selected < panel->start)
         panel->start = panel->selected;
 
-    for (int i = 0; i < max_display && i + panel->start < panel->count; i++) {
-        char *item = panel->items[i + panel->start];
+    for (int i = 0; i < max_display && i + panel->start < rows; i++) {
+        int at = (int)panel->view.rows[i + panel->start];
+        const char *item = panel_item(panel, at);
+        char detail[32];
+        panel_detail(panel, at, detail, sizeof(detail));
+        int name_width = width - 2 - 17;  // Room for the widest detail and a gap
         
         if (i + panel->start == panel->selected && is_active)
             wattron(panel->win, COLOR_PAIR(3));
@@ -373,7 +608,11 @@ void draw_panel(Panel *panel, int width, int height, int startx, int is_active)
         else
             wattron(panel->win, COLOR_PAIR(2));
 
-        mvwprintw(panel->win, i + 1, 1, "%-*.*s", width - 2, width - 2, item);
+        if (name_width > 8) {
+            mvwprintw(panel->win, i + 1, 1, "%-*.*s %16s", name_width, name_width, item, detail);
+        } else {
+            mvwprintw(panel->win, i + 1, 1, "%-*.*s", width - 2, width - 2, item);
+        }
         
         if (i + panel->start == panel->selected && is_active)
             wattroff(panel->win, COLOR_PAIR(3));
@@ -393,20 +632,15 @@ void load_directory(Panel *panel, const char *path) {
     }
 
     // Clear existing items
-    memset(panel->items, 0, sizeof(panel->items));
-    panel->count = 0;
+    panel_clear(panel);
     panel->selected = 0;
     panel->start = 0;
     panel->scroll_pos = 0;
 
     struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL && panel->count < MAX_ITEMS) {
+    while ((entry = readdir(dir)) != NULL) {
         if (strcmp(entry->d_name, ".") == 0) continue;
         
-        // Check if filename length is within bounds
-        size_t name_len = strlen(entry->d_name);
-        if (name_len >= MAX_NAME_LENGTH - 1) continue;  // Skip too long filenames
-        
         char full_path[MAX_PATH];
         if (snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name) >= MAX_PATH) {
             continue;  // Skip if path would be too long
@@ -414,18 +648,147 @@ void load_directory(Panel *panel, const char *path) {
         
         struct stat st;
         if (stat(full_path, &st) == 0) {
-            if (S_ISDIR(st.st_mode)) {
-                if (snprintf(panel->items[panel->count], MAX_NAME_LENGTH + 1, "%s/", entry->d_name) < MAX_NAME_LENGTH) {
-                    panel->count++;
-                }
-            } else {
-                if (snprintf(panel->items[panel->count], MAX_NAME_LENGTH + 1, "%s", entry->d_name) < MAX_NAME_LENGTH) {
-                    panel->count++;
-                }
-            }
+            panel_set(panel, panel->count, entry->d_name, &st);
         }
     }
     closedir(dir);
+    panel_sort(panel);
+
+    // Watch the directory shown, so the panel can be patched as it changes
+    if (strcmp(watched_path, path) != 0) {
+        fs_watch_remove(&watcher, dir_wd);
+        dir_wd = fs_watch_add(&watcher, path, FS_WATCH_DIR);
+        strncpy(watched_path, path, MAX_PATH - 1);
+    }
+    struct stat dir_st;
+    if (stat(path, &dir_st) == 0) {
+        watched_mtime = dir_st.st_mtime;
+    }
+}
+
+// Index of the item for name (directories carry a trailing '/'), or -1
+static int panel_find(const Panel *panel, const char *name) {
+    size_t len = strlen(name);
+    for (int i = 0; i < panel->count; i++) {
+        const char *item = panel_item(panel, i);
+        if (strncmp(item, name, len) == 0 && (item[len] == '\0' || (item[len] == '/' && item[len + 1] == '\0'))) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Bring one item up to date: added at the end, changed in place or removed.
+// The view is sorted again once every change is in.
+static void panel_patch(Panel *panel, const char *path, const char *name) {
+    int at = panel_find(panel, name);
+
+    char full_path[MAX_PATH];
+    struct stat st;
+    if (safe_path_join(full_path, sizeof(full_path), path, name) < 0 || stat(full_path, &st) != 0) {
+        if (at >= 0) {
+            panel_remove(panel, at);
+        }
+        return;
+    }
+
+    panel_set(panel, at < 0 ? panel->count : at, name, &st);
+}
+
+// Read the directory again, keeping the selection on the same item
+static void reload_directory(Panel *panel) {
+    const char *item = panel_selected(panel);
+    std::string selected = item ? item : "";
+    char path[MAX_PATH];
+    strcpy(path, watched_path);
+    watched_path[0] = '\0';  // Watch it anew, it may be a different directory now
+    load_directory(panel, path);
+    panel_select(panel, selected);
+}
+
+// Read a tab's file again after it changed on disk, unless it has edits
+static void reload_tab(Tab *tab, bool gone) {
+    if (gone) {
+        // Saved by replacing it, most likely - watch whatever is there now
+        fs_watch_remove(&watcher, tab->wd);
+        tab->wd = fs_watch_add(&watcher, tab->path, FS_WATCH_FILE);
+        if (tab->wd < 0 && access(tab->path, F_OK) != 0) {
+            show_status_message("File deleted on disk", 1);
+            return;
+        }
+    }
+    if (tab->modified) {
+        show_status_message("File changed on disk - Ctrl+S overwrites it", 1);
+        return;
+    }
+    if (tab->map) {
+        // Appended text is indexed on from where it was
+        if (file_map_refresh(tab->map) != FILE_MAP_SAME && tab->search) {
+            view_search_restart(tab->search, tab->map->fd, tab->map->size);
+        }
+        return;
+    }
+    free_file_content(tab);
+    load_file_content(tab);
+}
+
+// Apply what the watch collected to the panel and the open tabs
+static void apply_changes(Panel *panel) {
+    const char *item = panel_selected(panel);
+    std::string selected = item ? item : "";
+    bool patched = false;
+    bool reload = watcher.overflow;
+    if (watcher.fd < 0) {
+        struct stat st;
+        reload = stat(watched_path, &st) != 0 || st.st_mtime != watched_mtime;
+    }
+    for (size_t i = 0; i < watcher.events.size() && !reload; i++) {
+        const FsWatchEvent &event = watcher.events[i];
+        if (event.wd != dir_wd) {
+            continue;
+        }
+        if (event.what == FS_EVENT_GONE) {
+            reload = true;
+        } else if (!event.name.empty()) {
+            panel_patch(panel, watched_path, event.name.c_str());
+            patched = true;
+        }
+    }
+    if (reload) {
+        reload_directory(panel);
+    } else if (patched) {
+        panel_sort(panel);
+        panel_select(panel, selected);
+    }
+
+    for (int i = 0; i < tab_bar.count; i++) {
+        Tab *tab = &tab_bar.tabs[i];
+        if (tab->wd < 0 || !fs_watch_touched(&watcher, tab->wd)) {
+            continue;
+        }
+        bool gone = false;
+        for (size_t j = 0; j < watcher.events.size(); j++) {
+            gone |= watcher.events[j].wd == tab->wd && watcher.events[j].what == FS_EVENT_GONE;
+        }
+        reload_tab(tab, gone);
+    }
+    fs_watch_clear(&watcher);
+}
+
+// Read a key, applying file system changes while waiting
+static int watched_getch(Panel *panel) {
+    timeout(0);
+    int ch = getch();
+    while (ch == ERR) {
+        int why = fs_watch_wait(&watcher, STDIN_FILENO);
+        if (why != FS_WAIT_INPUT) {
+            apply_changes(panel);
+            break;  // Redraw, then wait again
+        }
+        ch = getch();
+    }
+    timeout(-1);
+    return ch;
 }
 
 void preview_file(WINDOW *win, const char *path) {
@@ -463,7 +826,10 @@ void show_status_message(const char *message, int type) {
 void close_current_tab() {
     if (tab_bar.count > 0 && tab_bar.active >= 0) {
         // Free the content of the current tab
-        free(tab_bar.tabs[tab_bar.active].content);
+        free_file_content(&tab_bar.tabs[tab_bar.active]);
+        
+        // Stop watching its file (another tab with it open holds its own watch)
+        fs_watch_remove(&watcher, tab_bar.tabs[tab_bar.active].wd);
         
         // Shift remaining tabs left
         for (int i = tab_bar.active; i < tab_bar.count - 1; i++) {
@@ -481,10 +847,25 @@ void close_current_tab() {
 void save_current_tab() {
     if (tab_bar.count > 0 && tab_bar.active >= 0) {
         Tab *tab = &tab_bar.tabs[tab_bar.active];
-        FILE *file = fopen(tab->path, "w");
-        if (file) {
-            fwrite(tab->content, 1, tab->content_size, file);
-            fclose(file);
+        if (!tab->modified) {
+            show_status_message("No changes to save", 2);
+            return;
+        }
+        
+        // Through a temporary file renamed over the old one, so a crash
+        // leaves one or the other; text still in the mapped file is copied
+        // from it in the kernel
+        FileSave save;
+        bool saved = false;
+        if (file_save_begin(&save, tab->path) == 0) {
+            if (tab->content) {
+                file_save_write(&save, tab->content, tab->content_size);
+            } else if (tab->map) {
+                file_save_copy(&save, tab->map->fd, 0, tab->map->size);
+            }
+            saved = file_save_commit(&save) == 0;
+        }
+        if (saved) {
             tab->modified = 0;
             show_status_message("File saved", 2);
         } else {
@@ -501,6 +882,120 @@ void toggle_hidden_files() {
     show_status_message(show_hidden ? "Showing hidden files" : "Hiding hidden files", 2);
 }
 
+// Sort by the next column: name, size, modified, extension
+void sort_next_column() {
+    DirColumns columns = panel_columns(&file_panel);
+    const char *item = panel_selected(&file_panel);
+    std::string selected = item ? item : "";
+    dir_view_set_key(&file_panel.view, &columns, (file_panel.view.key + 1) % DIR_VIEW_KEYS, file_panel.view.descending);
+    panel_select(&file_panel, selected);
+}
+
+void reverse_sort() {
+    DirColumns columns = panel_columns(&file_panel);
+    const char *item = panel_selected(&file_panel);
+    std::string selected = item ? item : "";
+    dir_view_set_key(&file_panel.view, &columns, file_panel.view.key, !file_panel.view.descending);
+    panel_select(&file_panel, selected);
+}
+
+void start_filter() {
+    filtering = true;
+}
+
+// Search the active tab's file for what is typed on the status bar, down
+// from the line at the top. An empty search repeats the last one.
+void search_tab() {
+    if (tab_bar.active < 0 || !tab_bar.tabs[tab_bar.active].map) {
+        show_status_message("Open a file to search it", 1);
+        return;
+    }
+    Tab *tab = &tab_bar.tabs[tab_bar.active];
+    char query[256];
+    wattron(status_bar, COLOR_PAIR(6));
+    mvwhline(status_bar, 0, 0, ' ', screen_width);
+    mvwprintw(status_bar, 0, 1, "Search%s: ", search_regex ? " (regex)" : "");
+    echo();
+    wgetnstr(status_bar, query, sizeof(query) - 1);
+    noecho();
+    wattroff(status_bar, COLOR_PAIR(6));
+
+    if (query[0]) {
+        if (!tab->search) {
+            tab->search = new ViewSearch;
+            view_search_init(tab->search);
+        }
+        char err[200];
+        if (view_search_start(tab->search, tab->map->fd, tab->map->size, query,
+                              search_regex ? TEXT_REGEX : TEXT_FIXED, err, sizeof(err)) != 0) {
+            char message[256];
+            snprintf(message, sizeof(message), "Bad pattern: %s", err);
+            show_status_message(message, 1);
+            return;
+        }
+    } else if (!tab->search || tab->search->text.empty()) {
+        return;
+    }
+    search_waiting = true;
+    search_forward = true;
+    search_from = tab->scroll_pos - 1;  // The top line counts
+}
+
+// Move the active tab on to its next match, or back to the one before
+void next_match(bool forward) {
+    if (tab_bar.active < 0 || !tab_bar.tabs[tab_bar.active].search ||
+        tab_bar.tabs[tab_bar.active].search->text.empty()) {
+        show_status_message("Nothing searched for yet - press ?", 1);
+        return;
+    }
+    search_waiting = true;
+    search_forward = forward;
+    search_from = tab_bar.tabs[tab_bar.active].scroll_pos;
+}
+
+// Make the jump once the search has got that far
+static void apply_search_jump() {
+    if (!search_waiting) {
+        return;
+    }
+    if (tab_bar.active < 0 || !tab_bar.tabs[tab_bar.active].search) {
+        search_waiting = false;
+        return;
+    }
+    Tab *tab = &tab_bar.tabs[tab_bar.active];
+    long found = view_search_next(tab->search, search_from, search_forward);
+    if (found == VIEW_SEARCH_PENDING) {
+        return;
+    }
+    search_waiting = false;
+    if (found == VIEW_SEARCH_NONE) {
+        show_status_message(search_forward ? "No more matches below" : "No more matches above", 1);
+        return;
+    }
+    tab->scroll_pos = (int)std::min(found, (long)INT_MAX);
+    tab->cursor_y = tab->scroll_pos;
+    tab->cursor_x = 0;
+}
+
+// Whether the active tab's search is still running
+static bool tab_searching() {
+    bool searched = true;
+    if (tab_bar.active >= 0 && tab_bar.tabs[tab_bar.active].search) {
+        view_search_count(tab_bar.tabs[tab_bar.active].search, &searched);
+    }
+    return !searched;
+}
+
+// Show only items containing filter, narrowing the rows shown as it grows
+static void set_filter(const char *filter) {
+    DirColumns columns = panel_columns(&file_panel);
+    const char *item = panel_selected(&file_panel);
+    std::string selected = item ? item : "";
+    dir_view_filter(&file_panel.view, &columns, filter);
+    file_panel.selected = 0;
+    panel_select(&file_panel, selected);
+}
+
 void show_help() {
     // Create help content
     const char *help_text = 
@@ -513,6 +1008,12 @@ void show_help() {
         "Ctrl+W: Close tab\n"
         "Tab: Switch tabs\n"
         "Enter: Open file/folder\n"
+        "s: Sort by next column\n"
+        "S: Reverse sort order\n"
+        "/: Filter by name (Enter keeps, Esc clears)\n"
+        "?: Search the open file\n"
+        "n/N: Next/previous match\n"
+        "r: Search for a regex/plain text\n"
         "Q: Quit\n";
     
     // Create a new tab with help content
@@ -520,20 +1021,23 @@ void show_help() {
         Tab *tab = &tab_bar.tabs[tab_bar.count];
         strncpy(tab->name, "Help", MAX_NAME_LENGTH - 1);
         strncpy(tab->path, "help", MAX_PATH - 1);
+        tab->map = NULL;
+        tab->search = NULL;
         tab->content_size = strlen(help_text);
         tab->content = strdup(help_text);
         tab->scroll_pos = 0;
         tab->cursor_x = 0;
         tab->cursor_y = 0;
         tab->modified = 0;
+        tab->wd = -1;
         tab_bar.active = tab_bar.count++;
     }
 }
 
-// Initialize menus
+// Initialize menus (the items must outlive this function)
 void init_menus() {
     // File menu
-    MenuItem file_items[] = {
+    static MenuItem file_items[] = {
         {(char *)"New Tab", (char *)"Ctrl+T", NULL},
         {(char *)"Open", (char *)"Ctrl+O", NULL},
         {(char *)"Save", (char *)"Ctrl+S", save_current_tab},
@@ -545,7 +1049,7 @@ void init_menus() {
     menus[0].count = 5;
     
     // Edit menu
-    MenuItem edit_items[] = {
+    static MenuItem edit_items[] = {
         {(char *)"Cut", (char *)"Ctrl+X", NULL},
         {(char *)"Copy", (char *)"Ctrl+C", NULL},
         {(char *)"Paste", (char *)"Ctrl+V", NULL}
@@ -555,16 +1059,19 @@ void init_menus() {
     menus[1].count = 3;
     
     // View menu
-    MenuItem view_items[] = {
+    static MenuItem view_items[] = {
         {(char *)"Toggle Hidden Files", (char *)"Ctrl+H", toggle_hidden_files},
+        {(char *)"Sort by Next Column", (char *)"s", sort_next_column},
+        {(char *)"Reverse Sort", (char *)"S", reverse_sort},
+        {(char *)"Filter", (char *)"/", start_filter},
         {(char *)"Word Wrap", (char *)"Alt+Z", NULL}
     };
     menus[2].name = (char *)"View";
     menus[2].items = view_items;
-    menus[2].count = 2;
+    menus[2].count = 5;
     
     // Help menu
-    MenuItem help_items[] = {
+    static MenuItem help_items[] = {
         {(char *)"Keyboard Shortcuts", (char *)"F1", show_help},
         {(char *)"About", (char *)"", NULL}
     };
@@ -690,6 +1197,7 @@ int main() {
     // Adjust main windows for menu bar, tab bar, and status bar
     int main_height = screen_height - 3;  // -1 for menu, -1 for tabs, -1 for status
     file_panel.win = newwin(main_height, screen_width / 2, 2, 0);
+    dir_view_init(&file_panel.view);
     preview_win = newwin(main_height, screen_width / 2, 2, screen_width / 2);
 
     // Show splash screen
@@ -701,10 +1209,15 @@ int main() {
     // Initialize menus
     init_menus();
 
+    // Changes to the directory and open files are picked up as they happen
+    fs_watch_init(&watcher);
+
     // Main event loop
     load_directory(&file_panel, current_path);
     
     while (1) {
+        apply_search_jump();
+        
         // Draw base windows first
         draw_panel(&file_panel, screen_width / 2, main_height, 0, 1);
         if (tab_bar.active >= 0) {
@@ -726,8 +1239,40 @@ int main() {
             doupdate();  // Ensure all updates are shown
         }
 
-        // Handle input
-        int ch = getch();
+        // Handle input - while the tab shown is being searched, the count
+        // is redrawn as it grows
+        int ch;
+        if (tab_searching() || search_waiting) {
+            timeout(VIEW_SEARCH_REDRAW_MS);
+            ch = getch();
+            timeout(-1);
+        } else {
+            ch = watched_getch(&file_panel);
+        }
+        if (ch == ERR) {
+            continue;  // Something changed on disk
+        }
+        
+        // While filtering, printable keys edit the filter and it is applied as typed
+        if (filtering && active_menu < 0 && ch != KEY_UP && ch != KEY_DOWN && ch != KEY_MOUSE) {
+            std::string filter = file_panel.view.filter;
+            if (ch == '\n' || ch == KEY_ESC) {  // Enter keeps the filter, Esc drops it
+                filtering = false;
+                if (ch == KEY_ESC) {
+                    filter.clear();
+                }
+            } else if (ch == KEY_BACKSPACE || ch == 127) {
+                if (!filter.empty()) {
+                    filter.erase(filter.size() - 1);
+                }
+            } else if (ch >= 32 && ch <= 126) {
+                filter += (char)ch;
+            }
+            if (filter != file_panel.view.filter) {
+                set_filter(filter.c_str());
+            }
+            continue;
+        }
         
         // Check for Alt key combinations
         if (ch == 27) {  // ESC or Alt key
@@ -755,17 +1300,40 @@ int main() {
                         file_panel.selected--;
                     break;
                 case KEY_DOWN:
-                    if (file_panel.selected < file_panel.count - 1)
+                    if (file_panel.selected < (int)file_panel.view.rows.size() - 1)
                         file_panel.selected++;
                     break;
+                case 's':
+                    sort_next_column();
+                    break;
+                case 'S':
+                    reverse_sort();
+                    break;
+                case '/':
+                    start_filter();
+                    break;
+                case '?':
+                    search_tab();
+                    break;
+                case 'n':
+                case 'N':
+                    next_match(ch == 'n');
+                    break;
+                case 'r':
+                    search_regex = !search_regex;
+                    show_status_message(search_regex ? "Searches take a regex" : "Searches take plain text", 2);
+                    break;
                 case '\t':
+                    search_waiting = false;
                     if (tab_bar.count > 0) {
                         tab_bar.active = (tab_bar.active + 1) % tab_bar.count;
                     }
                     break;
                 case '\n':
-                    {
-                        char *selected = file_panel.items[file_panel.selected];
+                    if (panel_selected(&file_panel)) {
+                        // A copy - reading the directory reuses the panel's arena
+                        char selected[MAX_PATH];
+                        snprintf(selected, sizeof(selected), "%s", panel_selected(&file_panel));
                         if (selected[strlen(selected) - 1] == '/') {
                             // Handle directory navigation
                             selected[strlen(selected) - 1] = '\0';
@@ -784,6 +1352,7 @@ int main() {
                                     show_status_message("Error: Path too long", 1);
                                 }
                             }
+                            file_panel.view.filter.clear();  // The filter was for the old directory
                             load_directory(&file_panel, current_path);
                         } else {
                             // Open file in new tab
@@ -817,9 +1386,11 @@ int main() {
 cleanup:
     // Free allocated memory
     for (int i = 0; i < tab_bar.count; i++) {
-        free(tab_bar.tabs[i].content);
+        free_file_content(&tab_bar.tabs[i]);
     }
     
+    fs_watch_close(&watcher);
+    
     // Delete windows
     delwin(menu_bar.win);
     delwin(status_bar);
@@ -0,0 +1,419 @@
+#include "file_map.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+struct FileMapIndex {
+    int fd;                             // The map's descriptor, read with pread()
+    uint64_t *blocks[FILE_MAP_BLOCKS];  // Start of line k * FILE_MAP_STRIDE at [k / BLOCK][k % BLOCK]
+    std::atomic<long> newlines;         // Newlines in the bytes scanned - their line starts are stored
+    std::atomic<bool> open_line;        // The bytes scanned end in the middle of a line
+    std::atomic<uint64_t> scanned;
+
+    // The indexer sleeps on grown until there is more to read
+    pthread_mutex_t lock;
+    pthread_cond_t grown;
+    uint64_t size;
+    bool stop;
+    pthread_t thread;
+};
+
+static void record_newline(FileMapIndex *index, long *newlines, uint64_t at) {
+    (*newlines)++;
+    if (*newlines % FILE_MAP_STRIDE != 0) {
+        return;
+    }
+    long k = *newlines / FILE_MAP_STRIDE;
+    long block = k / FILE_MAP_BLOCK;
+    if (block >= FILE_MAP_BLOCKS) {
+        return;  // Past what the index holds - the lines stay out of reach
+    }
+    if (!index->blocks[block]) {
+        index->blocks[block] = new uint64_t[FILE_MAP_BLOCK];
+    }
+    index->blocks[block][k % FILE_MAP_BLOCK] = at + 1;
+}
+
+// Count the newlines in text, which starts at offset base in the file
+static void index_newlines(FileMapIndex *index, const char *text, size_t len, uint64_t base, long *newlines) {
+    size_t i = 0;
+
+    // Most vectors hold no line start to record, so they are only counted
+#if defined(__AVX2__)
+    {
+        const __m256i want = _mm256_set1_epi8('\n');
+        for (; i + 32 <= len; i += 32) {
+            unsigned mask = (unsigned)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(text + i)), want));
+            int count = __builtin_popcount(mask);
+            if (*newlines % FILE_MAP_STRIDE + count < FILE_MAP_STRIDE) {
+                *newlines += count;
+                continue;
+            }
+            while (mask) {
+                record_newline(index, newlines, base + i + __builtin_ctz(mask));
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128i want = _mm_set1_epi8('\n');
+        for (; i + 16 <= len; i += 16) {
+            unsigned mask = (unsigned)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(text + i)), want));
+            int count = __builtin_popcount(mask);
+            if (*newlines % FILE_MAP_STRIDE + count < FILE_MAP_STRIDE) {
+                *newlines += count;
+                continue;
+            }
+            while (mask) {
+                record_newline(index, newlines, base + i + __builtin_ctz(mask));
+                mask &= mask - 1;
+            }
+        }
+    }
+#elif defined(__ARM_NEON)
+    {
+        const uint8x16_t want = vdupq_n_u8('\n');
+        for (; i + 16 <= len; i += 16) {
+            uint8x16_t hits = vceqq_u8(vld1q_u8((const uint8_t *)(text + i)), want);
+
+            // No movemask on NEON - narrow to 4 bits per byte instead
+            uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(hits), 4);
+            uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+            int count = __builtin_popcountll(mask) >> 2;
+            if (*newlines % FILE_MAP_STRIDE + count < FILE_MAP_STRIDE) {
+                *newlines += count;
+                continue;
+            }
+            while (mask) {
+                int bit = __builtin_ctzll(mask);
+                record_newline(index, newlines, base + i + (bit >> 2));
+                mask &= ~(0xFULL << (bit & ~3));
+            }
+        }
+    }
+#endif
+
+    // The rest, or all of it without vector support
+    while (i < len) {
+        const char *hit = (const char *)memchr(text + i, '\n', len - i);
+        if (!hit) {
+            break;
+        }
+        i = hit - text;
+        record_newline(index, newlines, base + i);
+        i++;
+    }
+}
+
+// Read the file through and count its lines, then wait for it to grow.
+// pread() rather than a mapping of its own, so a file truncated under it
+// just reads short.
+static void *index_thread(void *arg) {
+    FileMapIndex *index = (FileMapIndex *)arg;
+    char *buffer = new char[FILE_MAP_SCAN_CHUNK];
+    long newlines = index->newlines.load();
+
+    pthread_mutex_lock(&index->lock);
+    while (!index->stop) {
+        uint64_t offset = index->scanned.load();
+        if (offset >= index->size) {
+            pthread_cond_wait(&index->grown, &index->lock);
+            continue;
+        }
+        uint64_t left = index->size - offset;
+        pthread_mutex_unlock(&index->lock);
+
+        size_t want = left < FILE_MAP_SCAN_CHUNK ? (size_t)left : FILE_MAP_SCAN_CHUNK;
+        ssize_t got = pread(index->fd, buffer, want, (off_t)offset);
+        if (got > 0) {
+            index_newlines(index, buffer, (size_t)got, offset, &newlines);
+            index->newlines.store(newlines, std::memory_order_release);
+            index->open_line.store(buffer[got - 1] != '\n', std::memory_order_release);
+            index->scanned.store(offset + got, std::memory_order_release);
+        }
+
+        pthread_mutex_lock(&index->lock);
+        if (got <= 0) {
+            index->size = offset;  // Shorter than it was - refresh will sort it out
+        }
+    }
+    pthread_mutex_unlock(&index->lock);
+
+    delete[] buffer;
+    return NULL;
+}
+
+static void unmap(FileMap *map) {
+    if (map->data && map->size > 0) {
+        munmap((void *)map->data, map->size);
+    }
+    if (map->window) {
+        munmap((void *)map->window, map->window_len);
+    }
+    map->data = NULL;
+    map->window = NULL;
+    map->window_start = 0;
+    map->window_len = 0;
+}
+
+// Map all of the file if the address space allows, else leave it windowed
+static void map_file(FileMap *map) {
+    if (map->size == 0) {
+        map->data = "";
+        return;
+    }
+    if (map->size > (uint64_t)SIZE_MAX) {
+        return;
+    }
+    void *data = mmap(NULL, (size_t)map->size, PROT_READ, MAP_PRIVATE, map->fd, 0);
+    if (data != MAP_FAILED) {
+        map->data = (const char *)data;
+    }
+}
+
+static void stop_index(FileMap *map) {
+    FileMapIndex *index = map->index;
+    if (!index) {
+        return;
+    }
+    pthread_mutex_lock(&index->lock);
+    index->stop = true;
+    pthread_cond_signal(&index->grown);
+    pthread_mutex_unlock(&index->lock);
+    pthread_join(index->thread, NULL);
+
+    for (int i = 0; i < FILE_MAP_BLOCKS && index->blocks[i]; i++) {
+        delete[] index->blocks[i];
+    }
+    pthread_cond_destroy(&index->grown);
+    pthread_mutex_destroy(&index->lock);
+    delete index;
+    map->index = NULL;
+}
+
+static int start_index(FileMap *map) {
+    FileMapIndex *index = new FileMapIndex();
+    index->fd = map->fd;
+    index->blocks[0] = new uint64_t[FILE_MAP_BLOCK];
+    index->blocks[0][0] = 0;  // Line 0
+    index->newlines.store(0);
+    index->open_line.store(false);
+    index->scanned.store(0);
+    pthread_mutex_init(&index->lock, NULL);
+    pthread_cond_init(&index->grown, NULL);
+    index->size = map->size;
+    index->stop = false;
+    map->index = index;
+
+    if (pthread_create(&index->thread, NULL, index_thread, index) != 0) {
+        pthread_cond_destroy(&index->grown);
+        pthread_mutex_destroy(&index->lock);
+        delete[] index->blocks[0];
+        delete index;
+        map->index = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int file_map_open(FileMap *map, const char *path, int flags) {
+    map->path = path;
+    map->data = NULL;
+    map->window = NULL;
+    map->window_start = 0;
+    map->window_len = 0;
+    map->index = NULL;
+
+    map->fd = open(path, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+    if (map->fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(map->fd, &st) != 0 || S_ISDIR(st.st_mode)) {
+        int saved = S_ISDIR(st.st_mode) ? EISDIR : errno;
+        close(map->fd);
+        map->fd = -1;
+        errno = saved;
+        return -1;
+    }
+    map->ino = st.st_ino;
+    map->size = (uint64_t)st.st_size;
+    map_file(map);
+
+    if (flags & FILE_MAP_NO_INDEX) {
+        return 0;
+    }
+
+    // Read ahead for the indexer; whatever part is on screen is faulted in as needed
+    posix_fadvise(map->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (start_index(map) != 0) {
+        unmap(map);
+        close(map->fd);
+        map->fd = -1;
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+void file_map_close(FileMap *map) {
+    stop_index(map);
+    unmap(map);
+    if (map->fd >= 0) {
+        close(map->fd);
+    }
+    map->fd = -1;
+    map->size = 0;
+}
+
+int file_map_refresh(FileMap *map) {
+    struct stat st;
+    if (stat(map->path.c_str(), &st) != 0) {
+        return FILE_MAP_SAME;  // Between a rotation's rename and create, say
+    }
+    if (st.st_ino == map->ino && (uint64_t)st.st_size == map->size) {
+        return FILE_MAP_SAME;
+    }
+
+    if (st.st_ino != map->ino || (uint64_t)st.st_size < map->size) {
+        std::string path = map->path;
+        int flags = map->index ? 0 : FILE_MAP_NO_INDEX;
+        file_map_close(map);
+        return file_map_open(map, path.c_str(), flags) == 0 ? FILE_MAP_REOPENED : -1;
+    }
+
+    // Appended to: map the longer file and let the indexer carry on
+    unmap(map);
+    map->size = (uint64_t)st.st_size;
+    map_file(map);
+    if (map->index) {
+        pthread_mutex_lock(&map->index->lock);
+        map->index->size = map->size;
+        pthread_cond_signal(&map->index->grown);
+        pthread_mutex_unlock(&map->index->lock);
+    }
+    return FILE_MAP_GREW;
+}
+
+const char *file_map_span(FileMap *map, uint64_t offset, size_t *len) {
+    if (offset >= map->size) {
+        *len = 0;
+        return "";
+    }
+    if (*len > map->size - offset) {
+        *len = (size_t)(map->size - offset);
+    }
+    if (map->data) {
+        return map->data + offset;
+    }
+
+    // Windowed: move the window if the span doesn't fit in it
+    if (!map->window || offset < map->window_start || offset + *len > map->window_start + map->window_len) {
+        if (map->window) {
+            munmap((void *)map->window, map->window_len);
+            map->window = NULL;
+        }
+        uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+        uint64_t start = offset & ~(page - 1);
+        uint64_t left = map->size - start;
+        size_t window_len = left < FILE_MAP_WINDOW ? (size_t)left : FILE_MAP_WINDOW;
+        void *window = mmap(NULL, window_len, PROT_READ, MAP_PRIVATE, map->fd, (off_t)start);
+        if (window == MAP_FAILED) {
+            *len = 0;
+            return "";
+        }
+        map->window = (const char *)window;
+        map->window_start = start;
+        map->window_len = window_len;
+    }
+    return map->window + (offset - map->window_start);
+}
+
+// Offset of the first newline at or after from, or map->size if none
+static uint64_t find_newline(FileMap *map, uint64_t from) {
+    while (from < map->size) {
+        size_t len = FILE_MAP_SCAN_CHUNK;
+        const char *text = file_map_span(map, from, &len);
+        if (len == 0) {
+            break;
+        }
+        const char *hit = (const char *)memchr(text, '\n', len);
+        if (hit) {
+            return from + (hit - text);
+        }
+        from += len;
+    }
+    return map->size;
+}
+
+long file_map_lines(const FileMap *map, bool *complete) {
+    if (!map->index) {
+        *complete = true;
+        return 0;
+    }
+    uint64_t scanned = map->index->scanned.load(std::memory_order_acquire);
+    long newlines = map->index->newlines.load(std::memory_order_acquire);
+    *complete = scanned >= map->size;
+    if (*complete && map->index->open_line.load(std::memory_order_acquire)) {
+        newlines++;  // A last line without a newline is a line too
+    }
+    return newlines;
+}
+
+int file_map_progress(const FileMap *map) {
+    if (!map->index || map->size == 0) {
+        return 100;
+    }
+    uint64_t scanned = map->index->scanned.load(std::memory_order_acquire);
+    return scanned >= map->size ? 100 : (int)(scanned * 100 / map->size);
+}
+
+bool file_map_line(FileMap *map, long n, const char **text, size_t *len) {
+    if (!map->index || n < 0) {
+        return false;
+    }
+
+    // The nearest recorded start at or before the line, then newlines from there
+    long newlines = map->index->newlines.load(std::memory_order_acquire);
+    long k = n / FILE_MAP_STRIDE;
+    long known = newlines / FILE_MAP_STRIDE;
+    if (known >= (long)FILE_MAP_BLOCKS * FILE_MAP_BLOCK) {
+        known = (long)FILE_MAP_BLOCKS * FILE_MAP_BLOCK - 1;
+    }
+    if (k > known) {
+        k = known;
+    }
+    long skip = n - k * FILE_MAP_STRIDE;
+    if (skip >= FILE_MAP_STRIDE + FILE_MAP_AHEAD) {
+        return false;
+    }
+    uint64_t start = map->index->blocks[k / FILE_MAP_BLOCK][k % FILE_MAP_BLOCK];
+    for (long i = 0; i < skip && start < map->size; i++) {
+        start = find_newline(map, start) + 1;
+    }
+    if (start >= map->size) {
+        return false;
+    }
+
+    *len = FILE_MAP_LINE_MAX;
+    *text = file_map_span(map, start, len);
+    const char *end = (const char *)memchr(*text, '\n', *len);
+    if (end) {
+        *len = end - *text;
+    }
+    return true;
+}
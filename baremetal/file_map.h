@@ -0,0 +1,80 @@
+#ifndef FILE_MAP_H
+#define FILE_MAP_H
+
+// Mapped file for MINUX
+// A file opened for viewing without reading it into memory. The file is
+// mapped read-only - all of it, or a window at a time where the address
+// space is too small - and a thread indexes it in the background, keeping
+// where every FILE_MAP_STRIDE-th line starts. The first screen is read
+// straight from the mapping before any of that is done, and once a line
+// is indexed it is at most FILE_MAP_STRIDE - 1 newlines past a known
+// start. Newlines are counted with a vector compare (SSE2/AVX2 on x86,
+// NEON on ARM, memchr elsewhere). The index is only ever appended to, in
+// blocks that never move, so it is read without a lock while it grows.
+//
+// A mapped file that another program truncates makes reading the lost
+// part fault, so callers that expect that (following a log) should call
+// file_map_refresh() when it changes.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+
+// Mapped file settings
+#define FILE_MAP_STRIDE 64              // Lines between recorded line starts
+#define FILE_MAP_BLOCK 16384            // Line starts per index block
+#define FILE_MAP_BLOCKS 16384           // Index blocks at most (beyond that a file isn't indexed)
+#define FILE_MAP_SCAN_CHUNK (1 << 20)   // Bytes the indexer reads at a time
+#define FILE_MAP_WINDOW (64 << 20)      // Bytes mapped at a time when the whole file can't be
+#define FILE_MAP_LINE_MAX 65536         // Longest line returned; the rest is cut off
+#define FILE_MAP_AHEAD 1024             // Lines past the index file_map_line() looks for itself
+
+// file_map_refresh() results
+#define FILE_MAP_SAME 0
+#define FILE_MAP_GREW 1                 // Text was appended; the index carries on from where it was
+#define FILE_MAP_REOPENED 2             // Shrunk or replaced; everything was read again
+
+// file_map_open() flags
+#define FILE_MAP_NO_INDEX 1             // Map only; file_map_lines() and file_map_line() find nothing
+
+typedef struct FileMapIndex FileMapIndex;
+
+typedef struct {
+    std::string path;
+    int fd;
+    ino_t ino;
+    uint64_t size;
+    const char *data;                   // The whole file, or NULL when windowed
+    const char *window;                 // Windowed: the part mapped now
+    uint64_t window_start;
+    size_t window_len;
+    FileMapIndex *index;                // Shared with the indexing thread
+} FileMap;
+
+// Open and map path and, unless flags has FILE_MAP_NO_INDEX (for callers
+// that read the whole file themselves), start indexing it. Returns 0, or
+// -1 with errno set.
+int file_map_open(FileMap *map, const char *path, int flags);
+void file_map_close(FileMap *map);
+
+// Check the file at map->path again. Returns FILE_MAP_*, or -1 (with the
+// map closed) if it can't be opened any more.
+int file_map_refresh(FileMap *map);
+
+// Lines indexed so far; *complete is set once that is all of them
+long file_map_lines(const FileMap *map, bool *complete);
+
+// Percent of the file indexed
+int file_map_progress(const FileMap *map);
+
+// Line n (from 0), without its newline. Returns false if n is past the end,
+// or too far past the index to look for yet. text stays valid until the
+// next call on map.
+bool file_map_line(FileMap *map, long n, const char **text, size_t *len);
+
+// Up to *len bytes at offset (fewer at the end of the file), valid until
+// the next call on map. *len must not exceed FILE_MAP_WINDOW / 2.
+const char *file_map_span(FileMap *map, uint64_t offset, size_t *len);
+
+#endif // FILE_MAP_H
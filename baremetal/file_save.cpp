@@ -0,0 +1,197 @@
+#include "file_save.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// Write the buffer, then extra_len bytes of extra, in one writev()
+static void write_out(FileSave *save, const char *extra, size_t extra_len) {
+    struct iovec iov[2];
+    int count = 0;
+    if (save->buffered > 0) {
+        iov[count].iov_base = save->buffer;
+        iov[count].iov_len = save->buffered;
+        count++;
+    }
+    if (extra_len > 0) {
+        iov[count].iov_base = (void *)extra;
+        iov[count].iov_len = extra_len;
+        count++;
+    }
+    save->buffered = 0;
+
+    struct iovec *at = iov;
+    while (count > 0 && save->error == 0) {
+        ssize_t n = writev(save->fd, at, count);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            save->error = n < 0 ? errno : EIO;
+            break;
+        }
+        // Skip past what was written
+        while (count > 0 && (size_t)n >= at->iov_len) {
+            n -= at->iov_len;
+            at++;
+            count--;
+        }
+        if (count > 0) {
+            at->iov_base = (char *)at->iov_base + n;
+            at->iov_len -= n;
+        }
+    }
+}
+
+// Read len bytes of fd from offset through the buffer
+static void read_through(FileSave *save, int fd, uint64_t offset, uint64_t len) {
+    while (len > 0 && save->error == 0) {
+        if (save->buffered == FILE_SAVE_BUFFER) {
+            write_out(save, NULL, 0);
+        }
+        size_t part = FILE_SAVE_BUFFER - save->buffered;
+        if (part > len) {
+            part = (size_t)len;
+        }
+        ssize_t n = pread(fd, save->buffer + save->buffered, part, (off_t)offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            save->error = n < 0 ? errno : EIO;  // The source got shorter
+            break;
+        }
+        save->buffered += (size_t)n;
+        offset += (uint64_t)n;
+        len -= (uint64_t)n;
+    }
+}
+
+int file_save_begin(FileSave *save, const char *path) {
+    save->fd = -1;
+    save->buffer = NULL;
+    save->buffered = 0;
+    save->error = 0;
+
+    // Replace what a symlink points to, not the link
+    char resolved[PATH_MAX];
+    save->path = realpath(path, resolved) ? resolved : path;
+    struct stat st;
+    bool exists = stat(save->path.c_str(), &st) == 0;
+
+    // A hidden name beside the file, so the rename stays on one file system
+    size_t slash = save->path.rfind('/');
+    std::string dir = slash == std::string::npos ? "" : save->path.substr(0, slash + 1);
+    std::string name = save->path.substr(slash == std::string::npos ? 0 : slash + 1);
+    for (int attempt = 0; ; attempt++) {
+        char suffix[64];
+        snprintf(suffix, sizeof(suffix), ".%ld.%d.tmp", (long)getpid(), attempt);
+        save->temp_path = dir + "." + name + suffix;
+        save->fd = open(save->temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (save->fd >= 0) {
+            break;
+        }
+        if (errno != EEXIST || attempt >= 100) {
+            return -1;
+        }
+    }
+
+    if (exists) {
+        // Owner before mode, since chown() clears setuid and setgid. Only
+        // root can give a file away; saved as the user's instead, it keeps
+        // no setuid or setgid meant for someone else.
+        mode_t mode = st.st_mode & 07777;
+        if (fchown(save->fd, st.st_uid, st.st_gid) != 0) {
+            mode &= ~(mode_t)(S_ISUID | S_ISGID);
+        }
+        fchmod(save->fd, mode);
+    }
+    save->buffer = new char[FILE_SAVE_BUFFER];
+    return 0;
+}
+
+void file_save_write(FileSave *save, const char *text, size_t len) {
+    if (save->error != 0) {
+        return;
+    }
+    if (save->buffered + len <= FILE_SAVE_BUFFER) {
+        memcpy(save->buffer + save->buffered, text, len);
+        save->buffered += len;
+        return;
+    }
+    write_out(save, text, len);
+}
+
+void file_save_copy(FileSave *save, int fd, uint64_t offset, uint64_t len) {
+    if (save->error != 0) {
+        return;
+    }
+    if (len < FILE_SAVE_COPY_MIN) {
+        read_through(save, fd, offset, len);
+        return;
+    }
+
+    write_out(save, NULL, 0);
+#ifdef __linux__
+    while (len > 0 && save->error == 0) {
+        loff_t from = (loff_t)offset;
+        ssize_t n = copy_file_range(fd, &from, save->fd, NULL, (size_t)len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;  // Not across these file systems (or kernels) - copy it by hand
+        }
+        offset += (uint64_t)n;
+        len -= (uint64_t)n;
+    }
+#endif
+    read_through(save, fd, offset, len);
+}
+
+int file_save_commit(FileSave *save) {
+    write_out(save, NULL, 0);
+    if (save->error == 0 && fsync(save->fd) != 0) {
+        save->error = errno;
+    }
+    if (close(save->fd) != 0 && save->error == 0) {
+        save->error = errno;
+    }
+    save->fd = -1;
+    if (save->error == 0 && rename(save->temp_path.c_str(), save->path.c_str()) != 0) {
+        save->error = errno;
+    }
+    if (save->error != 0) {
+        int error = save->error;
+        file_save_abort(save);
+        errno = error;
+        return -1;
+    }
+
+    // Make the rename itself last
+    size_t slash = save->path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : save->path.substr(0, slash);
+    int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    delete[] save->buffer;
+    save->buffer = NULL;
+    return 0;
+}
+
+void file_save_abort(FileSave *save) {
+    if (save->fd >= 0) {
+        close(save->fd);
+        save->fd = -1;
+    }
+    unlink(save->temp_path.c_str());
+    delete[] save->buffer;
+    save->buffer = NULL;
+}
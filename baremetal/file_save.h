@@ -0,0 +1,48 @@
+#ifndef FILE_SAVE_H
+#define FILE_SAVE_H
+
+// Crash-safe saving for MINUX
+// A file is never written over in place. The new contents go to a
+// temporary file beside it, which is fsync()ed and then rename()d over the
+// old one, so a crash or power cut mid-save leaves the old file or the new
+// one, never a truncated mix. Text from memory is gathered in a large
+// buffer and written with writev(). Runs of an existing file (the parts
+// of the file being saved that didn't change) go through
+// copy_file_range(), which copies inside the kernel and, on file systems
+// with reflinks (btrfs, XFS), shares the blocks instead of copying them.
+// The saved file keeps the old one's permissions, and a symlink is
+// followed rather than replaced.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// File save settings
+#define FILE_SAVE_BUFFER (1 << 20)      // Bytes gathered before they are written
+#define FILE_SAVE_COPY_MIN 65536        // Shorter copies are read into the buffer instead
+
+typedef struct {
+    std::string path;                   // The file being replaced, symlinks resolved
+    std::string temp_path;
+    int fd;                             // The temporary file
+    char *buffer;
+    size_t buffered;
+    int error;                          // First errno, returned by file_save_commit()
+} FileSave;
+
+// Start saving path. Returns 0, or -1 with errno set.
+int file_save_begin(FileSave *save, const char *path);
+
+// Append len bytes of text, or len bytes of fd from offset. A failure is
+// kept and reported by file_save_commit().
+void file_save_write(FileSave *save, const char *text, size_t len);
+void file_save_copy(FileSave *save, int fd, uint64_t offset, uint64_t len);
+
+// Write what is buffered, fsync, and rename over the file. Returns 0, or
+// -1 with errno set and the old file left as it was.
+int file_save_commit(FileSave *save);
+
+// Give up, removing the temporary file
+void file_save_abort(FileSave *save);
+
+#endif // FILE_SAVE_H
@@ -0,0 +1,560 @@
+#include "file_search.h"
+#include "walker.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+// One line of a .gitignore
+typedef struct {
+    std::string pattern;
+    bool negate;                        // "!pattern" re-includes
+    bool dir_only;                      // "pattern/" matches directories only
+    bool anchored;                      // Contains a '/', so matched against the path below the .gitignore
+} IgnoreRule;
+
+// The rules of one .gitignore, for everything below its directory
+typedef struct {
+    int depth;                          // Depth of that directory, 0 for the root
+    std::string base;                   // Its path below the root, "" for the root
+    std::vector<IgnoreRule> rules;
+} IgnoreLevel;
+
+typedef struct {
+    long line;
+    std::string text;
+    size_t match_start;
+    size_t match_len;
+} SearchHit;
+
+typedef struct {
+    std::string path;
+    bool done;
+    bool binary;
+    std::vector<SearchHit> hits;
+} SearchFile;
+
+typedef struct {
+    const TextPattern *pattern;
+    int flags;
+    int (*stop)(void);
+    void (*progress)(const SearchStats *stats, void *ctx);
+    SearchResult report;
+    void *ctx;
+    SearchStats stats;
+    unsigned long next_progress;
+    bool ended;                         // report() or stop() said so
+    size_t root_len;
+    std::vector<IgnoreLevel> ignore;
+    std::vector<char> buffer;           // For files searched on the calling thread
+
+    // Files handed to the pool; pending waits for a thread, order for reporting
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    std::deque<SearchFile *> pending;
+    std::deque<SearchFile *> order;
+    bool finished;                      // No more files coming
+    std::atomic<bool> stopping;
+    pthread_t threads[FILE_SEARCH_THREADS];
+    int thread_count;
+} Search;
+
+// path below the root, without the leading '/'
+static const char *below_root(const Search *s, const char *path) {
+    const char *rel = path + std::min(strlen(path), s->root_len);
+    return *rel == '/' ? rel + 1 : rel;
+}
+
+static void read_ignore(Search *s, const char *dir, int depth) {
+    std::string path = dir;
+    path += "/.gitignore";
+    FILE *file = fopen(path.c_str(), "r");
+    if (!file) {
+        return;
+    }
+
+    IgnoreLevel level;
+    level.depth = depth;
+    level.base = below_root(s, dir);
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        size_t len = strcspn(line, "\r\n");
+        while (len > 0 && (line[len - 1] == ' ' || line[len - 1] == '\t')) {
+            len--;
+        }
+        line[len] = '\0';
+        if (len == 0 || line[0] == '#') {
+            continue;
+        }
+
+        IgnoreRule rule;
+        const char *text = line;
+        rule.negate = text[0] == '!';
+        if (rule.negate) {
+            text++;
+        } else if (text[0] == '\\') {
+            text++;  // "\!name" and "\#name"
+        }
+        rule.pattern = text;
+        rule.dir_only = !rule.pattern.empty() && rule.pattern[rule.pattern.size() - 1] == '/';
+        if (rule.dir_only) {
+            rule.pattern.resize(rule.pattern.size() - 1);
+        }
+        if (rule.pattern.compare(0, 3, "**/") == 0 && rule.pattern.find('/', 3) == std::string::npos) {
+            rule.pattern.erase(0, 3);  // "**/name" is the same as "name"
+        }
+        rule.anchored = rule.pattern.find('/') != std::string::npos;
+        if (rule.anchored && rule.pattern[0] == '/') {
+            rule.pattern.erase(0, 1);
+        }
+        if (!rule.pattern.empty()) {
+            level.rules.push_back(rule);
+        }
+    }
+    fclose(file);
+
+    if (!level.rules.empty()) {
+        s->ignore.push_back(level);
+    }
+}
+
+// The last rule that matches decides, and deeper .gitignore files win
+static bool is_ignored(const Search *s, const char *path, const char *name, bool is_dir) {
+    if (strcmp(name, ".git") == 0) {
+        return true;
+    }
+    if (s->flags & FILE_SEARCH_NO_IGNORE) {
+        return false;
+    }
+
+    const char *rel = below_root(s, path);
+    for (size_t i = s->ignore.size(); i-- > 0;) {
+        const IgnoreLevel &level = s->ignore[i];
+        const char *below = rel;
+        if (!level.base.empty()) {
+            if (strncmp(rel, level.base.c_str(), level.base.size()) != 0 || rel[level.base.size()] != '/') {
+                continue;
+            }
+            below = rel + level.base.size() + 1;
+        }
+        for (size_t j = level.rules.size(); j-- > 0;) {
+            const IgnoreRule &rule = level.rules[j];
+            if (rule.dir_only && !is_dir) {
+                continue;
+            }
+            // fnmatch() has no "**", so let '*' cross '/' in those patterns
+            int fn_flags = rule.pattern.find("**") == std::string::npos ? FNM_PATHNAME : 0;
+            if (fnmatch(rule.pattern.c_str(), rule.anchored ? below : name, fn_flags) == 0) {
+                return !rule.negate;
+            }
+        }
+    }
+    return false;
+}
+
+typedef struct {
+    Search *search;
+    SearchFile *file;
+    long base;                          // Lines before the text being scanned
+} Collect;
+
+static long count_newlines(const char *text, size_t len) {
+    long count = 0;
+    const char *end = text + len;
+    while ((text = (const char *)memchr(text, '\n', end - text)) != NULL) {
+        count++;
+        text++;
+    }
+    return count;
+}
+
+static int collect_line(long line_no, const char *line, size_t line_len,
+                        size_t match_start, size_t match_len, void *ctx) {
+    Collect *collect = (Collect *)ctx;
+    long at = collect->base + line_no;
+    if (!collect->file->hits.empty() && collect->file->hits.back().line == at) {
+        return 0;  // A line longer than a chunk, matched again in its next piece
+    }
+
+    // Keep a window of a long line, with the match near its start
+    size_t from = 0;
+    if (line_len > FILE_SEARCH_LINE_MAX && match_start > FILE_SEARCH_LINE_MAX / 4) {
+        from = match_start - FILE_SEARCH_LINE_MAX / 4;
+    }
+    size_t kept = std::min(line_len - from, (size_t)FILE_SEARCH_LINE_MAX);
+
+    SearchHit hit;
+    hit.line = at;
+    hit.text.assign(line + from, kept);
+    hit.match_start = match_start - from;
+    hit.match_len = std::min(match_len, kept - std::min(kept, hit.match_start));
+    collect->file->hits.push_back(hit);
+
+    return (collect->search->flags & FILE_SEARCH_FILES_ONLY) || collect->search->stopping.load();
+}
+
+// Read the file a chunk at a time into buffer. A mapping would fault if
+// the file were truncated while it is searched (a log being rotated), and
+// the fault would take the shell down. A line cut by the end of a chunk is
+// carried over to the next one, unless it fills the chunk by itself; then
+// it is searched in pieces and a match across a cut is missed.
+static void search_file(Search *s, SearchFile *f, std::vector<char> *buffer) {
+    int fd = open(f->path.c_str(), O_RDONLY | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+
+    buffer->resize(FILE_SEARCH_CHUNK);
+    char *text = &(*buffer)[0];
+    Collect collect = {s, f, 0};
+    off_t offset = 0;  // Where text starts in the file
+    size_t held = 0;
+    while (true) {
+        // Fill the buffer, or read to the end of the file
+        bool end = false;
+        while (held < FILE_SEARCH_CHUNK) {
+            ssize_t got = pread(fd, text + held, FILE_SEARCH_CHUNK - held, offset + (off_t)held);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                end = true;  // Also if it was cut short under us
+                break;
+            }
+            held += (size_t)got;
+        }
+        if (held == 0) {
+            break;
+        }
+        if (offset == 0 && text_is_binary(text, held)) {
+            f->binary = true;
+            break;
+        }
+
+        size_t len = held;
+        if (!end) {
+            const char *newline = (const char *)memrchr(text, '\n', held);
+            if (newline) {
+                len = newline - text + 1;
+            }
+        }
+        text_pattern_scan(s->pattern, text, len, collect_line, &collect);
+        bool enough = (s->flags & FILE_SEARCH_FILES_ONLY) && !f->hits.empty();
+        if (end || enough || s->stopping.load()) {
+            break;
+        }
+
+        collect.base += count_newlines(text, len);
+        memmove(text, text + len, held - len);
+        held -= len;
+        offset += (off_t)len;
+    }
+    close(fd);
+}
+
+static void *search_thread(void *arg) {
+    Search *s = (Search *)arg;
+    std::vector<char> buffer;
+    pthread_mutex_lock(&s->lock);
+    while (true) {
+        while (s->pending.empty() && !s->finished && !s->stopping.load()) {
+            pthread_cond_wait(&s->work, &s->lock);
+        }
+        if (s->pending.empty() || s->stopping.load()) {
+            break;
+        }
+        SearchFile *f = s->pending.front();
+        s->pending.pop_front();
+        pthread_mutex_unlock(&s->lock);
+
+        search_file(s, f, &buffer);
+
+        pthread_mutex_lock(&s->lock);
+        f->done = true;
+        pthread_cond_broadcast(&s->done);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static void report_file(Search *s, SearchFile *f) {
+    s->stats.files++;
+    if (f->binary) {
+        s->stats.binary++;
+    }
+    for (size_t i = 0; i < f->hits.size() && !s->ended; i++) {
+        const SearchHit &hit = f->hits[i];
+        SearchMatch match;
+        match.path = f->path.c_str();
+        match.line = hit.line;
+        match.text = hit.text.data();
+        match.text_len = hit.text.size();
+        match.match_start = hit.match_start;
+        match.match_len = hit.match_len;
+        s->stats.matches++;
+        if (s->report(&match, s->ctx)) {
+            s->ended = true;
+        }
+    }
+    if (s->progress && s->stats.files >= s->next_progress) {
+        s->progress(&s->stats, s->ctx);
+        s->next_progress = s->stats.files + FILE_SEARCH_PROGRESS_EVERY;
+    }
+}
+
+// Report finished files from the front of the queue, in the order they were
+// found. With keep at or above zero, wait until no more than keep are left.
+static void report_ready(Search *s, long keep) {
+    pthread_mutex_lock(&s->lock);
+    while (!s->order.empty() && !s->ended) {
+        SearchFile *f = s->order.front();
+        if (!f->done) {
+            if (keep < 0 || (long)s->order.size() <= keep) {
+                break;
+            }
+            // Wake now and then to poll stop() while a big file is scanned
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += 100 * 1000000L;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&s->done, &s->lock, &until);
+            if (!f->done && s->stop) {
+                pthread_mutex_unlock(&s->lock);
+                if (s->stop()) {
+                    s->ended = true;
+                }
+                pthread_mutex_lock(&s->lock);
+            }
+            continue;
+        }
+        s->order.pop_front();
+        pthread_mutex_unlock(&s->lock);
+        report_file(s, f);
+        delete f;
+        pthread_mutex_lock(&s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+static int search_visit(const WalkItem *item, void *ctx) {
+    Search *s = (Search *)ctx;
+
+    if (item->event == WALK_LEAVE) {
+        while (!s->ignore.empty() && s->ignore.back().depth >= item->depth) {
+            s->ignore.pop_back();
+        }
+        return WALK_CONTINUE;
+    }
+    if (item->event == WALK_ERROR) {
+        return WALK_CONTINUE;  // Unreadable directories are left out
+    }
+
+    bool is_dir = fs_entry_is_dir(item->entry);
+    if (is_ignored(s, item->path, item->name, is_dir)) {
+        s->stats.ignored++;
+        return WALK_SKIP;
+    }
+    if (is_dir) {
+        if (!(s->flags & FILE_SEARCH_NO_IGNORE)) {
+            read_ignore(s, item->path, item->depth);
+        }
+        return WALK_CONTINUE;
+    }
+    if (item->entry->type != DT_REG) {
+        return WALK_CONTINUE;
+    }
+
+    SearchFile *f = new SearchFile();
+    f->path = item->path;
+    f->done = false;
+    f->binary = false;
+    if (s->thread_count == 0) {
+        search_file(s, f, &s->buffer);
+        f->done = true;
+    }
+    pthread_mutex_lock(&s->lock);
+    s->order.push_back(f);
+    if (s->thread_count > 0) {
+        s->pending.push_back(f);
+        pthread_cond_signal(&s->work);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    report_ready(s, (long)s->order.size() > FILE_SEARCH_QUEUE ? FILE_SEARCH_QUEUE / 2 : -1);
+    return s->ended ? WALK_STOP : WALK_CONTINUE;
+}
+
+static void search_init(Search *s, const char *root, const TextPattern *pattern, const SearchOptions *options,
+                        SearchResult report, void *ctx) {
+    s->pattern = pattern;
+    s->flags = options->flags;
+    s->stop = options->stop;
+    s->progress = options->progress;
+    s->report = report;
+    s->ctx = ctx;
+    memset(&s->stats, 0, sizeof(s->stats));
+    s->next_progress = FILE_SEARCH_PROGRESS_EVERY;
+    s->ended = false;
+    s->root_len = strlen(root);
+    while (s->root_len > 1 && root[s->root_len - 1] == '/') {
+        s->root_len--;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->work, NULL);
+    pthread_cond_init(&s->done, NULL);
+    s->finished = false;
+    s->stopping.store(false);
+    s->thread_count = 0;
+    if (!(s->flags & FILE_SEARCH_NO_IGNORE)) {
+        read_ignore(s, root, 0);
+    }
+}
+
+static void search_destroy(Search *s, SearchStats *stats) {
+    for (size_t i = 0; i < s->order.size(); i++) {
+        delete s->order[i];
+    }
+    pthread_cond_destroy(&s->done);
+    pthread_cond_destroy(&s->work);
+    pthread_mutex_destroy(&s->lock);
+    if (stats) {
+        *stats = s->stats;
+    }
+}
+
+static int walk_flags(int flags) {
+    return (flags & FILE_SEARCH_HIDDEN) ? WALK_HIDDEN : 0;
+}
+
+int file_search(const char *root, const TextPattern *pattern, const SearchOptions *options,
+                SearchResult report, void *ctx, SearchStats *stats) {
+    Search *s = new Search();
+    search_init(s, root, pattern, options, report, ctx);
+
+    // A single file is searched as it is
+    struct stat st;
+    if (stat(root, &st) == 0 && !S_ISDIR(st.st_mode)) {
+        SearchFile f;
+        f.path = root;
+        f.binary = false;
+        search_file(s, &f, &s->buffer);
+        report_file(s, &f);
+        int result = s->ended ? 1 : 0;
+        search_destroy(s, stats);
+        delete s;
+        return result;
+    }
+
+    // On one core the hand-off costs more than it gains; search inline
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus > 1 ? (int)std::min(cpus, (long)FILE_SEARCH_THREADS) : 0;
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&s->threads[s->thread_count], NULL, search_thread, s) == 0) {
+            s->thread_count++;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    WalkOptions walk = {walk_flags(s->flags), 0, s->stop, NULL};
+    int result = walk_tree(root, &walk, search_visit, s);
+    int saved_errno = errno;
+
+    pthread_mutex_lock(&s->lock);
+    s->finished = true;
+    pthread_cond_broadcast(&s->work);
+    pthread_mutex_unlock(&s->lock);
+    if (result == 0) {
+        report_ready(s, 0);
+    }
+
+    pthread_mutex_lock(&s->lock);
+    s->stopping.store(true);
+    pthread_cond_broadcast(&s->work);
+    pthread_mutex_unlock(&s->lock);
+    for (int i = 0; i < s->thread_count; i++) {
+        pthread_join(s->threads[i], NULL);
+    }
+    if (result == 0 && s->ended) {
+        result = 1;
+    }
+    search_destroy(s, stats);
+    delete s;
+    errno = saved_errno;
+    return result;
+}
+
+static int find_visit(const WalkItem *item, void *ctx) {
+    Search *s = (Search *)ctx;
+
+    if (item->event == WALK_LEAVE) {
+        while (!s->ignore.empty() && s->ignore.back().depth >= item->depth) {
+            s->ignore.pop_back();
+        }
+        return WALK_CONTINUE;
+    }
+    if (item->event == WALK_ERROR) {
+        return WALK_CONTINUE;
+    }
+
+    bool is_dir = fs_entry_is_dir(item->entry);
+    if (is_ignored(s, item->path, item->name, is_dir)) {
+        s->stats.ignored++;
+        return WALK_SKIP;
+    }
+    if (is_dir && !(s->flags & FILE_SEARCH_NO_IGNORE)) {
+        read_ignore(s, item->path, item->depth);
+    }
+
+    s->stats.files++;
+    size_t match_start, match_len;
+    size_t name_len = strlen(item->name);
+    if (text_pattern_match(s->pattern, item->name, name_len, &match_start, &match_len)) {
+        SearchMatch match = {item->path, 0, item->name, name_len, match_start, match_len};
+        s->stats.matches++;
+        if (s->report(&match, s->ctx)) {
+            s->ended = true;
+            return WALK_STOP;
+        }
+    }
+    if (s->progress && s->stats.files >= s->next_progress) {
+        s->progress(&s->stats, s->ctx);
+        s->next_progress = s->stats.files + FILE_SEARCH_PROGRESS_EVERY;
+    }
+    return WALK_CONTINUE;
+}
+
+int file_find(const char *root, const TextPattern *pattern, const SearchOptions *options,
+              SearchResult report, void *ctx, SearchStats *stats) {
+    Search *s = new Search();
+    search_init(s, root, pattern, options, report, ctx);
+    WalkOptions walk = {walk_flags(s->flags), 0, s->stop, NULL};
+    int result = walk_tree(root, &walk, find_visit, s);
+    int saved_errno = errno;
+    search_destroy(s, stats);
+    delete s;
+    errno = saved_errno;
+    return result;
+}
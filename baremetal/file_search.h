@@ -0,0 +1,60 @@
+#ifndef FILE_SEARCH_H
+#define FILE_SEARCH_H
+
+// File search for MINUX
+// Searches the files below a directory on the walker: the visitor queues
+// regular files and a small pool reads and scans them in parallel, while
+// matches are still reported in walk order on the calling thread. Binary
+// files (a NUL near the start) are skipped, and so is anything a
+// .gitignore on the way down excludes.
+
+#include "text_search.h"
+
+// File search settings
+#define FILE_SEARCH_THREADS 4           // Threads scanning files, at most one per CPU
+#define FILE_SEARCH_QUEUE 1024          // Files queued but not yet reported (bounds memory)
+#define FILE_SEARCH_CHUNK (1 << 20)     // Bytes of a file read at a time, cut at a line end
+#define FILE_SEARCH_LINE_MAX 256        // Bytes kept of a long matching line, around the match
+#define FILE_SEARCH_PROGRESS_EVERY 256  // Files between progress callbacks
+
+// Flags for SearchOptions
+#define FILE_SEARCH_HIDDEN 0x1          // Include names starting with '.' (.git is always skipped)
+#define FILE_SEARCH_NO_IGNORE 0x2       // Don't read .gitignore files
+#define FILE_SEARCH_FILES_ONLY 0x4      // Report only the first match in each file
+
+typedef struct {
+    const char *path;                   // Root path as given, then "/name" per level
+    long line;                          // From 1, or 0 for a name match
+    const char *text;                   // The matching line (maybe cut down) or name
+    size_t text_len;
+    size_t match_start;                 // The first match within text
+    size_t match_len;
+} SearchMatch;
+
+typedef struct {
+    unsigned long files;                // Files searched, or entries seen by file_find()
+    unsigned long binary;               // ...of those, skipped as binary
+    unsigned long ignored;              // Entries left out by .gitignore rules
+    unsigned long matches;              // Lines (or names) reported
+} SearchStats;
+
+// Return nonzero to end the search
+typedef int (*SearchResult)(const SearchMatch *match, void *ctx);
+
+typedef struct {
+    int flags;                          // FILE_SEARCH_* flags
+    int (*stop)(void);                  // Polled on the calling thread, may be NULL
+    void (*progress)(const SearchStats *stats, void *ctx);  // May be NULL
+} SearchOptions;
+
+// Report every matching line of the files below root. Returns 0 when done,
+// 1 if report() or stop() ended the search, or -1 with errno set if root
+// can't be read. stats may be NULL.
+int file_search(const char *root, const TextPattern *pattern, const SearchOptions *options,
+                SearchResult report, void *ctx, SearchStats *stats);
+
+// Report every file and directory below root whose name matches pattern
+int file_find(const char *root, const TextPattern *pattern, const SearchOptions *options,
+              SearchResult report, void *ctx, SearchStats *stats);
+
+#endif // FILE_SEARCH_H
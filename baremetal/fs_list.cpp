@@ -0,0 +1,222 @@
+#include "fs_list.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#ifdef __linux__
+// Record layout returned by getdents64
+struct linux_dirent64 {
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+static bool grow(void **buf, size_t *cap, size_t needed, size_t item, size_t initial) {
+    if (needed <= *cap) {
+        return true;
+    }
+    size_t new_cap = *cap ? *cap : initial;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    void *grown = realloc(*buf, new_cap * item);
+    if (!grown) {
+        return false;
+    }
+    *buf = grown;
+    *cap = new_cap;
+    return true;
+}
+
+static unsigned char type_from_mode(mode_t mode) {
+    if (S_ISDIR(mode)) return DT_DIR;
+    if (S_ISLNK(mode)) return DT_LNK;
+    if (S_ISREG(mode)) return DT_REG;
+    if (S_ISCHR(mode)) return DT_CHR;
+    if (S_ISBLK(mode)) return DT_BLK;
+    if (S_ISFIFO(mode)) return DT_FIFO;
+    if (S_ISSOCK(mode)) return DT_SOCK;
+    return DT_UNKNOWN;
+}
+
+// Add one directory entry, statting it if the caller wants the metadata or
+// the filesystem didn't report a type. Returns false only when out of memory.
+static bool add_entry(FsListing *list, int dir_fd, const char *name, unsigned char type, int flags) {
+    if (name[0] == '.') {
+        bool dots = name[1] == '\0' || (name[1] == '.' && name[2] == '\0');
+        if (dots ? !(flags & FS_LIST_DOTS) : !(flags & FS_LIST_HIDDEN)) {
+            return true;
+        }
+    }
+
+    FsEntry entry;
+    entry.type = type;
+    entry.has_stat = 0;
+    bool follow = (flags & FS_LIST_FOLLOW) && (type == DT_LNK || type == DT_UNKNOWN);
+    if ((flags & FS_LIST_STAT) || type == DT_UNKNOWN || follow) {
+        if ((follow && fstatat(dir_fd, name, &entry.st, 0) == 0) ||
+            fstatat(dir_fd, name, &entry.st, AT_SYMLINK_NOFOLLOW) == 0) {
+            entry.has_stat = 1;
+            entry.type = type_from_mode(entry.st.st_mode);
+        } else if (flags & FS_LIST_STAT) {
+            return true;  // Removed since the directory was read
+        }
+    }
+
+    // Name and folded key go into the shared buffer
+    size_t len = strlen(name);
+    if (!grow((void **)&list->names, &list->names_cap, list->names_len + 2 * (len + 1), 1, 4096) ||
+        !grow((void **)&list->entries, &list->cap, list->count + 1, sizeof(FsEntry), 64)) {
+        return false;
+    }
+    entry.name = list->names_len;
+    memcpy(list->names + entry.name, name, len + 1);
+    entry.key = entry.name + len + 1;
+    for (size_t i = 0; i <= len; i++) {
+        list->names[entry.key + i] = (char)tolower((unsigned char)name[i]);
+    }
+    list->names_len += 2 * (len + 1);
+
+    list->entries[list->count++] = entry;
+    return true;
+}
+
+int fs_list_read(const char *path, int flags, FsListing *list) {
+    memset(list, 0, sizeof(*list));
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    int result = fs_list_read_fd(fd, flags, list);
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return result;
+}
+
+int fs_list_read_fd(int fd, int flags, FsListing *list) {
+    memset(list, 0, sizeof(*list));
+
+#ifdef __linux__
+    char *buf = (char *)malloc(FS_LIST_BUFFER);
+    if (!buf) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buf, FS_LIST_BUFFER)) > 0) {
+        for (long pos = 0; pos < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + pos);
+            if (!add_entry(list, fd, d->d_name, d->d_type, flags)) {
+                n = -1;
+                errno = ENOMEM;
+                break;
+            }
+            pos += d->d_reclen;
+        }
+        if (n < 0) {
+            break;
+        }
+    }
+    int saved = errno;
+    free(buf);
+    if (n < 0) {
+        fs_list_free(list);
+        errno = saved;
+        return -1;
+    }
+#else
+    // Portable path - fdopendir() takes over the descriptor, so give it a
+    // copy. Names are copied out, so readdir's buffer reuse is harmless.
+    int own = dup(fd);
+    DIR *dir = own >= 0 ? fdopendir(own) : NULL;
+    if (!dir) {
+        int saved = errno;
+        if (own >= 0) {
+            close(own);
+        }
+        errno = saved;
+        return -1;
+    }
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) {
+        if (!add_entry(list, fd, d->d_name, d->d_type, flags)) {
+            closedir(dir);
+            fs_list_free(list);
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    closedir(dir);
+#endif
+    return 0;
+}
+
+int fs_list_add(FsListing *list, int dir_fd, const char *name, unsigned char type, int flags) {
+    if (!add_entry(list, dir_fd, name, type, flags)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+void fs_list_free(FsListing *list) {
+    free(list->entries);
+    free(list->names);
+    free(list->order);
+    memset(list, 0, sizeof(*list));
+}
+
+void fs_list_sort(FsListing *list) {
+    free(list->order);
+    list->order = (size_t *)malloc((list->count ? list->count : 1) * sizeof(size_t));
+    if (!list->order) {
+        return;  // Stays in read order
+    }
+    for (size_t i = 0; i < list->count; i++) {
+        list->order[i] = i;
+    }
+
+    const FsEntry *entries = list->entries;
+    const char *names = list->names;
+    std::sort(list->order, list->order + list->count, [entries, names](size_t a, size_t b) {
+        bool a_dir = fs_entry_is_dir(&entries[a]);
+        bool b_dir = fs_entry_is_dir(&entries[b]);
+        if (a_dir != b_dir) {
+            return a_dir;
+        }
+        int c = strcmp(names + entries[a].key, names + entries[b].key);
+        if (c != 0) {
+            return c < 0;
+        }
+        return strcmp(names + entries[a].name, names + entries[b].name) < 0;
+    });
+}
+
+const FsEntry *fs_list_at(const FsListing *list, size_t i) {
+    if (i >= list->count) {
+        return NULL;
+    }
+    return &list->entries[list->order ? list->order[i] : i];
+}
+
+const char *fs_entry_name(const FsListing *list, const FsEntry *entry) {
+    return list->names + entry->name;
+}
+
+int fs_entry_is_dir(const FsEntry *entry) {
+    return entry->type == DT_DIR;
+}
@@ -0,0 +1,60 @@
+#ifndef FS_LIST_H
+#define FS_LIST_H
+
+// Directory listing engine for MINUX
+// Reads a whole directory with getdents64 into one growable buffer, takes
+// file types from d_type and stats each entry at most once (relative to
+// the directory descriptor). Sorting uses a case-folded key computed once
+// per entry, so listing n entries costs n syscalls and O(n log n) compares.
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Listing settings
+#define FS_LIST_BUFFER (64 * 1024)      // Bytes of directory entries per getdents64 call
+
+// Flags for fs_list_read()
+#define FS_LIST_STAT 0x1                // Fill in st for every entry (entries that vanish are dropped)
+#define FS_LIST_HIDDEN 0x2              // Include names starting with '.'
+#define FS_LIST_DOTS 0x4                // Include "." and ".."
+#define FS_LIST_FOLLOW 0x8              // Describe what symlinks point to (dangling links stay links)
+
+typedef struct {
+    size_t name;                // Offset of the name in FsListing.names
+    size_t key;                 // Offset of the case-folded sort key
+    unsigned char type;         // DT_* value, resolved with a stat when the filesystem doesn't say
+    int has_stat;
+    struct stat st;
+} FsEntry;
+
+typedef struct {
+    FsEntry *entries;
+    size_t count;
+    size_t cap;
+    char *names;                // Name and key strings, NUL-terminated
+    size_t names_len;
+    size_t names_cap;
+    size_t *order;              // Display order after fs_list_sort(), NULL before
+} FsListing;
+
+// Read the directory at path. Returns 0, or -1 with errno set.
+int fs_list_read(const char *path, int flags, FsListing *list);
+// Same, from a directory descriptor the caller keeps open (and may use
+// with openat() for the entries afterwards)
+int fs_list_read_fd(int fd, int flags, FsListing *list);
+void fs_list_free(FsListing *list);
+
+// Add one entry by name, statting it relative to dir_fd as flags ask
+// (for building a listing from names already known). Returns 0, or -1
+// when out of memory; entries that vanished are skipped.
+int fs_list_add(FsListing *list, int dir_fd, const char *name, unsigned char type, int flags);
+
+// Directories first, then case-insensitive by name
+void fs_list_sort(FsListing *list);
+
+// Entry i in display order (read order if the listing isn't sorted)
+const FsEntry *fs_list_at(const FsListing *list, size_t i);
+const char *fs_entry_name(const FsListing *list, const FsEntry *entry);
+int fs_entry_is_dir(const FsEntry *entry);
+
+#endif // FS_LIST_H
@@ -0,0 +1,203 @@
+#include "fs_watch.h"
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#ifdef __linux__
+#define FS_WATCH_DIR_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB | \
+                           IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define FS_WATCH_FILE_MASK (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+#endif
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void add_event(FsWatch *watch, int wd, int what, const char *name) {
+    // A file being written reports the same change over and over
+    if (!watch->events.empty()) {
+        const FsWatchEvent &last = watch->events.back();
+        if (last.wd == wd && last.what == what && last.name == name) {
+            return;
+        }
+    }
+    if (watch->events.size() >= FS_WATCH_EVENTS_MAX) {
+        watch->overflow = true;
+        return;
+    }
+    FsWatchEvent event;
+    event.wd = wd;
+    event.what = what;
+    event.name = name;
+    watch->events.push_back(event);
+}
+
+int fs_watch_init(FsWatch *watch) {
+    watch->events.clear();
+    watch->overflow = false;
+    watch->refs.clear();
+#ifdef __linux__
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+    watch->fd = -1;
+#endif
+    return watch->fd >= 0 ? 0 : -1;
+}
+
+void fs_watch_close(FsWatch *watch) {
+    if (watch->fd >= 0) {
+        close(watch->fd);  // Drops every watch with it
+    }
+    watch->fd = -1;
+    watch->refs.clear();
+    fs_watch_clear(watch);
+}
+
+int fs_watch_add(FsWatch *watch, const char *path, int kind) {
+#ifdef __linux__
+    if (watch->fd >= 0) {
+        // IN_MASK_ADD keeps what an earlier add of the same path asked for
+        uint32_t mask = kind == FS_WATCH_DIR ? FS_WATCH_DIR_MASK : FS_WATCH_FILE_MASK;
+        int wd = inotify_add_watch(watch->fd, path, mask | IN_MASK_ADD);
+        if (wd >= 0) {
+            watch->refs[wd]++;
+        }
+        return wd;
+    }
+#else
+    (void)path;
+    (void)kind;
+#endif
+    return -1;
+}
+
+void fs_watch_remove(FsWatch *watch, int wd) {
+#ifdef __linux__
+    std::map<int, int>::iterator ref = watch->refs.find(wd);
+    if (watch->fd < 0 || ref == watch->refs.end() || --ref->second > 0) {
+        return;
+    }
+    watch->refs.erase(ref);
+    inotify_rm_watch(watch->fd, wd);
+#else
+    (void)watch;
+    (void)wd;
+#endif
+}
+
+bool fs_watch_read(FsWatch *watch) {
+    bool any = false;
+#ifdef __linux__
+    if (watch->fd < 0) {
+        return false;
+    }
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(watch->fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            const char *name = ev->len ? ev->name : "";
+            if (ev->mask & IN_Q_OVERFLOW) {
+                watch->overflow = true;
+            } else if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED | IN_UNMOUNT)) {
+                if (ev->mask & IN_IGNORED) {
+                    watch->refs.erase(ev->wd);  // The kernel dropped it; removes are no-ops now
+                }
+                add_event(watch, ev->wd, FS_EVENT_GONE, "");
+            } else if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                add_event(watch, ev->wd, FS_EVENT_ADDED, name);
+            } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                add_event(watch, ev->wd, FS_EVENT_REMOVED, name);
+            } else {
+                add_event(watch, ev->wd, FS_EVENT_CHANGED, name);
+            }
+            any = true;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+#else
+    (void)watch;
+#endif
+    return any;
+}
+
+int fs_watch_wait(FsWatch *watch, int input_fd) {
+    // Events collected earlier start the burst now
+    long long burst_start = (!watch->events.empty() || watch->overflow) ? now_ms() : -1;
+
+    while (1) {
+        int timeout = -1;
+        if (watch->fd < 0) {
+            timeout = FS_WATCH_POLL_MS;
+        } else if (burst_start >= 0) {
+            long long left = burst_start + FS_WATCH_BURST_MAX_MS - now_ms();
+            timeout = left < FS_WATCH_DEBOUNCE_MS ? (int)(left > 0 ? left : 0) : FS_WATCH_DEBOUNCE_MS;
+        }
+
+        struct pollfd fds[2];
+        fds[0].fd = input_fd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = watch->fd;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        int ready = poll(fds, watch->fd >= 0 ? 2 : 1, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                return FS_WAIT_INPUT;  // A resize, say - let the caller look
+            }
+            return watch->fd >= 0 ? FS_WAIT_EVENTS : FS_WAIT_POLL;
+        }
+        if (fds[0].revents & POLLIN) {
+            return FS_WAIT_INPUT;
+        }
+        if (fds[0].revents) {
+            return FS_WAIT_ERROR;  // Nothing will ever be read from it
+        }
+        if (watch->fd < 0) {
+            return FS_WAIT_POLL;
+        }
+        if (!(fds[1].revents & POLLIN) && (fds[1].revents & (POLLERR | POLLHUP | POLLNVAL))) {
+            close(watch->fd);
+            watch->fd = -1;
+            watch->refs.clear();
+            watch->overflow = true;
+            return FS_WAIT_ERROR;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            if (fs_watch_read(watch) && burst_start < 0) {
+                burst_start = now_ms();
+            }
+            if (burst_start >= 0 && now_ms() - burst_start >= FS_WATCH_BURST_MAX_MS) {
+                return FS_WAIT_EVENTS;
+            }
+        } else if (ready == 0 && burst_start >= 0) {
+            return FS_WAIT_EVENTS;  // Quiet for FS_WATCH_DEBOUNCE_MS
+        }
+    }
+}
+
+void fs_watch_clear(FsWatch *watch) {
+    watch->events.clear();
+    watch->overflow = false;
+}
+
+bool fs_watch_touched(const FsWatch *watch, int wd) {
+    if (watch->overflow) {
+        return true;
+    }
+    for (size_t i = 0; i < watch->events.size(); i++) {
+        if (watch->events[i].wd == wd) {
+            return true;
+        }
+    }
+    return false;
+}
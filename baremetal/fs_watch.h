@@ -0,0 +1,77 @@
+#ifndef FS_WATCH_H
+#define FS_WATCH_H
+
+// File system watcher for MINUX
+// One inotify descriptor for any number of watched directories and files.
+// Events are collected with their names and coalesced, and fs_watch_wait()
+// polls them together with keyboard input, reporting a burst of changes
+// only once it has settled. Without inotify, callers are woken every
+// FS_WATCH_POLL_MS to check by stat instead.
+
+#include <map>
+#include <string>
+#include <vector>
+
+// File system watcher settings
+#define FS_WATCH_DEBOUNCE_MS 40         // Quiet time that ends a burst of events
+#define FS_WATCH_BURST_MAX_MS 250       // A burst that never settles is still reported this often
+#define FS_WATCH_POLL_MS 1000           // Wake-up interval without inotify
+#define FS_WATCH_EVENTS_MAX 4096        // Events kept before the rest are dropped as an overflow
+
+// What fs_watch_add() watches
+#define FS_WATCH_DIR 1                  // Entries added, removed or changed in a directory
+#define FS_WATCH_FILE 2                 // A file's contents or attributes
+
+// FsWatchEvent.what
+#define FS_EVENT_ADDED 1                // name was created or moved in
+#define FS_EVENT_REMOVED 2              // name was deleted or moved out
+#define FS_EVENT_CHANGED 3              // name (or a watched file itself) was written to
+#define FS_EVENT_GONE 4                 // The watched path itself was deleted or moved
+
+// fs_watch_wait() results
+#define FS_WAIT_INPUT 1                 // input_fd is readable
+#define FS_WAIT_EVENTS 2                // Events (or an overflow) were collected
+#define FS_WAIT_POLL 3                  // No inotify - time to check by stat
+#define FS_WAIT_ERROR 4                 // input_fd or inotify failed or hung up (see fs_watch_wait())
+
+typedef struct {
+    int wd;                             // As returned by fs_watch_add()
+    int what;                           // FS_EVENT_*
+    std::string name;                   // Entry in a watched directory, empty for the path itself
+} FsWatchEvent;
+
+typedef struct {
+    int fd;                             // inotify descriptor, -1 without inotify
+    std::vector<FsWatchEvent> events;   // Collected since fs_watch_clear()
+    bool overflow;                      // Events were lost - everything watched may have changed
+    std::map<int, int> refs;            // Callers holding each watch descriptor
+} FsWatch;
+
+// Returns 0, or -1 when inotify isn't available (the watch still works,
+// waking callers to poll)
+int fs_watch_init(FsWatch *watch);
+void fs_watch_close(FsWatch *watch);
+
+// Start watching path (FS_WATCH_DIR or FS_WATCH_FILE). Returns the watch
+// descriptor, or -1. inotify has one descriptor per path, so adding a path
+// again returns the same one, watching for what both adds asked for, and
+// it is only dropped once every add has been matched by a remove.
+int fs_watch_add(FsWatch *watch, const char *path, int kind);
+void fs_watch_remove(FsWatch *watch, int wd);
+
+// Collect whatever is queued without blocking. Returns true if anything was.
+bool fs_watch_read(FsWatch *watch);
+
+// Block until input_fd is readable or collected events have settled.
+// Returns FS_WAIT_ERROR rather than spinning when either descriptor
+// reports an error or hang-up; an inotify descriptor that does is closed,
+// with an overflow so callers check everything, and later waits poll.
+int fs_watch_wait(FsWatch *watch, int input_fd);
+
+// Forget collected events once they have been applied
+void fs_watch_clear(FsWatch *watch);
+
+// True if an event for wd (or an overflow) was collected
+bool fs_watch_touched(const FsWatch *watch, int wd);
+
+#endif // FS_WATCH_H
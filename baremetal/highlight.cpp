@@ -0,0 +1,471 @@
+#include "highlight.h"
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+
+// Lexer states carried from one line to the next
+#define STATE_NORMAL 0
+#define STATE_C_COMMENT 1               // Inside /* */
+#define STATE_PY_SINGLE 2               // Inside '''
+#define STATE_PY_DOUBLE 3               // Inside """
+#define STATE_UNKNOWN 255               // Not lexed yet
+
+// Sorted, for bsearch
+static const char *const c_keywords[] = {
+    "NULL", "alignas", "alignof", "and", "asm", "auto", "bool", "break", "case", "catch",
+    "char", "class", "const", "const_cast", "constexpr", "continue", "decltype", "default",
+    "delete", "do", "double", "dynamic_cast", "else", "enum", "explicit", "extern", "false",
+    "float", "for", "friend", "goto", "if", "inline", "int", "int16_t", "int32_t", "int64_t",
+    "int8_t", "long", "mutable", "namespace", "new", "noexcept", "not", "nullptr", "operator",
+    "or", "override", "private", "protected", "public", "register", "reinterpret_cast",
+    "return", "short", "signed", "size_t", "sizeof", "ssize_t", "static", "static_assert",
+    "static_cast", "struct", "switch", "template", "this", "throw", "true", "try", "typedef",
+    "typeid", "typename", "uint16_t", "uint32_t", "uint64_t", "uint8_t", "union", "unsigned",
+    "using", "virtual", "void", "volatile", "while",
+};
+
+static const char *const arduino_keywords[] = {
+    "A0", "A1", "A2", "A3", "A4", "A5", "HIGH", "INPUT", "INPUT_PULLUP", "LED_BUILTIN", "LOW",
+    "OUTPUT", "Serial", "String", "Wire", "analogRead", "analogWrite", "boolean", "byte",
+    "delay", "delayMicroseconds", "digitalRead", "digitalWrite", "loop", "micros", "millis",
+    "pinMode", "setup", "word",
+};
+
+static const char *const python_keywords[] = {
+    "False", "None", "True", "and", "as", "assert", "async", "await", "break", "class",
+    "continue", "def", "del", "elif", "else", "except", "finally", "for", "from", "global",
+    "if", "import", "in", "is", "lambda", "nonlocal", "not", "or", "pass", "raise", "return",
+    "self", "try", "while", "with", "yield",
+};
+
+typedef struct {
+    const char *text;
+    size_t len;
+} Word;
+
+static int word_compare(const void *key, const void *entry) {
+    const Word *word = (const Word *)key;
+    const char *keyword = *(const char *const *)entry;
+    int c = strncmp(word->text, keyword, word->len);
+    if (c != 0) {
+        return c;
+    }
+    return keyword[word->len] == '\0' ? 0 : -1;
+}
+
+static bool is_keyword(const char *const *table, size_t count, const char *text, size_t len) {
+    Word word = {text, len};
+    return bsearch(&word, table, count, sizeof(table[0]), word_compare) != NULL;
+}
+
+#define TABLE(t) t, sizeof(t) / sizeof(t[0])
+
+static void add_run(std::vector<HighlightRun> *runs, size_t start, size_t end, unsigned char kind) {
+    if (!runs || end <= start) {
+        return;
+    }
+    if (!runs->empty() && runs->back().kind == kind && runs->back().start + runs->back().len == start) {
+        runs->back().len += (uint32_t)(end - start);
+        return;
+    }
+    HighlightRun run;
+    run.start = (uint32_t)start;
+    run.len = (uint32_t)(end - start);
+    run.kind = kind;
+    runs->push_back(run);
+}
+
+static bool is_word_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+// End of a quoted string starting at i, past the closing quote (or the
+// end of the line)
+static size_t string_end(const char *text, size_t len, size_t i) {
+    char quote = text[i++];
+    while (i < len && text[i] != quote) {
+        i += text[i] == '\\' ? 2 : 1;
+    }
+    return i < len ? i + 1 : len;
+}
+
+// End of a number starting at start
+static size_t number_end(const char *text, size_t len, size_t start) {
+    bool hex = start + 1 < len && text[start] == '0' && (text[start + 1] == 'x' || text[start + 1] == 'X');
+    size_t i = start;
+    while (i < len) {
+        char c = text[i];
+        if (is_word_char(c) || c == '.') {
+            i++;
+        } else if ((c == '+' || c == '-') && !hex && (text[i - 1] == 'e' || text[i - 1] == 'E')) {
+            i++;
+        } else {
+            break;
+        }
+    }
+    return i;
+}
+
+// Where "*/" ends after from, or 0 if it doesn't on this line
+static size_t comment_end(const char *text, size_t len, size_t from) {
+    for (size_t i = from; i + 1 < len; i++) {
+        if (text[i] == '*' && text[i + 1] == '/') {
+            return i + 2;
+        }
+    }
+    return 0;
+}
+
+static unsigned char lex_c(const char *text, size_t len, unsigned char state, bool arduino,
+                           std::vector<HighlightRun> *runs) {
+    size_t i = 0;
+    if (state == STATE_C_COMMENT) {
+        size_t end = comment_end(text, len, 0);
+        if (end == 0) {
+            add_run(runs, 0, len, HIGHLIGHT_COMMENT);
+            return STATE_C_COMMENT;
+        }
+        add_run(runs, 0, end, HIGHLIGHT_COMMENT);
+        i = end;
+    }
+
+    // A directive: the # and its name, and <file> after #include
+    bool include = false;
+    size_t first = i;
+    while (first < len && (text[first] == ' ' || text[first] == '\t')) {
+        first++;
+    }
+    if (first < len && text[first] == '#') {
+        size_t name = first + 1;
+        while (name < len && (text[name] == ' ' || text[name] == '\t')) {
+            name++;
+        }
+        size_t end = name;
+        while (end < len && is_word_char(text[end])) {
+            end++;
+        }
+        include = end - name == 7 && strncmp(text + name, "include", 7) == 0;
+        add_run(runs, first, end, HIGHLIGHT_PREPROC);
+        i = end;
+    }
+
+    while (i < len) {
+        char c = text[i];
+        if (c == '/' && i + 1 < len && text[i + 1] == '/') {
+            add_run(runs, i, len, HIGHLIGHT_COMMENT);
+            break;
+        }
+        if (c == '/' && i + 1 < len && text[i + 1] == '*') {
+            size_t end = comment_end(text, len, i + 2);
+            if (end == 0) {
+                add_run(runs, i, len, HIGHLIGHT_COMMENT);
+                return STATE_C_COMMENT;
+            }
+            add_run(runs, i, end, HIGHLIGHT_COMMENT);
+            i = end;
+        } else if (c == '"' || c == '\'' || (include && c == '<')) {
+            size_t end;
+            if (c == '<') {
+                const char *close = (const char *)memchr(text + i, '>', len - i);
+                end = close ? close - text + 1 : len;
+            } else {
+                end = string_end(text, len, i);
+            }
+            add_run(runs, i, end, HIGHLIGHT_STRING);
+            i = end;
+        } else if (isdigit((unsigned char)c) || (c == '.' && i + 1 < len && isdigit((unsigned char)text[i + 1]))) {
+            size_t end = number_end(text, len, i);
+            add_run(runs, i, end, HIGHLIGHT_NUMBER);
+            i = end;
+        } else if (is_word_char(c)) {
+            size_t end = i;
+            while (end < len && is_word_char(text[end])) {
+                end++;
+            }
+            if (is_keyword(TABLE(c_keywords), text + i, end - i) ||
+                (arduino && is_keyword(TABLE(arduino_keywords), text + i, end - i))) {
+                add_run(runs, i, end, HIGHLIGHT_KEYWORD);
+            }
+            i = end;
+        } else {
+            i++;
+        }
+    }
+    return STATE_NORMAL;
+}
+
+// Where a triple-quoted string closed by quote ends after from, or 0
+static size_t triple_end(const char *text, size_t len, size_t from, char quote) {
+    for (size_t i = from; i < len; i++) {
+        if (text[i] == '\\') {
+            i++;
+        } else if (text[i] == quote && i + 2 < len && text[i + 1] == quote && text[i + 2] == quote) {
+            return i + 3;
+        }
+    }
+    return 0;
+}
+
+static unsigned char lex_python(const char *text, size_t len, unsigned char state,
+                                std::vector<HighlightRun> *runs) {
+    size_t i = 0;
+    if (state == STATE_PY_SINGLE || state == STATE_PY_DOUBLE) {
+        size_t end = triple_end(text, len, 0, state == STATE_PY_SINGLE ? '\'' : '"');
+        if (end == 0) {
+            add_run(runs, 0, len, HIGHLIGHT_STRING);
+            return state;
+        }
+        add_run(runs, 0, end, HIGHLIGHT_STRING);
+        i = end;
+    }
+
+    // A decorator
+    size_t first = i;
+    while (first < len && (text[first] == ' ' || text[first] == '\t')) {
+        first++;
+    }
+    if (first < len && text[first] == '@') {
+        size_t end = first + 1;
+        while (end < len && (is_word_char(text[end]) || text[end] == '.')) {
+            end++;
+        }
+        add_run(runs, first, end, HIGHLIGHT_PREPROC);
+        i = end;
+    }
+
+    while (i < len) {
+        char c = text[i];
+        size_t start = i;
+
+        // String prefixes (r, b, f, u and pairs of them) belong to the string
+        if (is_word_char(c) && !isdigit((unsigned char)c)) {
+            size_t end = i;
+            while (end < len && is_word_char(text[end])) {
+                end++;
+            }
+            bool prefix = end - i <= 2 && end < len && (text[end] == '"' || text[end] == '\'') &&
+                          strspn(text + i, "rRbBfFuU") >= end - i;
+            if (!prefix) {
+                if (is_keyword(TABLE(python_keywords), text + i, end - i)) {
+                    add_run(runs, i, end, HIGHLIGHT_KEYWORD);
+                }
+                i = end;
+                continue;
+            }
+            i = end;
+            c = text[i];
+        }
+
+        if (c == '#') {
+            add_run(runs, i, len, HIGHLIGHT_COMMENT);
+            break;
+        }
+        if (c == '"' || c == '\'') {
+            if (i + 2 < len && text[i + 1] == c && text[i + 2] == c) {
+                size_t end = triple_end(text, len, i + 3, c);
+                if (end == 0) {
+                    add_run(runs, start, len, HIGHLIGHT_STRING);
+                    return c == '\'' ? STATE_PY_SINGLE : STATE_PY_DOUBLE;
+                }
+                add_run(runs, start, end, HIGHLIGHT_STRING);
+                i = end;
+            } else {
+                size_t end = string_end(text, len, i);
+                add_run(runs, start, end, HIGHLIGHT_STRING);
+                i = end;
+            }
+        } else if (isdigit((unsigned char)c) || (c == '.' && i + 1 < len && isdigit((unsigned char)text[i + 1]))) {
+            size_t end = number_end(text, len, i);
+            add_run(runs, i, end, HIGHLIGHT_NUMBER);
+            i = end;
+        } else {
+            i++;
+        }
+    }
+    return STATE_NORMAL;
+}
+
+// Values: ${interpolation} and a ; or # comment after a space
+static void lex_ini_value(const char *text, size_t len, size_t i, std::vector<HighlightRun> *runs) {
+    while (i < len) {
+        if ((text[i] == ';' || text[i] == '#') && (i == 0 || text[i - 1] == ' ' || text[i - 1] == '\t')) {
+            add_run(runs, i, len, HIGHLIGHT_COMMENT);
+            return;
+        }
+        if (text[i] == '$' && i + 1 < len && text[i + 1] == '{') {
+            const char *close = (const char *)memchr(text + i, '}', len - i);
+            size_t end = close ? close - text + 1 : len;
+            add_run(runs, i, end, HIGHLIGHT_PREPROC);
+            i = end;
+        } else {
+            i++;
+        }
+    }
+}
+
+static unsigned char lex_ini(const char *text, size_t len, std::vector<HighlightRun> *runs) {
+    size_t first = 0;
+    while (first < len && (text[first] == ' ' || text[first] == '\t')) {
+        first++;
+    }
+    if (first == len) {
+        return STATE_NORMAL;
+    }
+    if (text[first] == ';' || text[first] == '#') {
+        add_run(runs, first, len, HIGHLIGHT_COMMENT);
+    } else if (text[first] == '[') {
+        const char *close = (const char *)memchr(text + first, ']', len - first);
+        size_t end = close ? close - text + 1 : len;
+        add_run(runs, first, end, HIGHLIGHT_SECTION);
+        lex_ini_value(text, len, end, runs);
+    } else if (first > 0) {
+        lex_ini_value(text, len, first, runs);  // An indented line continues a value
+    } else {
+        size_t equals = first;
+        while (equals < len && text[equals] != '=' && text[equals] != ':') {
+            equals++;
+        }
+        size_t key_end = equals;
+        while (key_end > first && (text[key_end - 1] == ' ' || text[key_end - 1] == '\t')) {
+            key_end--;
+        }
+        if (equals < len) {
+            add_run(runs, first, key_end, HIGHLIGHT_KEY);
+            lex_ini_value(text, len, equals + 1, runs);
+        }
+    }
+    return STATE_NORMAL;
+}
+
+// Lex one line from state, adding its runs if runs isn't NULL. Returns the
+// state the next line starts in.
+static unsigned char lex_line(int language, const char *text, size_t len, unsigned char state,
+                              std::vector<HighlightRun> *runs) {
+    switch (language) {
+        case HIGHLIGHT_C: return lex_c(text, len, state, false, runs);
+        case HIGHLIGHT_ARDUINO: return lex_c(text, len, state, true, runs);
+        case HIGHLIGHT_PYTHON: return lex_python(text, len, state, runs);
+        case HIGHLIGHT_INI: return lex_ini(text, len, runs);
+        default: return STATE_NORMAL;
+    }
+}
+
+int highlight_language(const char *path, const char *first_line, size_t len) {
+    const char *slash = strrchr(path, '/');
+    const char *name = slash ? slash + 1 : path;
+    const char *dot = strrchr(name, '.');
+    const char *ext = dot ? dot + 1 : "";
+    static const char *const c_exts[] = {"c", "h", "cc", "cpp", "cxx", "hh", "hpp", "hxx", "cu", "cuh"};
+    for (size_t i = 0; i < sizeof(c_exts) / sizeof(c_exts[0]); i++) {
+        if (strcasecmp(ext, c_exts[i]) == 0) {
+            return HIGHLIGHT_C;
+        }
+    }
+    if (strcasecmp(ext, "ino") == 0 || strcasecmp(ext, "pde") == 0) {
+        return HIGHLIGHT_ARDUINO;
+    }
+    if (strcasecmp(ext, "py") == 0 || strcasecmp(ext, "pyw") == 0) {
+        return HIGHLIGHT_PYTHON;
+    }
+    if (strcasecmp(ext, "ini") == 0 || strcasecmp(ext, "cfg") == 0 || strcasecmp(ext, "conf") == 0 ||
+        strcmp(name, ".editorconfig") == 0 || strcmp(name, ".gitconfig") == 0) {
+        return HIGHLIGHT_INI;
+    }
+
+    // A script named without an extension
+    if (first_line && len > 2 && first_line[0] == '#' && first_line[1] == '!') {
+        std::string shebang(first_line, len < 128 ? len : 128);
+        if (shebang.find("python") != std::string::npos) {
+            return HIGHLIGHT_PYTHON;
+        }
+    }
+    return HIGHLIGHT_NONE;
+}
+
+void highlight_init(Highlighter *highlighter, int language, HighlightSource source, void *ctx) {
+    highlighter->language = language;
+    highlighter->source = source;
+    highlighter->ctx = ctx;
+    highlight_reset(highlighter);
+}
+
+void highlight_reset(Highlighter *highlighter) {
+    highlighter->states.assign(1, STATE_NORMAL);
+    highlighter->cache.resize(HIGHLIGHT_CACHE);
+    for (size_t i = 0; i < highlighter->cache.size(); i++) {
+        highlighter->cache[i].line = -1;
+    }
+}
+
+const std::vector<HighlightRun> *highlight_line(Highlighter *highlighter, long line) {
+    if (highlighter->language == HIGHLIGHT_NONE || line < 0) {
+        return NULL;
+    }
+
+    // The state the line starts in, from the last line lexed
+    std::vector<unsigned char> &states = highlighter->states;
+    const char *text;
+    size_t len;
+    while ((long)states.size() <= line) {
+        long at = (long)states.size() - 1;
+        if (!highlighter->source(highlighter->ctx, at, &text, &len)) {
+            return NULL;
+        }
+        states.push_back(lex_line(highlighter->language, text, len, states[at], NULL));
+    }
+
+    HighlightCached &cached = highlighter->cache[line % HIGHLIGHT_CACHE];
+    if (cached.line == line && cached.state == states[line]) {
+        return &cached.runs;
+    }
+    if (!highlighter->source(highlighter->ctx, line, &text, &len)) {
+        return NULL;
+    }
+    cached.line = line;
+    cached.state = states[line];
+    cached.runs.clear();
+    lex_line(highlighter->language, text, len, cached.state, &cached.runs);
+    return &cached.runs;
+}
+
+void highlight_edit(Highlighter *highlighter, long line, long removed, long added) {
+    if (highlighter->language == HIGHLIGHT_NONE || line < 0) {
+        return;
+    }
+
+    // Runs of the changed lines, and of every line after if lines moved
+    for (size_t i = 0; i < highlighter->cache.size(); i++) {
+        long cached = highlighter->cache[i].line;
+        if (cached >= line && (removed != added || cached <= line + added)) {
+            highlighter->cache[i].line = -1;
+        }
+    }
+
+    // Move the states of the lines after along with them
+    std::vector<unsigned char> &states = highlighter->states;
+    if (line + 1 >= (long)states.size()) {
+        return;  // Past what has been lexed
+    }
+    long first = line + 1;
+    long last = std::min((long)states.size(), first + removed);
+    states.erase(states.begin() + first, states.begin() + last);
+    states.insert(states.begin() + first, added, (unsigned char)STATE_UNKNOWN);
+
+    // Lex on until a line starts as it did before
+    for (long i = line; i + 1 < (long)states.size(); i++) {
+        const char *text;
+        size_t len;
+        if (!highlighter->source(highlighter->ctx, i, &text, &len)) {
+            states.resize(i + 1);
+            break;
+        }
+        unsigned char next = lex_line(highlighter->language, text, len, states[i], NULL);
+        if (i >= line + added && states[i + 1] == next) {
+            break;
+        }
+        states[i + 1] = next;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+// Syntax highlighting for MINUX
+// A small tokenizer per language (C/C++, Arduino sketches, Python, INI and
+// platformio.ini) turns a line into runs of comment, string, keyword and
+// so on. What carries over from one line to the next - being inside a
+// /* comment */ or a Python """string""" - is a one-byte lexer state, and
+// the state each line starts in is kept, so a line is lexed on its own
+// without going back to the top of the file. The runs of the lines drawn
+// recently are kept too, and redrawing reuses them. After an edit only the
+// edited lines and those after them are lexed again, and only until a
+// line starts in the same state it did before.
+//
+// Lines come from a callback, so the same highlighter serves the viewer
+// (a mapped file) and the editor (a piece table).
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Highlighter settings
+#define HIGHLIGHT_CACHE 256             // Lines whose runs are kept (by line number mod this)
+
+// Languages
+#define HIGHLIGHT_NONE 0
+#define HIGHLIGHT_C 1                   // C, C++ and CUDA
+#define HIGHLIGHT_ARDUINO 2             // C++ with the Arduino core's names
+#define HIGHLIGHT_PYTHON 3
+#define HIGHLIGHT_INI 4                 // INI files, platformio.ini
+
+// Token kinds; text outside any run is plain
+#define HIGHLIGHT_COMMENT 1
+#define HIGHLIGHT_STRING 2
+#define HIGHLIGHT_KEYWORD 3
+#define HIGHLIGHT_NUMBER 4
+#define HIGHLIGHT_PREPROC 5             // #directives, decorators, ${interpolation}
+#define HIGHLIGHT_SECTION 6             // [section]
+#define HIGHLIGHT_KEY 7                 // key = value
+
+typedef struct {
+    uint32_t start;                     // Byte offset in the line
+    uint32_t len;
+    unsigned char kind;                 // HIGHLIGHT_*
+} HighlightRun;
+
+// Line n (from 0) without its newline, or false past the end (or not
+// available yet). text need only stay valid until the next call.
+typedef bool (*HighlightSource)(void *ctx, long line, const char **text, size_t *len);
+
+typedef struct {
+    long line;                          // -1 if unused
+    unsigned char state;                // The state the line was lexed from
+    std::vector<HighlightRun> runs;
+} HighlightCached;
+
+typedef struct {
+    int language;
+    HighlightSource source;
+    void *ctx;
+    std::vector<unsigned char> states;  // The state each line starts in, as far as lexed
+    std::vector<HighlightCached> cache;
+} Highlighter;
+
+// The language of path, or of its first line (a #! line) if the name
+// doesn't tell
+int highlight_language(const char *path, const char *first_line, size_t len);
+
+void highlight_init(Highlighter *highlighter, int language, HighlightSource source, void *ctx);
+
+// Forget everything lexed, after the text was replaced
+void highlight_reset(Highlighter *highlighter);
+
+// Runs for line, lexing the lines before it first if they haven't been.
+// NULL for plain text. Valid until the next call.
+const std::vector<HighlightRun> *highlight_line(Highlighter *highlighter, long line);
+
+// Lines line to line + removed were replaced by lines line to line + added
+// (so 0 and 0 for a change within one line). Lexes them again, and the
+// lines after until the state they start in settles.
+void highlight_edit(Highlighter *highlighter, long line, long removed, long added);
+
+#endif // HIGHLIGHT_H
@@ -0,0 +1,422 @@
+#include "history.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// One history line - either inside the mapped log or a heap copy
+typedef struct {
+    const char *text;
+    uint32_t len;
+    uint8_t owned;
+} HistoryEntry;
+
+// Per-entry bookkeeping charged against the memory bound
+#define HISTORY_ENTRY_OVERHEAD sizeof(HistoryEntry)
+
+static std::string history_path;
+static size_t memory_limit = HISTORY_DEFAULT_MEMORY;
+static int log_fd = -1;
+static bool loaded = false;
+
+// Ring of entries; ids run from first_id to first_id + count - 1
+static std::vector<HistoryEntry> ring;
+static size_t ring_head = 0;
+static size_t ring_count = 0;
+static long first_id = 0;
+static size_t memory_used = 0;
+
+// Mapping of the log as it was at load/compaction time
+static char *map_base = NULL;
+static size_t map_size = 0;
+
+static size_t log_size = 0;
+static int pending_syncs = 0;
+static time_t last_sync = 0;
+
+static HistoryEntry *entry_at(size_t index) {
+    return &ring[(ring_head + index) % ring.size()];
+}
+
+static void entry_free(HistoryEntry *entry) {
+    if (entry->owned) {
+        free((void *)entry->text);
+    }
+    entry->text = NULL;
+    entry->len = 0;
+    entry->owned = 0;
+}
+
+static void drop_oldest(void) {
+    HistoryEntry *oldest = entry_at(0);
+    memory_used -= oldest->len + HISTORY_ENTRY_OVERHEAD;
+    entry_free(oldest);
+    ring_head = (ring_head + 1) % ring.size();
+    ring_count--;
+    first_id++;
+}
+
+static void push_entry(const char *text, uint32_t len, bool owned) {
+    size_t cost = len + HISTORY_ENTRY_OVERHEAD;
+    while (ring_count > 0 && memory_used + cost > memory_limit) {
+        drop_oldest();
+    }
+
+    if (ring_count == ring.size()) {
+        // Grow, unrolling the ring so the oldest entry sits at index 0
+        std::vector<HistoryEntry> grown(ring.empty() ? 64 : ring.size() * 2);
+        for (size_t i = 0; i < ring_count; i++) {
+            grown[i] = *entry_at(i);
+        }
+        ring.swap(grown);
+        ring_head = 0;
+    }
+
+    HistoryEntry *slot = &ring[(ring_head + ring_count) % ring.size()];
+    slot->text = text;
+    slot->len = len;
+    slot->owned = owned ? 1 : 0;
+    ring_count++;
+    memory_used += cost;
+}
+
+static void unmap_log(void) {
+    if (map_base) {
+        munmap(map_base, map_size);
+        map_base = NULL;
+        map_size = 0;
+    }
+}
+
+// Map the log and index the newest lines that fit the memory bound.
+// Only the tail of the file is touched, so old history costs nothing.
+static void load_log(void) {
+    loaded = true;
+
+    int fd = open(history_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return;
+
+    map_base = (char *)base;
+    map_size = st.st_size;
+    log_size = st.st_size;
+
+    // Walk backwards collecting line boundaries until the budget is spent
+    std::vector<std::pair<size_t, uint32_t> > lines;  // (offset, length), newest first
+    size_t budget = 0;
+    size_t end = map_size;
+    while (end > 0) {
+        size_t line_end = end;
+        if (map_base[line_end - 1] == '\n') line_end--;
+
+        const char *nl = (const char *)memrchr(map_base, '\n', line_end);
+        size_t start = nl ? (size_t)(nl - map_base) + 1 : 0;
+        size_t len = line_end - start;
+
+        if (len > 0 && len <= UINT32_MAX) {
+            size_t cost = len + HISTORY_ENTRY_OVERHEAD;
+            if (budget + cost > memory_limit && !lines.empty()) break;
+            budget += cost;
+            lines.push_back(std::make_pair(start, (uint32_t)len));
+        }
+        end = start;
+    }
+
+    for (size_t i = lines.size(); i > 0; i--) {
+        push_entry(map_base + lines[i - 1].first, lines[i - 1].second, false);
+    }
+}
+
+static void ensure_loaded(void) {
+    if (!loaded && !history_path.empty()) {
+        load_log();
+    }
+}
+
+static void sync_log(void) {
+    if (log_fd >= 0 && pending_syncs > 0) {
+        fdatasync(log_fd);
+    }
+    pending_syncs = 0;
+    last_sync = time(NULL);
+}
+
+static bool write_all(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        // Advance past whatever was written
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+// Point log_fd at the file now at history_path, which another instance's
+// compaction may have renamed over the one it had open. Returns true if it
+// had been replaced.
+static bool reopen_if_replaced(void) {
+    struct stat open_st, path_st;
+    if (log_fd < 0 || fstat(log_fd, &open_st) != 0 || stat(history_path.c_str(), &path_st) != 0) {
+        return false;
+    }
+    if (open_st.st_dev == path_st.st_dev && open_st.st_ino == path_st.st_ino) {
+        return false;
+    }
+    close(log_fd);
+    log_fd = open(history_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    log_size = (size_t)path_st.st_size;
+    return true;
+}
+
+// flock() the log - shared to append, exclusive to compact - making sure
+// the lock is on the file still at history_path once it is held
+static bool lock_log(int how) {
+    reopen_if_replaced();
+    while (log_fd >= 0) {
+        int rc;
+        do {
+            rc = flock(log_fd, how);
+        } while (rc != 0 && errno == EINTR);
+        if (rc != 0) return false;
+        if (!reopen_if_replaced()) return true;  // Closing the old file dropped its lock
+    }
+    return false;
+}
+
+static void unlock_log(void) {
+    if (log_fd >= 0) flock(log_fd, LOCK_UN);
+}
+
+// Rewrite the log with just the ring contents, then point the ring at a
+// fresh mapping of the new file so heap copies can be released. Runs under
+// an exclusive lock, so other instances' appends wait and then reopen the
+// new file; without locking (some network file systems) the log isn't
+// compacted at all.
+static void compact_log(void) {
+    if (!lock_log(LOCK_EX)) return;
+    if (log_size <= HISTORY_COMPACT_MIN || log_size <= HISTORY_COMPACT_RATIO * memory_used) {
+        unlock_log();  // Another instance compacted it while this one waited
+        return;
+    }
+
+    std::string tmp_path = history_path + ".XXXXXX";
+    int fd = mkostemp(&tmp_path[0], O_CLOEXEC);
+    if (fd < 0) {
+        unlock_log();
+        return;
+    }
+
+    static char newline = '\n';
+    std::vector<struct iovec> iov;
+    iov.reserve(IOV_MAX);
+    size_t new_size = 0;
+    bool ok = true;
+    for (size_t i = 0; i < ring_count && ok; i++) {
+        HistoryEntry *entry = entry_at(i);
+        struct iovec text = { (void *)entry->text, entry->len };
+        struct iovec nl = { &newline, 1 };
+        iov.push_back(text);
+        iov.push_back(nl);
+        new_size += entry->len + 1;
+        if (iov.size() + 2 > IOV_MAX) {
+            ok = write_all(fd, iov.data(), iov.size());
+            iov.clear();
+        }
+    }
+    if (ok && !iov.empty()) {
+        ok = write_all(fd, iov.data(), iov.size());
+    }
+    if (!ok || fsync(fd) != 0) {
+        close(fd);
+        unlink(tmp_path.c_str());
+        unlock_log();
+        return;
+    }
+    close(fd);
+
+    if (rename(tmp_path.c_str(), history_path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        unlock_log();
+        return;
+    }
+
+    // Appends must go to the new file from now on; closing the old one
+    // releases the lock, and waiting instances find it replaced
+    if (log_fd >= 0) close(log_fd);
+    log_fd = open(history_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    log_size = new_size;
+    pending_syncs = 0;
+
+    int map_fd = open(history_path.c_str(), O_RDONLY | O_CLOEXEC);
+    void *base = MAP_FAILED;
+    if (map_fd >= 0 && new_size > 0) {
+        base = mmap(NULL, new_size, PROT_READ, MAP_PRIVATE, map_fd, 0);
+    }
+    if (map_fd >= 0) close(map_fd);
+    if (base == MAP_FAILED) return;  // Old mapping and heap copies stay valid
+
+    char *p = (char *)base;
+    for (size_t i = 0; i < ring_count; i++) {
+        HistoryEntry *entry = entry_at(i);
+        uint32_t len = entry->len;
+        entry_free(entry);
+        entry->text = p;
+        entry->len = len;
+        p += len + 1;
+    }
+    unmap_log();
+    map_base = (char *)base;
+    map_size = new_size;
+}
+
+int history_open(const char *path, size_t limit) {
+    history_close();
+
+    history_path = path;
+    memory_limit = limit < HISTORY_MIN_MEMORY ? HISTORY_MIN_MEMORY : limit;
+    log_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    last_sync = time(NULL);
+    return log_fd >= 0 ? 0 : -1;
+}
+
+void history_close(void) {
+    sync_log();
+    if (log_fd >= 0) {
+        close(log_fd);
+        log_fd = -1;
+    }
+    for (size_t i = 0; i < ring_count; i++) {
+        entry_free(entry_at(i));
+    }
+    ring.clear();
+    ring_head = 0;
+    ring_count = 0;
+    first_id = 0;
+    memory_used = 0;
+    unmap_log();
+    log_size = 0;
+    loaded = false;
+    history_path.clear();
+}
+
+size_t history_memory_limit_from_env(void) {
+    const char *value = getenv(HISTORY_MEMORY_ENV);
+    if (!value || !*value) {
+        return HISTORY_DEFAULT_MEMORY;
+    }
+
+    char *suffix;
+    unsigned long long bytes = strtoull(value, &suffix, 10);
+    if (*suffix == 'k' || *suffix == 'K') bytes *= 1024;
+    else if (*suffix == 'm' || *suffix == 'M') bytes *= 1024 * 1024;
+    else if (*suffix == 'g' || *suffix == 'G') bytes *= 1024ULL * 1024 * 1024;
+
+    if (bytes == 0 || bytes > SIZE_MAX) {
+        return HISTORY_DEFAULT_MEMORY;
+    }
+    return (size_t)bytes;
+}
+
+long history_add(const char *cmd) {
+    ensure_loaded();
+
+    size_t len = cmd ? strlen(cmd) : 0;
+    if (len == 0 || len > UINT32_MAX || memchr(cmd, '\n', len)) {
+        return -1;
+    }
+
+    // Don't add duplicates of the last command
+    if (ring_count > 0) {
+        HistoryEntry *last = entry_at(ring_count - 1);
+        if (last->len == len && memcmp(last->text, cmd, len) == 0) {
+            return -1;
+        }
+    }
+
+    char *copy = (char *)malloc(len);
+    if (!copy) return -1;
+    memcpy(copy, cmd, len);
+    push_entry(copy, (uint32_t)len, true);
+
+    // One write per command keeps O_APPEND lines intact across instances,
+    // and the lock keeps it out of the file a compaction is replacing
+    bool locked = lock_log(LOCK_SH);
+    if (log_fd >= 0) {
+        static char newline = '\n';
+        struct iovec iov[2] = { { (void *)cmd, len }, { &newline, 1 } };
+        if (write_all(log_fd, iov, 2)) {
+            log_size += len + 1;
+            pending_syncs++;
+        }
+    }
+    if (locked) unlock_log();
+
+    if (pending_syncs >= HISTORY_FSYNC_EVERY || time(NULL) - last_sync >= HISTORY_FSYNC_SECONDS) {
+        sync_log();
+    }
+
+    if (log_size > HISTORY_COMPACT_MIN && log_size > HISTORY_COMPACT_RATIO * memory_used) {
+        compact_log();
+    }
+
+    return first_id + (long)ring_count - 1;
+}
+
+long history_first(void) {
+    ensure_loaded();
+    return first_id;
+}
+
+long history_end(void) {
+    ensure_loaded();
+    return first_id + (long)ring_count;
+}
+
+const char *history_get(long id, size_t *len) {
+    ensure_loaded();
+    if (id < first_id || id >= first_id + (long)ring_count) {
+        return NULL;
+    }
+    HistoryEntry *entry = entry_at(id - first_id);
+    if (len) *len = entry->len;
+    return entry->text;
+}
+
+void history_flush(void) {
+    sync_log();
+}
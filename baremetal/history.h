@@ -0,0 +1,43 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+// Command history store for MINUX
+// Keeps recent commands in a memory-bounded ring backed by an append-only
+// log file. The log is mapped lazily on first use and compacted only when
+// it grows well past what is kept in memory. Several instances can share
+// the log: appends take a shared flock() and compaction an exclusive one,
+// and an instance whose log was replaced by another's compaction reopens
+// it before appending.
+
+#include <stddef.h>
+
+// History settings
+#define HISTORY_FILE ".minux_history"
+#define HISTORY_MEMORY_ENV "MINUX_HISTORY_BYTES"   // Overrides the memory bound (K/M suffixes allowed)
+#define HISTORY_DEFAULT_MEMORY (1024 * 1024)       // Bytes of history kept in memory
+#define HISTORY_MIN_MEMORY 4096
+#define HISTORY_FSYNC_EVERY 16                     // Appends between fsyncs
+#define HISTORY_FSYNC_SECONDS 5                    // ...or seconds, whichever comes first
+#define HISTORY_COMPACT_MIN (256 * 1024)           // Never compact a log smaller than this
+#define HISTORY_COMPACT_RATIO 4                    // Compact once the log is this many times the ring
+
+// Store lifecycle - history_open only records the path and opens the log
+// for appending; nothing is read until the history is first used
+int history_open(const char *path, size_t memory_limit);
+void history_close(void);
+size_t history_memory_limit_from_env(void);
+
+// Append a command (duplicates of the previous command are skipped).
+// Returns the new entry's id, or -1 if nothing was added.
+long history_add(const char *cmd);
+
+// Entries are addressed by monotonically increasing ids in [first, end).
+// Text is not NUL-terminated; use the returned length.
+long history_first(void);
+long history_end(void);
+const char *history_get(long id, size_t *len);
+
+// Force pending appends to disk
+void history_flush(void);
+
+#endif // HISTORY_H
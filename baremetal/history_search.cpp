@@ -0,0 +1,213 @@
+#include "history_search.h"
+#include "history.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+// Rebuild posting lists once this share of entries has been evicted
+#define SEARCH_PRUNE_RATIO 2
+
+typedef std::vector<uint32_t> PostingList;  // Entry ids, ascending
+
+static std::unordered_map<uint32_t, PostingList> trigram_index;
+static bool index_built = false;
+static long indexed_end = 0;         // Every id below this is indexed
+static size_t total_postings = 0;
+static size_t pruned_at_first = 0;   // history_first() when last pruned
+
+// Matches for the last query, ascending ids
+static std::string cached_query;
+static std::vector<long> cached_matches;
+static bool cache_valid = false;
+
+static inline unsigned char fold(unsigned char c) {
+    return (unsigned char)tolower(c);
+}
+
+static inline uint32_t trigram_at(const char *text) {
+    return ((uint32_t)fold(text[0]) << 16) | ((uint32_t)fold(text[1]) << 8) | fold(text[2]);
+}
+
+// Case-insensitive substring test against an already lower-cased needle
+static bool contains_folded(const char *text, size_t len, const char *needle, size_t nlen) {
+    if (nlen == 0) return true;
+    if (nlen > len) return false;
+
+    unsigned char first = needle[0];
+    for (size_t i = 0; i + nlen <= len; i++) {
+        if (fold(text[i]) != first) continue;
+        size_t j = 1;
+        while (j < nlen && fold(text[i + j]) == (unsigned char)needle[j]) j++;
+        if (j == nlen) return true;
+    }
+    return false;
+}
+
+static bool entry_matches(long id, const std::string &needle) {
+    size_t len;
+    const char *text = history_get(id, &len);
+    return text && contains_folded(text, len, needle.data(), needle.size());
+}
+
+static void index_entry(long id) {
+    size_t len;
+    const char *text = history_get(id, &len);
+    if (!text || len < 3) return;
+
+    std::vector<uint32_t> grams;
+    grams.reserve(len - 2);
+    for (size_t i = 0; i + 3 <= len; i++) {
+        grams.push_back(trigram_at(text + i));
+    }
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+
+    for (size_t i = 0; i < grams.size(); i++) {
+        trigram_index[grams[i]].push_back((uint32_t)id);
+    }
+    total_postings += grams.size();
+}
+
+// Drop postings for entries the history ring has evicted. They sit at
+// the front of every list, so this is a prefix erase per list.
+static void prune_evicted(void) {
+    uint32_t first = (uint32_t)history_first();
+    total_postings = 0;
+    for (auto it = trigram_index.begin(); it != trigram_index.end(); ) {
+        PostingList &list = it->second;
+        list.erase(list.begin(), std::lower_bound(list.begin(), list.end(), first));
+        if (list.empty()) {
+            it = trigram_index.erase(it);
+        } else {
+            total_postings += list.size();
+            ++it;
+        }
+    }
+    pruned_at_first = first;
+}
+
+// Bring the index up to date with the history store
+static void catch_up(void) {
+    long first = history_first();
+    long end = history_end();
+
+    if (!index_built) {
+        index_built = true;
+        indexed_end = first;
+        pruned_at_first = first;
+    }
+    if (indexed_end < first) {
+        indexed_end = first;
+    }
+    for (long id = indexed_end; id < end; id++) {
+        index_entry(id);
+    }
+    indexed_end = end;
+
+    long live = end - first;
+    if ((size_t)first > pruned_at_first && live > 0 &&
+        (size_t)(first - pruned_at_first) * SEARCH_PRUNE_RATIO > (size_t)live) {
+        prune_evicted();
+    }
+}
+
+// All entries containing a query of three or more characters
+static void match_with_index(const std::string &needle, std::vector<long> &out) {
+    std::vector<const PostingList *> lists;
+    for (size_t i = 0; i + 3 <= needle.size(); i++) {
+        auto it = trigram_index.find(trigram_at(needle.data() + i));
+        if (it == trigram_index.end()) return;  // A trigram nobody contains
+        lists.push_back(&it->second);
+    }
+    std::sort(lists.begin(), lists.end(),
+              [](const PostingList *a, const PostingList *b) { return a->size() < b->size(); });
+    lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+
+    // Walk the shortest list and probe the others
+    uint32_t first = (uint32_t)history_first();
+    const PostingList &shortest = *lists[0];
+    for (auto it = std::lower_bound(shortest.begin(), shortest.end(), first); it != shortest.end(); ++it) {
+        uint32_t id = *it;
+        bool in_all = true;
+        for (size_t l = 1; l < lists.size() && in_all; l++) {
+            in_all = std::binary_search(lists[l]->begin(), lists[l]->end(), id);
+        }
+        // Trigrams can match out of order, so confirm the substring
+        if (in_all && entry_matches(id, needle)) {
+            out.push_back(id);
+        }
+    }
+}
+
+void history_search_add(long id) {
+    if (!index_built) return;  // Built from scratch on first search
+
+    if (id >= indexed_end) {
+        catch_up();
+    }
+    if (cache_valid && entry_matches(id, cached_query) &&
+        (cached_matches.empty() || cached_matches.back() < id)) {
+        cached_matches.push_back(id);
+    }
+}
+
+void history_search_reset(void) {
+    trigram_index.clear();
+    index_built = false;
+    indexed_end = 0;
+    total_postings = 0;
+    pruned_at_first = 0;
+    cached_query.clear();
+    cached_matches.clear();
+    cache_valid = false;
+}
+
+long history_search_find(const char *query, long before) {
+    std::string needle;
+    for (const char *p = query; *p; p++) {
+        needle += (char)fold(*p);
+    }
+
+    long first = history_first();
+    if (before > history_end()) {
+        before = history_end();
+    }
+
+    // Short queries have no trigrams - scan back from the newest entry,
+    // which usually stops after a handful of entries
+    if (needle.size() < 3) {
+        for (long id = before - 1; id >= first; id--) {
+            if (entry_matches(id, needle)) return id;
+        }
+        return -1;
+    }
+
+    catch_up();
+
+    if (!cache_valid || needle != cached_query) {
+        std::vector<long> matches;
+        if (cache_valid && needle.find(cached_query) != std::string::npos) {
+            // The query grew: every new match is among the previous matches
+            for (size_t i = 0; i < cached_matches.size(); i++) {
+                long id = cached_matches[i];
+                if (id >= first && entry_matches(id, needle)) {
+                    matches.push_back(id);
+                }
+            }
+        } else {
+            match_with_index(needle, matches);
+        }
+        cached_query = needle;
+        cached_matches.swap(matches);
+        cache_valid = true;
+    }
+
+    auto it = std::lower_bound(cached_matches.begin(), cached_matches.end(), before);
+    if (it == cached_matches.begin()) return -1;
+    long id = *(it - 1);
+    return id >= first ? id : -1;
+}
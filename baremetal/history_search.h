@@ -0,0 +1,20 @@
+#ifndef HISTORY_SEARCH_H
+#define HISTORY_SEARCH_H
+
+// Incremental history search for MINUX
+// Case-insensitive substring search over the history store, backed by a
+// trigram index that is built on first use and extended as commands are
+// added. Results for a query are cached so each extra keystroke only
+// filters the previous matches.
+
+// Index a newly added history entry (no-op until the index is first used)
+void history_search_add(long id);
+
+// Drop the index and cached results (e.g. after the history is reopened)
+void history_search_reset(void);
+
+// Newest entry with an id below 'before' that contains 'query'.
+// Returns the entry id, or -1 if there is no match.
+long history_search_find(const char *query, long before);
+
+#endif // HISTORY_SEARCH_H
@@ -0,0 +1,142 @@
+#include "id_cache.h"
+#include <errno.h>
+#include <grp.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <unordered_map>
+
+typedef struct {
+    char name[ID_CACHE_NAME_LEN];   // Empty if the id has no name
+    time_t expires;
+} IdCacheEntry;
+
+typedef std::unordered_map<unsigned long, IdCacheEntry> IdTable;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static IdTable users;
+static IdTable groups;
+static IdCacheStats counters;
+
+static time_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+// Scratch size for the _r lookups, grown on ERANGE
+static size_t initial_buffer(int which) {
+    long n = sysconf(which);
+    return n > 0 ? (size_t)n : 1024;
+}
+
+static bool lookup_user(unsigned long id, char *name) {
+    size_t size = initial_buffer(_SC_GETPW_R_SIZE_MAX);
+    while (1) {
+        char *buf = (char *)malloc(size);
+        if (!buf) {
+            return false;
+        }
+        struct passwd pw;
+        struct passwd *result = NULL;
+        int err = getpwuid_r((uid_t)id, &pw, buf, size, &result);
+        if (err == ERANGE && size < 1024 * 1024) {
+            free(buf);
+            size *= 2;
+            continue;
+        }
+        bool found = err == 0 && result != NULL;
+        if (found) {
+            snprintf(name, ID_CACHE_NAME_LEN, "%s", pw.pw_name);
+        }
+        free(buf);
+        return found;
+    }
+}
+
+static bool lookup_group(unsigned long id, char *name) {
+    size_t size = initial_buffer(_SC_GETGR_R_SIZE_MAX);
+    while (1) {
+        char *buf = (char *)malloc(size);
+        if (!buf) {
+            return false;
+        }
+        struct group gr;
+        struct group *result = NULL;
+        int err = getgrgid_r((gid_t)id, &gr, buf, size, &result);
+        if (err == ERANGE && size < 1024 * 1024) {
+            free(buf);
+            size *= 2;
+            continue;
+        }
+        bool found = err == 0 && result != NULL;
+        if (found) {
+            snprintf(name, ID_CACHE_NAME_LEN, "%s", gr.gr_name);
+        }
+        free(buf);
+        return found;
+    }
+}
+
+// The lock is not held across the NSS call, so a slow directory service
+// only stalls the thread that missed. Two threads missing on the same id
+// both look it up and the second store wins, which is harmless.
+static int resolve(IdTable *table, unsigned long id, bool (*lookup)(unsigned long, char *),
+                   char *buf, size_t len) {
+    time_t t = now();
+    IdCacheEntry entry;
+    bool cached = false;
+
+    pthread_mutex_lock(&cache_lock);
+    IdTable::iterator it = table->find(id);
+    if (it != table->end() && it->second.expires > t) {
+        entry = it->second;
+        cached = true;
+        counters.hits++;
+        if (!entry.name[0]) {
+            counters.negative_hits++;
+        }
+    } else {
+        counters.misses++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    if (!cached) {
+        entry.name[0] = '\0';
+        bool found = lookup(id, entry.name);
+        entry.expires = t + (found ? ID_CACHE_TTL : ID_CACHE_NEGATIVE_TTL);
+
+        pthread_mutex_lock(&cache_lock);
+        if (table->size() >= ID_CACHE_MAX && table->find(id) == table->end()) {
+            table->clear();  // Crude, but a listing rarely sees this many owners
+        }
+        (*table)[id] = entry;
+        pthread_mutex_unlock(&cache_lock);
+    }
+
+    if (entry.name[0]) {
+        snprintf(buf, len, "%s", entry.name);
+        return 1;
+    }
+    snprintf(buf, len, "%lu", id);
+    return 0;
+}
+
+int id_cache_user_name(uid_t uid, char *buf, size_t len) {
+    return resolve(&users, (unsigned long)uid, lookup_user, buf, len);
+}
+
+int id_cache_group_name(gid_t gid, char *buf, size_t len) {
+    return resolve(&groups, (unsigned long)gid, lookup_group, buf, len);
+}
+
+void id_cache_stats(IdCacheStats *stats) {
+    pthread_mutex_lock(&cache_lock);
+    *stats = counters;
+    stats->entries = users.size() + groups.size();
+    pthread_mutex_unlock(&cache_lock);
+}
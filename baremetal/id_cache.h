@@ -0,0 +1,33 @@
+#ifndef ID_CACHE_H
+#define ID_CACHE_H
+
+// Owner name cache for MINUX
+// Maps uids and gids to user and group names for long listings. Answers are
+// kept for ID_CACHE_TTL seconds, and ids with no name are remembered too, so
+// a directory of files owned by one user costs one NSS lookup, not one per
+// line. Safe to call from worker threads.
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Cache settings
+#define ID_CACHE_TTL 300            // Seconds a resolved name is trusted
+#define ID_CACHE_NEGATIVE_TTL 30    // Seconds an id with no name is remembered
+#define ID_CACHE_MAX 1024           // Entries per table before it is flushed
+#define ID_CACHE_NAME_LEN 32        // Longest name kept, including the NUL
+
+typedef struct {
+    unsigned long hits;             // Answered from the cache (including negative hits)
+    unsigned long negative_hits;    // Answered from a remembered "no such id"
+    unsigned long misses;           // Needed a getpwuid_r/getgrgid_r call
+    size_t entries;                 // Users plus groups currently cached
+} IdCacheStats;
+
+// Write the name for uid/gid into buf, or the number if it has none.
+// Returns 1 if a name was found, 0 if buf holds the number.
+int id_cache_user_name(uid_t uid, char *buf, size_t len);
+int id_cache_group_name(gid_t gid, char *buf, size_t len);
+
+void id_cache_stats(IdCacheStats *stats);
+
+#endif // ID_CACHE_H
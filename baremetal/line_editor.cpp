@@ -0,0 +1,259 @@
+#include "line_editor.h"
+#include "render.h"
+#include <ncurses.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_DAMAGE SIZE_MAX
+
+static size_t gap_size(const LineEditor *ed) {
+    return ed->gap_end - ed->gap_start;
+}
+
+static char char_at(const LineEditor *ed, size_t i) {
+    return i < ed->gap_start ? ed->buf[i] : ed->buf[i + gap_size(ed)];
+}
+
+static void mark_damage(LineEditor *ed, size_t pos) {
+    if (pos < ed->damage) {
+        ed->damage = pos;
+    }
+}
+
+static bool reserve(char **buf, size_t *cap, size_t needed) {
+    if (needed <= *cap) {
+        return true;
+    }
+    size_t new_cap = *cap ? *cap : LINE_EDITOR_INITIAL;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    char *grown = (char *)realloc(*buf, new_cap);
+    if (!grown) {
+        return false;
+    }
+    *buf = grown;
+    *cap = new_cap;
+    return true;
+}
+
+// Make room for at least n more characters in the gap
+static bool ensure_gap(LineEditor *ed, size_t n) {
+    if (gap_size(ed) >= n) {
+        return true;
+    }
+
+    size_t len = line_editor_length(ed);
+    if (len + n > LINE_EDITOR_MAX_LENGTH) {
+        return false;
+    }
+
+    size_t tail = ed->cap - ed->gap_end;
+    size_t old_cap = ed->cap;
+    if (!reserve(&ed->buf, &ed->cap, len + n + LINE_EDITOR_INITIAL)) {
+        return false;
+    }
+    // Keep the text after the gap at the end of the larger buffer
+    memmove(ed->buf + ed->cap - tail, ed->buf + old_cap - tail, tail);
+    ed->gap_end = ed->cap - tail;
+    return true;
+}
+
+static void move_gap(LineEditor *ed, size_t pos) {
+    if (pos < ed->gap_start) {
+        size_t n = ed->gap_start - pos;
+        memmove(ed->buf + ed->gap_end - n, ed->buf + pos, n);
+        ed->gap_start -= n;
+        ed->gap_end -= n;
+    } else if (pos > ed->gap_start) {
+        size_t n = pos - ed->gap_start;
+        memmove(ed->buf + ed->gap_start, ed->buf + ed->gap_end, n);
+        ed->gap_start += n;
+        ed->gap_end += n;
+    }
+}
+
+// Screen cell for a text index, counting from the editor's origin
+static void cell_of(const LineEditor *ed, size_t i, int cols, int *y, int *x) {
+    size_t offset = (size_t)ed->origin_x + i;
+    *y = ed->origin_y + (int)(offset / cols);
+    *x = (int)(offset % cols);
+}
+
+int line_editor_init(LineEditor *ed) {
+    memset(ed, 0, sizeof(*ed));
+    if (!reserve(&ed->buf, &ed->cap, LINE_EDITOR_INITIAL)) {
+        return -1;
+    }
+    ed->gap_end = ed->cap;
+    ed->damage = NO_DAMAGE;
+    return 0;
+}
+
+void line_editor_free(LineEditor *ed) {
+    free(ed->buf);
+    free(ed->shadow);
+    free(ed->text);
+    memset(ed, 0, sizeof(*ed));
+}
+
+void line_editor_begin(LineEditor *ed) {
+    getyx(stdscr, ed->origin_y, ed->origin_x);
+    ed->shadow_len = 0;
+    ed->damage = 0;
+}
+
+int line_editor_insert(LineEditor *ed, const char *s, size_t n) {
+    if (!ensure_gap(ed, n)) {
+        return -1;
+    }
+    mark_damage(ed, ed->gap_start);
+    memcpy(ed->buf + ed->gap_start, s, n);
+    ed->gap_start += n;
+    return 0;
+}
+
+int line_editor_replace(LineEditor *ed, size_t from, size_t to, const char *s, size_t n) {
+    size_t len = line_editor_length(ed);
+    if (from > to || to > len) {
+        return -1;
+    }
+    if (len - (to - from) + n > LINE_EDITOR_MAX_LENGTH) {
+        return -1;
+    }
+    move_gap(ed, to);
+    ed->gap_start = from;  // Drop the replaced range into the gap
+    mark_damage(ed, from);
+    return line_editor_insert(ed, s, n);
+}
+
+int line_editor_set(LineEditor *ed, const char *s, size_t n) {
+    return line_editor_replace(ed, 0, line_editor_length(ed), s, n);
+}
+
+void line_editor_clear(LineEditor *ed) {
+    mark_damage(ed, 0);
+    ed->gap_start = 0;
+    ed->gap_end = ed->cap;
+}
+
+void line_editor_delete_back(LineEditor *ed) {
+    if (ed->gap_start > 0) {
+        ed->gap_start--;
+        mark_damage(ed, ed->gap_start);
+    }
+}
+
+void line_editor_delete_forward(LineEditor *ed) {
+    if (ed->gap_end < ed->cap) {
+        ed->gap_end++;
+        mark_damage(ed, ed->gap_start);
+    }
+}
+
+void line_editor_move_to(LineEditor *ed, size_t pos) {
+    size_t len = line_editor_length(ed);
+    move_gap(ed, pos > len ? len : pos);
+}
+
+size_t line_editor_cursor(const LineEditor *ed) {
+    return ed->gap_start;
+}
+
+size_t line_editor_length(const LineEditor *ed) {
+    return ed->cap - gap_size(ed);
+}
+
+const char *line_editor_text(LineEditor *ed) {
+    size_t len = line_editor_length(ed);
+    if (!reserve(&ed->text, &ed->text_cap, len + 1)) {
+        return "";
+    }
+    memcpy(ed->text, ed->buf, ed->gap_start);
+    memcpy(ed->text + ed->gap_start, ed->buf + ed->gap_end, ed->cap - ed->gap_end);
+    ed->text[len] = '\0';
+    return ed->text;
+}
+
+void line_editor_render(LineEditor *ed) {
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+    if (cols <= 0) {
+        return;
+    }
+
+    size_t len = line_editor_length(ed);
+
+    // Scroll until the cell after the text (where the cursor may sit) is visible
+    int end_y, end_x;
+    cell_of(ed, len, cols, &end_y, &end_x);
+    while (end_y > rows - 1 && ed->origin_y > 0) {
+        scroll(stdscr);
+        ed->origin_y--;
+        end_y--;
+    }
+
+    if (ed->damage != NO_DAMAGE && reserve(&ed->shadow, &ed->shadow_cap, len)) {
+        // Writing the bottom-right cell must not scroll the window
+        scrollok(stdscr, FALSE);
+
+        int y, x;
+        for (size_t i = ed->damage; i < len; i++) {
+            char c = char_at(ed, i);
+            if (i < ed->shadow_len && ed->shadow[i] == c) {
+                continue;
+            }
+            cell_of(ed, i, cols, &y, &x);
+            if (y >= 0 && y < rows) {
+                mvaddch(y, x, (unsigned char)c);
+            }
+            ed->shadow[i] = c;
+        }
+        for (size_t i = len; i < ed->shadow_len; i++) {
+            cell_of(ed, i, cols, &y, &x);
+            if (y >= 0 && y < rows) {
+                mvaddch(y, x, ' ');
+            }
+        }
+        ed->shadow_len = len;
+        ed->damage = NO_DAMAGE;
+
+        scrollok(stdscr, TRUE);
+    }
+
+    int cy, cx;
+    cell_of(ed, ed->gap_start, cols, &cy, &cx);
+    move(cy < rows ? cy : rows - 1, cx);
+    render_mark(stdscr);
+}
+
+void line_editor_erase(LineEditor *ed) {
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+    scrollok(stdscr, FALSE);
+    for (size_t i = 0; i < ed->shadow_len; i++) {
+        int y, x;
+        cell_of(ed, i, cols, &y, &x);
+        if (y >= 0 && y < rows) {
+            mvaddch(y, x, ' ');
+        }
+    }
+    scrollok(stdscr, TRUE);
+    ed->shadow_len = 0;
+    ed->damage = 0;
+    move(ed->origin_y, ed->origin_x);
+}
+
+void line_editor_finish(LineEditor *ed) {
+    int rows, cols;
+    getmaxyx(stdscr, rows, cols);
+    int y, x;
+    cell_of(ed, ed->shadow_len, cols, &y, &x);
+    if (y > rows - 1) {
+        // The text ends exactly at the bottom-right cell
+        y = rows - 1;
+        x = cols - 1;
+    }
+    move(y, x);
+}
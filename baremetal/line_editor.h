@@ -0,0 +1,61 @@
+#ifndef LINE_EDITOR_H
+#define LINE_EDITOR_H
+
+// Prompt line editor for MINUX
+// Holds the command being typed in a gap buffer and keeps a shadow copy of
+// what is on screen, so each keystroke only redraws the cells that changed.
+// Lines longer than the screen width wrap onto following rows.
+
+#include <stddef.h>
+
+// Editor settings
+#define LINE_EDITOR_INITIAL 256              // Initial buffer size
+#define LINE_EDITOR_MAX_LENGTH (64 * 1024)   // Longest command accepted
+
+typedef struct {
+    char *buf;              // Text before the gap, gap, text after the gap
+    size_t cap;
+    size_t gap_start;       // Also the cursor position
+    size_t gap_end;
+
+    char *shadow;           // Text as last drawn on screen
+    size_t shadow_len;
+    size_t shadow_cap;
+    size_t damage;          // First index changed since the last render
+
+    int origin_y;           // Screen cell where the text starts (after the prompt)
+    int origin_x;
+
+    char *text;             // NUL-terminated copy handed out by line_editor_text()
+    size_t text_cap;
+} LineEditor;
+
+// Editor lifecycle
+int line_editor_init(LineEditor *ed);
+void line_editor_free(LineEditor *ed);
+
+// Anchor the editor at the current cursor position, right after a freshly
+// printed prompt. Nothing is assumed to be on screen after it.
+void line_editor_begin(LineEditor *ed);
+
+// Editing - all of these only update the buffer; call line_editor_render()
+// to bring the screen up to date
+int line_editor_insert(LineEditor *ed, const char *s, size_t n);
+int line_editor_replace(LineEditor *ed, size_t from, size_t to, const char *s, size_t n);
+int line_editor_set(LineEditor *ed, const char *s, size_t n);
+void line_editor_clear(LineEditor *ed);
+void line_editor_delete_back(LineEditor *ed);
+void line_editor_delete_forward(LineEditor *ed);
+void line_editor_move_to(LineEditor *ed, size_t pos);
+
+// Accessors
+size_t line_editor_cursor(const LineEditor *ed);
+size_t line_editor_length(const LineEditor *ed);
+const char *line_editor_text(LineEditor *ed);  // Valid until the next edit
+
+// Screen updates
+void line_editor_render(LineEditor *ed);   // Draw changed cells and place the cursor
+void line_editor_erase(LineEditor *ed);    // Blank the drawn text, keep the buffer
+void line_editor_finish(LineEditor *ed);   // Move the cursor past the end of the text
+
+#endif // LINE_EDITOR_H
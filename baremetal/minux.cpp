@@ -29,11 +29,36 @@
 #include <chrono>
 #include <math.h>    // For sin() in tone generation
 #include <signal.h>  // For signal handling
+#include <poll.h>
 #include <openssl/sha.h>  // For SHA-256 hashing
 #include <openssl/evp.h>  // For AES encryption
 #include <openssl/rand.h> // For secure random generation
 #include <secp256k1.h>    // For secp256k1 cryptography
 #include "error_console.h"
+#include "command_registry.h"
+#include "output.h"
+#include "batch.h"
+#include "process.h"
+#include "history.h"
+#include "history_search.h"
+#include "completion.h"
+#include "line_editor.h"
+#include "render.h"
+#include "scrollback.h"
+#include "worker.h"
+#include "fs_list.h"
+#include "id_cache.h"
+#include "walker.h"
+#include "tree_render.h"
+#include "du.h"
+#include "file_search.h"
+#include "fs_watch.h"
+#include "dir_model.h"
+#include "dir_view.h"
+#include "file_map.h"
+#include "edit_buffer.h"
+#include "highlight.h"
+#include "view_search.h"
 #include <openssl/ec.h>
 #include <openssl/ecdsa.h>
 #include <openssl/obj_mac.h>
@@ -45,8 +70,6 @@
 #define PI_ALT0 4
 
 // Add these definitions for command history
-#define MAX_HISTORY 100
-#define HISTORY_FILE ".minux_history"
 
 // Try to include pigpio only if the compiler flag indicates it's available
 #ifndef HAS_PIGPIO
@@ -72,6 +95,10 @@
 #define MAX_ARGS 32
 #define MAX_PATH 4096
 #define STATUS_BAR_HEIGHT 1
+#define SEARCH_VIEW_MAX 10000  // Results kept by grep -p and find -p
+#define VIEWER_INDEX_REDRAW_MS 100  // Redraw interval while a file is being indexed
+#define EDITOR_SEARCH_CHUNK (4 << 20)  // Bytes the editor's search scans at a time
+#define EXPLORER_NAME_MIN 20  // Name columns the explorer keeps; Owner, then Modified, make way
 
 // Forward declarations for all functions (add these before they're used)
 static inline int min(int a, int b) {
@@ -113,15 +140,15 @@ void capture_image(const char *filename);
 void test_camera(void);
 void cmd_tree(void);
 void cmd_tree_interactive(void);
+void cmd_du_interactive(const char *path);
+void cmd_search_interactive(const char *root, const char *shown, const TextPattern *pattern, int flags, bool names);
 void cmd_cat(const char *filepath);
 void cmd_wallet(const char *arg); 
 void cmd_history(void);
+void cmd_stats(void);
 void cmd_log(const char *message);
 void add_to_history(const char *cmd);
 void load_history(void);
-void save_history(void);
-char *get_history_entry(int index);
-int history_size();
 void cmd_play(const char *arg);
 void play_audio_file(const char *filepath);
 void play_tone(int frequency, int duration_ms);
@@ -156,42 +183,97 @@ void init_windows(void);
 void cleanup(void);
 void draw_status_bar(void);
 void draw_error_status_bar(const char *error_msg);
+void draw_progress_status_bar(const char *progress);
 void handle_command(const char *cmd);
 void show_prompt(void);
 void view_file_contents(const char *filepath);
-static int levenshtein_distance(const char *s1, const char *s2);
+void view_file_at_line(const char *filepath, int line);
+void edit_file_contents(const char *filepath, int line);
+
+// Builtin handlers - adapt the command line to the cmd_* implementations
+static void builtin_help(int argc, char **argv, const char *raw_args);
+static void builtin_version(int argc, char **argv, const char *raw_args);
+static void builtin_time(int argc, char **argv, const char *raw_args);
+static void builtin_date(int argc, char **argv, const char *raw_args);
+static void builtin_path(int argc, char **argv, const char *raw_args);
+static void builtin_ls(int argc, char **argv, const char *raw_args);
+static void builtin_cd(int argc, char **argv, const char *raw_args);
+static void builtin_clear(int argc, char **argv, const char *raw_args);
+static void builtin_gpio(int argc, char **argv, const char *raw_args);
+static void builtin_explorer(int argc, char **argv, const char *raw_args);
+static void builtin_test_camera(int argc, char **argv, const char *raw_args);
+static void builtin_serial(int argc, char **argv, const char *raw_args);
+static void builtin_tree(int argc, char **argv, const char *raw_args);
+static void builtin_du(int argc, char **argv, const char *raw_args);
+static void builtin_grep(int argc, char **argv, const char *raw_args);
+static void builtin_find(int argc, char **argv, const char *raw_args);
+static void builtin_cat(int argc, char **argv, const char *raw_args);
+static void builtin_wallet(int argc, char **argv, const char *raw_args);
+static void builtin_history(int argc, char **argv, const char *raw_args);
+static void builtin_log(int argc, char **argv, const char *raw_args);
+static void builtin_play(int argc, char **argv, const char *raw_args);
+static void builtin_todo(int argc, char **argv, const char *raw_args);
+static void builtin_crypto(int argc, char **argv, const char *raw_args);
+static void builtin_cuda(int argc, char **argv, const char *raw_args);
+static void builtin_jobs(int argc, char **argv, const char *raw_args);
+static void builtin_stats(int argc, char **argv, const char *raw_args);
+static void builtin_fg(int argc, char **argv, const char *raw_args);
+static void builtin_exit(int argc, char **argv, const char *raw_args);
+static int job_foreground(Job *job);
+static void install_interrupt_handler(void);
+
+// Available commands - indexed by the registry at startup
+CommandSpec commands[] = {
+    {"help", builtin_help, 0, 0, "help", "Display this help message", 0},
+    {"version", builtin_version, 0, 0, "version", "Display MINUX version", 0},
+    {"time", builtin_time, 0, 0, "time", "Display current time", 0},
+    {"date", builtin_date, 0, 0, "date", "Display current date", 0},
+    {"path", builtin_path, 0, 0, "path", "Display or modify system path", 0},
+    {"ls", builtin_ls, 0, 1, "ls [directory]", "List directory contents", 0},
+    {"cd", builtin_cd, 1, 1, "cd <directory>", "Change directory", 0},
+    {"clear", builtin_clear, 0, 0, "clear", "Clear screen", 0},
+    {"gpio", builtin_gpio, 0, 0, "gpio", "Display GPIO status", 0},
+    {"explorer", builtin_explorer, 0, 0, "explorer", "Launch file explorer", COMMAND_INTERACTIVE},
+    {"test camera", builtin_test_camera, 0, 0, "test camera", "Test the Arducam camera", COMMAND_INTERACTIVE},
+    {"serial", builtin_serial, 0, 0, "serial", "Open serial monitor for device communication", COMMAND_INTERACTIVE},
+    {"tree", builtin_tree, 0, -1, "tree [-a] [-l] [-L level] [-J|--json|--ndjson] [-i] [directory]", "Display directory structure in a tree-like format", COMMAND_ASYNC},
+    {"du", builtin_du, 0, -1, "du [-s] [-d depth] [-n] [-i] [directory]", "Show disk usage below a directory", COMMAND_ASYNC},
+    {"grep", builtin_grep, 1, -1, "grep [-i] [-F|-E] [-l] [-a] [--no-ignore] [-p] <pattern> [path]", "Search file contents below a directory", COMMAND_ASYNC},
+    {"find", builtin_find, 1, -1, "find [-i] [-a] [--no-ignore] [-p] <name> [directory]", "Find files by name (wildcards or part of the name)", COMMAND_ASYNC},
+    {"cat", builtin_cat, 1, 1, "cat <filename>", "Display file contents", 0},
+    {"wallet", builtin_wallet, 0, -1, "wallet <command> [args]", "Cryptocurrency wallet operations", 0},
+    {"history", builtin_history, 0, 0, "history", "Display command history", 0},
+    {"log", builtin_log, 1, -1, "log <message>", "Add entry to log file", 0},
+    {"play", builtin_play, 1, -1, "play [wav|mp3|\"C:500\"|\"scale A\"]", "Play audio files, notes or scales", COMMAND_ASYNC},
+    {"todo", builtin_todo, 0, -1, "todo [add|done|remove|clear|help] [args]", "Task management (use 'todo help' for options)", 0},
+    {"crypto", builtin_crypto, 0, -1, "crypto <command> [data]", "Crypto operations", COMMAND_ASYNC},
+    {"cuda", builtin_cuda, 0, -1, "cuda [info|top|help]", "CUDA GPU information and utilities", 0},
+    {"jobs", builtin_jobs, 0, 0, "jobs", "List background jobs", 0},
+    {"stats", builtin_stats, 0, 0, "stats", "Show output, refreshes and frames per command, and owner-name cache counters", 0},
+    {"fg", builtin_fg, 0, 1, "fg [job]", "Bring a background job to the foreground", COMMAND_INTERACTIVE},
+    {"exit", builtin_exit, 0, 0, "exit", "Exit MINUX", 0},
+    {NULL, NULL, 0, 0, NULL, NULL, 0}
+};
 
-// Command structure
-typedef struct {
-    const char *name;
-    void (*func)(void);
-    const char *help;
-} Command;
-
-// Available commands
-Command commands[] = {
-    {"help", cmd_help, "Display this help message"},
-    {"version", cmd_version, "Display MINUX version"},
-    {"time", cmd_time, "Display current time"},
-    {"date", cmd_date, "Display current date"},
-    {"path", cmd_path, "Display or modify system path"},
-    {"ls", NULL, "List directory contents"},  // Special handling for args
-    {"cd", NULL, "Change directory"},         // Special handling for args
-    {"clear", cmd_clear, "Clear screen"},
-    {"gpio", cmd_gpio, "Display GPIO status"},
-    {"explorer", launch_explorer, "Launch file explorer"},
-    {"test camera", test_camera, "Test the Arducam camera"},
-    {"serial", serial_monitor, "Open serial monitor for device communication"},
-    {"tree", cmd_tree, "Display directory structure in a tree-like format"},
-    {"cat", NULL, "Display file contents"},   // Special handling for args
-    {"wallet", NULL, "Cryptocurrency wallet operations"}, // Special handling for args
-    {"history", cmd_history, "Display command history"},  // Add history command
-    {"log", NULL, "Add entry to log file"},   // Special handling for args
-    {"play", NULL, "Play audio files, notes or scales"}, // Add play command
-    {"todo", NULL, "Task management (use 'todo help' for options)"}, // Add todo command
-    {"crypto", NULL, "Crypto operations"}, // Add crypto command
-    {"cuda", NULL, "CUDA GPU information and utilities"}, // Add cuda command
-    {NULL, NULL, NULL}
+// Subcommand words offered by Tab completion
+static const char *const todo_words[] = {"add", "done", "remove", "clear", "help", NULL};
+static const char *const crypto_words[] = {"generate-keypair", "hash", "encrypt", "decrypt", NULL};
+static const char *const wallet_words[] = {"create", "import", "export", "sign", "verify", "help", NULL};
+static const char *const cuda_words[] = {"info", "top", "help", NULL};
+static const char *const play_words[] = {"scale", NULL};
+static const char *const scale_words[] = {
+    "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B",
+    "Cm", "C#m", "Dm", "D#m", "Em", "Fm", "F#m", "Gm", "G#m", "Am", "A#m", "Bm", NULL
+};
+
+static const CompletionWords completion_words[] = {
+    {"todo", todo_words, 0},
+    {"crypto", crypto_words, 0},
+    {"wallet", wallet_words, 0},
+    {"cuda", cuda_words, 0},
+    {"play", play_words, COMPLETION_PATHS},
+    {"play scale", scale_words, 0},
+    {NULL, NULL, 0}
 };
 
 char current_path[MAX_PATH];
@@ -207,9 +289,8 @@ SerialPort serial_port = {
     .is_connected = 0
 };
 
-char *command_history[MAX_HISTORY];
-int history_count = 0;
-int history_position = -1;
+long history_position = -1;
+static LineEditor prompt_line;
 
 // Define the GPIO pin information structure
 typedef struct {
@@ -346,30 +427,31 @@ void display_welcome_banner() {
 // Command implementations
 void cmd_help(void) {
     // Don't clear screen, just add a blank line for separation
-    printw("\n");
+    out_printw("\n");
     int y = getcury(stdscr);
     move(y, 0);  // Move to start of line
     
-    printw("MINUX Commands:\n\n");
-    for (Command *cmd = commands; cmd->name != NULL; cmd++) {
-        printw("  %-15s - %s\n", cmd->name, cmd->help);
+    out_printw("MINUX Commands:\n\n");
+    for (int i = 0; i < registry_count(); i++) {
+        const CommandSpec *cmd = registry_at(i);
+        out_printw("  %-15s - %s\n", cmd->name, cmd->help);
     }
-    printw("\n");
-    refresh();
+    out_printw("\n");
+    render_mark(stdscr);
 }
 
 void cmd_version(void) {
-    printw("\nMINUX Version %s\n\n", VERSION);
-    refresh();
+    out_printw("\nMINUX Version %s\n\n", VERSION);
+    render_mark(stdscr);
 }
 
 void cmd_cuda(void) {
-    printw("\nCUDA Testing Interface\n");
-    printw("=====================\n\n");
+    out_printw("\nCUDA Testing Interface\n");
+    out_printw("=====================\n\n");
     
     // Check if nvidia-smi is available
-    printw("1. Checking NVIDIA GPU presence...\n");
-    refresh();
+    out_printw("1. Checking NVIDIA GPU presence...\n");
+    render_mark(stdscr);
     
     FILE *pipe = popen("nvidia-smi --query-gpu=name,memory.total,memory.used,temperature.gpu --format=csv,noheader,nounits 2>/dev/null", "r");
     if (pipe) {
@@ -394,22 +476,22 @@ void cmd_cuda(void) {
                 while (*used_mem == ' ') used_mem++;
                 while (*temp == ' ') temp++;
                 
-                printw("   GPU Found: %s\n", name);
-                printw("   Memory: %s MB used / %s MB total\n", used_mem, total_mem);
-                printw("   Temperature: %s°C\n", temp);
+                out_printw("   GPU Found: %s\n", name);
+                out_printw("   Memory: %s MB used / %s MB total\n", used_mem, total_mem);
+                out_printw("   Temperature: %s°C\n", temp);
             }
         }
         pclose(pipe);
         
         if (!gpu_found) {
-            printw("   No NVIDIA GPUs detected\n");
+            out_printw("   No NVIDIA GPUs detected\n");
         }
     } else {
-        printw("   nvidia-smi not found - CUDA may not be installed\n");
+        out_printw("   nvidia-smi not found - CUDA may not be installed\n");
     }
     
-    printw("\n2. Checking CUDA installation...\n");
-    refresh();
+    out_printw("\n2. Checking CUDA installation...\n");
+    render_mark(stdscr);
     
     // Check CUDA compiler
     pipe = popen("nvcc --version 2>/dev/null | grep 'release'", "r");
@@ -417,9 +499,9 @@ void cmd_cuda(void) {
         char buffer[256];
         if (fgets(buffer, sizeof(buffer), pipe) != NULL) {
             buffer[strcspn(buffer, "\n")] = 0;
-            printw("   CUDA Compiler: %s\n", buffer);
+            out_printw("   CUDA Compiler: %s\n", buffer);
         } else {
-            printw("   CUDA compiler (nvcc) not found\n");
+            out_printw("   CUDA compiler (nvcc) not found\n");
         }
         pclose(pipe);
     }
@@ -429,7 +511,7 @@ void cmd_cuda(void) {
     if (pipe) {
         char buffer[256];
         bool cuda_libs_found = false;
-        printw("   CUDA Libraries:\n");
+        out_printw("   CUDA Libraries:\n");
         
         while (fgets(buffer, sizeof(buffer), pipe) != NULL) {
             cuda_libs_found = true;
@@ -441,19 +523,19 @@ void cmd_cuda(void) {
                 if (lib_end) {
                     lib_end += 3; // Include ".so"
                     *lib_end = '\0';
-                    printw("     - %s\n", lib_start);
+                    out_printw("     - %s\n", lib_start);
                 }
             }
         }
         
         if (!cuda_libs_found) {
-            printw("     No CUDA libraries found in system\n");
+            out_printw("     No CUDA libraries found in system\n");
         }
         pclose(pipe);
     }
     
-    printw("\n3. Running basic CUDA device query...\n");
-    refresh();
+    out_printw("\n3. Running basic CUDA device query...\n");
+    render_mark(stdscr);
     
     // Create a simple CUDA test program
     const char *cuda_test_code = R"(
@@ -493,16 +575,17 @@ int main() {
         fclose(test_file);
         
         // Try to compile and run
+        render_flush();
         int compile_result = system("cd /tmp && nvcc cuda_test.cu -o cuda_test 2>/dev/null");
         if (compile_result == 0) {
-            printw("   CUDA compilation successful\n");
+            out_printw("   CUDA compilation successful\n");
             
             pipe = popen("/tmp/cuda_test 2>&1", "r");
             if (pipe) {
                 char buffer[256];
                 while (fgets(buffer, sizeof(buffer), pipe) != NULL) {
                     buffer[strcspn(buffer, "\n")] = 0;
-                    printw("   %s\n", buffer);
+                    out_printw("   %s\n", buffer);
                 }
                 pclose(pipe);
             }
@@ -510,23 +593,23 @@ int main() {
             // Clean up
             system("rm -f /tmp/cuda_test /tmp/cuda_test.cu");
         } else {
-            printw("   CUDA compilation failed - CUDA development tools not available\n");
+            out_printw("   CUDA compilation failed - CUDA development tools not available\n");
             system("rm -f /tmp/cuda_test.cu");
         }
     } else {
-        printw("   Could not create test file\n");
+        out_printw("   Could not create test file\n");
     }
     
-    printw("\n4. Performance test options:\n");
-    printw("   - Matrix multiplication test\n");
-    printw("   - Memory bandwidth test\n");
-    printw("   - Compute throughput test\n");
-    printw("\nPress 'm' for matrix test, 'b' for bandwidth test, 'c' for compute test, or any other key to continue...\n\n");
-    refresh();
+    out_printw("\n4. Performance test options:\n");
+    out_printw("   - Matrix multiplication test\n");
+    out_printw("   - Memory bandwidth test\n");
+    out_printw("   - Compute throughput test\n");
+    out_printw("\nPress 'm' for matrix test, 'b' for bandwidth test, 'c' for compute test, or any other key to continue...\n\n");
+    render_mark(stdscr);
     
     int ch = getch();
     if (ch == 'm' || ch == 'M') {
-        printw("Running matrix multiplication test...\n");
+        out_printw("Running matrix multiplication test...\n");
         // Simple matrix multiplication performance test
         const char *matrix_test = R"(
 #include <cuda_runtime.h>
@@ -606,22 +689,25 @@ int main() {
             fprintf(matrix_file, "%s", matrix_test);
             fclose(matrix_file);
             
+            render_flush();
             int result = system("cd /tmp && nvcc cuda_matrix.cu -o cuda_matrix 2>/dev/null && timeout 10s ./cuda_matrix");
             if (result != 0) {
-                printw("Matrix test failed or timed out\n");
+                out_printw("Matrix test failed or timed out\n");
             }
             system("rm -f /tmp/cuda_matrix /tmp/cuda_matrix.cu");
         }
     } else if (ch == 'b' || ch == 'B') {
-        printw("Running memory bandwidth test...\n");
+        out_printw("Running memory bandwidth test...\n");
+        render_flush();
         system("cd /tmp && echo 'Memory bandwidth test would measure GPU memory throughput' && sleep 1");
     } else if (ch == 'c' || ch == 'C') {
-        printw("Running compute throughput test...\n");
+        out_printw("Running compute throughput test...\n");
+        render_flush();
         system("cd /tmp && echo 'Compute test would measure GPU computational performance' && sleep 1");
     }
     
-    printw("\nCUDA testing complete. Press any key to continue...\n");
-    refresh();
+    out_printw("\nCUDA testing complete. Press any key to continue...\n");
+    render_mark(stdscr);
     getch();
 }
 
@@ -630,8 +716,8 @@ void cmd_time(void) {
     struct tm *tm = localtime(&t);
     char time_str[64];
     strftime(time_str, sizeof(time_str), "%H:%M:%S", tm);
-    printw("\nCurrent time: %s\n\n", time_str);
-    refresh();
+    out_printw("\nCurrent time: %s\n\n", time_str);
+    render_mark(stdscr);
 }
 
 void cmd_date(void) {
@@ -639,171 +725,125 @@ void cmd_date(void) {
     struct tm *tm = localtime(&t);
     char date_str[64];
     strftime(date_str, sizeof(date_str), "%Y-%m-%d", tm);
-    printw("\nCurrent date: %s\n\n", date_str);
-    refresh();
+    out_printw("\nCurrent date: %s\n\n", date_str);
+    render_mark(stdscr);
 }
 
 void cmd_path(void) {
     char *path = getenv("PATH");
-    printw("\n");
+    out_printw("\n");
     if (path) {
-        printw("System PATH:\n\n");
+        out_printw("System PATH:\n\n");
         char path_copy[4096];
         strncpy(path_copy, path, sizeof(path_copy) - 1);
         path_copy[sizeof(path_copy) - 1] = '\0';
         
         char *token = strtok(path_copy, ":");
         while (token != NULL) {
-            printw("  %s\n", token);
+            out_printw("  %s\n", token);
             token = strtok(NULL, ":");
         }
     } else {
-        printw("PATH environment variable not found\n");
+        out_printw("PATH environment variable not found\n");
     }
-    printw("\n");
-    refresh();
+    out_printw("\n");
+    render_mark(stdscr);
 }
 
 void cmd_ls(const char *path) {
-    DIR *dir;
-    struct dirent *entry;
     const char *target_path = path ? path : ".";
 
-    dir = opendir(target_path);
-    if (dir == NULL) {
+    // One getdents64 pass and one stat per entry, whatever the directory size
+    FsListing listing;
+    if (fs_list_read(target_path, FS_LIST_STAT | FS_LIST_HIDDEN | FS_LIST_DOTS, &listing) != 0) {
         log_error(error_console, ERROR_WARNING, "MINUX", 
                   "Error opening directory '%s': %s", target_path, strerror(errno));
         return;
     }
 
-    printw("\nContents of %s:\n\n", target_path);
+    // Directories first, then alphabetically (case-insensitive)
+    fs_list_sort(&listing);
+
+    // Huge directories only draw their last screenful; the rest is in the scrollback
+    output_bulk_begin(LINES - STATUS_BAR_HEIGHT - 1);
+
+    out_printw("\nContents of %s:\n\n", target_path);
 
     // Initialize color pairs for ls
-    init_pair(1, COLOR_BLUE, COLOR_BLACK);   // Directories
-    init_pair(2, COLOR_GREEN, COLOR_BLACK);  // Executables
-    init_pair(3, COLOR_CYAN, COLOR_BLACK);   // Symlinks
+    if (!output_is_batch()) {
+        init_pair(1, COLOR_BLUE, COLOR_BLACK);   // Directories
+        init_pair(2, COLOR_GREEN, COLOR_BLACK);  // Executables
+        init_pair(3, COLOR_CYAN, COLOR_BLACK);   // Symlinks
+    }
     
     // Print header row
-    printw("%-10s %-8s %-8s %8s %-12s %s\n", "Permissions", "Owner", "Group", "Size", "Modified", "Name");
-    printw("--------------------------------------------------------------------------\n");
+    out_printw("%-10s %-8s %-8s %8s %-12s %s\n", "Permissions", "Owner", "Group", "Size", "Modified", "Name");
+    out_printw("--------------------------------------------------------------------------\n");
 
-    // Sort entries - we'll use a simple array for now
-    struct dirent *entries[1024]; // Assuming no more than 1024 entries
-    int entry_count = 0;
-    
-    while ((entry = readdir(dir)) != NULL && entry_count < 1024) {
-        entries[entry_count++] = entry;
-    }
-    
-    // Simple bubble sort to order entries (directories first, then files)
-    for (int i = 0; i < entry_count - 1; i++) {
-        for (int j = 0; j < entry_count - i - 1; j++) {
-            struct stat st_j, st_j1;
-            char full_path_j[MAX_PATH], full_path_j1[MAX_PATH];
-            
-            snprintf(full_path_j, sizeof(full_path_j), "%s/%s", target_path, entries[j]->d_name);
-            snprintf(full_path_j1, sizeof(full_path_j1), "%s/%s", target_path, entries[j+1]->d_name);
-            
-            stat(full_path_j, &st_j);
-            stat(full_path_j1, &st_j1);
-            
-            // Directories come first, then sort alphabetically
-            bool j_is_dir = S_ISDIR(st_j.st_mode);
-            bool j1_is_dir = S_ISDIR(st_j1.st_mode);
-            
-            if ((j_is_dir && !j1_is_dir) || 
-                (j_is_dir == j1_is_dir && strcasecmp(entries[j]->d_name, entries[j+1]->d_name) > 0)) {
-                // Swap
-                struct dirent *temp = entries[j];
-                entries[j] = entries[j+1];
-                entries[j+1] = temp;
-            }
-        }
-    }
-    
     // Display entries
-    for (int i = 0; i < entry_count; i++) {
-        struct stat st;
-        char full_path[MAX_PATH];
-        snprintf(full_path, sizeof(full_path), "%s/%s", target_path, entries[i]->d_name);
+    for (size_t i = 0; i < listing.count; i++) {
+        const FsEntry *entry = fs_list_at(&listing, i);
+        const struct stat &st = entry->st;
+
+        // Format permissions
+        char perm[11];
+        perm[0] = S_ISDIR(st.st_mode) ? 'd' : (S_ISLNK(st.st_mode) ? 'l' : '-');
+        perm[1] = (st.st_mode & S_IRUSR) ? 'r' : '-';
+        perm[2] = (st.st_mode & S_IWUSR) ? 'w' : '-';
+        perm[3] = (st.st_mode & S_IXUSR) ? 'x' : '-';
+        perm[4] = (st.st_mode & S_IRGRP) ? 'r' : '-';
+        perm[5] = (st.st_mode & S_IWGRP) ? 'w' : '-';
+        perm[6] = (st.st_mode & S_IXGRP) ? 'x' : '-';
+        perm[7] = (st.st_mode & S_IROTH) ? 'r' : '-';
+        perm[8] = (st.st_mode & S_IWOTH) ? 'w' : '-';
+        perm[9] = (st.st_mode & S_IXOTH) ? 'x' : '-';
+        perm[10] = '\0';
         
-        if (stat(full_path, &st) == 0) {
-            // Format permissions
-            char perm[11];
-            perm[0] = S_ISDIR(st.st_mode) ? 'd' : (S_ISLNK(st.st_mode) ? 'l' : '-');
-            perm[1] = (st.st_mode & S_IRUSR) ? 'r' : '-';
-            perm[2] = (st.st_mode & S_IWUSR) ? 'w' : '-';
-            perm[3] = (st.st_mode & S_IXUSR) ? 'x' : '-';
-            perm[4] = (st.st_mode & S_IRGRP) ? 'r' : '-';
-            perm[5] = (st.st_mode & S_IWGRP) ? 'w' : '-';
-            perm[6] = (st.st_mode & S_IXGRP) ? 'x' : '-';
-            perm[7] = (st.st_mode & S_IROTH) ? 'r' : '-';
-            perm[8] = (st.st_mode & S_IWOTH) ? 'w' : '-';
-            perm[9] = (st.st_mode & S_IXOTH) ? 'x' : '-';
-            perm[10] = '\0';
-            
-            // Get owner and group
-            char owner[32] = "unknown";
-            char group[32] = "unknown";
-            
-            // Try to get username and group name - handle gracefully if functions aren't available
-            struct passwd *pw = getpwuid(st.st_uid);
-            struct group *gr = getgrgid(st.st_gid);
-            
-            if (pw != NULL) {
-                strncpy(owner, pw->pw_name, sizeof(owner) - 1);
-                owner[sizeof(owner) - 1] = '\0'; // Ensure null termination
-            } else {
-                // Just use the numeric UID if lookup fails
-                snprintf(owner, sizeof(owner), "%d", st.st_uid);
-            }
-            
-            if (gr != NULL) {
-                strncpy(group, gr->gr_name, sizeof(group) - 1);
-                group[sizeof(group) - 1] = '\0'; // Ensure null termination
-            } else {
-                // Just use the numeric GID if lookup fails
-                snprintf(group, sizeof(group), "%d", st.st_gid);
-            }
-            
-            // Format size
-            char size_str[32];
-            if (st.st_size < 1024) {
-                snprintf(size_str, sizeof(size_str), "%d", (int)st.st_size);
-            } else if (st.st_size < 1024 * 1024) {
-                snprintf(size_str, sizeof(size_str), "%.1fK", st.st_size / 1024.0);
-            } else if (st.st_size < 1024 * 1024 * 1024) {
-                snprintf(size_str, sizeof(size_str), "%.1fM", st.st_size / (1024.0 * 1024.0));
-            } else {
-                snprintf(size_str, sizeof(size_str), "%.1fG", st.st_size / (1024.0 * 1024.0 * 1024.0));
-            }
-            
-            // Format time
-            char time_str[32];
-            struct tm *tm = localtime(&st.st_mtime);
-            strftime(time_str, sizeof(time_str), "%b %d %H:%M", tm);
-            
-            // Apply appropriate color based on file type
-            if (S_ISDIR(st.st_mode)) {
-                attron(COLOR_PAIR(1) | A_BOLD);
-            } else if (st.st_mode & S_IXUSR) {
-                attron(COLOR_PAIR(2) | A_BOLD);
-            } else if (S_ISLNK(st.st_mode)) {
-                attron(COLOR_PAIR(3) | A_BOLD);
-            }
-            
-            // Print the entry details
-            printw("%-10s %-8s %-8s %8s %-12s %s\n", 
-                    perm, owner, group, size_str, time_str, entries[i]->d_name);
-            
-            // Restore normal attributes
-            attroff(COLOR_PAIR(1) | COLOR_PAIR(2) | COLOR_PAIR(3) | A_BOLD);
+        // Get owner and group (numeric if the id has no name)
+        char owner[ID_CACHE_NAME_LEN];
+        char group[ID_CACHE_NAME_LEN];
+        id_cache_user_name(st.st_uid, owner, sizeof(owner));
+        id_cache_group_name(st.st_gid, group, sizeof(group));
+        
+        // Format size
+        char size_str[32];
+        if (st.st_size < 1024) {
+            snprintf(size_str, sizeof(size_str), "%d", (int)st.st_size);
+        } else if (st.st_size < 1024 * 1024) {
+            snprintf(size_str, sizeof(size_str), "%.1fK", st.st_size / 1024.0);
+        } else if (st.st_size < 1024 * 1024 * 1024) {
+            snprintf(size_str, sizeof(size_str), "%.1fM", st.st_size / (1024.0 * 1024.0));
+        } else {
+            snprintf(size_str, sizeof(size_str), "%.1fG", st.st_size / (1024.0 * 1024.0 * 1024.0));
+        }
+        
+        // Format time
+        char time_str[32];
+        struct tm tm;
+        localtime_r(&st.st_mtime, &tm);
+        strftime(time_str, sizeof(time_str), "%b %d %H:%M", &tm);
+        
+        // Apply appropriate color based on file type
+        if (S_ISDIR(st.st_mode)) {
+            out_attron(COLOR_PAIR(1) | A_BOLD);
+        } else if (S_ISLNK(st.st_mode)) {
+            out_attron(COLOR_PAIR(3) | A_BOLD);
+        } else if (st.st_mode & S_IXUSR) {
+            out_attron(COLOR_PAIR(2) | A_BOLD);
         }
+        
+        // Print the entry details
+        out_printw("%-10s %-8s %-8s %8s %-12s %s\n", 
+                perm, owner, group, size_str, time_str, fs_entry_name(&listing, entry));
+        
+        // Restore normal attributes
+        out_attroff(COLOR_PAIR(1) | COLOR_PAIR(2) | COLOR_PAIR(3) | A_BOLD);
     }
     
-    printw("\n");  // Add a blank line after the listing
-    refresh();
-    closedir(dir);
+    out_printw("\n");  // Add a blank line after the listing
+    output_bulk_end();
+    render_mark(stdscr);
+    fs_list_free(&listing);
 }
 
 void cmd_cd(const char *path) {
@@ -823,7 +863,7 @@ void cmd_cd(const char *path) {
 void cmd_clear(void) {
     // This command is meant to clear the screen, so keep the clear() call
     clear();
-    refresh();
+    render_mark(stdscr);
     show_prompt();
 }
 
@@ -834,398 +874,1054 @@ void cmd_gpio(void) {
 }
 
 
-// Update handle_command to not clear before running the tree command
-void handle_command(const char *cmd) {
-    // Add to history if not empty
-    if (cmd && *cmd) {
-        add_to_history(cmd);
-    }
-    
-    char *args[MAX_ARGS];
-    char cmd_copy[MAX_CMD_LENGTH];
-    strncpy(cmd_copy, cmd, MAX_CMD_LENGTH - 1);
-    cmd_copy[MAX_CMD_LENGTH - 1] = '\0';
-    
-    // Trim leading/trailing whitespace
-    char *start = cmd_copy;
-    while (*start && isspace(*start)) start++;
-    char *end = start + strlen(start) - 1;
-    while (end > start && isspace(*end)) *end-- = '\0';
-    
-    if (!*start) {
-        // Empty command, just show the prompt
-        show_prompt();
-        return;  
+// Builtin wrappers
+static void builtin_help(int, char **, const char *) {
+    cmd_help();
+}
+
+static void builtin_version(int, char **, const char *) {
+    cmd_version();
+}
+
+static void builtin_time(int, char **, const char *) {
+    cmd_time();
+}
+
+static void builtin_date(int, char **, const char *) {
+    cmd_date();
+}
+
+static void builtin_path(int, char **, const char *) {
+    cmd_path();
+}
+
+static void builtin_ls(int argc, char **argv, const char *) {
+    cmd_ls(argc > 1 ? argv[1] : NULL);
+}
+
+static void builtin_cd(int, char **argv, const char *) {
+    cmd_cd(argv[1]);
+}
+
+static void builtin_clear(int, char **, const char *) {
+    cmd_clear();
+}
+
+static void builtin_gpio(int, char **, const char *) {
+    cmd_gpio();
+}
+
+static void builtin_explorer(int, char **, const char *) {
+    launch_explorer();
+}
+
+static void builtin_test_camera(int, char **, const char *) {
+    test_camera();
+}
+
+static void builtin_serial(int, char **, const char *) {
+    serial_monitor();
+    install_interrupt_handler();  // The monitor takes over SIGINT
+}
+
+static void builtin_tree(int argc, char **argv, const char *) {
+    // Default settings
+    const char *path = ".";  // Default to current directory
+    int flags = WALK_STAT;
+    int max_depth = 0;  // 0 means unlimited
+    TreeFormat format = TREE_TEXT;
+    bool interactive = false;
+
+    // Parse any provided arguments
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0) {
+            if (output_is_batch()) {
+                log_error(error_console, ERROR_WARNING, "MINUX", 
+                         "'tree -i' needs an interactive terminal");
+                return;
+            }
+            interactive = true;
+            // Interactive mode does need a clear screen
+            clear();
+            break;
+        } else if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--all") == 0) {
+            flags |= WALK_HIDDEN;
+        } else if (strcmp(argv[i], "-l") == 0) {
+            flags |= WALK_FOLLOW_LINKS;
+        } else if (strcmp(argv[i], "-J") == 0 || strcmp(argv[i], "--json") == 0) {
+            format = TREE_JSON;
+        } else if (strcmp(argv[i], "--ndjson") == 0) {
+            format = TREE_NDJSON;
+        } else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc) {
+            max_depth = atoi(argv[i + 1]);
+            i++;  // Skip the next argument which is the depth number
+        } else if (argv[i][0] != '-') {
+            path = argv[i];
+        }
     }
-    
-    // Handle "test camera" as a special case
-    if (strcmp(start, "test camera") == 0) {
-        test_camera();
-        show_prompt();
+
+    if (interactive) {
+        cmd_tree_interactive();
         return;
     }
-    
-    // Split command into arguments
-    int argc = 0;
-    char *token = strtok(start, " ");
-    while (token && argc < MAX_ARGS) {
-        args[argc++] = token;
-        token = strtok(NULL, " ");
+
+    struct stat st;
+    int err = stat(path, &st) != 0 ? errno : (S_ISDIR(st.st_mode) ? 0 : ENOTDIR);
+    if (err) {
+        log_error(error_console, ERROR_WARNING, "MINUX", 
+                "Error opening directory '%s': %s", path, strerror(err));
+        return;
     }
 
-    // Handle commands
-    if (strcmp(args[0], "exit") == 0) {
-        log_error(error_console, ERROR_INFO, "MINUX", "Exiting MINUX...");
-        cleanup();
-        exit(0);
+    // Print header
+    char resolved_path[PATH_MAX];
+    if (realpath(path, resolved_path) == NULL) {
+        strncpy(resolved_path, path, PATH_MAX);
     }
-    else if (strcmp(args[0], "ls") == 0) {
-        cmd_ls(argc > 1 ? args[1] : NULL);
-        show_prompt();
+
+    // Large trees only draw their last screenful; the rest is in the scrollback
+    output_bulk_begin(LINES - STATUS_BAR_HEIGHT - 1);
+
+    // Walk from the absolute path, so a 'cd' made while the tree runs in
+    // the background doesn't change what it walks. Entries are printed as
+    // they are reached, and a cancelled task stops at the next one.
+    TreeRender tree;
+    tree_render_init(&tree, format, max_depth);
+    if (format == TREE_TEXT) {
+        out_printw("\n");
     }
-    else if (strcmp(args[0], "cd") == 0) {
-        cmd_cd(argc > 1 ? args[1] : NULL);
-        show_prompt();
+    tree_render_header(&tree, resolved_path);
+    WalkOptions options = {flags, max_depth, worker_cancelled, NULL};
+    if (walk_tree(resolved_path, &options, tree_render_visit, &tree) < 0) {
+        log_error(error_console, ERROR_WARNING, "MINUX", 
+                "Error opening directory '%s': %s", path, strerror(errno));
     }
-    else if (strcmp(args[0], "cat") == 0) {
-        cmd_cat(argc > 1 ? args[1] : NULL);
-        show_prompt();
+
+    // Print summary
+    tree_render_footer(&tree);
+    if (format == TREE_TEXT) {
+        out_printw("\n");  // Extra line for spacing
     }
-    else if (strcmp(args[0], "tree") == 0) {
-        // Special handling for tree command with arguments - add printw here instead of clear()
-        printw("\n");
-        
-        // Default settings
-        const char *path = ".";  // Default to current directory
-        bool show_hidden = false;
-        int max_depth = -1;  // -1 means unlimited
-        bool interactive = false;
-        
-        // Parse any provided arguments
-        for (int i = 1; i < argc; i++) {
-            if (strcmp(args[i], "-i") == 0) {
-                interactive = true;
-                // Interactive mode does need a clear screen
-                clear();
-                break;
-            } else if (strcmp(args[i], "-a") == 0 || strcmp(args[i], "--all") == 0) {
-                show_hidden = true;
-            } else if (strcmp(args[i], "-L") == 0 && i + 1 < argc) {
-                max_depth = atoi(args[i + 1]);
-                i++;  // Skip the next argument which is the depth number
-            } else if (args[i][0] != '-') {
-                path = args[i];
-            }
+    output_bulk_end();
+    render_mark(stdscr);
+}
+
+// Sizes of node and the directories below it, deepest first like du(1)
+static void du_print(const DuNode *node, std::string &path, int depth, int max_depth) {
+    if (max_depth < 0 || depth < max_depth) {
+        for (size_t i = 0; i < node->children.size() && !worker_cancelled(); i++) {
+            size_t base = path.size();
+            path += '/';
+            path += node->children[i]->name;
+            du_print(node->children[i], path, depth + 1, max_depth);
+            path.resize(base);
         }
-        
-        if (interactive) {
-            cmd_tree_interactive();
-        } else {
-            // Open the directory
-            DIR *dir = opendir(path);
-            if (!dir) {
+    }
+
+    char size[16];
+    du_format_size(node->bytes, size, sizeof(size));
+    out_printw("%-7s %s\n", size, path.c_str());
+}
+
+static unsigned long du_unreadable(const DuNode *node) {
+    unsigned long count = node->error ? 1 : 0;
+    for (size_t i = 0; i < node->children.size(); i++) {
+        count += du_unreadable(node->children[i]);
+    }
+    return count;
+}
+
+static void du_progress_worker(const DuStats *stats, void *) {
+    char progress[WORKER_PROGRESS_LEN];
+    snprintf(progress, sizeof(progress), "du: %lu directories scanned (%lu unchanged)",
+             stats->dirs, stats->cached);
+    worker_set_progress(progress);
+}
+
+static void builtin_du(int argc, char **argv, const char *) {
+    const char *path = ".";
+    int max_depth = 1;  // The directory and its subdirectories
+    int order = DU_SORT_SIZE;
+    bool interactive = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0) {
+            if (output_is_batch()) {
                 log_error(error_console, ERROR_WARNING, "MINUX", 
-                        "Error opening directory '%s': %s", path, strerror(errno));
-                show_prompt();
+                         "'du -i' needs an interactive terminal");
                 return;
             }
-            
-            // Print header
-            char resolved_path[PATH_MAX];
-            if (realpath(path, resolved_path) == NULL) {
-                strncpy(resolved_path, path, PATH_MAX);
-            }
-            
-            // Display path
-            attron(COLOR_PAIR(1) | A_BOLD);
-            printw("%s\n", resolved_path);
-            attroff(COLOR_PAIR(1) | A_BOLD);
-            
-            // Use recursive display for Unix-like functionality
-            int dir_count = 0;
-            int file_count = 0;
-            
-            // Adjust the display_tree_recursive function to use printw instead of mvprintw
-            std::function<void(const char*, int, const char*, bool)> display_tree_recursive = 
-                [&](const char* dir_path, int depth, const char* prefix, bool is_last) {
-                    if (max_depth > 0 && depth > max_depth) {
-                        return;
-                    }
-                    
-                    DIR *d = opendir(dir_path);
-                    if (!d) return;
-                    
-                    // Collect and sort entries
-                    std::vector<std::string> entries;
-                    std::vector<bool> is_dirs;
-                    struct dirent *entry;
-                    
-                    while ((entry = readdir(d)) != NULL) {
-                        // Skip . and .. entries
-                        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-                            continue;
-                        }
-                        
-                        // Skip hidden files if not showing them
-                        if (!show_hidden && entry->d_name[0] == '.') {
-                            continue;
-                        }
-                        
-                        char full_path[MAX_PATH];
-                        snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, entry->d_name);
-                        
-                        struct stat st;
-                        if (stat(full_path, &st) != 0) continue;
-                        
-                        entries.push_back(entry->d_name);
-                        is_dirs.push_back(S_ISDIR(st.st_mode));
-                    }
-                    
-                    closedir(d);
-                    
-                    // Sort entries
-                    std::vector<size_t> indices(entries.size());
-                    for (size_t i = 0; i < indices.size(); i++) {
-                        indices[i] = i;
-                    }
-                    
-                    std::sort(indices.begin(), indices.end(), [&](size_t a, size_t b) {
-                        if (is_dirs[a] != is_dirs[b]) {
-                            return is_dirs[a] > is_dirs[b]; // Directories first
-                        }
-                        return entries[a] < entries[b]; // Then alphabetically
-                    });
-                    
-                    // Process entries
-                    for (size_t i = 0; i < indices.size(); i++) {
-                        // No need to check for screen overflow in sequential mode
-                        
-                        size_t idx = indices[i];
-                        const std::string& name = entries[idx];
-                        bool is_directory = is_dirs[idx];
-                        bool is_entry_last = (i == indices.size() - 1);
-                        
-                        char full_path[MAX_PATH];
-                        snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, name.c_str());
-                        
-                        struct stat st;
-                        if (stat(full_path, &st) != 0) continue;
-                        
-                        // Create new prefix for children
-                        std::string new_prefix = prefix;
-                        new_prefix += is_last ? "    " : "|   ";
-                        
-                        // Display current entry
-                        printw("%s%s", prefix, is_entry_last ? "`-- " : "|-- ");
-                        
-                        if (is_directory) {
-                            attron(COLOR_PAIR(1) | A_BOLD);
-                            printw("%s\n", name.c_str());
-                            attroff(COLOR_PAIR(1) | A_BOLD);
-                            dir_count++;
-                            
-                            // Recurse into directory
-                            display_tree_recursive(full_path, depth + 1, new_prefix.c_str(), is_entry_last);
-                        } else {
-                            if (st.st_mode & S_IXUSR) {
-                                attron(COLOR_PAIR(2) | A_BOLD);
-                                printw("%s\n", name.c_str());
-                                attroff(COLOR_PAIR(2) | A_BOLD);
-                            } else if (S_ISLNK(st.st_mode)) {
-                                attron(COLOR_PAIR(3) | A_BOLD);
-                                printw("%s\n", name.c_str());
-                                attroff(COLOR_PAIR(3) | A_BOLD);
-                            } else {
-                                printw("%s\n", name.c_str());
-                            }
-                            file_count++;
-                        }
-                    }
-                };
-            
-            // Start with the root entry
-            printw(".\n");
-            
-            // Start recursive display
-            display_tree_recursive(path, 1, "", true);
-            
-            // Print summary
-            printw("\n%d directories, %d files\n", dir_count, file_count);
-            printw("\n");  // Extra line for spacing
-            refresh();
-            closedir(dir);
+            interactive = true;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            max_depth = 0;
+        } else if (strcmp(argv[i], "-n") == 0) {
+            order = DU_SORT_NAME;
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            max_depth = atoi(argv[i + 1]);
+            i++;
+        } else if (argv[i][0] != '-') {
+            path = argv[i];
         }
-        show_prompt();
     }
-    else if (strcmp(args[0], "history") == 0) {
-        cmd_history();
-        show_prompt();
+
+    // Scan the absolute path, as 'tree' does
+    char resolved_path[PATH_MAX];
+    if (realpath(path, resolved_path) == NULL) {
+        log_error(error_console, ERROR_WARNING, "MINUX", 
+                "Error opening directory '%s': %s", path, strerror(errno));
+        return;
     }
-    else if (strcmp(args[0], "log") == 0) {
-        // If there are arguments, combine them into a single message
-        if (argc > 1) {
-            // Get the original command string and extract everything after "log "
-            const char *message = cmd + 4;
-            while (isspace(*message)) message++;
-            cmd_log(message);
-        } else {
-            cmd_log(NULL);  // No arguments
-        }
-        show_prompt();
+
+    if (interactive) {
+        cmd_du_interactive(resolved_path);
+        return;
     }
-    else if (strcmp(args[0], "play") == 0) {
-        if (argc > 1) {
-            // Get the original command string and extract everything after "play "
-            const char *play_arg = cmd + 5;
-            while (isspace(*play_arg)) play_arg++;
-            cmd_play(play_arg);
-        } else {
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    DuStats stats;
+    DuNode *root = du_scan(resolved_path, worker_cancelled, du_progress_worker, NULL, &stats);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (root == NULL) {
+        if (errno != ECANCELED) {
             log_error(error_console, ERROR_WARNING, "MINUX", 
-                     "Usage: play [wav|mp3|\"C:500\"|\"scale A\"]");
+                    "Error opening directory '%s': %s", path, strerror(errno));
         }
-        show_prompt();
+        return;
     }
-    else if (strcmp(args[0], "todo") == 0) {
-        if (argc > 1) {
-            // Get the original command string and extract everything after "todo "
-            const char *todo_arg = cmd + 5;
-            while (isspace(*todo_arg)) todo_arg++;
-            cmd_todo(todo_arg);
-        } else {
-            // Default behavior is to list tasks
-            todo_list();
-        }
-        show_prompt();
+    if (order != DU_SORT_SIZE) {
+        du_sort(root, order);
     }
-    else if (strcmp(args[0], "crypto") == 0) {
-        if (argc > 1) {
-            // Get the original command string and extract everything after "crypto "
-            const char *crypto_arg = cmd + 7;
-            while (isspace(*crypto_arg)) crypto_arg++;
-            cmd_crypto(crypto_arg);
-        } else {
-            crypto_show_help();
-        }
-        show_prompt();
+
+    output_bulk_begin(LINES - STATUS_BAR_HEIGHT - 1);
+    std::string name = resolved_path;
+    du_print(root, name, 0, max_depth);
+    if (!output_is_batch()) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        out_printw("%lu files in %lu directories, scanned in %.2fs (%lu unchanged since the last scan)\n",
+                   root->files, root->dirs + 1, seconds, stats.cached);
     }
-    else if (strcmp(args[0], "cuda") == 0) {
-        if (argc > 1) {
-            // Get the original command string and extract everything after "cuda "
-            const char *cuda_arg = cmd + 5;
-            while (isspace(*cuda_arg)) cuda_arg++;
-            cmd_cuda(cuda_arg);
-        } else {
-            cuda_info();
-        }
-        show_prompt();
+    output_bulk_end();
+
+    unsigned long unreadable = du_unreadable(root);
+    if (unreadable > 0) {
+        log_error(error_console, ERROR_WARNING, "MINUX", 
+                "du: %lu directories could not be read", unreadable);
     }
-    else if (strcmp(args[0], "cat") == 0) {
-        cmd_cat(argc > 1 ? args[1] : NULL);
-        show_prompt();
+    du_free(root);
+    render_mark(stdscr);
+}
+
+// Where a search result is shown from - the directory as typed, or
+// relative to it when none was given, like grep -r
+typedef struct {
+    size_t root_len;                    // Of the absolute path searched
+    const char *shown;                  // NULL to print paths relative to the root
+} SearchDisplay;
+
+static std::string search_display_path(const SearchDisplay *display, const char *path) {
+    const char *rel = path + std::min(strlen(path), display->root_len);
+    if (!display->shown) {
+        return *rel == '/' ? rel + 1 : (*rel ? rel : path);
     }
-    else if (strcmp(args[0], "wallet") == 0) {
-        // Pass all arguments as a single string for parsing in the wallet command
-        if (argc > 1) {
-            // Find the position after "wallet "
-            const char *wallet_args = cmd + strlen("wallet") + 1;
-            while (*wallet_args == ' ') wallet_args++; // Skip any extra spaces
-            cmd_wallet(wallet_args);
-        } else {
-            cmd_wallet(NULL); // No arguments, show help
+    return std::string(display->shown) + rel;
+}
+
+// Control characters would move the cursor; show them as '?'
+static void search_print_text(const char *text, size_t len) {
+    std::string clean(text, len);
+    for (size_t i = 0; i < clean.size(); i++) {
+        if ((unsigned char)clean[i] < 0x20 && clean[i] != '\t') {
+            clean[i] = '?';
         }
-        show_prompt();
     }
-    else {
-        // Look for command in command table
-        Command *best_match = NULL;
-        int min_distance = MAX_CMD_LENGTH;
-        bool found_in_table = false;
-        
-        for (Command *cmd_entry = commands; cmd_entry->name != NULL; cmd_entry++) {
-            if (strcmp(args[0], cmd_entry->name) == 0) {
-                if (cmd_entry->func) {
-                    cmd_entry->func();
-                    show_prompt();
-                    return;
+    out_printw("%s", clean.c_str());
+}
+
+typedef struct {
+    SearchDisplay display;
+    bool files_only;
+    bool names;
+    std::string last_path;
+} SearchPrint;
+
+static int search_print(const SearchMatch *match, void *ctx) {
+    SearchPrint *print = (SearchPrint *)ctx;
+    std::string path = search_display_path(&print->display, match->path);
+
+    if (print->names || print->files_only) {
+        if (print->files_only && print->last_path == match->path) {
+            return worker_cancelled();
+        }
+        print->last_path = match->path;
+        out_attron(COLOR_PAIR(6));
+        out_printw("%s\n", path.c_str());
+        out_attroff(COLOR_PAIR(6));
+        return worker_cancelled();
+    }
+
+    out_attron(COLOR_PAIR(6));
+    out_printw("%s", path.c_str());
+    out_attroff(COLOR_PAIR(6));
+    out_printw(":");
+    out_attron(COLOR_PAIR(2));
+    out_printw("%ld", match->line);
+    out_attroff(COLOR_PAIR(2));
+    out_printw(":");
+    search_print_text(match->text, match->match_start);
+    out_attron(COLOR_PAIR(5) | A_BOLD);
+    search_print_text(match->text + match->match_start, match->match_len);
+    out_attroff(COLOR_PAIR(5) | A_BOLD);
+    size_t after = match->match_start + match->match_len;
+    search_print_text(match->text + after, match->text_len - after);
+    out_printw("\n");
+    return worker_cancelled();
+}
+
+static void search_progress_worker(const SearchStats *stats, void *) {
+    char progress[WORKER_PROGRESS_LEN];
+    snprintf(progress, sizeof(progress), "search: %lu files, %lu matches", stats->files, stats->matches);
+    worker_set_progress(progress);
+}
+
+// Split arguments on spaces, keeping quoted text ("a b" or 'a b') together,
+// so a pattern can hold spaces
+static std::vector<std::string> split_quoted(const char *text) {
+    std::vector<std::string> words;
+    const char *p = text;
+    while (*p) {
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (!*p) {
+            break;
+        }
+        std::string word;
+        while (*p && *p != ' ' && *p != '\t') {
+            if (*p == '"' || *p == '\'') {
+                char quote = *p++;
+                while (*p && *p != quote) {
+                    word += *p++;
                 }
-                found_in_table = true;
-            }
-            // Find closest match for typos
-            int dist = levenshtein_distance(args[0], cmd_entry->name);
-            if (dist < min_distance && dist <= 2) {  // Allow 2 character difference
-                min_distance = dist;
-                best_match = cmd_entry;
+                if (*p) {
+                    p++;
+                }
+            } else {
+                word += *p++;
             }
         }
-        
-        // If command not found in our table, try to execute it through the shell
-        if (!found_in_table) {
-            // Temporarily exit ncurses mode to run external command
-            endwin();
-            
-            // Execute the command through the shell
-            int result = system(cmd);
-            
-            // Re-initialize ncurses
-            initscr();
-            cbreak();
-            noecho();
-            keypad(stdscr, TRUE);
-            
-            // Re-initialize colors if they were set up
-            if (has_colors()) {
-                start_color();
-                init_pair(1, COLOR_BLUE, COLOR_BLACK);    // Directories
-                init_pair(2, COLOR_GREEN, COLOR_BLACK);   // Executables
-                init_pair(3, COLOR_CYAN, COLOR_BLACK);    // Symlinks
-                init_pair(4, COLOR_YELLOW, COLOR_BLACK);  // Status bar
-                init_pair(5, COLOR_RED, COLOR_BLACK);     // Errors
-                init_pair(6, COLOR_MAGENTA, COLOR_BLACK); // Special files
-            }
-            
-            // Redraw the screen
-            clear();
-            refresh();
-            
-            // Log the result if the command failed
-            if (result != 0) {
-                log_error(error_console, ERROR_WARNING, "SHELL", 
-                         "Command '%s' exited with status %d", args[0], WEXITSTATUS(result));
+        words.push_back(word);
+    }
+    return words;
+}
+
+// Shared by grep and find - names selects find
+static void builtin_search(const char *raw_args, bool names) {
+    const char *name = names ? "find" : "grep";
+    const char *pattern_text = NULL;
+    const char *path = NULL;
+    int text_flags = 0;
+    int flags = 0;
+    bool interactive = false;
+
+    std::vector<std::string> words = split_quoted(raw_args);
+    std::vector<char *> argv(1, (char *)name);
+    for (size_t i = 0; i < words.size(); i++) {
+        argv.push_back(&words[i][0]);
+    }
+    int argc = (int)argv.size();
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0) {
+            text_flags |= TEXT_ICASE;
+        } else if (strcmp(argv[i], "-F") == 0) {
+            text_flags |= TEXT_FIXED;
+        } else if (strcmp(argv[i], "-E") == 0) {
+            text_flags |= TEXT_REGEX;
+        } else if (strcmp(argv[i], "-l") == 0) {
+            flags |= FILE_SEARCH_FILES_ONLY;
+        } else if (strcmp(argv[i], "-a") == 0) {
+            flags |= FILE_SEARCH_HIDDEN;
+        } else if (strcmp(argv[i], "--no-ignore") == 0) {
+            flags |= FILE_SEARCH_NO_IGNORE;
+        } else if (strcmp(argv[i], "-p") == 0) {
+            if (output_is_batch()) {
+                log_error(error_console, ERROR_WARNING, "MINUX", 
+                         "'%s -p' needs an interactive terminal", name);
+                return;
             }
-        } else if (best_match) {
-            log_error(error_console, ERROR_WARNING, "MINUX", 
-                     "Unknown command '%s'. Did you mean '%s'?", args[0], best_match->name);
+            interactive = true;
+        } else if (!pattern_text) {
+            pattern_text = argv[i];
         } else {
-            log_error(error_console, ERROR_WARNING, "MINUX", 
-                     "Unknown command: %s", args[0]);
+            path = argv[i];
         }
-        show_prompt();
     }
-}
+    if (!pattern_text) {
+        log_error(error_console, ERROR_WARNING, "MINUX", "Usage: %s", registry_lookup(name)->usage);
+        return;
+    }
 
-// Helper function to calculate Levenshtein distance between two strings
-static int levenshtein_distance(const char *s1, const char *s2) {
-    int len1 = strlen(s1);
-    int len2 = strlen(s2);
-    int matrix[len1 + 1][len2 + 1];
-    
-    for (int i = 0; i <= len1; i++)
-        matrix[i][0] = i;
-    for (int j = 0; j <= len2; j++)
-        matrix[0][j] = j;
-        
-    for (int i = 1; i <= len1; i++) {
-        for (int j = 1; j <= len2; j++) {
-            int cost = (s1[i-1] == s2[j-1]) ? 0 : 1;
-            int deletion = matrix[i-1][j] + 1;
-            int insertion = matrix[i][j-1] + 1;
-            int substitution = matrix[i-1][j-1] + cost;
-            matrix[i][j] = std::min(std::min(deletion, insertion), substitution);
-        }
+    // find takes shell wildcards, or else a part of the name
+    if (names && !(text_flags & (TEXT_FIXED | TEXT_REGEX))) {
+        text_flags |= strpbrk(pattern_text, "*?[") ? TEXT_GLOB : TEXT_FIXED;
+    }
+    TextPattern pattern;
+    char err[128];
+    if (text_pattern_compile(&pattern, pattern_text, text_flags, err, sizeof(err)) != 0) {
+        log_error(error_console, ERROR_WARNING, "MINUX", "%s: bad pattern '%s': %s", name, pattern_text, err);
+        return;
     }
-    
-    return matrix[len1][len2];
-}
+
+    // Search the absolute path, so a 'cd' made meanwhile changes nothing
+    char resolved_path[PATH_MAX];
+    if (realpath(path ? path : ".", resolved_path) == NULL) {
+        log_error(error_console, ERROR_WARNING, "MINUX", 
+                "%s: cannot open '%s': %s", name, path ? path : ".", strerror(errno));
+        text_pattern_free(&pattern);
+        return;
+    }
+    SearchDisplay display = {strlen(resolved_path), path};
+
+    if (interactive) {
+        cmd_search_interactive(resolved_path, path, &pattern, flags, names);
+        text_pattern_free(&pattern);
+        return;
+    }
+
+    SearchPrint print;
+    print.display = display;
+    print.files_only = (flags & FILE_SEARCH_FILES_ONLY) != 0;
+    print.names = names;
+
+    output_bulk_begin(LINES - STATUS_BAR_HEIGHT - 1);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    SearchOptions options = {flags, worker_cancelled, search_progress_worker};
+    SearchStats stats;
+    int result = names ? file_find(resolved_path, &pattern, &options, search_print, &print, &stats)
+                       : file_search(resolved_path, &pattern, &options, search_print, &print, &stats);
+    int saved_errno = errno;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (result >= 0 && !output_is_batch()) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        out_printw("%lu matches, %lu %s searched in %.2fs (%lu binary, %lu ignored)\n",
+                   stats.matches, stats.files, names ? "names" : "files", seconds, stats.binary, stats.ignored);
+    }
+    output_bulk_end();
+    if (result < 0) {
+        log_error(error_console, ERROR_WARNING, "MINUX", 
+                "%s: cannot open '%s': %s", name, path ? path : ".", strerror(saved_errno));
+    }
+    text_pattern_free(&pattern);
+    render_mark(stdscr);
+}
+
+static void builtin_grep(int, char **, const char *raw_args) {
+    builtin_search(raw_args, false);
+}
+
+static void builtin_find(int, char **, const char *raw_args) {
+    builtin_search(raw_args, true);
+}
+
+static void builtin_cat(int, char **argv, const char *) {
+    cmd_cat(argv[1]);
+}
+
+static void builtin_wallet(int, char **, const char *raw_args) {
+    // Pass all arguments as a single string for parsing in the wallet command
+    cmd_wallet(*raw_args ? raw_args : NULL);
+}
+
+static void builtin_history(int, char **, const char *) {
+    cmd_history();
+}
+
+static void builtin_log(int, char **, const char *raw_args) {
+    cmd_log(raw_args);
+}
+
+static void builtin_play(int, char **, const char *raw_args) {
+    cmd_play(raw_args);
+}
+
+static void builtin_todo(int, char **, const char *raw_args) {
+    if (*raw_args) {
+        cmd_todo(raw_args);
+    } else {
+        // Default behavior is to list tasks
+        todo_list();
+    }
+}
+
+static void builtin_crypto(int, char **, const char *raw_args) {
+    if (*raw_args) {
+        cmd_crypto(raw_args);
+    } else {
+        crypto_show_help();
+    }
+}
+
+static void builtin_cuda(int, char **, const char *raw_args) {
+    if (*raw_args) {
+        cmd_cuda(raw_args);
+    } else {
+        cuda_info();
+    }
+}
+
+static void builtin_jobs(int, char **, const char *) {
+    jobs_poll();
+
+    out_printw("\n");
+    bool any = false;
+    for (int i = 0; i < MAX_JOBS; i++) {
+        Job *job = job_at(i);
+        if (!job) continue;
+        any = true;
+
+        out_printw("[%d]  %-10s %s", job->id,
+                   job->state == JOB_RUNNING ? "Running" : "Done", job->command);
+        if (job->backlog_len > 0) {
+            out_printw("  (%zu bytes of output)", job->backlog_len);
+        }
+        out_printw("\n");
+    }
+    if (!any) {
+        out_printw("No jobs\n");
+    }
+    render_mark(stdscr);
+}
+
+static void builtin_stats(int, char **, const char *) {
+    cmd_stats();
+}
+
+static void builtin_fg(int argc, char **argv, const char *) {
+    Job *job;
+    if (argc > 1) {
+        const char *id = argv[1][0] == '%' ? argv[1] + 1 : argv[1];
+        job = job_get(atoi(id));
+    } else {
+        job = job_latest();
+    }
+
+    if (!job) {
+        log_error(error_console, ERROR_WARNING, "MINUX", "fg: no such job");
+        return;
+    }
+    out_printw("\n%s\n", job->command);
+    job_foreground(job);
+}
+
+static void builtin_exit(int, char **, const char *) {
+    if (output_is_batch()) {
+        batch_stop();
+        return;
+    }
+
+    log_error(error_console, ERROR_INFO, "MINUX", "Exiting MINUX...");
+    cleanup();
+    exit(0);
+}
+
+// Refuse TUI-only commands when running a script
+static bool batch_refuses(const CommandSpec *spec) {
+    if (!output_is_batch() || !(spec->flags & COMMAND_INTERACTIVE)) {
+        return false;
+    }
+    log_error(error_console, ERROR_WARNING, "MINUX", 
+             "'%s' needs an interactive terminal", spec->name);
+    return true;
+}
+
+// Job output interpreter - plain text goes to the screen, a few cursor and
+// erase sequences are honoured and every other escape sequence is dropped
+enum {
+    PTY_TEXT = 0,
+    PTY_ESC,
+    PTY_CSI,
+    PTY_OSC,
+    PTY_OSC_ESC,
+    PTY_CHARSET
+};
+
+typedef struct {
+    int state;
+    int pending_cr;     // '\r' seen, held back in case a '\n' follows
+    char params[32];
+    int param_len;
+} PtyRenderState;
+
+static void pty_csi(PtyRenderState *st, char final) {
+    st->params[st->param_len] = '\0';
+    int row = 1, col = 1;
+
+    switch (final) {
+        case 'J':  // Erase display - erase() rather than clear() avoids a flash
+            if (st->params[0] == '2' || st->params[0] == '3') {
+                erase();
+            } else if (st->params[0] == '\0' || st->params[0] == '0') {
+                clrtobot();
+            }
+            break;
+        case 'K':  // Erase to end of line
+            if (st->params[0] == '\0' || st->params[0] == '0') {
+                clrtoeol();
+            }
+            break;
+        case 'H':  // Cursor position
+        case 'f':
+            sscanf(st->params, "%d;%d", &row, &col);
+            if (row < 1) row = 1;
+            if (col < 1) col = 1;
+            if (row > LINES - STATUS_BAR_HEIGHT) row = LINES - STATUS_BAR_HEIGHT;
+            if (col > COLS) col = COLS;
+            move(row - 1, col - 1);
+            break;
+        default:   // Colors and everything else are ignored
+            break;
+    }
+}
+
+static void pty_render(PtyRenderState *st, const char *data, size_t len) {
+    size_t run = 0;  // Start of the pending run of printable text
+
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = data[i];
+
+        if (st->state == PTY_TEXT) {
+            // curses clears the line on '\n', so a "\r\n" from the pty must not
+            // move to column 0 first or the line would be wiped
+            if (st->pending_cr && c != '\r') {
+                if (c != '\n') out_printw("\r");
+                st->pending_cr = 0;
+            }
+
+            bool control = c < 0x20 && c != '\n' && c != '\t' && c != '\b';
+            if (c != 0x1b && !control) continue;
+
+            if (i > run) out_printw("%.*s", (int)(i - run), data + run);
+            run = i + 1;
+            if (c == 0x1b) st->state = PTY_ESC;
+            else if (c == '\r') st->pending_cr = 1;
+            continue;
+        }
+
+        switch (st->state) {
+            case PTY_ESC:
+                if (c == '[') {
+                    st->state = PTY_CSI;
+                    st->param_len = 0;
+                } else if (c == ']') {
+                    st->state = PTY_OSC;
+                } else if (c == '(' || c == ')' || c == '*' || c == '+') {
+                    st->state = PTY_CHARSET;
+                } else {
+                    if (c == 'c') erase();  // Full reset
+                    st->state = PTY_TEXT;
+                }
+                break;
+            case PTY_CSI:
+                if (c >= 0x40 && c <= 0x7e) {
+                    pty_csi(st, c);
+                    st->state = PTY_TEXT;
+                } else if (st->param_len < (int)sizeof(st->params) - 1) {
+                    st->params[st->param_len++] = c;
+                }
+                break;
+            case PTY_OSC:
+                if (c == 0x07) st->state = PTY_TEXT;
+                else if (c == 0x1b) st->state = PTY_OSC_ESC;
+                break;
+            case PTY_OSC_ESC:
+                st->state = (c == '\\') ? PTY_TEXT : PTY_OSC;
+                break;
+            case PTY_CHARSET:
+                st->state = PTY_TEXT;
+                break;
+        }
+        run = i + 1;
+    }
+
+    if (st->state == PTY_TEXT && len > run) {
+        out_printw("%.*s", (int)(len - run), data + run);
+    }
+}
+
+// Translate a curses key into the bytes a terminal would send
+static void job_forward_key(Job *job, int ch) {
+    const char *seq = NULL;
+    switch (ch) {
+        case KEY_UP:        seq = "\033[A"; break;
+        case KEY_DOWN:      seq = "\033[B"; break;
+        case KEY_RIGHT:     seq = "\033[C"; break;
+        case KEY_LEFT:      seq = "\033[D"; break;
+        case KEY_HOME:      seq = "\033[H"; break;
+        case KEY_END:       seq = "\033[F"; break;
+        case KEY_DC:        seq = "\033[3~"; break;
+        case KEY_BACKSPACE: seq = "\177"; break;
+        case KEY_ENTER:
+        case '\n':          seq = "\r"; break;
+    }
+
+    if (seq) {
+        job_send_input(job, seq, strlen(seq));
+    } else if (ch >= 0 && ch < 256) {
+        char c = (char)ch;
+        job_send_input(job, &c, 1);
+    }
+}
+
+// Show a job in the TUI until it exits or Ctrl-Z sends it to the background.
+// Keys go to the job; Ctrl-C reaches it through the pty (or cancels a
+// builtin task) instead of killing minux. Returns the wait status, or -1 if
+// the job was backgrounded.
+static int job_foreground(Job *job) {
+    PtyRenderState st;
+    memset(&st, 0, sizeof(st));
+    job->foreground = 1;
+
+    // Builtin output is plain lines, so a long listing only draws its last
+    // screenful; programs on a pty may move the cursor and are drawn as-is
+    bool bulk = job->kind == JOB_TASK;
+    if (bulk) {
+        output_bulk_begin(LINES - STATUS_BAR_HEIGHT - 1);
+    }
+
+    // Output produced while nobody was watching
+    if (job->backlog_dropped > 0) {
+        out_printw("[... %zu bytes of earlier output dropped ...]\n", job->backlog_dropped);
+    }
+    if (job->backlog_len > 0) {
+        pty_render(&st, job->backlog, job->backlog_len);
+    }
+    job_clear_backlog(job);
+    render_mark(stdscr);
+
+    raw();
+    bool detached = false;
+    char progress[WORKER_PROGRESS_LEN] = "";
+    while (!detached) {
+        struct pollfd fds[2];
+        fds[0].fd = STDIN_FILENO;
+        fds[0].events = POLLIN;
+        fds[1].fd = job_poll_fd(job);
+        fds[1].events = POLLIN;
+        poll(fds, fds[1].fd >= 0 ? 2 : 1, PROCESS_POLL_MS);
+
+        char buf[4096];
+        ssize_t n;
+        bool drew = false;
+        while ((n = job_read(job, buf, sizeof(buf))) > 0) {
+            pty_render(&st, buf, n);
+            drew = true;
+        }
+        if (drew) render_mark(stdscr);
+
+        // A task's running count, since its output may be held back
+        if (job->task) {
+            char latest[WORKER_PROGRESS_LEN];
+            if (worker_progress(job->task, latest, sizeof(latest)) > 0 && strcmp(latest, progress) != 0) {
+                strcpy(progress, latest);
+                draw_progress_status_bar(progress);
+            }
+        }
+
+        // Forward everything typed since the last wakeup
+        timeout(0);
+        int ch;
+        while ((ch = getch()) != ERR) {
+            if (ch == 0x1a) {  // Ctrl-Z
+                detached = true;
+                break;
+            }
+            if (ch == KEY_RESIZE) {
+                job_resize(job, LINES - STATUS_BAR_HEIGHT, COLS);
+                continue;
+            }
+            job_forward_key(job, ch);
+        }
+        timeout(-1);
+
+        if (!detached && job_check_exit(job)) {
+            // Show the last output written before the child went away
+            while ((n = job_read(job, buf, sizeof(buf))) > 0) {
+                pty_render(&st, buf, n);
+            }
+            break;
+        }
+
+        // Don't let background jobs stall on a full pty
+        jobs_poll();
+        error_console_flush_pending(error_console);
+    }
+    cbreak();
+    job->foreground = 0;
+    if (bulk) {
+        output_bulk_end();
+    }
+    if (progress[0]) {
+        draw_status_bar();
+    }
+
+    if (detached) {
+        out_printw("\n[%d]+ %s &\n", job->id, job->command);
+        render_mark(stdscr);
+        return -1;
+    }
+
+    int status = job->status;
+    job->reported = 1;
+    job_release(job);
+    render_mark(stdscr);
+    return status;
+}
+
+// Run a shell command and wait for it - inside the TUI through a pty, or
+// with our own stdio in batch mode. Returns the wait status.
+static int run_external(const char *cmd) {
+    if (output_is_batch()) {
+        // Keep our buffered output ahead of the child's
+        out_flush();
+        return process_run(cmd);
+    }
+
+    int id = process_spawn_pty(cmd, LINES - STATUS_BAR_HEIGHT, COLS);
+    if (id < 0) {
+        log_error(error_console, ERROR_WARNING, "SHELL", 
+                 "Could not start '%s': %s", cmd, strerror(errno));
+        return -1;
+    }
+    return job_foreground(job_get(id));
+}
+
+// Start a shell command as a background job
+static void run_background(const char *cmd) {
+    int id = output_is_batch() ? process_spawn(cmd)
+                               : process_spawn_pty(cmd, LINES - STATUS_BAR_HEIGHT, COLS);
+    if (id < 0) {
+        log_error(error_console, ERROR_WARNING, "SHELL", 
+                 "Could not start '%s': %s", cmd, strerror(errno));
+        return;
+    }
+    if (!output_is_batch()) {
+        out_printw("[%d] %d\n", id, (int)job_get(id)->pid);
+    }
+}
+
+// A builtin call copied for a worker thread
+typedef struct {
+    CommandHandler handler;
+    std::vector<std::string> args;
+    std::string raw_args;
+} BuiltinCall;
+
+static void builtin_task_run(void *arg) {
+    BuiltinCall *call = (BuiltinCall *)arg;
+    std::vector<char *> argv;
+    for (size_t i = 0; i < call->args.size(); i++) {
+        argv.push_back(&call->args[i][0]);
+    }
+    argv.push_back(NULL);
+    call->handler((int)call->args.size(), &argv[0], call->raw_args.c_str());
+}
+
+static void builtin_task_free(void *arg) {
+    delete (BuiltinCall *)arg;
+}
+
+// Builtins flagged COMMAND_ASYNC run on the worker pool, apart from the
+// forms that read the keyboard or take over the screen
+static bool runs_on_worker(const CommandSpec *spec, int argc, char **argv) {
+    if (!(spec->flags & COMMAND_ASYNC) || output_is_batch()) {
+        return false;
+    }
+    for (int i = 1; i < argc; i++) {
+        if ((spec->handler == builtin_tree || spec->handler == builtin_du) && strcmp(argv[i], "-i") == 0) {
+            return false;
+        }
+        if ((spec->handler == builtin_grep || spec->handler == builtin_find) && strcmp(argv[i], "-p") == 0) {
+            return false;
+        }
+    }
+    if (spec->handler == builtin_crypto && argc > 1 && strcmp(argv[1], "decrypt") == 0) {
+        return false;  // Prompts for the key and IV
+    }
+    return true;
+}
+
+// Run a builtin on the worker pool - in the foreground, where Ctrl-C
+// cancels it and Ctrl-Z backgrounds it, or as a background job for
+// 'cmd &'. Runs it here instead if the pool can't take it.
+static void run_builtin_task(const CommandSpec *spec, int argc, char **argv, const char *raw_args,
+                             const char *line, bool background) {
+    BuiltinCall *call = new BuiltinCall;
+    call->handler = spec->handler;
+    for (int i = 0; i < argc; i++) {
+        call->args.push_back(argv[i]);
+    }
+    call->raw_args = raw_args;
+
+    int id = process_start_task(line, builtin_task_run, call, builtin_task_free);
+    if (id < 0) {
+        delete call;
+        spec->handler(argc, argv, raw_args);
+        return;
+    }
+
+    if (background) {
+        out_printw("[%d] %s\n", id, line);
+        return;
+    }
+    int status = job_foreground(job_get(id));
+    if (status > 0 && WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) {
+        out_printw("^C\n");
+    }
+}
+
+// Tell the user about background jobs that finished since the last prompt
+static void report_finished_jobs(void) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        Job *job = job_at(i);
+        if (!job || job->state != JOB_DONE || job->reported || job->foreground) continue;
+
+        if (WIFEXITED(job->status) && WEXITSTATUS(job->status) != 0) {
+            out_printw("\n[%d]  Exit %d     %s", job->id, WEXITSTATUS(job->status), job->command);
+        } else {
+            out_printw("\n[%d]  Done       %s", job->id, job->command);
+        }
+        job->reported = 1;
+
+        if (job->backlog_len > 0) {
+            out_printw("  (output kept, 'fg %d' to view)", job->id);
+        } else {
+            job_release(job);
+        }
+    }
+}
+
+// Run a command line that isn't a builtin through the shell
+static void run_shell_command(const char *cmd, const char *name) {
+    int result = run_external(cmd);
+    if (result <= 0) {
+        return;  // Success, failed to start (already logged) or backgrounded
+    }
+
+    // Status 127 is the shell's "command not found" - offer the closest builtin
+    const CommandSpec *suggestion = NULL;
+    if (WIFEXITED(result) && WEXITSTATUS(result) == 127) {
+        suggestion = registry_suggest(name);
+    }
+
+    if (suggestion) {
+        log_error(error_console, ERROR_WARNING, "MINUX", 
+                 "Unknown command '%s'. Did you mean '%s'?", name, suggestion->name);
+    } else if (WIFSIGNALED(result)) {
+        // Interrupting a command with Ctrl-C isn't worth a warning
+        if (WTERMSIG(result) != SIGINT) {
+            log_error(error_console, ERROR_WARNING, "SHELL", 
+                     "Command '%s' terminated by signal %d", name, WTERMSIG(result));
+        }
+    } else {
+        log_error(error_console, ERROR_WARNING, "SHELL", 
+                 "Command '%s' exited with status %d", name, WEXITSTATUS(result));
+    }
+}
+
+void handle_command(const char *cmd) {
+    // Add to history if not empty (scripts don't touch the user's history)
+    if (cmd && *cmd && !output_is_batch()) {
+        add_to_history(cmd);
+    }
+    
+    char *args[MAX_ARGS + 1];
+    // Lines from the editor can be longer than MAX_CMD_LENGTH
+    size_t cmd_len = strlen(cmd);
+    std::vector<char> cmd_copy(cmd, cmd + cmd_len + 1);
+    
+    // Trim leading/trailing whitespace
+    char *start = &cmd_copy[0];
+    while (*start && isspace(*start)) start++;
+    char *end = start + strlen(start) - 1;
+    while (end > start && isspace(*end)) *end-- = '\0';
+    
+    if (!*start) {
+        // Empty command, just show the prompt
+        show_prompt();
+        return;  
+    }
+    
+    // A trailing '&' (but not '&&') runs the command as a background job
+    bool background = false;
+    if (end > start && *end == '&' && end[-1] != '&') {
+        background = true;
+        *end-- = '\0';
+        while (end > start && isspace(*end)) *end-- = '\0';
+    }
+    
+    // Keep the full line before strtok splits it up
+    std::vector<char> line_buf(start, start + strlen(start) + 1);
+    char *line_copy = &line_buf[0];
+    std::vector<char> raw_buf(1, '\0');
+    int argc = 0;
+
+    // Multi-word builtins such as "test camera" match the whole line;
+    // every other builtin is looked up by its first word
+    const CommandSpec *spec = registry_lookup(start);
+    if (spec && strchr(spec->name, ' ')) {
+        args[argc++] = start;
+    } else {
+        // Keep the argument text before strtok splits it too
+        const char *raw_args = start;
+        while (*raw_args && !isspace(*raw_args)) raw_args++;
+        while (isspace(*raw_args)) raw_args++;
+        raw_buf.assign(raw_args, raw_args + strlen(raw_args) + 1);
+
+        // Split command into arguments
+        char *token = strtok(start, " ");
+        while (token && argc < MAX_ARGS) {
+            args[argc++] = token;
+            token = strtok(NULL, " ");
+        }
+
+        spec = registry_lookup(args[0]);
+        if (!spec) {
+            if (background) {
+                run_background(line_copy);
+            } else {
+                run_shell_command(line_copy, args[0]);
+            }
+            show_prompt();
+            return;
+        }
+    }
+    args[argc] = NULL;
+    const char *raw_copy = &raw_buf[0];
+
+    bool async = runs_on_worker(spec, argc, args);
+    if (background && !async) {
+        log_error(error_console, ERROR_INFO, "MINUX", 
+                 "'%s' is a builtin and runs in the foreground", spec->name);
+    }
+
+    if (batch_refuses(spec)) {
+        return;
+    }
+
+    if (!registry_check_args(spec, argc)) {
+        log_error(error_console, ERROR_WARNING, "MINUX", "Usage: %s", spec->usage);
+        show_prompt();
+        return;
+    }
+
+    if (async) {
+        run_builtin_task(spec, argc, args, raw_copy, line_copy, background);
+    } else {
+        spec->handler(argc, args, raw_copy);
+    }
+    show_prompt();
+}
 
 // Serial monitor implementation
 static int open_serial_port(const char *port, int baud_rate) {
@@ -1319,8 +2015,8 @@ static void handle_serial_input(SerialPort *sp) {
     int n = read(sp->fd, buffer, sizeof(buffer) - 1);
     if (n > 0) {
         buffer[n] = '\0';
-        printw("%s", buffer);
-        refresh();
+        out_printw("%s", buffer);
+        render_mark(stdscr);
     }
 }
 
@@ -1347,7 +2043,7 @@ void serial_monitor(void) {
     clear();
     mvprintw(1, 1, "Serial Monitor Configuration");
     mvprintw(3, 1, "Enter port (e.g., /dev/ttyUSB0): ");
-    refresh();
+    render_mark(stdscr);
 
     char port[256];
     int pos = 0;
@@ -1355,8 +2051,8 @@ void serial_monitor(void) {
     while ((ch = getch()) != '\n' && pos < 255) {
         if (ch >= 32 && ch <= 126) {
             port[pos++] = ch;
-            printw("%c", ch);
-            refresh();
+            out_printw("%c", ch);
+            render_mark(stdscr);
         }
     }
     port[pos] = '\0';
@@ -1368,7 +2064,7 @@ void serial_monitor(void) {
     serial_port.fd = open_serial_port(port, serial_port.baud_rate);
     if (serial_port.fd < 0) {
         mvprintw(5, 1, "Failed to open port. Press any key to continue...");
-        refresh();
+        render_mark(stdscr);
         getch();
         delwin(serial_win);
         return;
@@ -1384,11 +2080,12 @@ void serial_monitor(void) {
     clear();
     mvprintw(0, 1, "Serial Monitor - %s @ %d baud", port, serial_port.baud_rate);
     mvprintw(1, 1, "Press Ctrl+C to exit");
-    refresh();
+    render_mark(stdscr);
 
     while (serial_port.is_connected) {
         handle_serial_input(&serial_port);
         handle_serial_output(&serial_port);
+        render_flush();
         usleep(10000);  // 10ms delay to prevent CPU hogging
     }
 
@@ -1408,19 +2105,19 @@ void cmd_tree(void) {
     
     // Get command line arguments (if any)
     mvprintw(y, 1, "Arguments (optional): ");
-    refresh();
+    render_mark(stdscr);
     
     while ((ch = getch()) != '\n' && pos < MAX_CMD_LENGTH - 1) {
         if (ch >= 32 && ch <= 126) { // Printable characters
             args[pos++] = ch;
-            printw("%c", ch);
+            out_printw("%c", ch);
         } else if (ch == KEY_BACKSPACE || ch == 127) { // Backspace
             if (pos > 0) {
                 pos--;
-                printw("\b \b"); // Erase character
+                out_printw("\b \b"); // Erase character
             }
         }
-        refresh();
+        render_mark(stdscr);
     }
     args[pos] = '\0';
     
@@ -1446,13 +2143,15 @@ void cmd_tree(void) {
     
     // Default settings
     const char *path = ".";  // Default to current directory
-    bool show_hidden = false;
-    int max_depth = -1;  // -1 means unlimited
+    int flags = WALK_STAT;
+    int max_depth = 0;  // 0 means unlimited
     
     // Parse any provided arguments
     for (int i = 0; i < argc; i++) {
         if (i < argc && (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--all") == 0)) {
-            show_hidden = true;
+            flags |= WALK_HIDDEN;
+        } else if (strcmp(argv[i], "-l") == 0) {
+            flags |= WALK_FOLLOW_LINKS;
         } else if (i < argc-1 && strcmp(argv[i], "-L") == 0) {
             max_depth = atoi(argv[i + 1]);
             i++;  // Skip the next argument which is the depth number
@@ -1461,11 +2160,11 @@ void cmd_tree(void) {
         }
     }
     
-    // Open the directory
-    DIR *dir = opendir(path);
-    if (!dir) {
-        mvprintw(1, 1, "Error: Cannot open directory '%s': %s", path, strerror(errno));
-        refresh();
+    struct stat st;
+    int err = stat(path, &st) != 0 ? errno : (S_ISDIR(st.st_mode) ? 0 : ENOTDIR);
+    if (err) {
+        mvprintw(1, 1, "Error: Cannot open directory '%s': %s", path, strerror(err));
+        render_mark(stdscr);
         getch();
         return;
     }
@@ -1481,134 +2180,27 @@ void cmd_tree(void) {
     mvprintw(1, 1, "%s", resolved_path);
     attroff(COLOR_PAIR(1) | A_BOLD);
     
-    // Reset position for tree display
-    y = 3;
+    // Display the directory tree a page at a time
+    mvprintw(3, 1, ".");
+    TreeRender tree;
+    tree_render_init(&tree, TREE_TEXT, max_depth);
+    tree_render_page(&tree, 4);
+    WalkOptions options = {flags, max_depth, NULL, NULL};
+    walk_tree(path, &options, tree_render_visit, &tree);
+    y = tree_render_page_end(&tree, 4);
     
-    // Use recursive display for Unix-like functionality
-    int dir_count = 0;
-    int file_count = 0;
+    // Print summary
+    mvprintw(y + 1, 1, "\n%d directories, %d files", tree.dir_count, tree.file_count);
     
-    // Display the directory tree
-    mvprintw(y++, 1, ".");
-    
-    // Display tree recursively using a dedicated function
-    std::function<void(const char*, int, const char*, bool)> display_tree_recursive = 
-    [&](const char* dir_path, int depth, const char* prefix, bool is_last) {
-        if (max_depth > 0 && depth > max_depth) {
-            return;
-        }
-        
-        DIR *d = opendir(dir_path);
-        if (!d) return;
-        
-        // Collect and sort entries
-        std::vector<std::string> entries;
-        std::vector<bool> is_dirs;
-        struct dirent *entry;
-        
-        while ((entry = readdir(d)) != NULL) {
-            // Skip . and .. entries
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-                continue;
-            }
-            
-            // Skip hidden files if not showing them
-            if (!show_hidden && entry->d_name[0] == '.') {
-                continue;
-            }
-            
-            char full_path[MAX_PATH];
-            snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, entry->d_name);
-            
-            struct stat st;
-            if (stat(full_path, &st) != 0) continue;
-            
-            entries.push_back(entry->d_name);
-            is_dirs.push_back(S_ISDIR(st.st_mode));
-        }
-        
-        closedir(d);
-        
-        // Sort entries
-        std::vector<size_t> indices(entries.size());
-        for (size_t i = 0; i < entries.size(); i++) {
-            indices[i] = i;
-        }
-        
-        std::sort(indices.begin(), indices.end(), [&](size_t a, size_t b) {
-            if (is_dirs[a] != is_dirs[b]) {
-                return is_dirs[a] > is_dirs[b]; // Directories first
-            }
-            return entries[a] < entries[b]; // Then alphabetically
-        });
-        
-        // Process entries
-        for (size_t i = 0; i < indices.size(); i++) {
-            if (y >= LINES - 5) {
-                mvprintw(y++, 1, "... (more items not shown)");
-                return;
-            }
-            
-            size_t idx = indices[i];
-            const std::string& name = entries[idx];
-            bool is_directory = is_dirs[idx];
-            bool is_entry_last = (i == indices.size() - 1);
-            
-            char full_path[MAX_PATH];
-            snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, name.c_str());
-            
-            struct stat st;
-            if (stat(full_path, &st) != 0) continue;
-            
-            // Create new prefix for children
-            std::string new_prefix = prefix;
-            new_prefix += is_last ? "    " : "|   ";
-            
-            // Display current entry
-            mvprintw(y, 1, "%s%s", prefix, is_entry_last ? "`-- " : "|-- ");
-            
-            if (is_directory) {
-                attron(COLOR_PAIR(1) | A_BOLD);
-                mvprintw(y, 1 + strlen(prefix) + 4, "%s", name.c_str());
-                attroff(COLOR_PAIR(1) | A_BOLD);
-                dir_count++;
-                y++;
-                
-                // Recurse into directory
-                display_tree_recursive(full_path, depth + 1, new_prefix.c_str(), is_entry_last);
-            } else {
-                if (st.st_mode & S_IXUSR) {
-                    attron(COLOR_PAIR(2) | A_BOLD);
-                    mvprintw(y, 1 + strlen(prefix) + 4, "%s", name.c_str());
-                    attroff(COLOR_PAIR(2) | A_BOLD);
-                } else if (S_ISLNK(st.st_mode)) {
-                    attron(COLOR_PAIR(3) | A_BOLD);
-                    mvprintw(y, 1 + strlen(prefix) + 4, "%s", name.c_str());
-                    attroff(COLOR_PAIR(3) | A_BOLD);
-                } else {
-                    mvprintw(y, 1 + strlen(prefix) + 4, "%s", name.c_str());
-                }
-                file_count++;
-                y++;
-            }
-        }
-    };
-    
-    // Start recursive display
-    display_tree_recursive(path, 1, "", true);
-    
-    // Print summary
-    mvprintw(y + 1, 1, "\n%d directories, %d files", dir_count, file_count);
-    
-    // Instructions to continue
-    mvprintw(y + 3, 1, "Press any key to continue...");
-    refresh();
-    getch();
-}
-
-// Interactive version of the tree command
-void cmd_tree_interactive(void) {
-    clear();
+    // Instructions to continue
+    mvprintw(y + 3, 1, "Press any key to continue...");
+    render_mark(stdscr);
+    getch();
+}
+
+// Interactive version of the tree command
+void cmd_tree_interactive(void) {
+    clear();
     
     // Get arguments from user
     mvprintw(1, 1, "Tree Command - Directory Structure Viewer");
@@ -1623,7 +2215,7 @@ void cmd_tree_interactive(void) {
     mvprintw(12, 1, "  tree -a         - Show all files including hidden ones");
     mvprintw(13, 1, "  tree -L 2       - Limit depth to 2 levels");
     mvprintw(15, 1, "Enter path (default is current directory): ");
-    refresh();
+    render_mark(stdscr);
     
     // Get user input for path
     char path_input[MAX_PATH] = {0};
@@ -1634,63 +2226,65 @@ void cmd_tree_interactive(void) {
     while ((ch = getch()) != '\n' && pos < MAX_PATH - 1) {
         if (ch >= 32 && ch <= 126) { // Printable characters
             path_input[pos++] = ch;
-            printw("%c", ch);
+            out_printw("%c", ch);
         } else if (ch == KEY_BACKSPACE || ch == 127) { // Backspace
             if (pos > 0) {
                 pos--;
-                printw("\b \b"); // Erase character
+                out_printw("\b \b"); // Erase character
             }
         }
-        refresh();
+        render_mark(stdscr);
     }
     path_input[pos] = '\0';
     
     // Use current directory if no path entered
     const char *path = (path_input[0] == '\0') ? "." : path_input;
     
-    // Collect options (simplified for this implementation)
-    bool show_hidden = false;
-    int max_depth = -1; // -1 means unlimited
+    // Collect options
+    int flags = WALK_STAT;
+    int max_depth = 0; // 0 means unlimited
     
     // Ask about hidden files
     mvprintw(17, 1, "Show hidden files? (y/n): ");
-    refresh();
+    render_mark(stdscr);
     ch = getch();
-    show_hidden = (ch == 'y' || ch == 'Y');
-    printw("%c", ch);
+    if (ch == 'y' || ch == 'Y') {
+        flags |= WALK_HIDDEN;
+    }
+    out_printw("%c", ch);
     
     // Ask about depth limit
     mvprintw(19, 1, "Limit depth? (Enter number or 0 for unlimited): ");
-    refresh();
+    render_mark(stdscr);
     char depth_input[10] = {0};
     pos = 0;
     
     while ((ch = getch()) != '\n' && pos < 9) {
         if (ch >= '0' && ch <= '9') {
             depth_input[pos++] = ch;
-            printw("%c", ch);
+            out_printw("%c", ch);
         } else if (ch == KEY_BACKSPACE || ch == 127) {
             if (pos > 0) {
                 pos--;
-                printw("\b \b");
+                out_printw("\b \b");
             }
         }
-        refresh();
+        render_mark(stdscr);
     }
     depth_input[pos] = '\0';
     
     if (depth_input[0] != '\0') {
         max_depth = atoi(depth_input);
-        if (max_depth == 0) max_depth = -1; // Convert 0 to unlimited
     }
     
     // Clear screen and start displaying tree
     clear();
     
-    DIR *dir = opendir(path);
-    if (!dir) {
-        mvprintw(1, 1, "Error: Cannot open directory '%s': %s", path, strerror(errno));
-        refresh();
+    struct stat st;
+    int err = stat(path, &st) != 0 ? errno : (S_ISDIR(st.st_mode) ? 0 : ENOTDIR);
+    if (err) {
+        mvprintw(1, 1, "Error: Cannot open directory '%s': %s", path, strerror(err));
+        render_mark(stdscr);
         getch();
         return;
     }
@@ -1705,110 +2299,20 @@ void cmd_tree_interactive(void) {
     mvprintw(1, 1, "%s", resolved_path);
     attroff(COLOR_PAIR(1) | A_BOLD);
     
-    // Counters for summary
-    int dir_count = 0;
-    int file_count = 0;
-    
-    // Current display position
-    int y = 3;
-    
-    // Helper function to display tree (simple version without recursion)
-    // Instead, we'll just display the top level for simplicity
-    struct dirent *entry;
-    
-    // Collect all entries for sorting
-    std::vector<std::string> entries;
-    std::vector<bool> is_dir;
-    
-    while ((entry = readdir(dir)) != NULL) {
-        // Skip . and .. entries
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-        
-        // Skip hidden files if not showing them
-        if (!show_hidden && entry->d_name[0] == '.') {
-            continue;
-        }
-        
-        char full_path[MAX_PATH];
-        snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
-        
-        struct stat st;
-        if (stat(full_path, &st) != 0) continue;
-        
-        entries.push_back(entry->d_name);
-        is_dir.push_back(S_ISDIR(st.st_mode));
-    }
-    
-    // Sort entries (directories first, then alphabetically)
-    std::vector<size_t> indices(entries.size());
-    for (size_t i = 0; i < entries.size(); i++) {
-        indices[i] = i;
-    }
-    
-    std::sort(indices.begin(), indices.end(), [&](size_t a, size_t b) {
-        if (is_dir[a] != is_dir[b]) {
-            return is_dir[a] > is_dir[b]; // Directories first
-        }
-        return entries[a] < entries[b]; // Then alphabetically
-    });
-    
-    // Display entries with tree-like structure
-    for (size_t i = 0; i < indices.size(); i++) {
-        size_t idx = indices[i];
-        const std::string& name = entries[idx];
-        bool is_directory = is_dir[idx];
-        
-        char full_path[MAX_PATH];
-        snprintf(full_path, sizeof(full_path), "%s/%s", path, name.c_str());
-        
-        struct stat st;
-        if (stat(full_path, &st) != 0) continue;
-        
-        // Display with appropriate prefix and color
-        bool is_last = (i == indices.size() - 1);
-        
-        if (is_last) {
-            mvprintw(y, 1, "`-- ");
-        } else {
-            mvprintw(y, 1, "|-- ");
-        }
-        
-        if (is_directory) {
-            attron(COLOR_PAIR(1) | A_BOLD); // Blue for directories
-            mvprintw(y, 5, "%s/", name.c_str());
-            attroff(COLOR_PAIR(1) | A_BOLD);
-            dir_count++;
-        } else {
-            // Check if it's executable
-            if (st.st_mode & S_IXUSR) {
-                attron(COLOR_PAIR(2) | A_BOLD);
-                mvprintw(y, 5, "%s", name.c_str());
-                attroff(COLOR_PAIR(2) | A_BOLD);
-            } else {
-                mvprintw(y, 5, "%s", name.c_str());
-            }
-            file_count++;
-        }
-        
-        y++;
-        
-        // Limit display to fit on screen
-        if (y >= LINES - 5) {
-            mvprintw(y++, 1, "... (more items not shown)");
-            break;
-        }
-    }
-    
-    closedir(dir);
+    // Display the tree a page at a time
+    TreeRender tree;
+    tree_render_init(&tree, TREE_TEXT, max_depth);
+    tree_render_page(&tree, 3);
+    WalkOptions options = {flags, max_depth, NULL, NULL};
+    walk_tree(resolved_path, &options, tree_render_visit, &tree);
+    int y = tree_render_page_end(&tree, 4);
     
     // Print summary
-    mvprintw(y + 1, 1, "\n%d directories, %d files", dir_count, file_count);
+    mvprintw(y + 1, 1, "\n%d directories, %d files", tree.dir_count, tree.file_count);
     
     // Instructions to continue
     mvprintw(y + 3, 1, "Press any key to continue...");
-    refresh();
+    render_mark(stdscr);
     getch();
 }
 
@@ -1850,21 +2354,26 @@ void init_windows(void) {
         exit(1);
     }
     
+    // Coalesce screen updates into frames from here on
+    render_init();
+    scrollback_init(scrollback_memory_limit_from_env());
+
     // Refresh windows
-    refresh();
+    render_mark(stdscr);
     draw_status_bar();
 }
 
 void cleanup(void) {
-    // Free command history
-    for (int i = 0; i < history_count; i++) {
-        if (command_history[i]) {
-            free(command_history[i]);
-            command_history[i] = NULL;
-        }
-    }
+    // Flush and release command history
+    history_close();
+    completion_shutdown();
+    line_editor_free(&prompt_line);
     
+    jobs_kill_all();
+    worker_pool_shutdown();
     error_console_destroy(error_console);
+    scrollback_shutdown();
+    render_shutdown();
     endwin();
     
     cleanup_serial();
@@ -1892,39 +2401,123 @@ void draw_status_bar(void) {
     mvwprintw(status_bar, 0, screen_width - 10, "%s", time_str);
     
     wattroff(status_bar, A_REVERSE);
-    wrefresh(status_bar);
+    render_mark(status_bar);
+}
+
+// Status bar with a running job's progress in place of the path
+void draw_progress_status_bar(const char *progress) {
+    werase(status_bar);
+    
+    wattron(status_bar, A_REVERSE);
+    for (int i = 0; i < screen_width; i++) {
+        mvwaddch(status_bar, 0, i, ' ');
+    }
+    mvwprintw(status_bar, 0, 1, "MINUX v%s | %s", VERSION, progress);
+    
+    wattroff(status_bar, A_REVERSE);
+    render_mark(status_bar);
 }
 
 void show_prompt(void) {
+    if (output_is_batch()) {
+        return;
+    }
+
+    report_finished_jobs();
+
     // Draw updated status bar
     draw_status_bar();
     
     // Show command prompt
-    printw("\nminux:%s$ ", current_path);
-    refresh();
+    out_printw("\nminux:%s$ ", current_path);
+    render_mark(stdscr);
 }
 
 // Placeholder for test_camera
 void test_camera(void) {
     clear();
-    printw("\nCamera testing functionality is not implemented on this platform.\n");
-    printw("Press any key to continue...\n");
-    refresh();
+    out_printw("\nCamera testing functionality is not implemented on this platform.\n");
+    out_printw("Press any key to continue...\n");
+    render_mark(stdscr);
     getch();
 }
 
 // Function to view file contents
 void view_file_contents(const char *filepath) {
-    clear();
-    
-    // Create a new window for file viewing with proper code editor appearance
-    int viewer_height = LINES - 6;  // Leave room for header and footer
-    int viewer_width = COLS;
-    
-    WINDOW *viewer_win = newwin(viewer_height, viewer_width, 3, 0);
-    keypad(viewer_win, TRUE);
-    scrollok(viewer_win, TRUE);
-    
+    view_file_at_line(filepath, 1);
+}
+
+// Read a key, waiting on watch at the same time. Returns the key, or ERR
+// once a burst of file system changes has settled (or, without inotify,
+// every FS_WATCH_POLL_MS).
+static int watched_getch(WINDOW *win, FsWatch *watch) {
+    wtimeout(win, 0);
+    int ch = wgetch(win);
+    while (ch == ERR && fs_watch_wait(watch, STDIN_FILENO) == FS_WAIT_INPUT) {
+        ch = wgetch(win);
+    }
+    wtimeout(win, -1);
+    return ch;
+}
+
+// Colour of a highlighted token
+static attr_t highlight_attr(unsigned char kind) {
+    switch (kind) {
+        case HIGHLIGHT_COMMENT: return COLOR_PAIR(3);
+        case HIGHLIGHT_STRING: return COLOR_PAIR(2);
+        case HIGHLIGHT_KEYWORD: return COLOR_PAIR(1) | A_BOLD;
+        case HIGHLIGHT_NUMBER: return COLOR_PAIR(5);
+        case HIGHLIGHT_PREPROC: return COLOR_PAIR(4);
+        case HIGHLIGHT_SECTION: return COLOR_PAIR(4) | A_BOLD;
+        case HIGHLIGHT_KEY: return COLOR_PAIR(1);
+        default: return A_NORMAL;
+    }
+}
+
+// Draw len bytes of text on row y from column left up to column right,
+// coloured by runs (NULL for plain text), with what matches marked (NULL
+// for nothing) in reverse video. Tabs stop every 4 columns.
+static void draw_highlighted(WINDOW *win, int y, int left, int right, const char *text, size_t len,
+                             const std::vector<HighlightRun> *runs, const TextPattern *marked) {
+    int x = left;
+    size_t run = 0;
+    size_t mark_start = 0;
+    size_t mark_len = 0;
+    bool marking = marked && text_pattern_match(marked, text, len, &mark_start, &mark_len);
+    for (size_t j = 0; j < len && x < right; j++) {
+        attr_t attr = A_NORMAL;
+        if (runs) {
+            while (run < runs->size() && (*runs)[run].start + (*runs)[run].len <= j) run++;
+            if (run < runs->size() && (*runs)[run].start <= j) attr = highlight_attr((*runs)[run].kind);
+        }
+        if (marking && j >= mark_start + mark_len) {
+            // Past this match; a regex is only marked once, as ^ would match again
+            size_t from = mark_start + std::max(mark_len, (size_t)1);
+            marking = marked->literal && from < len &&
+                      text_pattern_match(marked, text + from, len - from, &mark_start, &mark_len);
+            mark_start += from;
+        }
+        if (marking && j >= mark_start && j < mark_start + mark_len) {
+            attr |= A_REVERSE;
+        }
+        if (text[j] == '\t') {
+            int spaces = 4 - ((x - left) % 4);
+            for (int k = 0; k < spaces && x < right; k++) {
+                mvwaddch(win, y, x++, ' ' | attr);
+            }
+            continue;
+        }
+        mvwaddch(win, y, x++, (unsigned char)text[j] | attr);
+    }
+}
+
+// Lines of a mapped file, for the highlighter
+static bool viewer_highlight_source(void *ctx, long line, const char **text, size_t *len) {
+    return file_map_line((FileMap *)ctx, line, text, len);
+}
+
+// The viewer's title bar, path and border
+static void viewer_draw_frame(WINDOW *viewer_win, const char *filepath) {
     // Use a more code-editor-like title bar with modern styling
     attron(A_REVERSE | COLOR_PAIR(4));
     for (int i = 0; i < COLS; i++) {
@@ -1942,45 +2535,104 @@ void view_file_contents(const char *filepath) {
     
     // Draw a double-lined box around the viewer window for a more professional look
     wborder(viewer_win, '|', '|', '-', '-', '+', '+', '+', '+');
+}
+
+// Open the viewer with line (from 1) at the top
+void view_file_at_line(const char *filepath, int line) {
+    clear();
     
-    // Try to open the file
-    FILE *file = fopen(filepath, "r");
-    if (!file) {
+    // Create a new window for file viewing with proper code editor appearance
+    int viewer_height = LINES - 6;  // Leave room for header and footer
+    int viewer_width = COLS;
+    
+    WINDOW *viewer_win = newwin(viewer_height, viewer_width, 3, 0);
+    keypad(viewer_win, TRUE);
+    scrollok(viewer_win, TRUE);
+    
+    viewer_draw_frame(viewer_win, filepath);
+    
+    // Map the file rather than read it - lines are found as they are shown,
+    // while the whole file is indexed in the background
+    FileMap map;
+    if (file_map_open(&map, filepath, 0) != 0) {
         mvprintw(2, 1, "Error: Cannot open file: %s", strerror(errno));
         draw_error_status_bar("Cannot open file");
-        wrefresh(viewer_win);
-        refresh();
+        render_mark(stdscr);
+        render_mark(viewer_win);
         getch();
         delwin(viewer_win);
         return;
     }
     
-    // Read the file into a vector of lines
-    std::vector<std::string> lines;
-    char line_buffer[4096];
-    while (fgets(line_buffer, sizeof(line_buffer), file)) {
-        // Remove trailing newline
-        size_t len = strlen(line_buffer);
-        if (len > 0 && line_buffer[len-1] == '\n') {
-            line_buffer[len-1] = '\0';
-        }
-        lines.push_back(line_buffer);
-    }
-    fclose(file);
-    
-    // Display parameters
-    int current_line = 0;
+    // Follow mode watches the file's directory, which also reports the file
+    // being replaced or created again
+    bool following = false;
+    FsWatch follow_watch;
+    fs_watch_init(&follow_watch);
+    int follow_wd = -1;
+    std::string follow_dir = filepath;
+    std::string follow_name = filepath;
+    size_t slash = follow_dir.rfind('/');
+    if (slash == std::string::npos) {
+        follow_dir = ".";
+    } else {
+        follow_dir.erase(slash == 0 ? 1 : slash);
+        follow_name.erase(0, slash + 1);
+    }
+    
+    // Colour by language, told from the name or the first line
+    const char *first_text = NULL;
+    size_t first_len = 0;
+    file_map_line(&map, 0, &first_text, &first_len);
+    Highlighter highlighter;
+    highlight_init(&highlighter, highlight_language(filepath, first_text, first_len), viewer_highlight_source, &map);
+    
+    // Searching runs in the background; a jump waits until it gets that far
+    ViewSearch search;
+    view_search_init(&search);
+    bool search_regex = false;    // Otherwise the text is taken literally
+    bool search_waiting = false;  // The jump below is yet to be made
+    bool search_down = true;      // Which way / or ? went, and so n
+    bool search_forward = true;
+    long search_from = 0;
+    char query[256];
+    
+    // Display parameters (the line is checked once the index reaches it)
+    int current_line = std::max(0, line - 1);
     int max_display_lines = viewer_height - 2;  // Account for border
+    int number_width = 4;  // Digits in a line number, more for long files
     int left_margin = 6;  // Space for line numbers
     
     // Main viewing loop
     bool running = true;
-    bool edit_mode = false;
-    int edit_line = 0;
-    int edit_col = 0;
-    bool modified = false;
+    const char *notice = NULL;  // Shown next to the position until the next key
+    char notice_text[256];
     
     while (running) {
+        // A search's jump is made once the search has got that far
+        if (search_waiting) {
+            long found = view_search_next(&search, search_from, search_forward);
+            if (found != VIEW_SEARCH_PENDING) {
+                search_waiting = false;
+                if (found == VIEW_SEARCH_NONE) {
+                    notice = search_forward ? "No more matches below" : "No more matches above";
+                } else {
+                    current_line = (int)std::min(found, (long)INT_MAX);
+                }
+            }
+        }
+        
+        bool indexed;
+        int total_lines = (int)std::min(file_map_lines(&map, &indexed), (long)INT_MAX);
+        if (indexed && current_line > std::max(0, total_lines - 1)) {
+            current_line = std::max(0, total_lines - 1);
+        }
+        int numbered = std::max(total_lines, current_line + max_display_lines);
+        for (number_width = 4; numbered >= 10000 && number_width < 10; numbered /= 10) {
+            number_width++;
+        }
+        left_margin = number_width + 2;
+        
         // Clear viewer window content but preserve the border
         for (int i = 1; i < viewer_height - 1; i++) {
             wmove(viewer_win, i, 1);
@@ -1989,417 +2641,391 @@ void view_file_contents(const char *filepath) {
             }
         }
         
-        if (!edit_mode) {
-            // VIEW MODE
-            // Display lines with syntax highlighting-like coloring for common programming elements
-            for (int i = 0; i < max_display_lines && current_line + i < (int)lines.size(); i++) {
-                // Ensure we don't go beyond window boundaries
-                if (i + 1 >= viewer_height - 1) break;
-                
-                // Display line number with right alignment and highlighted background
-                wattron(viewer_win, COLOR_PAIR(4) | A_BOLD);
-                mvwprintw(viewer_win, i + 1, 1, "%4d ", current_line + i + 1);
-                wattroff(viewer_win, COLOR_PAIR(4) | A_BOLD);
-                
-                // Add a separator between line numbers and text
-                wattron(viewer_win, COLOR_PAIR(4));
-                mvwaddch(viewer_win, i + 1, left_margin - 1, '|');
-                wattroff(viewer_win, COLOR_PAIR(4));
-                
-                // Get the line to display
-                std::string &display_line = lines[current_line + i];
-                
-                // Apply simple syntax highlighting (just for visual effect)
-                std::string current_word;
-                int cursor_pos = left_margin;
-                
-                for (size_t j = 0; j < display_line.length() && cursor_pos < viewer_width - 2; j++) {
-                    char ch = display_line[j];
-                    
-                    // Handle tab characters properly
-                    if (ch == '\t') {
-                        int spaces = 4 - ((cursor_pos - left_margin) % 4);
-                        for (int k = 0; k < spaces && cursor_pos < viewer_width - 2; k++) {
-                            mvwaddch(viewer_win, i + 1, cursor_pos++, ' ');
-                        }
-                        continue;
-                    }
-                    
-                    // Check for comments (C/C++ style)
-                    if (j < display_line.length() - 1 && ch == '/' && display_line[j+1] == '/') {
-                        wattron(viewer_win, COLOR_PAIR(3));  // Use cyan for comments
-                        for (size_t k = j; k < display_line.length() && cursor_pos < viewer_width - 2; k++) {
-                            mvwaddch(viewer_win, i + 1, cursor_pos++, display_line[k]);
-                        }
-                        wattroff(viewer_win, COLOR_PAIR(3));
-                        break;
-                    }
-                    
-                    // Check for string literals
-                    if (ch == '"' || ch == '\'') {
-                        char quote = ch;
-                        wattron(viewer_win, COLOR_PAIR(2));  // Use green for strings
-                        mvwaddch(viewer_win, i + 1, cursor_pos++, ch);
-                        for (j++; j < display_line.length() && cursor_pos < viewer_width - 2; j++) {
-                            if (display_line[j] == '\\' && j+1 < display_line.length()) {
-                                // Handle escape sequence
-                                mvwaddch(viewer_win, i + 1, cursor_pos++, '\\');
-                                j++;
-                                if (cursor_pos < viewer_width - 2) {
-                                    mvwaddch(viewer_win, i + 1, cursor_pos++, display_line[j]);
-                                }
-                            } else if (display_line[j] == quote) {
-                                mvwaddch(viewer_win, i + 1, cursor_pos++, quote);
-                                break;
-                            } else {
-                                mvwaddch(viewer_win, i + 1, cursor_pos++, display_line[j]);
-                            }
-                        }
-                        wattroff(viewer_win, COLOR_PAIR(2));
-                        continue;
-                    }
-                    
-                    // Just display the character normally
-                    mvwaddch(viewer_win, i + 1, cursor_pos++, ch);
-                }
-            }
+        // Display lines with syntax highlighting-like coloring for common programming elements
+        for (int i = 0; i < max_display_lines; i++) {
+            // Ensure we don't go beyond window boundaries
+            if (i + 1 >= viewer_height - 1) break;
             
-            // Show position info in a cleaner format
-            int total_lines = lines.size();
-            attron(A_BOLD);
-            mvprintw(2, 0, "Line: ");
-            attroff(A_BOLD);
-            printw("%d of %d (%.0f%%)", 
-                  current_line + 1, total_lines, 
-                  total_lines > 0 ? (current_line + 1) * 100.0 / total_lines : 0);
+            // Runs first: lexing reads other lines, which invalidates text
+            const std::vector<HighlightRun> *runs = highlight_line(&highlighter, current_line + i);
             
-            // Show scrollbar using block characters for a more modern look
-            if (total_lines > max_display_lines) {
-                int scrollbar_height = (max_display_lines * max_display_lines) / total_lines;
-                if (scrollbar_height < 1) scrollbar_height = 1;
-                
-                int scrollbar_pos = (max_display_lines * current_line) / total_lines;
-                
-                wattron(viewer_win, COLOR_PAIR(4));
-                for (int i = 0; i < max_display_lines; i++) {
-                    mvwaddch(viewer_win, i + 1, viewer_width - 2, 
-                           (i >= scrollbar_pos && i < scrollbar_pos + scrollbar_height) ? '#' : '|');
-                }
-                wattroff(viewer_win, COLOR_PAIR(4));
-            }
+            // Lines past what has been indexed yet stay blank until it has
+            const char *text;
+            size_t text_len;
+            if (!file_map_line(&map, current_line + i, &text, &text_len)) break;
             
-            // Update instructions with a cleaner layout
-            mvprintw(LINES - 2, 0, "Arrow keys: scroll | Page Up/Down: page scroll | Home/End: start/end");
-            mvprintw(LINES - 1, 0, "e: edit file | q: quit");
-        }
-        else {
-            // EDIT MODE
-            // Update title bar to show we're in edit mode
-            attron(A_REVERSE | COLOR_PAIR(5));
-            for (int i = 0; i < COLS; i++) {
-                mvaddch(0, i, ' ');
-            }
-            mvprintw(0, 1, "EDITOR - %s", filepath);
-            mvprintw(0, COLS - 35, "Press F2 to save, Esc to exit without saving");
-            attroff(A_REVERSE | COLOR_PAIR(5));
+            // Display line number with right alignment and highlighted background
+            wattron(viewer_win, COLOR_PAIR(4) | A_BOLD);
+            mvwprintw(viewer_win, i + 1, 1, "%*d ", number_width, current_line + i + 1);
+            wattroff(viewer_win, COLOR_PAIR(4) | A_BOLD);
             
-            // Show edit position
-            attron(A_BOLD);
-            mvprintw(2, 0, "Line: ");
-            attroff(A_BOLD);
-            printw("%d of %d, Col: %d  ", 
-                  edit_line + 1, (int)lines.size(), edit_col + 1);
+            // Add a separator between line numbers and text
+            wattron(viewer_win, COLOR_PAIR(4));
+            mvwaddch(viewer_win, i + 1, left_margin - 1, '|');
+            wattroff(viewer_win, COLOR_PAIR(4));
             
-            if (modified) {
-                attron(COLOR_PAIR(5) | A_BOLD);
-                printw("[Modified]");
-                attroff(COLOR_PAIR(5) | A_BOLD);
+            draw_highlighted(viewer_win, i + 1, left_margin, viewer_width - 2, text, text_len, runs,
+                             search.text.empty() ? NULL : &search.pattern);
+        }
+        
+        // Show position info in a cleaner format
+        attron(A_BOLD);
+        mvprintw(2, 0, "Line: ");
+        attroff(A_BOLD);
+        printw("%d of %d%s (%.0f%%)", 
+              current_line + 1, total_lines, indexed ? "" : "+",
+              total_lines > 0 ? std::min(100.0, (current_line + 1) * 100.0 / total_lines) : 0);
+        if (!indexed) {
+            printw("  [Indexing %d%%]", file_map_progress(&map));
+        }
+        bool searched = true;
+        if (!search.text.empty()) {
+            long matches = view_search_count(&search, &searched);
+            printw("  [%s \"%s\": %ld %s", (search.flags & TEXT_REGEX) ? "Regex" : "Text", search.text.c_str(),
+                   matches, matches == 1 ? "line" : "lines");
+            if (!searched) {
+                printw(", searching %d%%", view_search_progress(&search));
             }
+            printw("]");
+        }
+        if (notice) {
+            attron(COLOR_PAIR(5) | A_BOLD);
+            printw("  %s", notice);
+            attroff(COLOR_PAIR(5) | A_BOLD);
+        }
+        if (following) {
+            attron(COLOR_PAIR(2) | A_BOLD);
+            printw("  [Following]");
+            attroff(COLOR_PAIR(2) | A_BOLD);
+        }
+        clrtoeol();
+        
+        // Show scrollbar using block characters for a more modern look
+        if (total_lines > max_display_lines) {
+            int scrollbar_height = (max_display_lines * max_display_lines) / total_lines;
+            if (scrollbar_height < 1) scrollbar_height = 1;
             
-            // Display lines for editing
-            for (int i = 0; i < max_display_lines && current_line + i < (int)lines.size(); i++) {
-                // Ensure we don't go beyond window boundaries
-                if (i + 1 >= viewer_height - 1) break;
-                
-                // Display line number with right alignment and highlighted background
-                wattron(viewer_win, COLOR_PAIR(4) | A_BOLD);
-                mvwprintw(viewer_win, i + 1, 1, "%4d ", current_line + i + 1);
-                wattroff(viewer_win, COLOR_PAIR(4) | A_BOLD);
-                
-                // Add a separator between line numbers and text
-                wattron(viewer_win, COLOR_PAIR(4));
-                mvwaddch(viewer_win, i + 1, left_margin - 1, '|');
-                wattroff(viewer_win, COLOR_PAIR(4));
-                
-                // Get the line to display
-                std::string &display_line = lines[current_line + i];
-                
-                // Display the text
-                for (size_t j = 0; j < display_line.length() && left_margin + j < (size_t)viewer_width - 2; j++) {
-                    // If this is the current edit line and column, position the cursor here
-                    if (current_line + i == edit_line && (int)j == edit_col) {
-                        wmove(viewer_win, i + 1, left_margin + j);
-                    }
-                    
-                    // Handle tabs for display
-                    if (display_line[j] == '\t') {
-                        int spaces = 4 - ((j) % 4);
-                        for (int k = 0; k < spaces && left_margin + j + k < (size_t)viewer_width - 2; k++) {
-                            mvwaddch(viewer_win, i + 1, left_margin + j + k, ' ');
-                        }
-                    } else {
-                        mvwaddch(viewer_win, i + 1, left_margin + j, display_line[j]);
-                    }
+            int scrollbar_pos = (max_display_lines * current_line) / total_lines;
+            
+            wattron(viewer_win, COLOR_PAIR(4));
+            for (int i = 0; i < max_display_lines; i++) {
+                mvwaddch(viewer_win, i + 1, viewer_width - 2, 
+                       (i >= scrollbar_pos && i < scrollbar_pos + scrollbar_height) ? '#' : '|');
+            }
+            wattroff(viewer_win, COLOR_PAIR(4));
+        }
+        
+        // Update instructions with a cleaner layout
+        mvprintw(LINES - 2, 0, "Arrow keys: scroll | Page Up/Down: page scroll | Home/End: start/end");
+        mvprintw(LINES - 1, 0, "/ ?: search | n/N: next/previous match | r: regex on/off | e: edit | f: follow | q: quit");
+        
+        // Refresh display - stdscr first, it covers the viewer window
+        render_mark(stdscr);
+        render_mark(viewer_win);
+        
+        // Handle input - while following, changes to the file are waited on too,
+        // and while indexing or searching, the counts are redrawn as they grow
+        int ch;
+        if (!indexed || !searched) {
+            wtimeout(viewer_win, VIEWER_INDEX_REDRAW_MS);
+            ch = wgetch(viewer_win);
+            wtimeout(viewer_win, -1);
+        } else {
+            ch = following ? watched_getch(viewer_win, &follow_watch) : wgetch(viewer_win);
+        }
+        
+        if (ch != ERR) {
+            notice = NULL;
+        }
+        if (ch == ERR) {
+            if (following) {
+                bool ours = follow_watch.overflow || follow_watch.fd < 0;
+                for (size_t i = 0; i < follow_watch.events.size() && !ours; i++) {
+                    ours = follow_watch.events[i].wd == follow_wd && follow_watch.events[i].name == follow_name;
                 }
+                fs_watch_clear(&follow_watch);
                 
-                // If we're at the edit line but at the end of text, position cursor at the end
-                if (current_line + i == edit_line && edit_col >= (int)display_line.length()) {
-                    wmove(viewer_win, i + 1, left_margin + display_line.length());
+                // Appended text is indexed from where the index stopped; a
+                // file truncated or replaced (a rotated log) is mapped again
+                if (ours && file_map_refresh(&map) != FILE_MAP_SAME) {
+                    highlight_reset(&highlighter);
+                    view_search_restart(&search, map.fd, map.size);
                 }
+                current_line = std::max(0, (int)std::min(file_map_lines(&map, &indexed), (long)INT_MAX) - max_display_lines);
             }
-            
-            // Update instructions for edit mode
-            mvprintw(LINES - 2, 0, "Arrow keys: move cursor | Backspace/Delete: delete char | Enter: new line");
-            mvprintw(LINES - 1, 0, "F2: save | Esc: exit without saving");
+            continue;
         }
         
-        // Refresh display
-        wrefresh(viewer_win);
-        refresh();
-        
-        // Handle input
-        int ch = wgetch(viewer_win);
-        
-        if (!edit_mode) {
-            // VIEW MODE CONTROLS
-            switch (ch) {
-                case KEY_UP:
-                    if (current_line > 0) {
-                        current_line--;
+        switch (ch) {
+            case KEY_UP:
+                if (current_line > 0) {
+                    current_line--;
+                }
+                break;
+            
+            case KEY_DOWN:
+                if (current_line < total_lines - max_display_lines) {
+                    current_line++;
+                }
+                break;
+            
+            case KEY_PPAGE:  // Page Up
+                current_line -= max_display_lines;
+                if (current_line < 0) {
+                    current_line = 0;
+                }
+                break;
+            
+            case KEY_NPAGE:  // Page Down
+                current_line += max_display_lines;
+                if (current_line > total_lines - max_display_lines) {
+                    current_line = total_lines - max_display_lines;
+                }
+                if (current_line < 0) {
+                    current_line = 0;
+                }
+                break;
+            
+            case KEY_HOME:
+                current_line = 0;
+                break;
+            
+            case KEY_END:  // The end of what has been indexed so far
+                current_line = total_lines - max_display_lines;
+                if (current_line < 0) {
+                    current_line = 0;
+                }
+                break;
+            
+            case 'f':  // Follow changes, from what the file holds now
+                following = !following;
+                if (following) {
+                    follow_wd = fs_watch_add(&follow_watch, follow_dir.c_str(), FS_WATCH_DIR);
+                    if (file_map_refresh(&map) != FILE_MAP_SAME) {
+                        highlight_reset(&highlighter);
+                        view_search_restart(&search, map.fd, map.size);
                     }
-                    break;
+                    current_line = std::max(0, (int)std::min(file_map_lines(&map, &indexed), (long)INT_MAX) - max_display_lines);
+                } else {
+                    fs_watch_remove(&follow_watch, follow_wd);
+                    fs_watch_clear(&follow_watch);
+                    follow_wd = -1;
+                }
+                break;
                 
-                case KEY_DOWN:
-                    if (current_line < (int)lines.size() - max_display_lines) {
-                        current_line++;
-                    }
-                    break;
+            case 'e':  // Edit from the line at the top
+                if (following) {
+                    fs_watch_remove(&follow_watch, follow_wd);
+                    fs_watch_clear(&follow_watch);
+                    follow_wd = -1;
+                    following = false;
+                }
                 
-                case KEY_PPAGE:  // Page Up
-                    current_line -= max_display_lines;
-                    if (current_line < 0) {
-                        current_line = 0;
-                    }
+                // Saving writes over the file, so it is mapped again afterwards
+                file_map_close(&map);
+                edit_file_contents(filepath, current_line + 1);
+                if (file_map_open(&map, filepath, 0) != 0) {
+                    draw_error_status_bar("Cannot open file");
+                    running = false;
                     break;
+                }
+                highlight_reset(&highlighter);
+                view_search_restart(&search, map.fd, map.size);
+                touchwin(viewer_win);
+                viewer_draw_frame(viewer_win, filepath);
+                break;
                 
-                case KEY_NPAGE:  // Page Down
-                    current_line += max_display_lines;
-                    if (current_line > (int)lines.size() - max_display_lines) {
-                        current_line = lines.size() - max_display_lines;
-                    }
-                    if (current_line < 0) {
-                        current_line = 0;
+            case '/':  // Search down, or up, from the line at the top
+            case '?': {
+                mvprintw(2, 0, "%s%s: ", ch == '/' ? "Search" : "Search up", search_regex ? " (regex)" : "");
+                clrtoeol();
+                echo();
+                getnstr(query, sizeof(query) - 1);
+                noecho();
+                if (query[0]) {
+                    char err[200];
+                    if (view_search_start(&search, map.fd, map.size, query, search_regex ? TEXT_REGEX : TEXT_FIXED,
+                                          err, sizeof(err)) != 0) {
+                        snprintf(notice_text, sizeof(notice_text), "Bad pattern: %s", err);
+                        notice = notice_text;
+                        break;
                     }
+                } else if (search.text.empty()) {
                     break;
+                }
+                search_down = ch == '/';
+                search_waiting = true;
+                search_forward = search_down;
+                search_from = search_down ? current_line - 1 : current_line;  // The top line counts
+                break;
+            }
                 
-                case KEY_HOME:
-                    current_line = 0;
-                    break;
-                
-                case KEY_END:
-                    current_line = lines.size() - max_display_lines;
-                    if (current_line < 0) {
-                        current_line = 0;
-                    }
-                    break;
-                
-                case 'e':  // Switch to edit mode
-                    edit_mode = true;
-                    edit_line = current_line;
-                    edit_col = 0;
-                    break;
-                    
-                case 'q':
-                    running = false;
-                    break;
-            }
-        }
-        else {
-            // EDIT MODE CONTROLS
-            switch (ch) {
-                case KEY_UP:
-                    if (edit_line > 0) {
-                        edit_line--;
-                        if (edit_col > (int)lines[edit_line].length()) {
-                            edit_col = lines[edit_line].length();
-                        }
-                        if (edit_line < current_line) {
-                            current_line = edit_line;
-                        }
-                    }
-                    break;
-                
-                case KEY_DOWN:
-                    if (edit_line < (int)lines.size() - 1) {
-                        edit_line++;
-                        if (edit_col > (int)lines[edit_line].length()) {
-                            edit_col = lines[edit_line].length();
-                        }
-                        if (edit_line >= current_line + max_display_lines) {
-                            current_line = edit_line - max_display_lines + 1;
-                        }
-                    }
-                    break;
-                
-                case KEY_LEFT:
-                    if (edit_col > 0) {
-                        edit_col--;
-                    } else if (edit_line > 0) {
-                        edit_line--;
-                        edit_col = lines[edit_line].length();
-                        if (edit_line < current_line) {
-                            current_line = edit_line;
-                        }
-                    }
-                    break;
-                
-                case KEY_RIGHT:
-                    if (edit_col < (int)lines[edit_line].length()) {
-                        edit_col++;
-                    } else if (edit_line < (int)lines.size() - 1) {
-                        edit_line++;
-                        edit_col = 0;
-                        if (edit_line >= current_line + max_display_lines) {
-                            current_line = edit_line - max_display_lines + 1;
-                        }
-                    }
-                    break;
-                
-                case KEY_HOME:
-                    edit_col = 0;
-                    break;
-                
-                case KEY_END:
-                    edit_col = lines[edit_line].length();
-                    break;
-                
-                case KEY_BACKSPACE:
-                case 127:  // DEL key
-                    if (edit_col > 0) {
-                        // Delete character before cursor
-                        lines[edit_line].erase(edit_col - 1, 1);
-                        edit_col--;
-                        modified = true;
-                    } else if (edit_line > 0) {
-                        // Merge with previous line
-                        edit_col = lines[edit_line - 1].length();
-                        lines[edit_line - 1] += lines[edit_line];
-                        lines.erase(lines.begin() + edit_line);
-                        edit_line--;
-                        modified = true;
-                        if (edit_line < current_line) {
-                            current_line = edit_line;
-                        }
-                    }
-                    break;
-                
-                case KEY_DC:  // Delete key
-                    if (edit_col < (int)lines[edit_line].length()) {
-                        // Delete character at cursor
-                        lines[edit_line].erase(edit_col, 1);
-                        modified = true;
-                    } else if (edit_line < (int)lines.size() - 1) {
-                        // Merge with next line
-                        lines[edit_line] += lines[edit_line + 1];
-                        lines.erase(lines.begin() + edit_line + 1);
-                        modified = true;
-                    }
-                    break;
-                
-                case '\n':
-                case KEY_ENTER:
-                    // Split line and insert a new one
-                    {
-                        std::string new_line = lines[edit_line].substr(edit_col);
-                        lines[edit_line].erase(edit_col);
-                        lines.insert(lines.begin() + edit_line + 1, new_line);
-                        edit_line++;
-                        edit_col = 0;
-                        modified = true;
-                        if (edit_line >= current_line + max_display_lines) {
-                            current_line = edit_line - max_display_lines + 1;
-                        }
-                    }
-                    break;
-                
-                case '\t':
-                    // Insert tab
-                    lines[edit_line].insert(edit_col, "\t");
-                    edit_col++;
-                    modified = true;
-                    break;
-                
-                case KEY_F(2):  // Save
-                    {
-                        FILE *save_file = fopen(filepath, "w");
-                        bool success = false;
-                        
-                        if (save_file) {
-                            for (size_t i = 0; i < lines.size(); i++) {
-                                fprintf(save_file, "%s\n", lines[i].c_str());
-                            }
-                            fclose(save_file);
-                            success = true;
-                        }
-                        
-                        if (success) {
-                            modified = false;
-                            mvprintw(2, 30, "File saved successfully!         ");
-                        } else {
-                            mvprintw(2, 30, "Error saving file!               ");
-                        }
-                        refresh();
-                    }
+            case 'n':  // The next match the way the search went, or back
+            case 'N':
+                if (search.text.empty()) {
+                    notice = "Nothing searched for yet - press / or ?";
                     break;
+                }
+                search_waiting = true;
+                search_forward = (ch == 'n') == search_down;
+                search_from = current_line;
+                break;
                 
-                case 27:  // ESC key
-                    if (modified) {
-                        // Confirm before exiting
-                        mvprintw(LINES - 1, 0, "File modified! Press 'y' to exit without saving, any other key to continue editing");
-                        refresh();
-                        int confirm = wgetch(viewer_win);
-                        if (confirm == 'y' || confirm == 'Y') {
-                            edit_mode = false;
-                        }
-                    } else {
-                        edit_mode = false;
-                    }
-                    break;
+            case 'r':  // Regex or plain text, for the next search
+                search_regex = !search_regex;
+                notice = search_regex ? "Searches take a regex" : "Searches take plain text";
+                break;
                 
-                default:
-                    // Insert regular characters
-                    if (ch >= 32 && ch <= 126) {  // Printable ASCII
-                        lines[edit_line].insert(edit_col, 1, (char)ch);
-                        edit_col++;
-                        modified = true;
-                    }
-                    break;
-            }
+            case 'q':
+                running = false;
+                break;
         }
     }
     
     // Clean up
+    view_search_stop(&search);
+    file_map_close(&map);
+    fs_watch_close(&follow_watch);
     delwin(viewer_win);
     clear();
-    refresh();
+    render_mark(stdscr);
+}
+
+// Lines of an edit buffer, for the highlighter
+typedef struct {
+    EditBuffer *buffer;
+    std::string text;                   // The last line asked for
+} EditorLines;
+
+static bool editor_highlight_source(void *ctx, long line, const char **text, size_t *len) {
+    EditorLines *lines = (EditorLines *)ctx;
+    if (line >= edit_buffer_lines(lines->buffer)) {
+        return false;
+    }
+    edit_buffer_line(lines->buffer, line, &lines->text);
+    *text = lines->text.data();
+    *len = lines->text.size();
+    return true;
+}
+
+// The first match in a line after col, or with forward false the last one
+// before it. A regex is only tried once per line, as ^ would match again
+// further on.
+static bool editor_match_in_line(const std::string &text, const TextPattern *pattern, bool forward,
+                                 long col, long *found_col) {
+    long best = -1;
+    size_t from = 0;
+    size_t start, len;
+    while (from <= text.size() && text_pattern_match(pattern, text.data() + from, text.size() - from, &start, &len)) {
+        long found = (long)(from + start);
+        if (forward ? found > col : found < col) {
+            best = found;
+            if (forward) {
+                break;
+            }
+        }
+        if (!pattern->literal) {
+            break;
+        }
+        from += start + std::max(len, (size_t)1);
+    }
+    if (best < 0) {
+        return false;
+    }
+    *found_col = best;
+    return true;
+}
+
+// Where a chunk scan of the editor's text found a match
+typedef struct {
+    const char *text;                   // The chunk scanned
+    size_t found;                       // Offset of the match in it, or SIZE_MAX
+    bool first;                         // Stop at the first match, else keep the last
+} EditorScan;
+
+static int editor_scan_line(long, const char *line, size_t, size_t match_start, size_t, void *ctx) {
+    EditorScan *scan = (EditorScan *)ctx;
+    scan->found = (size_t)(line - scan->text) + match_start;
+    return scan->first ? 1 : 0;
+}
+
+// Land on the line holding a match found at offset, at the match in it a
+// search that way would pick
+static void editor_land(EditBuffer *buffer, const TextPattern *pattern, bool forward, uint64_t offset,
+                        long *line, long *col) {
+    *line = edit_buffer_line_of(buffer, offset);
+    std::string text;
+    edit_buffer_line(buffer, *line, &text);
+    if (!editor_match_in_line(text, pattern, forward, forward ? -1 : LONG_MAX, col)) {
+        *col = (long)(offset - edit_buffer_line_start(buffer, *line));  // Across a cut in a long line
+    }
 }
 
-// Add forward declarations right before the view_file_contents function
-void edit_file_contents(const char *filepath);
-bool save_file(const std::vector<std::string> &lines, const char *filepath);
+// The first match of pattern after line and col, or with forward false the
+// last one before. Past the cursor's line the text is scanned a chunk at a
+// time, cut at line ends, so a search costs about the same in a file of any
+// size. Returns false if there is none.
+static bool editor_search(EditBuffer *buffer, const TextPattern *pattern, bool forward, long *line, long *col) {
+    std::string text;
+    edit_buffer_line(buffer, *line, &text);
+    if (editor_match_in_line(text, pattern, forward, *col, col)) {
+        return true;
+    }
+
+    EditorScan scan;
+    scan.first = forward;
+    uint64_t length = edit_buffer_length(buffer);
+    if (forward) {
+        if (*line + 1 >= edit_buffer_lines(buffer)) {
+            return false;
+        }
+        uint64_t at = edit_buffer_line_start(buffer, *line + 1);
+        while (at < length) {
+            edit_buffer_read(buffer, at, std::min((uint64_t)EDITOR_SEARCH_CHUNK, length - at), &text);
+            size_t len = text.size();
+            size_t newline = text.rfind('\n');
+            if (at + len < length && newline != std::string::npos) {
+                len = newline + 1;
+            }
+            scan.text = text.data();
+            scan.found = SIZE_MAX;
+            text_pattern_scan(pattern, text.data(), len, editor_scan_line, &scan);
+            if (scan.found != SIZE_MAX) {
+                editor_land(buffer, pattern, forward, at + scan.found, line, col);
+                return true;
+            }
+            at += len;
+        }
+        return false;
+    }
+
+    // Backward, the chunks end where the cursor's line starts
+    uint64_t end = edit_buffer_line_start(buffer, *line);
+    while (end > 0) {
+        uint64_t at = end > EDITOR_SEARCH_CHUNK ? end - EDITOR_SEARCH_CHUNK : 0;
+        edit_buffer_read(buffer, at, end - at, &text);
+        size_t skip = 0;
+        size_t newline = text.find('\n');
+        if (at > 0 && newline + 1 < text.size()) {
+            skip = newline + 1;  // Start at a line start, unless one line fills the chunk
+        }
+        scan.text = text.data() + skip;
+        scan.found = SIZE_MAX;
+        text_pattern_scan(pattern, scan.text, text.size() - skip, editor_scan_line, &scan);
+        if (scan.found != SIZE_MAX) {
+            editor_land(buffer, pattern, forward, at + skip + scan.found, line, col);
+            return true;
+        }
+        end = at + skip;
+    }
+    return false;
+}
 
 // New function to edit files
-void edit_file_contents(const char *filepath) {
+// The file stays mapped and edits go into a piece table over it
+// (edit_buffer.h), so a big file opens as fast as a small one and no edit
+// moves the rest of it. Ctrl-Z and Ctrl-Y undo and redo.
+void edit_file_contents(const char *filepath, int line) {
     clear();
     
     // Create a new window for file editing with code editor appearance
@@ -2428,54 +3054,73 @@ void edit_file_contents(const char *filepath) {
     // Draw a double-lined box around the editor window
     wborder(editor_win, '|', '|', '-', '-', '+', '+', '+', '+');
     
-    // Try to open the file
-    FILE *file = fopen(filepath, "r");
-    if (!file) {
-        // If file doesn't exist, create a new empty file
-        mvprintw(2, 1, "Creating new file: %s", filepath);
-    }
-    
-    // Read the file into a vector of lines or start with one empty line for new files
-    std::vector<std::string> lines;
-    if (file) {
-        char line_buffer[4096];
-        while (fgets(line_buffer, sizeof(line_buffer), file)) {
-            // Remove trailing newline
-            size_t len = strlen(line_buffer);
-            if (len > 0 && line_buffer[len-1] == '\n') {
-                line_buffer[len-1] = '\0';
-            }
-            lines.push_back(line_buffer);
+    // Map the file, or start an empty one if it doesn't exist
+    EditBuffer buffer;
+    bool created = false;
+    if (edit_buffer_open(&buffer, filepath) != 0) {
+        if (errno != ENOENT) {
+            mvprintw(2, 1, "Error: Cannot open file: %s", strerror(errno));
+            draw_error_status_bar("Cannot open file");
+            render_mark(stdscr);
+            render_mark(editor_win);
+            getch();
+            delwin(editor_win);
+            clear();
+            render_mark(stdscr);
+            return;
         }
-        fclose(file);
-    }
-    
-    // Ensure there's at least one line to edit
-    if (lines.empty()) {
-        lines.push_back("");
+        edit_buffer_init(&buffer);
+        created = true;
     }
     
     // Editor state variables
-    int current_line = 0;         // Current line in the file
-    int current_col = 0;          // Current column in the line
-    int screen_line = 0;          // Top line displayed on screen
+    long total_lines = edit_buffer_lines(&buffer);
+    long current_line = std::min(std::max(0L, (long)line - 1), total_lines - 1);  // Current line in the file
+    long current_col = 0;         // Current column (byte) in the line
+    long screen_line = current_line;  // Top line displayed on screen
+    int number_width = 4;         // Digits in a line number, more for long files
     int left_margin = 6;          // Space for line numbers
     int max_display_lines = editor_height - 2;  // Account for border
-    bool modified = false;        // Whether the file has been modified
-    
-    // Draw status message about key functions
-    attron(A_BOLD);
-    mvprintw(2, 0, "Status: ");
-    attroff(A_BOLD);
-    if (file) {
-        printw("File loaded successfully.");
-    } else {
-        printw("Creating new file.");
-    }
+    const char *notice = created ? "New file" : NULL;  // Shown next to the position until the next key
+    char notice_text[256];
+    std::string text;             // The current line
+    
+    // Colour by language; edits tell the highlighter which lines changed
+    EditorLines highlight_lines = { &buffer, std::string() };
+    edit_buffer_line(&buffer, 0, &text);
+    Highlighter highlighter;
+    highlight_init(&highlighter, highlight_language(filepath, text.data(), text.size()),
+                   editor_highlight_source, &highlight_lines);
+    
+    std::string searched;         // What was searched for, empty if nothing
+    TextPattern pattern;
+    bool search_regex = false;    // Otherwise the text is taken literally
+    char query[256];
+    
+    // Ctrl-Z and Ctrl-Y reach the editor rather than the terminal
+    raw();
     
     // Main editing loop
     bool running = true;
     while (running) {
+        total_lines = edit_buffer_lines(&buffer);
+        edit_buffer_line(&buffer, current_line, &text);
+        if (current_col > (long)text.length()) {
+            current_col = text.length();
+        }
+        
+        // Keep the cursor on screen
+        if (current_line < screen_line) {
+            screen_line = current_line;
+        } else if (current_line >= screen_line + max_display_lines) {
+            screen_line = current_line - max_display_lines + 1;
+        }
+        long numbered = std::max(total_lines, screen_line + max_display_lines);
+        for (number_width = 4; numbered >= 10000 && number_width < 10; numbered /= 10) {
+            number_width++;
+        }
+        left_margin = number_width + 2;
+        
         // Clear editor window content but preserve the border
         for (int i = 1; i < editor_height - 1; i++) {
             wmove(editor_win, i, 1);
@@ -2485,13 +3130,16 @@ void edit_file_contents(const char *filepath) {
         }
         
         // Display lines with line numbers
-        for (int i = 0; i < max_display_lines && screen_line + i < (int)lines.size(); i++) {
+        int cursor_y = 1;
+        int cursor_x = left_margin;
+        std::string display_line;
+        for (int i = 0; i < max_display_lines && screen_line + i < total_lines; i++) {
             // Ensure we don't go beyond window boundaries
             if (i + 1 >= editor_height - 1) break;
             
             // Display line number with right alignment and highlighted background
             wattron(editor_win, COLOR_PAIR(4) | A_BOLD);
-            mvwprintw(editor_win, i + 1, 1, "%4d ", screen_line + i + 1);
+            mvwprintw(editor_win, i + 1, 1, "%*ld ", number_width, screen_line + i + 1);
             wattroff(editor_win, COLOR_PAIR(4) | A_BOLD);
             
             // Add a separator between line numbers and text
@@ -2500,105 +3148,49 @@ void edit_file_contents(const char *filepath) {
             wattroff(editor_win, COLOR_PAIR(4));
             
             // Get the line to display
-            std::string &display_line = lines[screen_line + i];
+            const std::vector<HighlightRun> *runs = highlight_line(&highlighter, screen_line + i);
+            edit_buffer_line(&buffer, screen_line + i, &display_line);
+            draw_highlighted(editor_win, i + 1, left_margin, editor_width - 2,
+                             display_line.data(), display_line.size(), runs, searched.empty() ? NULL : &pattern);
             
-            // Display the line with basic syntax coloring
-            std::string current_word;
-            int display_col = 0;  // Column position in the displayed text
-            
-            for (size_t j = 0; j < display_line.length() && left_margin + display_col < editor_width - 2; j++) {
-                char ch = display_line[j];
-                
-                // Handle tab characters
-                if (ch == '\t') {
-                    int spaces = 4 - (display_col % 4);
-                    for (int k = 0; k < spaces && left_margin + display_col < editor_width - 2; k++) {
-                        mvwaddch(editor_win, i + 1, left_margin + display_col, ' ');
-                        display_col++;
-                    }
-                    continue;
-                }
-                
-                // Check for comments (C/C++ style)
-                if (j < display_line.length() - 1 && ch == '/' && display_line[j+1] == '/') {
-                    wattron(editor_win, COLOR_PAIR(3));  // Use cyan for comments
-                    for (size_t k = j; k < display_line.length() && left_margin + display_col < editor_width - 2; k++) {
-                        mvwaddch(editor_win, i + 1, left_margin + display_col, display_line[k]);
-                        display_col++;
-                    }
-                    wattroff(editor_win, COLOR_PAIR(3));
-                    break;
-                }
-                
-                // Check for string literals
-                if (ch == '"' || ch == '\'') {
-                    char quote = ch;
-                    wattron(editor_win, COLOR_PAIR(2));  // Use green for strings
-                    mvwaddch(editor_win, i + 1, left_margin + display_col, ch);
-                    display_col++;
-                    
-                    for (j++; j < display_line.length() && left_margin + display_col < editor_width - 2; j++) {
-                        if (display_line[j] == '\\' && j+1 < display_line.length()) {
-                            // Handle escape sequence
-                            mvwaddch(editor_win, i + 1, left_margin + display_col, '\\');
-                            display_col++;
-                            j++;
-                            if (left_margin + display_col < editor_width - 2) {
-                                mvwaddch(editor_win, i + 1, left_margin + display_col, display_line[j]);
-                                display_col++;
-                            }
-                        } else if (display_line[j] == quote) {
-                            mvwaddch(editor_win, i + 1, left_margin + display_col, quote);
-                            display_col++;
-                            break;
-                        } else {
-                            mvwaddch(editor_win, i + 1, left_margin + display_col, display_line[j]);
-                            display_col++;
-                        }
-                    }
-                    wattroff(editor_win, COLOR_PAIR(2));
-                    continue;
-                }
-                
-                // Regular characters
-                mvwaddch(editor_win, i + 1, left_margin + display_col, ch);
-                display_col++;
-            }
-            
-            // If this is the current line, highlight it
+            // If this is the current line, work out where the cursor goes
             if (screen_line + i == current_line) {
-                // Position the cursor
-                int cursor_x = left_margin;
-                for (int j = 0; j < current_col; j++) {
-                    if (j < (int)display_line.length()) {
-                        if (display_line[j] == '\t') {
-                            // Each tab is 4 spaces
-                            cursor_x += 4 - ((cursor_x - left_margin) % 4);
-                        } else {
-                            cursor_x++;
-                        }
+                cursor_y = i + 1;
+                for (long j = 0; j < current_col && j < (long)display_line.length(); j++) {
+                    if (display_line[j] == '\t') {
+                        // Each tab is 4 spaces
+                        cursor_x += 4 - ((cursor_x - left_margin) % 4);
                     } else {
                         cursor_x++;
                     }
                 }
-                wmove(editor_win, i + 1, cursor_x);
+                cursor_x = std::min(cursor_x, editor_width - 3);
             }
         }
         
         // Update position information
-        mvprintw(2, 30, "Line: %d, Col: %d  ", current_line + 1, current_col + 1);
-        if (modified) {
+        attron(A_BOLD);
+        mvprintw(2, 0, "Line: ");
+        attroff(A_BOLD);
+        printw("%ld of %ld, Col: %ld  ", current_line + 1, total_lines, current_col + 1);
+        if (edit_buffer_modified(&buffer)) {
             attron(COLOR_PAIR(5) | A_BOLD);
             printw("[Modified]");
             attroff(COLOR_PAIR(5) | A_BOLD);
         }
+        if (notice) {
+            attron(COLOR_PAIR(5) | A_BOLD);
+            printw("  %s", notice);
+            attroff(COLOR_PAIR(5) | A_BOLD);
+        }
+        clrtoeol();
         
         // Show scrollbar
-        if (lines.size() > (size_t)max_display_lines) {
-            int scrollbar_height = (max_display_lines * max_display_lines) / lines.size();
+        if (total_lines > max_display_lines) {
+            int scrollbar_height = (int)((long)max_display_lines * max_display_lines / total_lines);
             if (scrollbar_height < 1) scrollbar_height = 1;
             
-            int scrollbar_pos = (max_display_lines * screen_line) / lines.size();
+            int scrollbar_pos = (int)((double)max_display_lines * screen_line / total_lines);
             
             wattron(editor_win, COLOR_PAIR(4));
             for (int i = 0; i < max_display_lines; i++) {
@@ -2609,70 +3201,64 @@ void edit_file_contents(const char *filepath) {
         }
         
         // Update instructions
-        mvprintw(LINES - 2, 0, "Arrow keys: move cursor | Backspace/Delete: delete | Enter: new line");
-        mvprintw(LINES - 1, 0, "F2: save | Esc: quit without saving");
+        mvprintw(LINES - 2, 0, "Arrow keys: move cursor | Ctrl-F: find | F3/Shift-F3: next/previous | Ctrl-R: regex on/off");
+        clrtoeol();
+        mvprintw(LINES - 1, 0, "F2: save | Ctrl-Z: undo | Ctrl-Y: redo | Esc: quit without saving");
+        clrtoeol();
         
-        // Refresh display and position cursor
-        wrefresh(editor_win);
-        refresh();
+        // Refresh display and position cursor - stdscr first, it covers the editor window
+        wmove(editor_win, cursor_y, cursor_x);
+        render_mark(stdscr);
+        render_mark(editor_win);
         
         // Get user input
         int ch = wgetch(editor_win);
+        notice = NULL;
+        uint64_t offset = edit_buffer_line_start(&buffer, current_line) + current_col;
+        uint64_t start, end;
+        long edit_from = -1;  // Lines edit_from to edit_to now hold what changed
+        long edit_to = -1;
         
         switch (ch) {
             case KEY_UP:
                 if (current_line > 0) {
                     current_line--;
-                    // Make sure cursor column is valid for the new line
-                    if (current_col > (int)lines[current_line].length()) {
-                        current_col = lines[current_line].length();
-                    }
-                    // Scroll if needed
-                    if (current_line < screen_line) {
-                        screen_line = current_line;
-                    }
                 }
                 break;
                 
             case KEY_DOWN:
-                if (current_line < (int)lines.size() - 1) {
+                if (current_line < total_lines - 1) {
                     current_line++;
-                    // Make sure cursor column is valid for the new line
-                    if (current_col > (int)lines[current_line].length()) {
-                        current_col = lines[current_line].length();
-                    }
-                    // Scroll if needed
-                    if (current_line >= screen_line + max_display_lines) {
-                        screen_line = current_line - max_display_lines + 1;
-                    }
                 }
                 break;
                 
+            case KEY_PPAGE:  // Page Up
+                current_line = std::max(0L, current_line - max_display_lines);
+                screen_line = std::max(0L, screen_line - max_display_lines);
+                break;
+                
+            case KEY_NPAGE:  // Page Down
+                current_line = std::min(total_lines - 1, current_line + max_display_lines);
+                screen_line = std::min(std::max(0L, total_lines - max_display_lines), screen_line + max_display_lines);
+                break;
+                
             case KEY_LEFT:
                 if (current_col > 0) {
                     current_col--;
                 } else if (current_line > 0) {
                     // Move to the end of the previous line
                     current_line--;
-                    current_col = lines[current_line].length();
-                    // Scroll if needed
-                    if (current_line < screen_line) {
-                        screen_line = current_line;
-                    }
+                    current_col = LONG_MAX;
                 }
                 break;
                 
             case KEY_RIGHT:
-                if (current_col < (int)lines[current_line].length()) {
+                if (current_col < (long)text.length()) {
                     current_col++;
-                } else if (current_line < (int)lines.size() - 1) {
+                } else if (current_line < total_lines - 1) {
                     // Move to the beginning of the next line
                     current_line++;
                     current_col = 0;
-                    // Scroll if needed
-                    if (current_line >= screen_line + max_display_lines) {
-                        screen_line = current_line - max_display_lines + 1;
-                    }
                 }
                 break;
                 
@@ -2681,94 +3267,113 @@ void edit_file_contents(const char *filepath) {
                 break;
                 
             case KEY_END:
-                current_col = lines[current_line].length();
+                current_col = text.length();
                 break;
                 
             case KEY_BACKSPACE:
             case 127:  // DEL key
-                if (current_col > 0) {
-                    // Delete character before cursor
-                    lines[current_line].erase(current_col - 1, 1);
-                    current_col--;
-                    modified = true;
-                } else if (current_line > 0) {
-                    // Merge with previous line
-                    current_col = lines[current_line - 1].length();
-                    lines[current_line - 1] += lines[current_line];
-                    lines.erase(lines.begin() + current_line);
-                    current_line--;
-                    modified = true;
-                    // Adjust screen_line if needed
-                    if (current_line < screen_line) {
-                        screen_line = current_line;
+            case 8:    // Ctrl-H
+                // Delete the character before the cursor, or join with the previous line
+                if (offset > 0) {
+                    if (current_col == 0) {
+                        current_line--;
+                        current_col = LONG_MAX;
+                    } else {
+                        current_col--;
                     }
+                    edit_buffer_erase(&buffer, offset - 1, 1);
+                    edit_from = edit_to = current_line;
                 }
                 break;
                 
             case KEY_DC:  // Delete key
-                if (current_col < (int)lines[current_line].length()) {
-                    // Delete character at cursor
-                    lines[current_line].erase(current_col, 1);
-                    modified = true;
-                } else if (current_line < (int)lines.size() - 1) {
-                    // Merge with next line
-                    lines[current_line] += lines[current_line + 1];
-                    lines.erase(lines.begin() + current_line + 1);
-                    modified = true;
-                }
+                // Delete the character at the cursor, or join with the next line
+                edit_buffer_erase(&buffer, offset, 1);
+                edit_from = edit_to = current_line;
                 break;
                 
             case '\n':
+            case '\r':
             case KEY_ENTER:
-                // Split line and insert a new one
-                {
-                    std::string new_line = lines[current_line].substr(current_col);
-                    lines[current_line].erase(current_col);
-                    lines.insert(lines.begin() + current_line + 1, new_line);
-                    current_line++;
-                    current_col = 0;
-                    modified = true;
-                    // Scroll if needed
-                    if (current_line >= screen_line + max_display_lines) {
-                        screen_line = current_line - max_display_lines + 1;
-                    }
-                }
+                // Split the line
+                edit_buffer_insert(&buffer, offset, "\n", 1);
+                edit_from = current_line;
+                edit_to = ++current_line;
+                current_col = 0;
                 break;
                 
             case '\t':
                 // Insert tab
-                lines[current_line].insert(current_col, "\t");
+                edit_buffer_insert(&buffer, offset, "\t", 1);
+                edit_from = edit_to = current_line;
                 current_col++;
-                modified = true;
                 break;
                 
-            case KEY_F(2):  // Save
-                {
-                    FILE *file = fopen(filepath, "w");
-                    bool success = false;
-                    if (file) {
-                        for (size_t i = 0; i < lines.size(); i++) {
-                            fprintf(file, "%s\n", lines[i].c_str());
+            case 0x1a:  // Ctrl-Z: undo
+            case 0x19:  // Ctrl-Y: redo
+                if (ch == 0x1a ? edit_buffer_undo(&buffer, &start, &end) : edit_buffer_redo(&buffer, &start, &end)) {
+                    edit_from = edit_buffer_line_of(&buffer, start);
+                    edit_to = current_line = edit_buffer_line_of(&buffer, end);
+                    current_col = (long)(end - edit_buffer_line_start(&buffer, current_line));
+                } else {
+                    notice = ch == 0x1a ? "Nothing to undo" : "Nothing to redo";
+                }
+                break;
+                
+            case 0x06:       // Ctrl-F: find, from the cursor
+            case KEY_F(3):   // Next match
+            case KEY_F(15):  // Shift-F3: previous match
+                if (ch == 0x06) {
+                    mvprintw(2, 0, "Find%s: ", search_regex ? " (regex)" : "");
+                    clrtoeol();
+                    echo();
+                    getnstr(query, sizeof(query) - 1);
+                    noecho();
+                    if (query[0]) {
+                        // A bad pattern leaves the last one in place
+                        int flags = search_regex ? TEXT_REGEX : TEXT_FIXED;
+                        char err[200];
+                        TextPattern check;
+                        if (text_pattern_compile(&check, query, flags, err, sizeof(err)) != 0) {
+                            snprintf(notice_text, sizeof(notice_text), "Bad pattern: %s", err);
+                            notice = notice_text;
+                            break;
                         }
-                        fclose(file);
-                        success = true;
-                    }
-                    
-                    if (success) {
-                        modified = false;
-                        mvprintw(2, 30, "File saved successfully!         ");
-                    } else {
-                        mvprintw(2, 30, "Error saving file!               ");
+                        text_pattern_free(&check);
+                        if (!searched.empty()) {
+                            text_pattern_free(&pattern);
+                        }
+                        text_pattern_compile(&pattern, query, flags, err, sizeof(err));
+                        searched = query;
                     }
                 }
-                refresh();
+                if (searched.empty()) {
+                    notice = "Nothing to find yet - press Ctrl-F";
+                } else if (!editor_search(&buffer, &pattern, ch != KEY_F(15), &current_line, &current_col)) {
+                    notice = ch != KEY_F(15) ? "No more matches below" : "No more matches above";
+                }
+                break;
+                
+            case 0x12:  // Ctrl-R: regex or plain text, for the next search
+                search_regex = !search_regex;
+                notice = search_regex ? "Ctrl-F takes a regex" : "Ctrl-F takes plain text";
+                break;
+                
+            case KEY_F(2):  // Save
+                if (edit_buffer_save(&buffer, filepath) == 0) {
+                    notice = "File saved successfully!";
+                } else {
+                    snprintf(notice_text, sizeof(notice_text), "Error saving file: %s", strerror(errno));
+                    notice = notice_text;
+                }
                 break;
                 
             case 27:  // ESC key
-                if (modified) {
+                if (edit_buffer_modified(&buffer)) {
                     // Confirm before exiting
                     mvprintw(LINES - 1, 0, "File modified! Press 'y' to exit without saving, any other key to continue editing");
-                    refresh();
+                    clrtoeol();
+                    render_mark(stdscr);
                     int confirm = wgetch(editor_win);
                     if (confirm == 'y' || confirm == 'Y') {
                         running = false;
@@ -2781,35 +3386,84 @@ void edit_file_contents(const char *filepath) {
             default:
                 // Insert regular characters
                 if (ch >= 32 && ch <= 126) {  // Printable ASCII
-                    lines[current_line].insert(current_col, 1, (char)ch);
+                    char c = (char)ch;
+                    edit_buffer_insert(&buffer, offset, &c, 1);
+                    edit_from = edit_to = current_line;
                     current_col++;
-                    modified = true;
                 }
                 break;
         }
+        
+        // Lex the changed lines again; the count of lines they replaced
+        // follows from how many the text gained or lost
+        if (edit_from >= 0) {
+            long added = edit_to - edit_from;
+            highlight_edit(&highlighter, edit_from, added - (edit_buffer_lines(&buffer) - total_lines), added);
+        }
     }
     
     // Clean up
+    cbreak();
+    if (!searched.empty()) {
+        text_pattern_free(&pattern);
+    }
+    edit_buffer_free(&buffer);
     delwin(editor_win);
     clear();
-    refresh();
+    render_mark(stdscr);
 }
 
-bool save_file(const std::vector<std::string> &lines, const char *filepath) {
-    FILE *file = fopen(filepath, "w");
-    if (!file) {
-        return false;
+// Improved file explorer implementation
+// The model's arrays as the view reads them
+static DirColumns explorer_columns(const DirModel *model) {
+    DirColumns columns;
+    columns.count = dir_model_count(model);
+    columns.names = model->names.c_str();
+    columns.name_at = model->name_at.data();
+    columns.kind = model->kind.data();
+    columns.dir_kind = DIR_MODEL_DIR;
+    columns.size = model->size.data();
+    columns.mtime = model->modified.data();
+    columns.name_ordered = true;
+    return columns;
+}
+
+// Sort and filter the explorer's entries again from the cached columns,
+// then select the entry called selected if it is still shown
+static void explorer_sort(const DirModel *model, DirView *view, const char *selected, int *current_item) {
+    DirColumns columns = explorer_columns(model);
+    dir_view_sort(view, &columns);
+
+    long at = selected ? dir_model_find(model, selected) : -1;
+    long row = at >= 0 ? dir_view_row(view, (uint32_t)at) : -1;
+    *current_item = row >= 0 ? (int)row : 0;
+}
+
+// As explorer_sort(), for a new filter: the view narrows or widens the
+// rows it has rather than sorting again
+static void explorer_filter(const DirModel *model, DirView *view, const char *filter, int *current_item) {
+    uint32_t selected = *current_item < (int)view->rows.size() ? view->rows[*current_item] : UINT32_MAX;
+    DirColumns columns = explorer_columns(model);
+    dir_view_filter(view, &columns, filter);
+
+    long row = selected != UINT32_MAX ? dir_view_row(view, selected) : -1;
+    *current_item = row >= 0 ? (int)row : 0;
+}
+
+// Apply changes to the explorer's directory, keeping the selection on the
+// same name
+static void explorer_refresh(DirModel *model, DirView *view, int *current_item) {
+    std::string selected;
+    if (*current_item < (int)view->rows.size()) {
+        selected = dir_model_name(model, view->rows[*current_item]);
     }
-    
-    for (size_t i = 0; i < lines.size(); i++) {
-        fprintf(file, "%s\n", lines[i].c_str());
+    fs_watch_read(model->watch);
+    if (dir_model_update(model)) {
+        explorer_sort(model, view, selected.c_str(), current_item);
     }
-    
-    fclose(file);
-    return true;
+    fs_watch_clear(model->watch);
 }
 
-// Improved file explorer implementation
 void launch_explorer(void) {
     clear();
     int explorer_height = LINES - 4;
@@ -2828,12 +3482,16 @@ void launch_explorer(void) {
     
     mvprintw(1, 0, "Path: %s", current_path);
     
-    // Variables for directory listing
-    DIR *dir;
-    struct dirent *entry;
-    std::vector<std::string> entries;
-    std::vector<bool> is_dir;
-    std::vector<off_t> file_sizes;
+    // The directory being shown - read when entered, then patched as it changes
+    FsWatch watch;
+    fs_watch_init(&watch);
+    DirModel model;
+    dir_model_init(&model, &watch);
+    
+    // Order and filter, worked out from the model without touching the disk
+    DirView view;
+    dir_view_init(&view);
+    bool filtering = false;  // Typed keys go to the filter
     
     // Current selection and scroll position
     int current_item = 0;
@@ -2845,94 +3503,37 @@ void launch_explorer(void) {
     strncpy(current_explorer_path, current_path, MAX_PATH - 1);
     current_explorer_path[MAX_PATH - 1] = '\0'; // Ensure null termination
     
-    // Define column widths and positions
-    const int name_col_width = explorer_width - 32; // Allow enough space for size and type columns
-    const int size_col_pos = name_col_width + 2;
-    const int type_col_pos = size_col_pos + 12;
+    // Define column widths and positions. Owner and then Modified are left
+    // out when the name would get fewer than EXPLORER_NAME_MIN columns.
+    const bool show_owner = explorer_width - 62 >= EXPLORER_NAME_MIN;
+    const bool show_modified = explorer_width - (show_owner ? 62 : 50) >= EXPLORER_NAME_MIN;
+    const int name_col_width = std::max(explorer_width - 32 - (show_owner ? 12 : 0) - (show_modified ? 18 : 0),
+                                        EXPLORER_NAME_MIN);
+    const int owner_col_pos = name_col_width + 2;
+    const int size_col_pos = owner_col_pos + (show_owner ? 12 : 0);
+    const int modified_col_pos = size_col_pos + 12;
+    const int type_col_pos = modified_col_pos + (show_modified ? 18 : 0);
+    
+    dir_model_open(&model, current_explorer_path);
+    explorer_sort(&model, &view, NULL, &current_item);
     
     while (running) {
-        // Clear entries from previous directory
-        entries.clear();
-        is_dir.clear();
-        file_sizes.clear();
-        
-        // Get directory listing
-        dir = opendir(current_explorer_path);
-        if (dir) {
-            while ((entry = readdir(dir)) != NULL) {
-                entries.push_back(entry->d_name);
-                
-                // Check if it's a directory and get file size
-                char full_path[MAX_PATH];
-                
-                // Safe path construction to avoid buffer overflow
-                size_t path_len = strlen(current_explorer_path);
-                size_t name_len = strlen(entry->d_name);
-                
-                // Check if the combined length would exceed buffer size (accounting for '/' and null terminator)
-                if (path_len + name_len + 2 <= MAX_PATH) {
-                    strcpy(full_path, current_explorer_path);
-                    strcat(full_path, "/");
-                    strcat(full_path, entry->d_name);
-                } else {
-                    // Path would be too long - log error and use truncated path
-                    log_error(error_console, ERROR_WARNING, "EXPLORER", 
-                              "Path too long: %s/%s", current_explorer_path, entry->d_name);
-                    draw_error_status_bar("Path too long");
-                    strncpy(full_path, current_explorer_path, MAX_PATH - 1);
-                    full_path[MAX_PATH - 1] = '\0';
-                }
-                
-                struct stat st;
-                bool is_directory = false;
-                off_t size = 0;
-                
-                if (stat(full_path, &st) == 0) {
-                    is_directory = S_ISDIR(st.st_mode);
-                    size = st.st_size;
-                }
-                
-                is_dir.push_back(is_directory);
-                file_sizes.push_back(size);
-            }
-            closedir(dir);
-            
-            // Sort entries (directories first, then alphabetically)
-            std::vector<size_t> indices(entries.size());
-            for (size_t i = 0; i < entries.size(); i++) {
-                indices[i] = i;
-            }
-            
-            std::sort(indices.begin(), indices.end(), [&](size_t a, size_t b) {
-                if (is_dir[a] != is_dir[b]) {
-                    return is_dir[a] > is_dir[b]; // Directories first
-                }
-                return entries[a] < entries[b]; // Then alphabetically
-            });
-            
-            // Apply the sort
-            std::vector<std::string> sorted_entries;
-            std::vector<bool> sorted_is_dir;
-            std::vector<off_t> sorted_file_sizes;
-            
-            for (size_t idx : indices) {
-                sorted_entries.push_back(entries[idx]);
-                sorted_is_dir.push_back(is_dir[idx]);
-                sorted_file_sizes.push_back(file_sizes[idx]);
-            }
-            
-            entries = sorted_entries;
-            is_dir = sorted_is_dir;
-            file_sizes = sorted_file_sizes;
+        if (model.error == 0) {
+            int count = (int)view.rows.size();
             
             // Reset selection if needed
-            if (current_item >= (int)entries.size()) {
-                current_item = entries.size() - 1;
+            if (current_item >= count) {
+                current_item = count - 1;
                 if (current_item < 0) current_item = 0;
             }
             
             // Update display path
             mvprintw(1, 0, "Path: %s ", current_explorer_path); // Space at end to clear any leftover text
+            printw(" [sort: %s%s]", dir_view_key_name(view.key), view.descending ? ", reversed" : "");
+            if (filtering || !view.filter.empty()) {
+                printw(" [filter: %s%s] %d of %d", view.filter.c_str(), filtering ? "_" : "",
+                       count, (int)dir_model_count(&model));
+            }
             clrtoeol(); // Clear to the end of line
             
             // Clear explorer window
@@ -2942,7 +3543,13 @@ void launch_explorer(void) {
             // Add column headers
             wattron(explorer_win, A_BOLD);
             mvwprintw(explorer_win, 0, 2, " Name");
+            if (show_owner) {
+                mvwprintw(explorer_win, 0, owner_col_pos, "Owner");
+            }
             mvwprintw(explorer_win, 0, size_col_pos, "Size");
+            if (show_modified) {
+                mvwprintw(explorer_win, 0, modified_col_pos, "Modified");
+            }
             mvwprintw(explorer_win, 0, type_col_pos, "Type");
             wattroff(explorer_win, A_BOLD);
             
@@ -2956,9 +3563,12 @@ void launch_explorer(void) {
                 scroll_pos = current_item - display_height + 1;
             }
             
-            for (int i = 0; i < display_height && i + scroll_pos < (int)entries.size(); i++) {
-                int entry_idx = i + scroll_pos;
-                std::string name = entries[entry_idx];
+            // Only the visible rows are drawn, straight from the model
+            for (int i = 0; i < display_height && i + scroll_pos < count; i++) {
+                int row = i + scroll_pos;
+                uint32_t entry_idx = view.rows[row];
+                std::string name = dir_model_name(&model, entry_idx);
+                bool is_directory = model.kind[entry_idx] == DIR_MODEL_DIR;
                 
                 // Truncate name if too long for the column
                 if (name.length() > (size_t)name_col_width - 5) {
@@ -2966,7 +3576,7 @@ void launch_explorer(void) {
                 }
                 
                 // Highlight selected item
-                if (entry_idx == current_item) {
+                if (row == current_item) {
                     wattron(explorer_win, A_REVERSE);
                 }
                 
@@ -2977,8 +3587,8 @@ void launch_explorer(void) {
                 
                 // Display file size
                 char size_str[32] = "";
-                if (!is_dir[entry_idx]) {
-                    off_t size = file_sizes[entry_idx];
+                if (!is_directory) {
+                    off_t size = model.size[entry_idx];
                     if (size < 1024) {
                         snprintf(size_str, sizeof(size_str), "%ld B", (long)size);
                     } else if (size < 1024 * 1024) {
@@ -2991,67 +3601,52 @@ void launch_explorer(void) {
                 }
                 
                 // Display file type
-                const char *type_str = is_dir[entry_idx] ? "Directory" : "File";
+                const char *type_str = is_directory ? "Directory" : "File";
+                
+                // Owner name, shared with ls through the id cache
+                if (show_owner) {
+                    char owner_str[ID_CACHE_NAME_LEN] = "";
+                    if (model.owner[entry_idx] != (uid_t)-1) {
+                        id_cache_user_name(model.owner[entry_idx], owner_str, sizeof(owner_str));
+                    }
+                    mvwprintw(explorer_win, i + 1, owner_col_pos, "%.10s", owner_str);
+                }
                 
                 // Display entry with appropriate color
-                if (is_dir[entry_idx]) {
+                if (is_directory) {
                     wattron(explorer_win, COLOR_PAIR(1) | A_BOLD);
                     mvwprintw(explorer_win, i + 1, 2, " %s/", name.c_str());
                     wattroff(explorer_win, COLOR_PAIR(1) | A_BOLD);
-                    
-                    // Display file type (right-aligned)
-                    mvwprintw(explorer_win, i + 1, type_col_pos, "%s", type_str);
+                } else if (model.kind[entry_idx] == DIR_MODEL_EXEC) {
+                    wattron(explorer_win, COLOR_PAIR(2) | A_BOLD);
+                    mvwprintw(explorer_win, i + 1, 2, " %s", name.c_str());
+                    wattroff(explorer_win, COLOR_PAIR(2) | A_BOLD);
                 } else {
-                    // Check if it's executable
-                    char full_path[MAX_PATH];
-                    
-                    // Safe path construction
-                    size_t path_len = strlen(current_explorer_path);
-                    size_t name_len = entries[entry_idx].length();
-                    
-                    // Check if the combined length would exceed buffer size
-                    if (path_len + name_len + 2 <= MAX_PATH) {
-                        strcpy(full_path, current_explorer_path);
-                        strcat(full_path, "/");
-                        strcat(full_path, entries[entry_idx].c_str());
-                    } else {
-                        // Path would be too long - log error and use truncated path
-                        log_error(error_console, ERROR_WARNING, "EXPLORER", 
-                                "Path too long: %s/%s", current_explorer_path, entries[entry_idx].c_str());
-                        draw_error_status_bar("Path too long");
-                        strncpy(full_path, current_explorer_path, MAX_PATH - 1);
-                        full_path[MAX_PATH - 1] = '\0';
-                    }
-                    
-                    struct stat st;
-                    
-                    if (stat(full_path, &st) == 0 && (st.st_mode & S_IXUSR)) {
-                        wattron(explorer_win, COLOR_PAIR(2) | A_BOLD);
-                        mvwprintw(explorer_win, i + 1, 2, " %s", name.c_str());
-                        wattroff(explorer_win, COLOR_PAIR(2) | A_BOLD);
-                    } else {
-                        mvwprintw(explorer_win, i + 1, 2, " %s", name.c_str());
-                    }
-                    
-                    // Display file size (right-aligned)
-                    mvwprintw(explorer_win, i + 1, size_col_pos, "%s", size_str);
-                    
-                    // Display file type (right-aligned)
-                    mvwprintw(explorer_win, i + 1, type_col_pos, "%s", type_str);
+                    mvwprintw(explorer_win, i + 1, 2, " %s", name.c_str());
+                }
+                
+                // Display file size and type (right-aligned)
+                mvwprintw(explorer_win, i + 1, size_col_pos, "%s", size_str);
+                if (show_modified) {
+                    char modified_str[32];
+                    strftime(modified_str, sizeof(modified_str), "%Y-%m-%d %H:%M",
+                             localtime(&model.modified[entry_idx]));
+                    mvwprintw(explorer_win, i + 1, modified_col_pos, "%s", modified_str);
                 }
+                mvwprintw(explorer_win, i + 1, type_col_pos, "%s", type_str);
                 
                 // End highlight
-                if (entry_idx == current_item) {
+                if (row == current_item) {
                     wattroff(explorer_win, A_REVERSE);
                 }
             }
             
             // Show scrollbar if needed
-            if (entries.size() > (size_t)display_height) {
-                int scrollbar_height = (display_height * display_height) / entries.size();
+            if (count > display_height) {
+                int scrollbar_height = (display_height * display_height) / count;
                 if (scrollbar_height < 1) scrollbar_height = 1;
                 
-                int scrollbar_pos = (display_height * current_item) / entries.size();
+                int scrollbar_pos = (display_height * current_item) / count;
                 
                 for (int i = 0; i < display_height; i++) {
                     mvwaddch(explorer_win, i + 1, explorer_width - 2, 
@@ -3060,16 +3655,67 @@ void launch_explorer(void) {
             }
             
             // Add instructions at the bottom
-            mvprintw(LINES - 1, 0, "Up/Down: navigate | Enter: open dir | v: view file | Backspace: go up | Home/End: first/last | q: quit");
+            if (filtering) {
+                mvprintw(LINES - 1, 0, "Type to filter | Backspace: delete | Enter: keep filter | Esc: clear filter");
+            } else {
+                mvprintw(LINES - 1, 0, "Up/Down: navigate | Enter: open dir | v: view file | u: disk usage | s/S: sort/reverse | /: filter | Backspace: go up | q: quit");
+            }
+            clrtoeol();
+            
+            // Refresh windows - stdscr first, it covers the explorer window
+            render_mark(stdscr);
+            render_mark(explorer_win);
+            
+            // Handle input, and changes to the directory while waiting
+            int ch = watched_getch(explorer_win, &watch);
             
-            // Refresh windows
-            wrefresh(explorer_win);
-            refresh();
+            // While filtering, printable keys edit the filter and it is applied as typed
+            if (filtering && ch != ERR && ch != KEY_UP && ch != KEY_DOWN && ch != KEY_PPAGE && ch != KEY_NPAGE) {
+                std::string filter = view.filter;
+                if (ch == '\n' || ch == 27) {  // Enter keeps the filter, Esc drops it
+                    filtering = false;
+                    if (ch == 27) {
+                        filter.clear();
+                    }
+                } else if (ch == KEY_BACKSPACE || ch == 127) {
+                    if (!filter.empty()) {
+                        filter.erase(filter.size() - 1);
+                    }
+                } else if (ch >= 32 && ch <= 126) {
+                    filter += (char)ch;
+                }
+                if (filter != view.filter) {
+                    explorer_filter(&model, &view, filter.c_str(), &current_item);
+                }
+                continue;
+            }
             
-            // Handle input
-            int ch = wgetch(explorer_win);
+            // The entry under the selection, as an index into the model
+            uint32_t selected = count > 0 ? view.rows[current_item] : 0;
             
             switch (ch) {
+                case ERR:  // The directory changed
+                    explorer_refresh(&model, &view, &current_item);
+                    break;
+                    
+                case 's':  // Next sort key
+                case 'S':  // Reverse the order
+                    {
+                        DirColumns columns = explorer_columns(&model);
+                        if (ch == 's') {
+                            dir_view_set_key(&view, &columns, (view.key + 1) % DIR_VIEW_KEYS, view.descending);
+                        } else {
+                            dir_view_set_key(&view, &columns, view.key, !view.descending);
+                        }
+                        long row = count > 0 ? dir_view_row(&view, selected) : -1;
+                        current_item = row >= 0 ? (int)row : 0;
+                    }
+                    break;
+                    
+                case '/':  // Type to filter
+                    filtering = true;
+                    break;
+                    
                 case KEY_UP:
                     if (current_item > 0) {
                         current_item--;
@@ -3077,7 +3723,7 @@ void launch_explorer(void) {
                     break;
                     
                 case KEY_DOWN:
-                    if (current_item < (int)entries.size() - 1) {
+                    if (current_item < count - 1) {
                         current_item++;
                     }
                     break;
@@ -3091,8 +3737,8 @@ void launch_explorer(void) {
                     
                 case KEY_NPAGE:  // Page Down
                     current_item += display_height;
-                    if (current_item >= (int)entries.size()) {
-                        current_item = entries.size() - 1;
+                    if (current_item >= count) {
+                        current_item = count - 1;
                     }
                     break;
                     
@@ -3101,60 +3747,62 @@ void launch_explorer(void) {
                     break;
                     
                 case KEY_END:
-                    current_item = entries.size() - 1;
+                    current_item = count - 1;
                     break;
                     
                 case '\n': // Enter
-                    if (entries.size() > 0) {
-                        if (is_dir[current_item]) {
-                            // Change directory
-                            if (entries[current_item] == "..") {
-                                // Go up one level
-                                char *last_slash = strrchr(current_explorer_path, '/');
-                                if (last_slash != NULL && last_slash != current_explorer_path) {
-                                    *last_slash = '\0';
-                                }
-                            } else if (entries[current_item] != ".") {
-                                // Go into subdirectory - check buffer space first
-                                size_t current_len = strlen(current_explorer_path);
-                                size_t entry_len = entries[current_item].length();
-                                
-                                // Check if adding "/entry_name" would exceed buffer
-                                if (current_len + entry_len + 2 <= MAX_PATH) {
-                                    strcat(current_explorer_path, "/");
-                                    strcat(current_explorer_path, entries[current_item].c_str());
-                                } else {
-                                    // Path would be too long
-                                    log_error(error_console, ERROR_WARNING, "EXPLORER", 
-                                            "Path too long: cannot enter %s", entries[current_item].c_str());
-                                    draw_error_status_bar("Path too long: cannot enter directory");
-                                }
+                    if (count > 0 && model.kind[selected] == DIR_MODEL_DIR) {
+                        std::string entry_name = dir_model_name(&model, selected);
+                        
+                        // Change directory
+                        if (entry_name == "..") {
+                            // Go up one level
+                            char *last_slash = strrchr(current_explorer_path, '/');
+                            if (last_slash != NULL && last_slash != current_explorer_path) {
+                                *last_slash = '\0';
                             }
+                        } else if (entry_name != ".") {
+                            // Go into subdirectory - check buffer space first
+                            size_t current_len = strlen(current_explorer_path);
                             
-                            // Reset selection
-                            current_item = 0;
-                            scroll_pos = 0;
+                            // Check if adding "/entry_name" would exceed buffer
+                            if (current_len + entry_name.length() + 2 <= MAX_PATH) {
+                                strcat(current_explorer_path, "/");
+                                strcat(current_explorer_path, entry_name.c_str());
+                            } else {
+                                // Path would be too long
+                                log_error(error_console, ERROR_WARNING, "EXPLORER", 
+                                        "Path too long: cannot enter %s", entry_name.c_str());
+                                draw_error_status_bar("Path too long: cannot enter directory");
+                            }
                         }
+                        
+                        // Reset selection, and the filter with it
+                        dir_model_open(&model, current_explorer_path);
+                        view.filter.clear();
+                        explorer_sort(&model, &view, NULL, &current_item);
+                        scroll_pos = 0;
                     }
                     break;
                 
                 case 'v': // View file contents
-                    if (entries.size() > 0 && !is_dir[current_item]) {
+                    if (count > 0 && model.kind[selected] != DIR_MODEL_DIR) {
                         // Build full path for the file
                         char full_path[MAX_PATH];
+                        std::string entry_name = dir_model_name(&model, selected);
                         
                         size_t path_len = strlen(current_explorer_path);
-                        size_t entry_len = entries[current_item].length();
+                        size_t entry_len = entry_name.length();
                         
                         if (path_len + entry_len + 2 <= MAX_PATH) {
                             strcpy(full_path, current_explorer_path);
                             strcat(full_path, "/");
-                            strcat(full_path, entries[current_item].c_str());
+                            strcat(full_path, entry_name.c_str());
                             
                             // View the file with our enhanced viewer
                             view_file_contents(full_path);
                             
-                            // Redraw explorer after returning
+                            // Redraw explorer after returning, with any edit made there
                             clear();
                             attron(A_REVERSE);
                             for (int i = 0; i < COLS; i++) {
@@ -3163,54 +3811,549 @@ void launch_explorer(void) {
                             mvprintw(0, 1, "File Explorer - Use arrow keys to navigate, Enter to select, v to view/edit, q to quit");
                             attroff(A_REVERSE);
                             mvprintw(1, 0, "Path: %s", current_explorer_path);
+                            explorer_refresh(&model, &view, &current_item);
                         } else {
                             // Path would be too long
                             log_error(error_console, ERROR_WARNING, "EXPLORER", 
-                                    "Path too long: cannot view %s", entries[current_item].c_str());
+                                    "Path too long: cannot view %s", entry_name.c_str());
                             draw_error_status_bar("Path too long: cannot view file");
                         }
                     }
                     break;
-                    
-                case KEY_BACKSPACE:
-                case 127: // DEL key
-                    // Go up one level
-                    {
-                        char *last_slash = strrchr(current_explorer_path, '/');
-                        if (last_slash != NULL && last_slash != current_explorer_path) {
-                            *last_slash = '\0';
-                        }
-                        current_item = 0;
-                        scroll_pos = 0;
+                    
+                case 'u': // Disk usage of the current directory
+                    cmd_du_interactive(current_explorer_path);
+                    
+                    // Redraw explorer after returning
+                    clear();
+                    attron(A_REVERSE);
+                    for (int i = 0; i < COLS; i++) {
+                        mvaddch(0, i, ' ');
+                    }
+                    mvprintw(0, 1, "File Explorer - Use arrow keys to navigate, Enter to select, v to view, q to quit");
+                    attroff(A_REVERSE);
+                    mvprintw(1, 0, "Path: %s", current_explorer_path);
+                    explorer_refresh(&model, &view, &current_item);
+                    break;
+                    
+                case KEY_BACKSPACE:
+                case 127: // DEL key
+                    // Go up one level, with the directory we came from selected
+                    {
+                        char *last_slash = strrchr(current_explorer_path, '/');
+                        std::string came_from;
+                        if (last_slash != NULL && last_slash != current_explorer_path) {
+                            came_from = last_slash + 1;
+                            *last_slash = '\0';
+                        }
+                        dir_model_open(&model, current_explorer_path);
+                        view.filter.clear();
+                        explorer_sort(&model, &view, came_from.c_str(), &current_item);
+                        scroll_pos = 0;
+                    }
+                    break;
+                    
+                case 'q':
+                    running = false;
+                    break;
+            }
+        } else {
+            // Failed to open directory
+            log_error(error_console, ERROR_WARNING, "EXPLORER", 
+                      "Error opening directory '%s': %s", current_explorer_path, strerror(model.error));
+            draw_error_status_bar("Cannot open directory");
+            
+            // Wait for user acknowledgment
+            mvprintw(LINES - 1, 0, "Press any key to return to the shell...");
+            render_mark(stdscr);
+            getch();
+            running = false;
+        }
+    }
+    
+    // Clean up
+    dir_model_close(&model);
+    fs_watch_close(&watch);
+    delwin(explorer_win);
+    clear();
+    render_mark(stdscr);
+}
+
+// The disk usage and search views scan on this thread, so q/Esc is
+// polled every so often to cancel a slow scan
+static int scan_polls = 0;
+
+static int scan_poll_stop(void) {
+    if (++scan_polls % 4096 != 0) {
+        return 0;
+    }
+    timeout(0);
+    int ch = getch();
+    timeout(-1);
+    return ch == 'q' || ch == 27;
+}
+
+static void du_view_progress(const DuStats *stats, void *ctx) {
+    mvprintw(2, 0, "Scanning %s: %lu directories (%lu unchanged), q to cancel",
+             (const char *)ctx, stats->dirs, stats->cached);
+    clrtoeol();
+    render_mark(stdscr);
+}
+
+static DuNode *du_view_scan(const char *path, DuStats *stats, double *seconds) {
+    scan_polls = 0;
+    move(2, 0);
+    clrtobot();
+    mvprintw(2, 0, "Scanning %s...", path);
+    render_mark(stdscr);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    DuNode *root = du_scan(path, scan_poll_stop, du_view_progress, (void *)path, stats);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return root;
+}
+
+// Names from root down to node, to find the same directory after a rescan
+static std::vector<std::string> du_view_trail(const DuNode *node) {
+    std::vector<std::string> trail;
+    for (; node->parent; node = node->parent) {
+        trail.insert(trail.begin(), node->name);
+    }
+    return trail;
+}
+
+static DuNode *du_view_follow(DuNode *root, const std::vector<std::string> &trail) {
+    DuNode *node = root;
+    for (size_t i = 0; i < trail.size(); i++) {
+        DuNode *next = NULL;
+        for (size_t j = 0; j < node->children.size() && !next; j++) {
+            if (node->children[j]->name == trail[i]) {
+                next = node->children[j];
+            }
+        }
+        if (!next) {
+            break;
+        }
+        node = next;
+    }
+    return node;
+}
+
+// One row of the view - a subdirectory, or the files held directly
+typedef struct {
+    DuNode *node;                       // NULL for the files row
+    unsigned long long bytes;
+} DuRow;
+
+static std::vector<DuRow> du_view_rows(DuNode *dir, int order) {
+    std::vector<DuRow> rows;
+    for (size_t i = 0; i < dir->children.size(); i++) {
+        DuRow row = {dir->children[i], dir->children[i]->bytes};
+        rows.push_back(row);
+    }
+    if (dir->own_files > 0) {
+        DuRow files = {NULL, dir->own_bytes};
+        size_t at = rows.size();
+        if (order == DU_SORT_SIZE) {
+            for (at = 0; at < rows.size() && rows[at].bytes >= files.bytes; at++) {
+            }
+        }
+        rows.insert(rows.begin() + at, files);
+    }
+    return rows;
+}
+
+void cmd_du_interactive(const char *path) {
+    clear();
+    attron(A_REVERSE);
+    for (int i = 0; i < COLS; i++) {
+        mvaddch(0, i, ' ');
+    }
+    mvprintw(0, 1, "Disk Usage - Enter to open, Backspace to go up, s to sort, r to rescan, q to quit");
+    attroff(A_REVERSE);
+
+    DuStats stats;
+    double seconds;
+    DuNode *root = du_view_scan(path, &stats, &seconds);
+    if (!root) {
+        if (errno != ECANCELED) {
+            log_error(error_console, ERROR_WARNING, "MINUX", 
+                    "Error opening directory '%s': %s", path, strerror(errno));
+            draw_error_status_bar("Cannot open directory");
+            mvprintw(LINES - 1, 0, "Press any key to return to the shell...");
+            render_mark(stdscr);
+            getch();
+        }
+        clear();
+        render_mark(stdscr);
+        return;
+    }
+
+    DuNode *dir = root;
+    int order = DU_SORT_SIZE;
+    int current_item = 0;
+    int scroll_pos = 0;
+    const int display_height = LINES - 5;
+    bool running = true;
+
+    while (running) {
+        std::vector<DuRow> rows = du_view_rows(dir, order);
+        unsigned long long largest = rows.empty() ? 0 : rows[0].bytes;
+        for (size_t i = 0; i < rows.size(); i++) {
+            largest = std::max(largest, rows[i].bytes);
+        }
+
+        if (current_item >= (int)rows.size()) {
+            current_item = rows.empty() ? 0 : (int)rows.size() - 1;
+        }
+        if (current_item < scroll_pos) {
+            scroll_pos = current_item;
+        } else if (current_item >= scroll_pos + display_height) {
+            scroll_pos = current_item - display_height + 1;
+        }
+
+        move(1, 0);
+        clrtobot();
+        std::string shown = path;
+        std::vector<std::string> trail = du_view_trail(dir);
+        for (size_t i = 0; i < trail.size(); i++) {
+            shown += "/" + trail[i];
+        }
+        char total[16];
+        du_format_size(dir->bytes, total, sizeof(total));
+        mvprintw(1, 0, "Path: %s", shown.c_str());
+        mvprintw(2, 0, "Total %s in %lu files, %lu directories  (scanned %lu directories in %.2fs, %lu unchanged)",
+                 total, dir->files, dir->dirs, stats.dirs, seconds, stats.cached);
+
+        for (int i = 0; i < display_height && scroll_pos + i < (int)rows.size(); i++) {
+            int row_idx = scroll_pos + i;
+            const DuRow &row = rows[row_idx];
+
+            char size[16];
+            du_format_size(row.bytes, size, sizeof(size));
+            char bar[11];
+            int filled = largest > 0 ? (int)(row.bytes * 10 / largest) : 0;
+            for (int b = 0; b < 10; b++) {
+                bar[b] = b < filled ? '#' : ' ';
+            }
+            bar[10] = '\0';
+
+            if (row_idx == current_item) {
+                attron(A_REVERSE);
+            }
+            mvprintw(i + 4, 1, "%7s [%s] ", size, bar);
+            if (row.node) {
+                attron(COLOR_PAIR(1) | A_BOLD);
+                printw("%s/", row.node->name.c_str());
+                attroff(COLOR_PAIR(1) | A_BOLD);
+                if (row.node->error) {
+                    printw("  (%s)", strerror(row.node->error));
+                }
+            } else {
+                printw("[%lu files]", dir->own_files);
+            }
+            if (row_idx == current_item) {
+                attroff(A_REVERSE);
+            }
+        }
+        if (rows.empty()) {
+            mvprintw(4, 1, "(empty)");
+        }
+
+        mvprintw(LINES - 1, 0, "Up/Down: navigate | Enter: open dir | Backspace: go up | s: sort by %s | r: rescan | q: quit",
+                 order == DU_SORT_SIZE ? "name" : "size");
+        render_mark(stdscr);
+
+        int ch = getch();
+        switch (ch) {
+            case KEY_UP:
+                if (current_item > 0) {
+                    current_item--;
+                }
+                break;
+            case KEY_DOWN:
+                if (current_item < (int)rows.size() - 1) {
+                    current_item++;
+                }
+                break;
+            case KEY_PPAGE:
+                current_item = std::max(0, current_item - display_height);
+                break;
+            case KEY_NPAGE:
+                current_item = std::min((int)rows.size() - 1, current_item + display_height);
+                break;
+            case KEY_HOME:
+                current_item = 0;
+                break;
+            case KEY_END:
+                current_item = (int)rows.size() - 1;
+                break;
+            case '\n':
+            case KEY_ENTER:
+            case KEY_RIGHT:
+                if (!rows.empty() && rows[current_item].node) {
+                    dir = rows[current_item].node;
+                    current_item = 0;
+                    scroll_pos = 0;
+                }
+                break;
+            case KEY_BACKSPACE:
+            case 127:
+            case KEY_LEFT:
+                if (dir->parent) {
+                    // Back up with the directory we came from selected
+                    DuNode *from = dir;
+                    dir = dir->parent;
+                    std::vector<DuRow> above = du_view_rows(dir, order);
+                    for (size_t i = 0; i < above.size(); i++) {
+                        if (above[i].node == from) {
+                            current_item = (int)i;
+                        }
+                    }
+                }
+                break;
+            case 's': {
+                order = order == DU_SORT_SIZE ? DU_SORT_NAME : DU_SORT_SIZE;
+                DuNode *selected = rows.empty() ? NULL : rows[current_item].node;
+                du_sort(root, order);
+                std::vector<DuRow> sorted = du_view_rows(dir, order);
+                for (size_t i = 0; i < sorted.size(); i++) {
+                    if (sorted[i].node == selected) {
+                        current_item = (int)i;
+                    }
+                }
+                break;
+            }
+            case 'r': {
+                // Unchanged directories come from the cache, so this is quick
+                std::vector<std::string> trail = du_view_trail(dir);
+                DuStats fresh_stats;
+                double fresh_seconds;
+                DuNode *fresh = du_view_scan(path, &fresh_stats, &fresh_seconds);
+                if (fresh) {
+                    du_free(root);
+                    root = fresh;
+                    stats = fresh_stats;
+                    seconds = fresh_seconds;
+                    if (order != DU_SORT_SIZE) {
+                        du_sort(root, order);
+                    }
+                    dir = du_view_follow(root, trail);
+                }
+                break;
+            }
+            case 'q':
+                running = false;
+                break;
+        }
+    }
+
+    du_free(root);
+    clear();
+    render_mark(stdscr);
+}
+
+// Search results view - grep -p and find -p
+typedef struct {
+    std::string path;                   // Absolute, for opening
+    std::string shown;
+    long line;
+    std::string text;
+    size_t match_start;
+    size_t match_len;
+} SearchViewRow;
+
+typedef struct {
+    SearchDisplay display;
+    bool files_only;
+    std::vector<SearchViewRow> rows;
+} SearchView;
+
+static int search_view_collect(const SearchMatch *match, void *ctx) {
+    SearchView *view = (SearchView *)ctx;
+    if (view->files_only && !view->rows.empty() && view->rows.back().path == match->path) {
+        return 0;
+    }
+
+    SearchViewRow row;
+    row.path = match->path;
+    row.shown = search_display_path(&view->display, match->path);
+    row.line = match->line;
+    row.text.assign(match->text, match->text_len);
+    for (size_t i = 0; i < row.text.size(); i++) {
+        if ((unsigned char)row.text[i] < 0x20) {
+            row.text[i] = ' ';
+        }
+    }
+    row.match_start = match->match_start;
+    row.match_len = match->match_len;
+    view->rows.push_back(row);
+    return view->rows.size() >= SEARCH_VIEW_MAX;
+}
+
+static void search_view_progress(const SearchStats *stats, void *) {
+    mvprintw(2, 0, "Searching: %lu files, %lu matches, q to cancel", stats->files, stats->matches);
+    clrtoeol();
+    render_mark(stdscr);
+}
+
+// Print up to the right edge; returns the column after the text
+static int search_view_put(const char *text, size_t len, int x, int attrs) {
+    int room = COLS - 1 - x;
+    if (room <= 0 || len == 0) {
+        return x;
+    }
+    int shown = (int)std::min(len, (size_t)room);
+    attron(attrs);
+    addnstr(text, shown);
+    attroff(attrs);
+    return x + shown;
+}
+
+void cmd_search_interactive(const char *root, const char *shown, const TextPattern *pattern, int flags, bool names) {
+    SearchView view;
+    view.display.root_len = strlen(root);
+    view.display.shown = shown;
+    view.files_only = (flags & FILE_SEARCH_FILES_ONLY) != 0;
+
+    clear();
+    attron(A_REVERSE);
+    for (int i = 0; i < COLS; i++) {
+        mvaddch(0, i, ' ');
+    }
+    mvprintw(0, 1, "Search Results - Enter to open, q to quit");
+    attroff(A_REVERSE);
+    mvprintw(1, 0, "%s '%s' in %s", names ? "Names matching" : "Lines matching", pattern->needle.c_str(), root);
+    mvprintw(2, 0, "Searching...");
+    render_mark(stdscr);
+
+    scan_polls = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    SearchOptions options = {flags, scan_poll_stop, search_view_progress};
+    SearchStats stats;
+    int result = names ? file_find(root, pattern, &options, search_view_collect, &view, &stats)
+                       : file_search(root, pattern, &options, search_view_collect, &view, &stats);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (result < 0) {
+        log_error(error_console, ERROR_WARNING, "MINUX", 
+                "Error opening directory '%s': %s", root, strerror(errno));
+        clear();
+        render_mark(stdscr);
+        return;
+    }
+
+    int current_item = 0;
+    int scroll_pos = 0;
+    const int display_height = LINES - 5;
+    bool running = true;
+
+    while (running) {
+        if (current_item < scroll_pos) {
+            scroll_pos = current_item;
+        } else if (current_item >= scroll_pos + display_height) {
+            scroll_pos = current_item - display_height + 1;
+        }
+
+        move(2, 0);
+        clrtobot();
+        mvprintw(2, 0, "%lu matches in %lu %s, %.2fs%s", (unsigned long)view.rows.size(), stats.files,
+                 names ? "names" : "files", seconds,
+                 view.rows.size() >= SEARCH_VIEW_MAX ? " (stopped at the limit)" :
+                 result > 0 ? " (cancelled)" : "");
+
+        for (int i = 0; i < display_height && scroll_pos + i < (int)view.rows.size(); i++) {
+            int row_idx = scroll_pos + i;
+            const SearchViewRow &row = view.rows[row_idx];
+            int selected = row_idx == current_item ? A_REVERSE : 0;
+
+            move(i + 4, 1);
+            int x = search_view_put(row.shown.c_str(), row.shown.size(), 1, COLOR_PAIR(6) | selected);
+            if (row.line > 0 && !view.files_only) {
+                char number[24];
+                int len = snprintf(number, sizeof(number), ":%ld: ", row.line);
+                x = search_view_put(number, len, x, COLOR_PAIR(2) | selected);
+                const char *text = row.text.c_str();
+                x = search_view_put(text, row.match_start, x, selected);
+                x = search_view_put(text + row.match_start, row.match_len, x, COLOR_PAIR(5) | A_BOLD | selected);
+                size_t after = row.match_start + row.match_len;
+                search_view_put(text + after, row.text.size() - after, x, selected);
+            }
+        }
+        if (view.rows.empty()) {
+            mvprintw(4, 1, "(no matches)");
+        }
+
+        mvprintw(LINES - 1, 0, "Up/Down: navigate | PgUp/PgDn: page | Enter: open file | Home/End: first/last | q: quit");
+        render_mark(stdscr);
+
+        int ch = getch();
+        switch (ch) {
+            case KEY_UP:
+                if (current_item > 0) {
+                    current_item--;
+                }
+                break;
+            case KEY_DOWN:
+                if (current_item < (int)view.rows.size() - 1) {
+                    current_item++;
+                }
+                break;
+            case KEY_PPAGE:
+                current_item = std::max(0, current_item - display_height);
+                break;
+            case KEY_NPAGE:
+                current_item = std::max(0, std::min((int)view.rows.size() - 1, current_item + display_height));
+                break;
+            case KEY_HOME:
+                current_item = 0;
+                break;
+            case KEY_END:
+                current_item = std::max(0, (int)view.rows.size() - 1);
+                break;
+            case '\n':
+            case KEY_ENTER: {
+                if (view.rows.empty()) {
+                    break;
+                }
+                const SearchViewRow &row = view.rows[current_item];
+                struct stat st;
+                if (stat(row.path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+                    view_file_at_line(row.path.c_str(), (int)row.line);
+
+                    // Redraw the header after returning
+                    clear();
+                    attron(A_REVERSE);
+                    for (int i = 0; i < COLS; i++) {
+                        mvaddch(0, i, ' ');
                     }
-                    break;
-                    
-                case 'q':
-                    running = false;
-                    break;
+                    mvprintw(0, 1, "Search Results - Enter to open, q to quit");
+                    attroff(A_REVERSE);
+                    mvprintw(1, 0, "%s '%s' in %s", names ? "Names matching" : "Lines matching",
+                             pattern->needle.c_str(), root);
+                }
+                break;
             }
-        } else {
-            // Failed to open directory
-            log_error(error_console, ERROR_WARNING, "EXPLORER", 
-                      "Error opening directory '%s': %s", current_explorer_path, strerror(errno));
-            draw_error_status_bar("Cannot open directory");
-            
-            // Wait for user acknowledgment
-            mvprintw(LINES - 1, 0, "Press any key to return to the shell...");
-            refresh();
-            getch();
-            running = false;
+            case 'q':
+            case 27:
+                running = false;
+                break;
         }
     }
-    
-    // Clean up
-    delwin(explorer_win);
+
     clear();
-    refresh();
+    render_mark(stdscr);
 }
 
 // Function to display status bar with error message
 void draw_error_status_bar(const char *error_msg) {
+    if (!status_bar) {
+        return;
+    }
+
     // Clear status bar
     werase(status_bar);
     
@@ -3225,7 +4368,7 @@ void draw_error_status_bar(const char *error_msg) {
     mvwprintw(status_bar, 0, screen_width - 26, "Press ~ to view error log");
     
     wattroff(status_bar, COLOR_PAIR(5) | A_REVERSE | A_BOLD);
-    wrefresh(status_bar);
+    render_mark(status_bar);
 }
 
 // Update the log_error function to draw the error status bar for important errors
@@ -3242,46 +4385,96 @@ void draw_error_status_bar(const char *error_msg) {
 void cmd_cat(const char *filepath) {
     if (!filepath) {
         // Use the same approach as the other command functions
-        printw("\nUsage: cat <filename>\n\n");
-        refresh();
+        out_printw("\nUsage: cat <filename>\n\n");
+        render_mark(stdscr);
         return;
     }
     
     FILE *file = fopen(filepath, "r");
     if (!file) {
-        printw("\nError: Cannot open file '%s': %s\n\n", filepath, strerror(errno));
-        refresh();
+        out_printw("\nError: Cannot open file '%s': %s\n\n", filepath, strerror(errno));
+        render_mark(stdscr);
         return;
     }
     
+    output_bulk_begin(LINES - STATUS_BAR_HEIGHT - 1);
+
     // Print a header with the filename
-    printw("\nFile: %s\n", filepath);
-    printw("-------------------------------------------------\n");
+    out_printw("\nFile: %s\n", filepath);
+    out_printw("-------------------------------------------------\n");
     
     // Read and display file contents
     char line_buffer[4096];
     while (fgets(line_buffer, sizeof(line_buffer), file)) {
         // Print the line directly without modifications
-        printw("%s", line_buffer);
+        out_printw("%s", line_buffer);
     }
     
     // Print a footer
-    printw("-------------------------------------------------\n\n");
+    out_printw("-------------------------------------------------\n\n");
+    output_bulk_end();
     
     fclose(file);
-    refresh();
+    render_mark(stdscr);
 }
 
 // Add these implementations for history and log commands
 void cmd_history(void) {
-    printw("\nCommand History:\n\n");
+    output_bulk_begin(LINES - STATUS_BAR_HEIGHT - 1);
+    out_printw("\nCommand History:\n\n");
     
-    for (int i = 0; i < history_count; i++) {
-        printw("  %3d  %s\n", i + 1, command_history[i]);
+    for (long id = history_first(); id < history_end(); id++) {
+        size_t len;
+        const char *entry = history_get(id, &len);
+        out_printw("  %3ld  %.*s\n", id + 1, (int)len, entry);
     }
     
-    printw("\n");
-    refresh();
+    out_printw("\n");
+    output_bulk_end();
+    render_mark(stdscr);
+}
+
+// Output per command, for tuning the frame cap over slow links
+void cmd_stats(void) {
+    IdCacheStats ids;
+    id_cache_stats(&ids);
+    out_printw("Owner names: %lu cached, %lu hits (%lu negative), %lu lookups\n",
+               (unsigned long)ids.entries, ids.hits, ids.negative_hits, ids.misses);
+
+    if (output_is_batch()) {
+        out_printw("Output statistics are only collected in the TUI\n");
+        return;
+    }
+
+    long long total = render_total_bytes();
+    out_printw("\nFrame cap: %d fps (set %s to change, 0 = no cap)\n", render_fps(), RENDER_FPS_ENV);
+    if (total >= 0) {
+        out_printw("Session: %lld bytes written by the process, %lu refreshes in %lu frames\n\n",
+                   total, render_total_marks(), render_total_frames());
+    } else {
+        out_printw("Session: %lu refreshes in %lu frames\n\n", render_total_marks(), render_total_frames());
+    }
+
+    if (render_stats_count() == 0) {
+        out_printw("No commands yet\n");
+        render_mark(stdscr);
+        return;
+    }
+
+    out_printw("  %-30s %10s %9s %7s %8s\n", "Command", "Written", "Refreshes", "Frames", "Time");
+    out_printw("  (Written counts every byte the process wrote: the terminal, history, saved files)\n");
+    for (int i = render_stats_count() - 1; i >= 0; i--) {
+        const RenderCommandStats *st = render_stats_at(i);
+        char bytes[24];
+        if (st->bytes >= 0) {
+            snprintf(bytes, sizeof(bytes), "%lld", st->bytes);
+        } else {
+            snprintf(bytes, sizeof(bytes), "n/a");
+        }
+        out_printw("  %-30.30s %10s %9lu %7lu %7.2fs\n", st->command, bytes, st->marks, st->frames, st->seconds);
+    }
+    out_printw("\n");
+    render_mark(stdscr);
 }
 
 void cmd_log(const char *message) {
@@ -3326,34 +4519,19 @@ void cmd_log(const char *message) {
     fprintf(fp, "[%s] %s\n", timestamp, message);
     fclose(fp);
     
-    printw("\nLog entry added: %s\n\n", message);
-    refresh();
+    out_printw("\nLog entry added: %s\n\n", message);
+    render_mark(stdscr);
 }
 
 // Add history management functions
 void add_to_history(const char *cmd) {
-    // Don't add empty commands or duplicates of the last command
-    if (!cmd || !*cmd || (history_count > 0 && strcmp(cmd, command_history[history_count - 1]) == 0)) {
-        return;
-    }
-    
-    // Add new command to history
-    if (history_count < MAX_HISTORY) {
-        command_history[history_count++] = strdup(cmd);
-    } else {
-        // If history is full, remove oldest entry
-        free(command_history[0]);
-        for (int i = 0; i < MAX_HISTORY - 1; i++) {
-            command_history[i] = command_history[i + 1];
-        }
-        command_history[MAX_HISTORY - 1] = strdup(cmd);
+    long id = history_add(cmd);
+    if (id >= 0) {
+        history_search_add(id);
     }
     
     // Reset position to point to the end of history
-    history_position = history_count;
-    
-    // Save history to file
-    save_history();
+    history_position = history_end();
 }
 
 void load_history(void) {
@@ -3373,66 +4551,282 @@ void load_history(void) {
     char history_path[MAX_PATH];
     snprintf(history_path, sizeof(history_path), "%s/.minux/%s", home, HISTORY_FILE);
     
-    FILE *fp = fopen(history_path, "r");
-    if (!fp) return;
-    
-    char line[MAX_CMD_LENGTH];
-    history_count = 0;
-    
-    while (fgets(line, sizeof(line), fp) && history_count < MAX_HISTORY) {
-        // Remove newline character
-        int len = strlen(line);
-        if (len > 0 && line[len - 1] == '\n') {
-            line[len - 1] = '\0';
-        }
-        
-        if (len > 1) {  // Only add non-empty lines
-            command_history[history_count++] = strdup(line);
+    // Entries are read lazily the first time the history is used
+    if (history_open(history_path, history_memory_limit_from_env()) != 0) {
+        log_error(error_console, ERROR_WARNING, "MINUX", 
+                 "Could not open history file '%s': %s", history_path, strerror(errno));
+    }
+    history_search_reset();
+    history_position = -1;
+}
+
+// Redraw the prompt on row y and the command after it, e.g. after the
+// line was overwritten by the search prompt or a completion listing
+static void redraw_prompt_line(int y) {
+    move(y, 0);
+    clrtoeol();
+    printw("minux:%s$ ", current_path);  // Already in the scrollback
+    line_editor_begin(&prompt_line);
+    line_editor_render(&prompt_line);
+}
+
+// Ctrl-R reverse incremental search. Typing narrows the match, Ctrl-R
+// steps to older matches, Enter runs the match, Esc/Ctrl-G restores the
+// original line and any other key keeps the match for editing.
+// Returns true if the command in the prompt line should be run right away.
+static bool history_reverse_search(void) {
+    int y = prompt_line.origin_y;
+    line_editor_erase(&prompt_line);
+
+    char query[MAX_CMD_LENGTH] = "";
+    size_t qlen = 0;
+    long match = -1;
+    bool run = false;
+    bool keep = true;
+
+    while (1) {
+        size_t match_len = 0;
+        const char *text = match >= 0 ? history_get(match, &match_len) : NULL;
+
+        move(y, 0);
+        clrtoeol();
+        char line[MAX_CMD_LENGTH * 2];
+        snprintf(line, sizeof(line), "(%sreverse-i-search)`%s': %.*s",
+                 (match < 0 && qlen > 0) ? "failed " : "", query, (int)match_len, text ? text : "");
+        printw("%.*s", COLS > 1 ? COLS - 1 : 0, line);  // Stay on one row
+        render_mark(stdscr);
+
+        int ch = getch();
+        if (ch == 0x12) {  // Ctrl-R - next older match
+            long older = history_search_find(query, match >= 0 ? match : history_end());
+            if (older >= 0) match = older;
+        } else if (ch == KEY_BACKSPACE || ch == 127 || ch == 8) {
+            if (qlen > 0) {
+                query[--qlen] = '\0';
+            }
+            match = qlen > 0 ? history_search_find(query, history_end()) : -1;
+        } else if (ch == 0x07 || ch == 27) {  // Ctrl-G / Esc - give up
+            keep = false;
+            break;
+        } else if (ch == '\n' || ch == KEY_ENTER) {
+            run = match >= 0;
+            break;
+        } else if (ch >= 0x20 && ch < 0x7f && qlen < sizeof(query) - 1) {
+            query[qlen++] = (char)ch;
+            query[qlen] = '\0';
+            // The current match stays if it still contains the longer query
+            match = history_search_find(query, match >= 0 ? match + 1 : history_end());
+        } else if (ch != ERR) {
+            break;  // Accept the match and go back to editing
         }
     }
-    
-    fclose(fp);
-    
-    // Initialize history position to point to the end of history
-    history_position = history_count;
+
+    if (keep && match >= 0) {
+        size_t len;
+        const char *text = history_get(match, &len);
+        line_editor_set(&prompt_line, text, std::min(len, (size_t)LINE_EDITOR_MAX_LENGTH));
+    }
+
+    redraw_prompt_line(y);
+    return run;
 }
 
-void save_history(void) {
-    // Get path to history file in user's home directory
-    const char *home = getenv("HOME");
-    if (!home) {
-        struct passwd *pw = getpwuid(getuid());
-        if (!pw) return;
-        home = pw->pw_dir;
+// Tab completion on the prompt line. A unique match is inserted with a
+// trailing space ('/' for directories), otherwise the shared prefix is;
+// a second Tab with nothing left to insert lists the candidates.
+static void complete_prompt_line(bool list) {
+    const char *cmd = line_editor_text(&prompt_line);
+    int cursor = (int)line_editor_cursor(&prompt_line);
+
+    int word_start;
+    int count = completion_complete(cmd, cursor, current_path, &word_start);
+    if (count == 0) {
+        beep();
+        return;
     }
-    
-    // Make sure .minux directory exists
-    char dir_path[MAX_PATH];
-    snprintf(dir_path, sizeof(dir_path), "%s/.minux", home);
-    mkdir(dir_path, 0755);
-    
-    char history_path[MAX_PATH];
-    snprintf(history_path, sizeof(history_path), "%s/.minux/%s", home, HISTORY_FILE);
-    
-    FILE *fp = fopen(history_path, "w");
-    if (!fp) return;
-    
-    for (int i = 0; i < history_count; i++) {
-        fprintf(fp, "%s\n", command_history[i]);
+
+    const char *replacement = count == 1 ? completion_match(0) : completion_common();
+    int rep_len = strlen(replacement);
+
+    if (count > 1 && rep_len <= cursor - word_start) {
+        if (!list) {
+            beep();
+            return;
+        }
+
+        // List the candidates in columns below the prompt
+        int width = 0;
+        for (int i = 0; i < count; i++) {
+            width = std::max(width, (int)strlen(completion_display(i)) + 2);
+        }
+        int columns = std::max(1, COLS / width);
+        int shown = std::min(count, columns * std::max(1, LINES - 4));
+
+        line_editor_finish(&prompt_line);
+        scrollback_append(cmd, strlen(cmd));
+        out_printw("\n");
+        for (int i = 0; i < shown; i++) {
+            out_printw("%-*s", width, completion_display(i));
+            if ((i + 1) % columns == 0 || i + 1 == shown) {
+                out_printw("\n");
+            }
+        }
+        if (shown < count) {
+            out_printw("... and %d more\n", count - shown);
+        }
+
+        show_prompt();
+        line_editor_begin(&prompt_line);
+        line_editor_render(&prompt_line);
+        return;
     }
-    
-    fclose(fp);
+
+    bool add_space = count == 1 && rep_len > 0 && replacement[rep_len - 1] != '/' && cmd[cursor] != ' ';
+
+    if (line_editor_replace(&prompt_line, word_start, cursor, replacement, rep_len) != 0 ||
+        (add_space && line_editor_insert(&prompt_line, " ", 1) != 0)) {
+        beep();
+    }
+    line_editor_render(&prompt_line);
 }
 
-char *get_history_entry(int index) {
-    if (index < 0 || index >= history_count) {
-        return NULL;
+// Full-screen scrollback viewer, opened with PgUp at the prompt. Only the
+// lines in the viewport are fetched from the scrollback, so paging through
+// a long output costs a screenful of work however much is stored.
+static void scrollback_view(void) {
+    int rows = LINES - STATUS_BAR_HEIGHT - 1;  // Last row is the key help
+    if (rows < 1 || scrollback_end() == scrollback_first()) {
+        beep();
+        return;
+    }
+
+    WINDOW *win = newwin(rows + 1, COLS, 0, 0);
+    if (!win) {
+        return;
+    }
+    keypad(win, TRUE);
+
+    long first = scrollback_first();
+    long end = scrollback_end();
+    long max_top = std::max(first, end - rows);
+    long top = std::max(first, max_top - rows);  // Start one page up
+    int shift = 0;
+    long match = -1;
+    char query[128] = "";
+
+    while (1) {
+        // Output may have arrived from background jobs
+        first = scrollback_first();
+        end = scrollback_end();
+        max_top = std::max(first, end - rows);
+        top = std::max(first, std::min(top, max_top));
+
+        werase(win);
+        for (int row = 0; row < rows && top + row < end; row++) {
+            size_t len;
+            const char *text = scrollback_line(top + row, &len);
+            if (!text || (size_t)shift >= len) {
+                continue;
+            }
+            if (top + row == match) wattron(win, A_REVERSE);
+            mvwaddnstr(win, row, 0, text + shift, std::min((int)(len - shift), COLS));
+            if (top + row == match) wattroff(win, A_REVERSE);
+        }
+
+        wattron(win, A_REVERSE);
+        mvwprintw(win, rows, 0, " Scrollback %ld-%ld of %ld | PgUp/PgDn Up/Down Left/Right g/G | / search, n/N next | q quit",
+                  top - first + 1, std::min(top + rows, end) - first, end - first);
+        wclrtoeol(win);
+        wattroff(win, A_REVERSE);
+        render_mark(win);
+
+        int ch = wgetch(win);
+        if (ch == 'q' || ch == 27) {
+            break;
+        }
+        switch (ch) {
+            case KEY_PPAGE: top -= rows; break;
+            case KEY_NPAGE: case ' ': top += rows; break;
+            case KEY_UP: case 'k': top--; break;
+            case KEY_DOWN: case 'j': top++; break;
+            case KEY_HOME: case 'g': top = first; break;
+            case KEY_END: case 'G': top = max_top; break;
+            case KEY_LEFT: shift = std::max(0, shift - COLS / 2); break;
+            case KEY_RIGHT: shift += COLS / 2; break;
+            case KEY_RESIZE:
+                rows = LINES - STATUS_BAR_HEIGHT - 1;
+                if (rows < 1) {
+                    rows = 1;
+                }
+                wresize(win, rows + 1, COLS);
+                break;
+            case '/': {
+                wmove(win, rows, 0);
+                wclrtoeol(win);
+                waddch(win, '/');
+                echo();
+                wgetnstr(win, query, sizeof(query) - 1);
+                noecho();
+                // Search older lines from the bottom of the viewport
+                match = scrollback_search(query, std::min(top + rows, end) - 1, -1);
+                break;
+            }
+            case 'n':
+            case 'N': {
+                if (!query[0]) {
+                    break;
+                }
+                long from = match >= 0 ? match + (ch == 'n' ? -1 : 1) : std::min(top + rows, end) - 1;
+                long found = scrollback_search(query, from, ch == 'n' ? -1 : 1);
+                if (found >= 0) {
+                    match = found;
+                } else {
+                    beep();
+                }
+                break;
+            }
+        }
+
+        if ((ch == '/' || ch == 'n' || ch == 'N') && match >= 0 && (match < top || match >= top + rows)) {
+            top = match - rows / 2;  // Centre the match
+        } else if (ch == '/' && match < 0 && query[0]) {
+            beep();
+        }
     }
-    return command_history[index];
+
+    delwin(win);
+    touchwin(stdscr);
+    render_mark(stdscr);
+}
+
+// Ctrl-C at the prompt abandons the line instead of killing minux. Jobs
+// in the foreground see it as a key (the terminal is in raw mode then).
+static volatile sig_atomic_t interrupt_pending = 0;
+
+static void on_interrupt(int) {
+    interrupt_pending = 1;
+}
+
+static void install_interrupt_handler(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_interrupt;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
 }
 
-int history_size() {
-    return history_count;
+// Run the command on the prompt line and start a fresh one
+static void run_prompt_line(void) {
+    const char *cmd = line_editor_text(&prompt_line);
+    line_editor_finish(&prompt_line);
+    line_editor_clear(&prompt_line);  // The text copy stays valid
+    scrollback_append(cmd, strlen(cmd));  // The editor draws the line itself
+    out_printw("\n");  // Add a newline before executing the command
+    render_command_begin(cmd);
+    handle_command(cmd);
+    render_command_end();
+    history_position = history_end();  // Reset history position
+    line_editor_begin(&prompt_line);
 }
 
 // Add these implementations for play commands
@@ -3561,11 +4955,12 @@ void play_audio_file(const char *filepath) {
         return;
     }
     
-    printw("\nPlaying %s...\n", filepath);
-    refresh();
+    out_printw("\nPlaying %s...\n", filepath);
+    render_mark(stdscr);
+    render_flush();  // Blocks until playback ends
     
-    // Use system() to execute the command
-    int result = system(cmd);
+    // Ctrl-C on the task stops the player
+    int result = process_run_cancellable(cmd, worker_cancelled);
     if (result != 0) {
         log_error(error_console, ERROR_WARNING, "MINUX", 
                  "Failed to play audio file. Make sure you have the required audio players installed.");
@@ -3665,7 +5060,8 @@ void play_tone(int frequency, int duration_ms) {
     }
     #endif
     
-    system(cmd);
+    render_flush();
+    process_run_cancellable(cmd, worker_cancelled);
     
     // Sleep a bit to avoid notes running into each other
     usleep(50000); // 50ms pause
@@ -3678,8 +5074,8 @@ void play_note(const char *note, int duration_ms) {
         return;
     }
     
-    printw("\nPlaying note %s (%.2f Hz) for %d ms\n", note, freq, duration_ms);
-    refresh();
+    out_printw("\nPlaying note %s (%.2f Hz) for %d ms\n", note, freq, duration_ms);
+    render_mark(stdscr);
     
     play_tone((int)freq, duration_ms);
 }
@@ -3732,21 +5128,21 @@ void play_scale(const char *scale_name) {
     }
     
     // Print scale information
-    printw("\nPlaying %s %s scale\n", root_note, is_minor ? "minor" : "major");
-    refresh();
+    out_printw("\nPlaying %s %s scale\n", root_note, is_minor ? "minor" : "major");
+    render_mark(stdscr);
     
     // Play the scale notes
     const int *steps = is_minor ? minor_steps : major_steps;
     
     // Play each note in the scale directly using play_note - this already works for individual notes
-    for (int i = 0; i < 8; i++) {
+    for (int i = 0; i < 8 && !worker_cancelled(); i++) {
         int note_idx = (root_idx + steps[i]) % 12;
         char note[16];
         snprintf(note, sizeof(note), "%s%d", notes[note_idx], i == 7 ? 5 : 4);
         
         // Print current note
-        printw("Playing: %s\n", note);
-        refresh();
+        out_printw("Playing: %s\n", note);
+        render_mark(stdscr);
         
         // Play the note (300ms per note, 8 notes in scale) using the existing play_note function
         // This function already handles WSL detection and proper tone generation
@@ -3875,7 +5271,7 @@ void todo_add(const char *description) {
     
     task_count++;
     
-    printw("Task added: %s\n", description);
+    out_printw("Task added: %s\n", description);
     
     // Save the updated task list
     save_tasks();
@@ -3883,13 +5279,13 @@ void todo_add(const char *description) {
 
 void todo_list(void) {
     if (task_count == 0) {
-        printw("No tasks. Use 'todo add <description>' to add a task.\n");
+        out_printw("No tasks. Use 'todo add <description>' to add a task.\n");
         return;
     }
     
-    printw("\n");
-    printw("ID | Status | Date       | Description\n");
-    printw("---+--------+------------+--------------------------\n");
+    out_printw("\n");
+    out_printw("ID | Status | Date       | Description\n");
+    out_printw("---+--------+------------+--------------------------\n");
     
     for (int i = 0; i < task_count; i++) {
         struct tm *tm_info;
@@ -3903,14 +5299,14 @@ void todo_list(void) {
         
         strftime(date_str, sizeof(date_str), "%Y-%m-%d", tm_info);
         
-        printw("%2d | [%s] | %s | %s\n", 
+        out_printw("%2d | [%s] | %s | %s\n", 
                i + 1, 
                tasks[i].completed ? "X" : " ", 
                date_str,
                tasks[i].description);
     }
     
-    printw("\n");
+    out_printw("\n");
 }
 
 void todo_done(int task_id) {
@@ -3926,7 +5322,7 @@ void todo_done(int task_id) {
     tasks[index].completed = true;
     tasks[index].completed_at = time(NULL);
     
-    printw("Task %d marked as completed: %s\n", task_id, tasks[index].description);
+    out_printw("Task %d marked as completed: %s\n", task_id, tasks[index].description);
     
     // Save the updated task list
     save_tasks();
@@ -3941,7 +5337,7 @@ void todo_remove(int task_id) {
         return;
     }
     
-    printw("Task %d removed: %s\n", task_id, tasks[index].description);
+    out_printw("Task %d removed: %s\n", task_id, tasks[index].description);
     
     // Remove the task by shifting all tasks after it
     for (int i = index; i < task_count - 1; i++) {
@@ -3964,7 +5360,7 @@ void todo_clear(void) {
     }
     
     if (completed_count == 0) {
-        printw("No completed tasks to clear.\n");
+        out_printw("No completed tasks to clear.\n");
         return;
     }
     
@@ -3979,20 +5375,20 @@ void todo_clear(void) {
     int removed = task_count - new_count;
     task_count = new_count;
     
-    printw("Cleared %d completed task(s).\n", removed);
+    out_printw("Cleared %d completed task(s).\n", removed);
     
     // Save the updated task list
     save_tasks();
 }
 
 void todo_help(void) {
-    printw("\nTODO Command Usage:\n");
-    printw("  todo                 - Show task list\n");
-    printw("  todo add <desc>      - Add a new task\n");
-    printw("  todo done <id>       - Mark task as completed\n");
-    printw("  todo remove <id>     - Remove a task\n");
-    printw("  todo clear           - Remove all completed tasks\n");
-    printw("  todo help            - Show this help message\n\n");
+    out_printw("\nTODO Command Usage:\n");
+    out_printw("  todo                 - Show task list\n");
+    out_printw("  todo add <desc>      - Add a new task\n");
+    out_printw("  todo done <id>       - Mark task as completed\n");
+    out_printw("  todo remove <id>     - Remove a task\n");
+    out_printw("  todo clear           - Remove all completed tasks\n");
+    out_printw("  todo help            - Show this help message\n\n");
 }
 
 void cmd_todo(const char *arg) {
@@ -4069,8 +5465,10 @@ void cmd_crypto(const char *arg) {
     strncpy(cmd_copy, arg, sizeof(cmd_copy) - 1);
     cmd_copy[sizeof(cmd_copy) - 1] = '\0';
     
-    char *cmd_name = strtok(cmd_copy, " \t");
-    char *cmd_arg = strtok(NULL, "");
+    // strtok_r - this may run on a worker while the prompt parses a command
+    char *save = NULL;
+    char *cmd_name = strtok_r(cmd_copy, " \t", &save);
+    char *cmd_arg = strtok_r(NULL, "", &save);
     
     if (cmd_arg) {
         // Skip leading whitespace
@@ -4107,8 +5505,8 @@ void cmd_crypto(const char *arg) {
 
 void crypto_generate_keypair(void) {
     // Implement key generation logic
-    printw("\nGenerating real crypto key pair using secp256k1...\n");
-    refresh();
+    out_printw("\nGenerating real crypto key pair using secp256k1...\n");
+    render_mark(stdscr);
     
     // Use the actual secp256k1 library
     secp256k1_context *ctx = secp256k1_context_create(SECP256K1_CONTEXT_SIGN | SECP256K1_CONTEXT_VERIFY);
@@ -4150,11 +5548,11 @@ void crypto_generate_keypair(void) {
     }
     
     // Print private key
-    printw("Private Key: ");
+    out_printw("Private Key: ");
     for (size_t i = 0; i < 32; i++) {
-        printw("%02x", privkey[i]);
+        out_printw("%02x", privkey[i]);
     }
-    printw("\n");
+    out_printw("\n");
     
     // Serialize the public key in compressed format
     unsigned char output[33];
@@ -4162,12 +5560,12 @@ void crypto_generate_keypair(void) {
     secp256k1_ec_pubkey_serialize(ctx, output, &outputlen, &pubkey, SECP256K1_EC_COMPRESSED);
     
     // Print public key
-    printw("Public Key: ");
+    out_printw("Public Key: ");
     for (size_t i = 0; i < outputlen; i++) {
-        printw("%02x", output[i]);
+        out_printw("%02x", output[i]);
     }
-    printw("\n");
-    refresh();
+    out_printw("\n");
+    render_mark(stdscr);
     
     // Clean up
     secp256k1_context_destroy(ctx);
@@ -4175,8 +5573,8 @@ void crypto_generate_keypair(void) {
 }
 
 void crypto_hash(const char *data) {
-    printw("\nHashing data using SHA-256: %s\n", data);
-    refresh();
+    out_printw("\nHashing data using SHA-256: %s\n", data);
+    render_mark(stdscr);
     
     // Use OpenSSL SHA-256 for real cryptographic hashing
     unsigned char hash[SHA256_DIGEST_LENGTH];
@@ -4186,17 +5584,17 @@ void crypto_hash(const char *data) {
     SHA256_Final(hash, &sha256);
     
     // Print the hash value in hexadecimal
-    printw("SHA-256 Hash: ");
+    out_printw("SHA-256 Hash: ");
     for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-        printw("%02x", hash[i]);
+        out_printw("%02x", hash[i]);
     }
-    printw("\n");
-    refresh();
+    out_printw("\n");
+    render_mark(stdscr);
 }
 
 void crypto_encrypt(const char *data) {
-    printw("\nEncrypting data using AES-256: %s\n", data);
-    refresh();
+    out_printw("\nEncrypting data using AES-256: %s\n", data);
+    render_mark(stdscr);
     
     // Use AES-256 in CBC mode from OpenSSL
     const EVP_CIPHER *cipher = EVP_aes_256_cbc();
@@ -4258,39 +5656,39 @@ void crypto_encrypt(const char *data) {
     len += final_len;
     
     // Print the key and IV as hex
-    printw("Key: ");
+    out_printw("Key: ");
     for (size_t i = 0; i < sizeof(key); i++) {
-        printw("%02x", key[i]);
+        out_printw("%02x", key[i]);
     }
-    printw("\n");
+    out_printw("\n");
     
-    printw("IV: ");
+    out_printw("IV: ");
     for (size_t i = 0; i < sizeof(iv); i++) {
-        printw("%02x", iv[i]);
+        out_printw("%02x", iv[i]);
     }
-    printw("\n");
+    out_printw("\n");
     
     // Print the encrypted data as hex
-    printw("Encrypted (hex): ");
+    out_printw("Encrypted (hex): ");
     for (int i = 0; i < len; i++) {
-        printw("%02x", encrypted[i]);
+        out_printw("%02x", encrypted[i]);
     }
-    printw("\n");
+    out_printw("\n");
     
     // Cleanup
     EVP_CIPHER_CTX_free(ctx);
     free(encrypted);
     memset(key, 0, sizeof(key)); // Clear sensitive data
-    refresh();
+    render_mark(stdscr);
 }
 
 void crypto_decrypt(const char *data) {
-    printw("\nDecrypting data using AES-256...\n");
-    refresh();
+    out_printw("\nDecrypting data using AES-256...\n");
+    render_mark(stdscr);
     
     // We need key, iv, and ciphertext to decrypt
-    printw("Please enter the encryption key (64 hex chars): ");
-    refresh();
+    out_printw("Please enter the encryption key (64 hex chars): ");
+    render_mark(stdscr);
     
     // Get key input
     char key_hex[65];
@@ -4304,18 +5702,18 @@ void crypto_decrypt(const char *data) {
     while (pos < 64 && (ch = getch()) != '\n' && ch != EOF) {
         if (isxdigit(ch)) {
             key_hex[pos++] = ch;
-            printw("%c", ch);
-            refresh();
+            out_printw("%c", ch);
+            render_mark(stdscr);
         } else if (ch == KEY_BACKSPACE || ch == 127) {
             if (pos > 0) {
                 pos--;
-                printw("\b \b");
-                refresh();
+                out_printw("\b \b");
+                render_mark(stdscr);
             }
         }
     }
     key_hex[pos] = '\0';
-    printw("\n");
+    out_printw("\n");
     
     if (pos != 64) {
         log_error(error_console, ERROR_WARNING, "CRYPTO", 
@@ -4324,25 +5722,25 @@ void crypto_decrypt(const char *data) {
     }
     
     // Get IV input
-    printw("Please enter the IV (32 hex chars): ");
-    refresh();
+    out_printw("Please enter the IV (32 hex chars): ");
+    render_mark(stdscr);
     pos = 0;
     
     while (pos < 32 && (ch = getch()) != '\n' && ch != EOF) {
         if (isxdigit(ch)) {
             iv_hex[pos++] = ch;
-            printw("%c", ch);
-            refresh();
+            out_printw("%c", ch);
+            render_mark(stdscr);
         } else if (ch == KEY_BACKSPACE || ch == 127) {
             if (pos > 0) {
                 pos--;
-                printw("\b \b");
-                refresh();
+                out_printw("\b \b");
+                render_mark(stdscr);
             }
         }
     }
     iv_hex[pos] = '\0';
-    printw("\n");
+    out_printw("\n");
     
     if (pos != 32) {
         log_error(error_console, ERROR_WARNING, "CRYPTO", 
@@ -4444,7 +5842,7 @@ void crypto_decrypt(const char *data) {
     plaintext[len] = '\0';
     
     // Print the decrypted data
-    printw("Decrypted: %s\n", plaintext);
+    out_printw("Decrypted: %s\n", plaintext);
     
     // Cleanup
     EVP_CIPHER_CTX_free(ctx);
@@ -4452,17 +5850,17 @@ void crypto_decrypt(const char *data) {
     free(plaintext);
     memset(key, 0, sizeof(key)); // Clear sensitive data
     memset(iv, 0, sizeof(iv));   // Clear sensitive data
-    refresh();
+    render_mark(stdscr);
 }
 
 void crypto_show_help(void) {
-    printw("\nCrypto Command Usage:\n");
-    printw("  crypto generate-keypair - Generate a new secp256k1 keypair\n");
-    printw("  crypto hash <data>     - Hash data using SHA-256\n");
-    printw("  crypto encrypt <data>  - Encrypt data using AES-256-CBC\n");
-    printw("  crypto decrypt <data>  - Decrypt data using AES-256-CBC\n\n");
-    printw("Note: These are real cryptographic implementations using\n");
-    printw("      secp256k1 and OpenSSL libraries.\n\n");
+    out_printw("\nCrypto Command Usage:\n");
+    out_printw("  crypto generate-keypair - Generate a new secp256k1 keypair\n");
+    out_printw("  crypto hash <data>     - Hash data using SHA-256\n");
+    out_printw("  crypto encrypt <data>  - Encrypt data using AES-256-CBC\n");
+    out_printw("  crypto decrypt <data>  - Decrypt data using AES-256-CBC\n\n");
+    out_printw("Note: These are real cryptographic implementations using\n");
+    out_printw("      secp256k1 and OpenSSL libraries.\n\n");
 }
 
 // Add a wallet-related structure after the Task structure
@@ -4536,40 +5934,40 @@ void cmd_wallet(const char *arg) {
         if (verify_parsed == 3) {
             wallet_verify(message, signature, pubkey);
         } else {
-            printw("\nError: Missing parameters for verify command\n");
-            printw("Usage: wallet verify <message> <signature in hex> <public key in hex>\n\n");
+            out_printw("\nError: Missing parameters for verify command\n");
+            out_printw("Usage: wallet verify <message> <signature in hex> <public key in hex>\n\n");
         }
     }
     else if (strcmp(subcommand, "help") == 0) {
         wallet_help();
     }
     else {
-        printw("\nUnknown wallet subcommand: %s\n", subcommand);
+        out_printw("\nUnknown wallet subcommand: %s\n", subcommand);
         wallet_help();
     }
     
-    refresh();
+    render_mark(stdscr);
 }
 
 void wallet_help(void) {
-    printw("\nWallet Commands:\n");
-    printw("  wallet create                 - Generate a new wallet (keypair)\n");
-    printw("  wallet import <privkey>       - Import a wallet using a private key\n");
-    printw("  wallet export                 - Show public & private key of current wallet\n");
-    printw("  wallet sign <message>         - Sign a message with the wallet's private key\n");
-    printw("  wallet verify <message> <sig> <pubkey> - Verify a signed message\n\n");
-    refresh();
+    out_printw("\nWallet Commands:\n");
+    out_printw("  wallet create                 - Generate a new wallet (keypair)\n");
+    out_printw("  wallet import <privkey>       - Import a wallet using a private key\n");
+    out_printw("  wallet export                 - Show public & private key of current wallet\n");
+    out_printw("  wallet sign <message>         - Sign a message with the wallet's private key\n");
+    out_printw("  wallet verify <message> <sig> <pubkey> - Verify a signed message\n\n");
+    render_mark(stdscr);
 }
 
 void wallet_create(void) {
     EC_KEY *key = EC_KEY_new_by_curve_name(NID_secp256k1);
     if (!key) {
-        printw("\nError: Failed to create key structure\n");
+        out_printw("\nError: Failed to create key structure\n");
         return;
     }
     
     if (EC_KEY_generate_key(key) != 1) {
-        printw("\nError: Failed to generate keypair\n");
+        out_printw("\nError: Failed to generate keypair\n");
         EC_KEY_free(key);
         return;
     }
@@ -4577,7 +5975,7 @@ void wallet_create(void) {
     // Get private key
     const BIGNUM *priv_key = EC_KEY_get0_private_key(key);
     if (!priv_key) {
-        printw("\nError: Failed to get private key\n");
+        out_printw("\nError: Failed to get private key\n");
         EC_KEY_free(key);
         return;
     }
@@ -4589,7 +5987,7 @@ void wallet_create(void) {
     // Get public key
     const EC_POINT *pub_key = EC_KEY_get0_public_key(key);
     if (!pub_key) {
-        printw("\nError: Failed to get public key\n");
+        out_printw("\nError: Failed to get public key\n");
         EC_KEY_free(key);
         return;
     }
@@ -4600,7 +5998,7 @@ void wallet_create(void) {
         current_wallet.public_key, sizeof(current_wallet.public_key), NULL);
     
     if (current_wallet.public_key_length == 0) {
-        printw("\nError: Failed to convert public key\n");
+        out_printw("\nError: Failed to convert public key\n");
         EC_KEY_free(key);
         return;
     }
@@ -4608,33 +6006,33 @@ void wallet_create(void) {
     current_wallet.initialized = true;
     EC_KEY_free(key);
     
-    printw("\nWallet created successfully!\n");
-    printw("Private key: %s\n", bytes_to_hex(current_wallet.private_key, 32));
-    printw("Public key: %s\n\n", bytes_to_hex(current_wallet.public_key, current_wallet.public_key_length));
-    refresh();
+    out_printw("\nWallet created successfully!\n");
+    out_printw("Private key: %s\n", bytes_to_hex(current_wallet.private_key, 32));
+    out_printw("Public key: %s\n\n", bytes_to_hex(current_wallet.public_key, current_wallet.public_key_length));
+    render_mark(stdscr);
 }
 
 void wallet_import(const char *private_key_hex) {
     if (!private_key_hex) {
-        printw("\nError: No private key provided\n");
-        printw("Usage: wallet import <private key in hex>\n\n");
+        out_printw("\nError: No private key provided\n");
+        out_printw("Usage: wallet import <private key in hex>\n\n");
         return;
     }
     
     if (!hex_to_bytes(private_key_hex, current_wallet.private_key, sizeof(current_wallet.private_key))) {
-        printw("\nError: Invalid private key format\n\n");
+        out_printw("\nError: Invalid private key format\n\n");
         return;
     }
     
     EC_KEY *key = EC_KEY_new_by_curve_name(NID_secp256k1);
     if (!key) {
-        printw("\nError: Failed to create key structure\n\n");
+        out_printw("\nError: Failed to create key structure\n\n");
         return;
     }
     
     BIGNUM *bn_priv_key = BN_bin2bn(current_wallet.private_key, 32, NULL);
     if (!bn_priv_key || EC_KEY_set_private_key(key, bn_priv_key) != 1) {
-        printw("\nError: Failed to set private key\n\n");
+        out_printw("\nError: Failed to set private key\n\n");
         if (bn_priv_key) BN_free(bn_priv_key);
         EC_KEY_free(key);
         return;
@@ -4643,14 +6041,14 @@ void wallet_import(const char *private_key_hex) {
     const EC_GROUP *group = EC_KEY_get0_group(key);
     EC_POINT *pub_key = EC_POINT_new(group);
     if (!pub_key) {
-        printw("\nError: Failed to create point\n\n");
+        out_printw("\nError: Failed to create point\n\n");
         BN_free(bn_priv_key);
         EC_KEY_free(key);
         return;
     }
     
     if (!EC_POINT_mul(group, pub_key, bn_priv_key, NULL, NULL, NULL)) {
-        printw("\nError: Failed to derive public key\n\n");
+        out_printw("\nError: Failed to derive public key\n\n");
         EC_POINT_free(pub_key);
         BN_free(bn_priv_key);
         EC_KEY_free(key);
@@ -4662,7 +6060,7 @@ void wallet_import(const char *private_key_hex) {
         current_wallet.public_key, sizeof(current_wallet.public_key), NULL);
     
     if (current_wallet.public_key_length == 0) {
-        printw("\nError: Failed to convert public key\n\n");
+        out_printw("\nError: Failed to convert public key\n\n");
         EC_POINT_free(pub_key);
         BN_free(bn_priv_key);
         EC_KEY_free(key);
@@ -4675,45 +6073,45 @@ void wallet_import(const char *private_key_hex) {
     BN_free(bn_priv_key);
     EC_KEY_free(key);
     
-    printw("\nWallet imported successfully!\n");
-    printw("Private key: %s\n", bytes_to_hex(current_wallet.private_key, 32));
-    printw("Public key: %s\n\n", bytes_to_hex(current_wallet.public_key, current_wallet.public_key_length));
-    refresh();
+    out_printw("\nWallet imported successfully!\n");
+    out_printw("Private key: %s\n", bytes_to_hex(current_wallet.private_key, 32));
+    out_printw("Public key: %s\n\n", bytes_to_hex(current_wallet.public_key, current_wallet.public_key_length));
+    render_mark(stdscr);
 }
 
 void wallet_export(void) {
     if (!current_wallet.initialized) {
-        printw("\nError: No wallet initialized. Use 'wallet create' or 'wallet import' first.\n\n");
+        out_printw("\nError: No wallet initialized. Use 'wallet create' or 'wallet import' first.\n\n");
         return;
     }
     
-    printw("\nWallet Export:\n");
-    printw("Private key: %s\n", bytes_to_hex(current_wallet.private_key, 32));
-    printw("Public key: %s\n\n", bytes_to_hex(current_wallet.public_key, current_wallet.public_key_length));
-    refresh();
+    out_printw("\nWallet Export:\n");
+    out_printw("Private key: %s\n", bytes_to_hex(current_wallet.private_key, 32));
+    out_printw("Public key: %s\n\n", bytes_to_hex(current_wallet.public_key, current_wallet.public_key_length));
+    render_mark(stdscr);
 }
 
 void wallet_sign(const char *message) {
     if (!current_wallet.initialized) {
-        printw("\nError: No wallet initialized. Use 'wallet create' or 'wallet import' first.\n\n");
+        out_printw("\nError: No wallet initialized. Use 'wallet create' or 'wallet import' first.\n\n");
         return;
     }
     
     if (!message || strlen(message) == 0) {
-        printw("\nError: No message provided\n");
-        printw("Usage: wallet sign <message>\n\n");
+        out_printw("\nError: No message provided\n");
+        out_printw("Usage: wallet sign <message>\n\n");
         return;
     }
     
     EC_KEY *key = EC_KEY_new_by_curve_name(NID_secp256k1);
     if (!key) {
-        printw("\nError: Failed to create key structure\n\n");
+        out_printw("\nError: Failed to create key structure\n\n");
         return;
     }
     
     BIGNUM *bn_priv_key = BN_bin2bn(current_wallet.private_key, 32, NULL);
     if (!bn_priv_key || EC_KEY_set_private_key(key, bn_priv_key) != 1) {
-        printw("\nError: Failed to set private key\n\n");
+        out_printw("\nError: Failed to set private key\n\n");
         if (bn_priv_key) BN_free(bn_priv_key);
         EC_KEY_free(key);
         return;
@@ -4727,7 +6125,7 @@ void wallet_sign(const char *message) {
     
     ECDSA_SIG *signature = ECDSA_do_sign(hash, SHA256_DIGEST_LENGTH, key);
     if (!signature) {
-        printw("\nError: Failed to sign message\n\n");
+        out_printw("\nError: Failed to sign message\n\n");
         BN_free(bn_priv_key);
         EC_KEY_free(key);
         return;
@@ -4744,51 +6142,51 @@ void wallet_sign(const char *message) {
     memcpy(combined_sig, r_bin, 32);
     memcpy(combined_sig + 32, s_bin, 32);
     
-    printw("\nMessage: %s\n", message);
-    printw("Signature: %s\n\n", bytes_to_hex(combined_sig, 64));
+    out_printw("\nMessage: %s\n", message);
+    out_printw("Signature: %s\n\n", bytes_to_hex(combined_sig, 64));
     
     ECDSA_SIG_free(signature);
     BN_free(bn_priv_key);
     EC_KEY_free(key);
-    refresh();
+    render_mark(stdscr);
 }
 
 void wallet_verify(const char *message, const char *signature_hex, const char *public_key_hex) {
     if (!message || !signature_hex || !public_key_hex) {
-        printw("\nError: Missing parameters\n");
-        printw("Usage: wallet verify <message> <signature in hex> <public key in hex>\n\n");
+        out_printw("\nError: Missing parameters\n");
+        out_printw("Usage: wallet verify <message> <signature in hex> <public key in hex>\n\n");
         return;
     }
     
     unsigned char signature[64];
     if (!hex_to_bytes(signature_hex, signature, sizeof(signature))) {
-        printw("\nError: Invalid signature format\n\n");
+        out_printw("\nError: Invalid signature format\n\n");
         return;
     }
     
     unsigned char public_key[65];
     if (!hex_to_bytes(public_key_hex, public_key, sizeof(public_key))) {
-        printw("\nError: Invalid public key format\n\n");
+        out_printw("\nError: Invalid public key format\n\n");
         return;
     }
     
     EC_KEY *key = EC_KEY_new_by_curve_name(NID_secp256k1);
     if (!key) {
-        printw("\nError: Failed to create key structure\n\n");
+        out_printw("\nError: Failed to create key structure\n\n");
         return;
     }
     
     const EC_GROUP *group = EC_KEY_get0_group(key);
     EC_POINT *pub_point = EC_POINT_new(group);
     if (!pub_point) {
-        printw("\nError: Failed to create point\n\n");
+        out_printw("\nError: Failed to create point\n\n");
         EC_KEY_free(key);
         return;
     }
     
     if (!EC_POINT_oct2point(group, pub_point, public_key, 65, NULL) ||
         EC_KEY_set_public_key(key, pub_point) != 1) {
-        printw("\nError: Failed to set public key\n\n");
+        out_printw("\nError: Failed to set public key\n\n");
         EC_POINT_free(pub_point);
         EC_KEY_free(key);
         return;
@@ -4805,7 +6203,7 @@ void wallet_verify(const char *message, const char *signature_hex, const char *p
     BIGNUM *s = BN_bin2bn(signature + 32, 32, NULL);
     
     if (!r || !s || ECDSA_SIG_set0(ecdsa_sig, r, s) != 1) {
-        printw("\nError: Failed to set signature values\n\n");
+        out_printw("\nError: Failed to set signature values\n\n");
         if (r) BN_free(r);
         if (s) BN_free(s);
         ECDSA_SIG_free(ecdsa_sig);
@@ -4817,17 +6215,17 @@ void wallet_verify(const char *message, const char *signature_hex, const char *p
     int verify_result = ECDSA_do_verify(hash, SHA256_DIGEST_LENGTH, ecdsa_sig, key);
     
     if (verify_result == 1) {
-        printw("\nValid Signature\n\n");
+        out_printw("\nValid Signature\n\n");
     } else if (verify_result == 0) {
-        printw("\nInvalid Signature\n\n");
+        out_printw("\nInvalid Signature\n\n");
     } else {
-        printw("\nVerification Error\n\n");
+        out_printw("\nVerification Error\n\n");
     }
     
     ECDSA_SIG_free(ecdsa_sig);
     EC_POINT_free(pub_point);
     EC_KEY_free(key);
-    refresh();
+    render_mark(stdscr);
 }
 
 // Add these implementations after the Wallet structure definition and before the wallet functions
@@ -4864,13 +6262,72 @@ char *bytes_to_hex(const unsigned char *bytes, size_t len) {
     return hex_buffer;
 }
 
-int main(void) {
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s                 interactive shell\n", prog);
+    fprintf(stderr, "       %s -c \"<commands>\"   run commands separated by ';' or newlines\n", prog);
+    fprintf(stderr, "       %s <script.mx>     run commands from a script file\n", prog);
+    fprintf(stderr, "       %s -               run commands from stdin\n", prog);
+}
+
+// Run commands without the TUI: no ncurses, banner, prompt or history.
+// Returns the process exit status.
+static int run_batch(int argc, char **argv) {
+    output_set_batch(1);
+    getcwd(current_path, sizeof(current_path));
+    registry_init(commands);
+
+    int result;
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            print_usage(argv[0]);
+            return 2;
+        }
+        result = batch_run_string(argv[2], handle_command);
+    } else if (argc > 1 && strcmp(argv[1], "-") != 0) {
+        if (argv[1][0] == '-') {
+            print_usage(argv[0]);
+            return strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0 ? 0 : 2;
+        }
+        int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "minux: cannot open '%s': %s\n", argv[1], strerror(errno));
+            return 1;
+        }
+        result = batch_run_fd(fd, handle_command);
+        close(fd);
+    } else {
+        result = batch_run_fd(STDIN_FILENO, handle_command);
+    }
+
+    jobs_wait_all();
+    out_flush();
+    cleanup_serial();
+    registry_destroy();
+
+    if (result != 0) {
+        fprintf(stderr, "minux: error reading commands\n");
+        return 1;
+    }
+    // Any warning or error logged while running fails the batch
+    if (get_error_count(NULL, ERROR_WARNING) + get_error_count(NULL, ERROR_CRITICAL) > 0) {
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    // Arguments, or commands piped in, select batch mode
+    if (argc > 1 || !isatty(STDIN_FILENO)) {
+        return run_batch(argc, argv);
+    }
+
     // Set up locale and UTF-8 support BEFORE ncurses init
     setlocale(LC_ALL, "");
     const char *env_var = "NCURSES_NO_UTF8_ACS=1";
     putenv((char *)env_var);
 
     init_windows();
+    install_interrupt_handler();
     getcwd(current_path, sizeof(current_path));
 
     display_welcome_banner();
@@ -4947,20 +6404,44 @@ int main(void) {
     // Add another empty line before prompt
     y++;
     move(y, 0);
-    refresh();
+    render_mark(stdscr);
 
     // Initialize the command history
     load_history();
 
+    // Index the builtin commands
+    registry_init(commands);
+    completion_init(completion_words);
+
     // Show the initial prompt
     show_prompt();
+    line_editor_init(&prompt_line);
+    line_editor_begin(&prompt_line);
 
-    char cmd[MAX_CMD_LENGTH];
-    int cmd_pos = 0;
     int ch;
+    bool last_was_tab = false;
 
     while (1) {
+        // Show the last frame before waiting for input, then wake up
+        // periodically so background jobs keep draining
+        error_console_flush_pending(error_console);
+        render_flush();
+        timeout(PROCESS_POLL_MS);
         ch = getch();
+        timeout(-1);
+        if (interrupt_pending) {
+            interrupt_pending = 0;
+            line_editor_finish(&prompt_line);
+            line_editor_clear(&prompt_line);
+            out_printw("^C");
+            history_position = history_end();
+            show_prompt();
+            line_editor_begin(&prompt_line);
+        }
+        if (ch == ERR) {
+            jobs_poll();
+            continue;
+        }
 
         if (ch == '`' || ch == '~') {  // Toggle error console
             error_console_toggle(error_console);
@@ -4972,172 +6453,100 @@ int main(void) {
             continue;
         }
 
+        bool tab_again = last_was_tab;
+        last_was_tab = false;
+        size_t cursor = line_editor_cursor(&prompt_line);
+
         switch (ch) {
+            case '\t':  // Complete the word before the cursor
+                complete_prompt_line(tab_again);
+                last_was_tab = true;
+                break;
+
+            case 0x12:  // Ctrl-R - reverse incremental history search
+                if (history_reverse_search()) {
+                    run_prompt_line();
+                }
+                break;
+
             case '\n':
-                cmd[cmd_pos] = '\0';
-                printw("\n");  // Add a newline before executing the command
-                handle_command(cmd);
-                cmd_pos = 0;
-                history_position = history_count;  // Reset history position
+                run_prompt_line();
                 break;
 
             case KEY_BACKSPACE:
             case 127:  // Also handle DEL key
-                if (cmd_pos > 0) {
-                    cmd_pos--;
-                    // Erase character on screen
-                    int y, x;
-                    getyx(stdscr, y, x);
-                    move(y, x - 1);
-                    delch();
-                    refresh();
-                }
+                line_editor_delete_back(&prompt_line);
                 break;
                 
             case KEY_UP:  // Previous command in history
-                if (history_position > 0) {
+                if (history_position < 0) {
+                    history_position = history_end();  // First use loads the history
+                }
+                if (history_position > history_first()) {
                     history_position--;
-                    // Clear current command
-                    int y, x, start_x;
-                    getyx(stdscr, y, x);
-                    start_x = x - cmd_pos;
-                    move(y, start_x);
-                    for (int i = 0; i < cmd_pos; i++) {
-                        delch();
-                    }
-                    
-                    // Display the history entry
-                    char *hist_cmd = get_history_entry(history_position);
+                    size_t hist_len;
+                    const char *hist_cmd = history_get(history_position, &hist_len);
                     if (hist_cmd) {
-                        strncpy(cmd, hist_cmd, MAX_CMD_LENGTH - 1);
-                        cmd[MAX_CMD_LENGTH - 1] = '\0';
-                        cmd_pos = strlen(cmd);
-                        printw("%s", cmd);
+                        line_editor_set(&prompt_line, hist_cmd, std::min(hist_len, (size_t)LINE_EDITOR_MAX_LENGTH));
                     }
                 }
                 break;
                 
             case KEY_DOWN:  // Next command in history
-                if (history_position < history_count) {
+                if (history_position >= 0 && history_position < history_end()) {
                     history_position++;
-                    
-                    // Clear current command
-                    int y, x, start_x;
-                    getyx(stdscr, y, x);
-                    start_x = x - cmd_pos;
-                    move(y, start_x);
-                    for (int i = 0; i < cmd_pos; i++) {
-                        delch();
-                    }
-                    
-                    // If at the end of history, show an empty command
-                    if (history_position == history_count) {
-                        cmd[0] = '\0';
-                        cmd_pos = 0;
-                    } else {
-                        // Display the history entry
-                        char *hist_cmd = get_history_entry(history_position);
-                        if (hist_cmd) {
-                            strncpy(cmd, hist_cmd, MAX_CMD_LENGTH - 1);
-                            cmd[MAX_CMD_LENGTH - 1] = '\0';
-                            cmd_pos = strlen(cmd);
-                            printw("%s", cmd);
-                        }
+                    size_t hist_len = 0;
+                    const char *hist_cmd = NULL;
+                    // Past the newest entry the line is empty again
+                    if (history_position < history_end()) {
+                        hist_cmd = history_get(history_position, &hist_len);
                     }
+                    line_editor_set(&prompt_line, hist_cmd ? hist_cmd : "", std::min(hist_len, (size_t)LINE_EDITOR_MAX_LENGTH));
                 }
                 break;
                 
             case KEY_LEFT:  // Move cursor left
-                if (cmd_pos > 0) {
-                    cmd_pos--;
-                    // Move cursor left
-                    int y, x;
-                    getyx(stdscr, y, x);
-                    move(y, x - 1);
-                    refresh();
+                if (cursor > 0) {
+                    line_editor_move_to(&prompt_line, cursor - 1);
                 }
                 break;
                 
             case KEY_RIGHT:  // Move cursor right
-                if (cmd_pos < (int)strlen(cmd)) {
-                    cmd_pos++;
-                    // Move cursor right
-                    int y, x;
-                    getyx(stdscr, y, x);
-                    move(y, x + 1);
-                    refresh();
-                }
+                line_editor_move_to(&prompt_line, cursor + 1);
                 break;
                 
             case KEY_HOME:  // Move to beginning of line
-                {
-                    int y, x, start_x;
-                    getyx(stdscr, y, x);
-                    start_x = x - cmd_pos;
-                    move(y, start_x);
-                    cmd_pos = 0;
-                    refresh();
-                }
+                line_editor_move_to(&prompt_line, 0);
                 break;
                 
             case KEY_END:  // Move to end of line
-                {
-                    int y, x, start_x;
-                    getyx(stdscr, y, x);
-                    start_x = x - cmd_pos;
-                    cmd_pos = (int)strlen(cmd);
-                    move(y, start_x + cmd_pos);
-                    refresh();
-                }
+                line_editor_move_to(&prompt_line, line_editor_length(&prompt_line));
                 break;
                 
             case KEY_DC:  // Delete key (delete under cursor)
-                if (cmd_pos < (int)strlen(cmd)) {
-                    // Shift all characters left
-                    memmove(&cmd[cmd_pos], &cmd[cmd_pos + 1], strlen(cmd) - cmd_pos);
-                    
-                    // Redraw the command line
-                    int y, x, start_x;
-                    getyx(stdscr, y, x);
-                    start_x = x - cmd_pos;
-                    move(y, start_x);
-                    for (int i = 0; i < (int)strlen(cmd); i++) {
-                        delch();
-                    }
-                    move(y, start_x);
-                    printw("%s", cmd);
-                    move(y, start_x + cmd_pos);
-                    refresh();
-                }
+                line_editor_delete_forward(&prompt_line);
+                break;
+
+            case KEY_RESIZE:  // Wrapped rows moved, draw the line again
+                redraw_prompt_line(std::min(prompt_line.origin_y, LINES - 1));
+                break;
+
+            case KEY_PPAGE:  // Browse earlier output
+                scrollback_view();
                 break;
 
             default:
-                if (cmd_pos < MAX_CMD_LENGTH - 1 && ch >= 32 && ch <= 126) {
-                    // If cursor is in the middle of the command, make room for the new character
-                    if (cmd_pos < (int)strlen(cmd)) {
-                        memmove(&cmd[cmd_pos + 1], &cmd[cmd_pos], strlen(cmd) - cmd_pos + 1);
-                        
-                        // Insert the character
-                        cmd[cmd_pos] = ch;
-                        
-                        // Redraw the command line from the cursor position
-                        int y, x;
-                        getyx(stdscr, y, x);
-                        insch(ch);  // Insert the character at cursor position
-                        
-                        // Move cursor forward
-                        move(y, x + 1);
-                    } else {
-                        // Simply append to the end
-                        cmd[cmd_pos] = ch;
-                        cmd[cmd_pos + 1] = '\0';
-                        printw("%c", ch);
+                if (ch >= 32 && ch <= 126) {
+                    char c = (char)ch;
+                    if (line_editor_insert(&prompt_line, &c, 1) != 0) {
+                        beep();  // Line is at its maximum length
                     }
-                    cmd_pos++;
-                    refresh();
                 }
                 break;
         }
+
+        // Only the cells that changed are redrawn
+        line_editor_render(&prompt_line);
     }
 
     cleanup();
@@ -5161,6 +6570,10 @@ void cmd_cuda(const char *arg) {
     if (strcmp(cmd_name, "info") == 0) {
         cuda_info();
     } else if (strcmp(cmd_name, "top") == 0) {
+        if (output_is_batch()) {
+            log_error(error_console, ERROR_WARNING, "CUDA", "'cuda top' needs an interactive terminal");
+            return;
+        }
         cuda_top();
     } else if (strcmp(cmd_name, "help") == 0) {
         cuda_help();
@@ -5171,16 +6584,16 @@ void cmd_cuda(const char *arg) {
 }
 
 void cuda_help(void) {
-    printw("\nCUDA Command Usage:\n");
-    printw("  cuda                 - Show GPU information\n");
-    printw("  cuda info            - Show detailed GPU information\n");
-    printw("  cuda top             - Launch real-time GPU monitor\n");
-    printw("  cuda help            - Show this help message\n\n");
-    refresh();
+    out_printw("\nCUDA Command Usage:\n");
+    out_printw("  cuda                 - Show GPU information\n");
+    out_printw("  cuda info            - Show detailed GPU information\n");
+    out_printw("  cuda top             - Launch real-time GPU monitor\n");
+    out_printw("  cuda help            - Show this help message\n\n");
+    render_mark(stdscr);
 }
 
 void cuda_info(void) {
-    printw("\n=== CUDA GPU Information ===\n\n");
+    out_printw("\n=== CUDA GPU Information ===\n\n");
     
     // First, try to run our external CUDA utilities if they exist
     char cuda_simple_path[MAX_PATH];
@@ -5188,61 +6601,33 @@ void cuda_info(void) {
     
     // Check if the CUDA utility exists
     if (access(cuda_simple_path, X_OK) == 0) {
-        printw("Running CUDA device information tool...\n\n");
-        refresh();
-        
-        // Temporarily exit ncurses mode to run external command
-        endwin();
+        out_printw("Running CUDA device information tool...\n\n");
+        render_mark(stdscr);
         
         // Execute the cuda_simple command
         char cmd[512];
         snprintf(cmd, sizeof(cmd), "cd %s && ./cuda_simple", "/marcetux/robotics.minux.io/baremetal");
-        int result = system(cmd);
-        
-        // Re-initialize ncurses
-        initscr();
-        cbreak();
-        noecho();
-        keypad(stdscr, TRUE);
-        
-        // Re-initialize colors if they were set up
-        if (has_colors()) {
-            start_color();
-            init_pair(1, COLOR_BLUE, COLOR_BLACK);    // Directories
-            init_pair(2, COLOR_GREEN, COLOR_BLACK);   // Executables
-            init_pair(3, COLOR_CYAN, COLOR_BLACK);    // Symlinks
-            init_pair(4, COLOR_YELLOW, COLOR_BLACK);  // Status bar
-            init_pair(5, COLOR_RED, COLOR_BLACK);     // Errors
-            init_pair(6, COLOR_MAGENTA, COLOR_BLACK); // Special files
-        }
-        
-        // Redraw the screen
-        clear();
-        refresh();
+        int result = run_external(cmd);
         
         if (result != 0) {
-            printw("CUDA tool execution failed.\n");
+            out_printw("CUDA tool execution failed.\n");
         }
-        printw("\nPress any key to continue...");
-        refresh();
-        getch();
-        clear();
     } else {
         // CUDA utilities not found, provide instructions
-        printw("CUDA utilities not found.\n\n");
-        printw("To use CUDA features:\n");
-        printw("1. Make sure NVIDIA drivers and CUDA toolkit are installed\n");
-        printw("2. Compile the CUDA utilities with:\n");
-        printw("   cd /marcetux/robotics.minux.io/baremetal\n");
-        printw("   g++ -o cuda_simple cuda_simple.cpp -lcudart -lcuda\n\n");
-        printw("3. Then use 'cuda info' for GPU information\n");
-        printw("4. Use 'cuda top' for real-time monitoring\n\n");
-        printw("Alternatively, you can use these external commands:\n");
-        printw("  nvidia-smi       - NVIDIA System Management Interface\n");
-        printw("  nvtop            - GPU process monitor (install with: sudo apt install nvtop)\n");
-        printw("  gpustat          - GPU status monitor (install with: pip install gpustat)\n\n");
-    }
-    refresh();
+        out_printw("CUDA utilities not found.\n\n");
+        out_printw("To use CUDA features:\n");
+        out_printw("1. Make sure NVIDIA drivers and CUDA toolkit are installed\n");
+        out_printw("2. Compile the CUDA utilities with:\n");
+        out_printw("   cd /marcetux/robotics.minux.io/baremetal\n");
+        out_printw("   g++ -o cuda_simple cuda_simple.cpp -lcudart -lcuda\n\n");
+        out_printw("3. Then use 'cuda info' for GPU information\n");
+        out_printw("4. Use 'cuda top' for real-time monitoring\n\n");
+        out_printw("Alternatively, you can use these external commands:\n");
+        out_printw("  nvidia-smi       - NVIDIA System Management Interface\n");
+        out_printw("  nvtop            - GPU process monitor (install with: sudo apt install nvtop)\n");
+        out_printw("  gpustat          - GPU status monitor (install with: pip install gpustat)\n\n");
+    }
+    render_mark(stdscr);
 }
 
 void cuda_top(void) {
@@ -5251,58 +6636,34 @@ void cuda_top(void) {
     snprintf(cuda_top_path, sizeof(cuda_top_path), "%s/cuda_top", "/marcetux/robotics.minux.io/baremetal");
     
     if (access(cuda_top_path, X_OK) == 0) {
-        printw("\n=== CUDA GPU Monitor ===\n\n");
-        printw("Launching real-time GPU monitor...\n");
-        printw("Press Ctrl+C in the monitor to return to MINUX.\n\n");
-        printw("Press any key to continue...");
-        refresh();
-        getch();
-        
-        // Temporarily exit ncurses mode to run external command
-        endwin();
+        out_printw("\n=== CUDA GPU Monitor ===\n\n");
+        out_printw("Launching real-time GPU monitor...\n");
+        out_printw("Press Ctrl+C in the monitor to return to MINUX,\n");
+        out_printw("or Ctrl+Z to keep it running as a background job.\n\n");
+        render_mark(stdscr);
         
         // Execute the cuda_top command
         char cmd[512];
         snprintf(cmd, sizeof(cmd), "cd %s && ./cuda_top", "/marcetux/robotics.minux.io/baremetal");
-        int result = system(cmd);
-        
-        // Re-initialize ncurses
-        initscr();
-        cbreak();
-        noecho();
-        keypad(stdscr, TRUE);
-        
-        // Re-initialize colors if they were set up
-        if (has_colors()) {
-            start_color();
-            init_pair(1, COLOR_BLUE, COLOR_BLACK);    // Directories
-            init_pair(2, COLOR_GREEN, COLOR_BLACK);   // Executables
-            init_pair(3, COLOR_CYAN, COLOR_BLACK);    // Symlinks
-            init_pair(4, COLOR_YELLOW, COLOR_BLACK);  // Status bar
-            init_pair(5, COLOR_RED, COLOR_BLACK);     // Errors
-            init_pair(6, COLOR_MAGENTA, COLOR_BLACK); // Special files
-        }
-        
-        // Redraw the screen
-        clear();
-        refresh();
+        int result = run_external(cmd);
         
-        if (result != 0) {
+        // Stopping the monitor with Ctrl+C is the normal way out
+        if (result > 0 && WIFEXITED(result) && WEXITSTATUS(result) != 0) {
             log_error(error_console, ERROR_WARNING, "CUDA", 
                      "CUDA Top failed with exit code %d", WEXITSTATUS(result));
         }
     } else {
-        printw("\n=== CUDA GPU Monitor ===\n\n");
-        printw("CUDA Top utility not found.\n\n");
-        printw("To use the real-time GPU monitor:\n");
-        printw("1. Compile the CUDA utilities with:\n");
-        printw("   cd /marcetux/robotics.minux.io/baremetal\n");
-        printw("   g++ -o cuda_top cuda_top.cpp -lcudart -lcuda -lnvidia-ml\n\n");
-        printw("2. Then use 'cuda top' for real-time monitoring\n\n");
-        printw("Alternative GPU monitoring tools:\n");
-        printw("  nvidia-smi -l 1  - Update every second\n");
-        printw("  nvtop            - Interactive GPU monitor\n");
-        printw("  watch nvidia-smi - Watch nvidia-smi output\n\n");
-    }
-    refresh();
+        out_printw("\n=== CUDA GPU Monitor ===\n\n");
+        out_printw("CUDA Top utility not found.\n\n");
+        out_printw("To use the real-time GPU monitor:\n");
+        out_printw("1. Compile the CUDA utilities with:\n");
+        out_printw("   cd /marcetux/robotics.minux.io/baremetal\n");
+        out_printw("   g++ -o cuda_top cuda_top.cpp -lcudart -lcuda -lnvidia-ml\n\n");
+        out_printw("2. Then use 'cuda top' for real-time monitoring\n\n");
+        out_printw("Alternative GPU monitoring tools:\n");
+        out_printw("  nvidia-smi -l 1  - Update every second\n");
+        out_printw("  nvtop            - Interactive GPU monitor\n");
+        out_printw("  watch nvidia-smi - Watch nvidia-smi output\n\n");
+    }
+    render_mark(stdscr);
 } 
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include "output.h"
+#include "scrollback.h"
+#include <ncurses.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+static int batch_mode = 0;
+
+// Set on worker threads to redirect their output
+static thread_local OutputSink thread_sink = NULL;
+static thread_local void *thread_sink_ctx = NULL;
+
+// Bulk output state (TUI only)
+static bool bulk_active = false;
+static bool bulk_deferred = false;
+static int bulk_max_rows = 0;
+static int bulk_rows_drawn = 0;
+static long bulk_defer_from = 0;     // First line that was not drawn
+
+// Batch writer state - output is collected here and written in large chunks
+static char out_buffer[OUTPUT_BUFFER_SIZE];
+static size_t out_used = 0;
+
+static void write_all(const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;  // Reader went away (e.g. closed pipe), drop the output
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+void output_set_batch(int enabled) {
+    if (batch_mode && !enabled) {
+        out_flush();
+    }
+    batch_mode = enabled;
+}
+
+int output_is_batch(void) {
+    return batch_mode;
+}
+
+// Draw formatted text on the screen unless a bulk command has gone past
+// its screenful, and keep it in the scrollback either way
+static int screen_write(const char *text, int len) {
+    if (bulk_active && !bulk_deferred) {
+        // Only switch at the start of a line so drawn and skipped output
+        // meet at a line boundary
+        if (bulk_rows_drawn >= bulk_max_rows && scrollback_partial_length() == 0) {
+            bulk_deferred = true;
+            bulk_defer_from = scrollback_end();
+        }
+        for (int i = 0; i < len; i++) {
+            if (text[i] == '\n') bulk_rows_drawn++;
+        }
+    }
+    scrollback_append(text, len);
+    if (bulk_deferred) {
+        return OK;
+    }
+    return waddnstr(stdscr, text, len);
+}
+
+// Hand formatted text to the worker's sink or the screen
+static int deliver(const char *text, int len) {
+    if (thread_sink) {
+        thread_sink(text, len, thread_sink_ctx);
+        return OK;
+    }
+    return screen_write(text, len);
+}
+
+int out_vprintw(const char *format, va_list args) {
+    if (!batch_mode || thread_sink) {
+        char small[1024];
+        va_list copy;
+        va_copy(copy, args);
+        int len = vsnprintf(small, sizeof(small), format, copy);
+        va_end(copy);
+        if (len < 0) {
+            return ERR;
+        }
+        if ((size_t)len < sizeof(small)) {
+            return deliver(small, len);
+        }
+
+        char *big = new char[len + 1];
+        vsnprintf(big, len + 1, format, args);
+        int result = deliver(big, len);
+        delete[] big;
+        return result;
+    }
+
+    // Try to format straight into the free space of the buffer
+    va_list copy;
+    va_copy(copy, args);
+    size_t space = sizeof(out_buffer) - out_used;
+    int len = vsnprintf(out_buffer + out_used, space, format, copy);
+    va_end(copy);
+    if (len < 0) {
+        return ERR;
+    }
+
+    if ((size_t)len < space) {
+        out_used += len;
+        return OK;
+    }
+
+    // Didn't fit - flush what we have and retry, spilling straight to
+    // stdout if a single write is larger than the whole buffer
+    out_flush();
+    if ((size_t)len < sizeof(out_buffer)) {
+        vsnprintf(out_buffer, sizeof(out_buffer), format, args);
+        out_used = len;
+    } else {
+        char *big = new char[len + 1];
+        vsnprintf(big, len + 1, format, args);
+        write_all(big, len);
+        delete[] big;
+    }
+    return OK;
+}
+
+int out_printw(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int result = out_vprintw(format, args);
+    va_end(args);
+    return result;
+}
+
+void out_flush(void) {
+    if (out_used > 0) {
+        write_all(out_buffer, out_used);
+        out_used = 0;
+    }
+}
+
+void out_attron(int attrs) {
+    if (!batch_mode && !thread_sink) {
+        attron(attrs);
+    }
+}
+
+void out_attroff(int attrs) {
+    if (!batch_mode && !thread_sink) {
+        attroff(attrs);
+    }
+}
+
+void output_set_thread_sink(OutputSink sink, void *ctx) {
+    thread_sink = sink;
+    thread_sink_ctx = ctx;
+}
+
+void output_bulk_begin(int max_rows) {
+    if (batch_mode || thread_sink) {
+        return;
+    }
+    bulk_active = true;
+    bulk_deferred = false;
+    bulk_max_rows = max_rows > 2 ? max_rows : 2;
+    bulk_rows_drawn = 0;
+}
+
+void output_bulk_end(void) {
+    if (!bulk_active || thread_sink) {
+        return;
+    }
+    bulk_active = false;
+    if (!bulk_deferred) {
+        return;
+    }
+    bulk_deferred = false;
+
+    // The line the cursor is on - empty if the output ended with '\n'
+    long current = scrollback_end() - (scrollback_partial_length() > 0 ? 1 : 0);
+    long from = current - (bulk_max_rows - 2);
+    if (from < bulk_defer_from) from = bulk_defer_from;
+    if (from < scrollback_first()) from = scrollback_first();
+
+    if (from > bulk_defer_from) {
+        char notice[96];
+        snprintf(notice, sizeof(notice), "[... %ld lines not shown, PgUp to scroll back ...]\n",
+                 from - bulk_defer_from);
+        waddstr(stdscr, notice);
+    }
+    for (long id = from; id <= current; id++) {
+        size_t len;
+        const char *text = scrollback_line(id, &len);
+        if (text) {
+            waddnstr(stdscr, text, (int)len);
+        }
+        if (id < current) {
+            waddch(stdscr, '\n');
+        }
+    }
+}
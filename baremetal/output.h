@@ -0,0 +1,43 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+// Output routing for MINUX
+// Command output goes to the ncurses screen (and the scrollback) in the
+// TUI and to a buffered stdout writer in batch mode
+
+#include <stdarg.h>
+#include <stddef.h>
+
+// Size of the stdout buffer used in batch mode
+#define OUTPUT_BUFFER_SIZE 65536
+
+// Mode selection - call output_set_batch(1) before any output when
+// running without ncurses
+void output_set_batch(int enabled);
+int output_is_batch(void);
+
+// printw replacement used by all command implementations
+int out_printw(const char *format, ...) __attribute__((format(printf, 1, 2)));
+int out_vprintw(const char *format, va_list args);
+
+// Push buffered batch output to stdout (no-op in the TUI)
+void out_flush(void);
+
+// Text attributes for command output - ignored in batch mode and on
+// worker threads, which must not touch the screen
+void out_attron(int attrs);
+void out_attroff(int attrs);
+
+// Output from worker threads. While a sink is set for the calling thread,
+// out_printw hands the formatted text to it instead of the screen.
+typedef void (*OutputSink)(const char *text, size_t len, void *ctx);
+void output_set_thread_sink(OutputSink sink, void *ctx);
+
+// Bulk output for commands that can print far more than a screen. Once
+// max_rows lines have been drawn the rest only goes to the scrollback, and
+// output_bulk_end() draws the last screenful in one go. No-op on worker
+// threads.
+void output_bulk_begin(int max_rows);
+void output_bulk_end(void);
+
+#endif // OUTPUT_H
@@ -0,0 +1,430 @@
+#include "process.h"
+#include <spawn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <vector>
+
+extern char **environ;
+
+static Job jobs[MAX_JOBS];
+static unsigned long job_seq = 0;
+
+// Children see a plain terminal since the TUI only interprets a few
+// escape sequences
+static const char *child_term = "TERM=dumb";
+
+static void job_init(Job *job, int slot, JobKind kind, const char *cmd) {
+    memset(job, 0, sizeof(*job));
+    job->id = slot + 1;
+    job->kind = kind;
+    job->state = JOB_RUNNING;
+    job->pid = -1;
+    job->master_fd = -1;
+    job->slave_fd = -1;
+    job->seq = ++job_seq;
+    strncpy(job->command, cmd, sizeof(job->command) - 1);
+}
+
+// Find a free slot, reclaiming the oldest finished job if the table is full
+static Job *job_alloc(JobKind kind, const char *cmd) {
+    Job *oldest_done = NULL;
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].id == 0) {
+            job_init(&jobs[i], i, kind, cmd);
+            return &jobs[i];
+        }
+        if (jobs[i].state == JOB_DONE && !jobs[i].foreground &&
+            (!oldest_done || jobs[i].seq < oldest_done->seq)) {
+            oldest_done = &jobs[i];
+        }
+    }
+
+    if (oldest_done) {
+        int slot = oldest_done->id - 1;
+        job_release(oldest_done);
+        job_init(&jobs[slot], slot, kind, cmd);
+        return &jobs[slot];
+    }
+    errno = EAGAIN;
+    return NULL;
+}
+
+static void close_pty(Job *job) {
+    if (job->master_fd >= 0) {
+        close(job->master_fd);
+        job->master_fd = -1;
+    }
+    if (job->slave_fd >= 0) {
+        close(job->slave_fd);
+        job->slave_fd = -1;
+    }
+}
+
+// Copy of the environment with TERM replaced, built once per spawn
+static std::vector<char *> child_environment(bool plain_term) {
+    std::vector<char *> env;
+    for (char **e = environ; *e; e++) {
+        if (plain_term && strncmp(*e, "TERM=", 5) == 0) continue;
+        env.push_back(*e);
+    }
+    if (plain_term) {
+        env.push_back((char *)child_term);
+    }
+    env.push_back(NULL);
+    return env;
+}
+
+static int spawn_shell(pid_t *pid, const char *cmd, const char *tty_path, bool new_session) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    if (tty_path) {
+        // Opened after setsid(), so the pty becomes the controlling terminal
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, tty_path, O_RDWR, 0);
+        posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO, STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO, STDERR_FILENO);
+    }
+
+    // Children start with default signal handling and nothing blocked
+    sigset_t mask, defaults;
+    sigemptyset(&mask);
+    sigfillset(&defaults);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    if (new_session) {
+#ifdef POSIX_SPAWN_SETSID
+        flags |= POSIX_SPAWN_SETSID;
+#else
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, 0);
+#endif
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    std::vector<char *> env = child_environment(tty_path != NULL);
+    char *argv[] = { (char *)"sh", (char *)"-c", (char *)cmd, NULL };
+    int rc = posix_spawn(pid, PROCESS_SHELL, &actions, &attr, argv, env.data());
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return rc;
+}
+
+int process_spawn_pty(const char *cmd, int rows, int cols) {
+    Job *job = job_alloc(JOB_PROCESS, cmd);
+    if (!job) return -1;
+
+    job->master_fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (job->master_fd < 0 || grantpt(job->master_fd) != 0 || unlockpt(job->master_fd) != 0) {
+        int saved = errno;
+        job_release(job);
+        errno = saved;
+        return -1;
+    }
+
+    char tty_path[64];
+    const char *name = ptsname(job->master_fd);
+    if (!name) {
+        int saved = errno;
+        job_release(job);
+        errno = saved;
+        return -1;
+    }
+    strncpy(tty_path, name, sizeof(tty_path) - 1);
+    tty_path[sizeof(tty_path) - 1] = '\0';
+
+    job->slave_fd = open(tty_path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    fcntl(job->master_fd, F_SETFL, fcntl(job->master_fd, F_GETFL) | O_NONBLOCK);
+    job_resize(job, rows, cols);
+
+    int rc = spawn_shell(&job->pid, cmd, tty_path, true);
+    if (rc != 0) {
+        job_release(job);
+        errno = rc;
+        return -1;
+    }
+    return job->id;
+}
+
+int process_spawn(const char *cmd) {
+    Job *job = job_alloc(JOB_PROCESS, cmd);
+    if (!job) return -1;
+
+    int rc = spawn_shell(&job->pid, cmd, NULL, false);
+    if (rc != 0) {
+        job_release(job);
+        errno = rc;
+        return -1;
+    }
+    return job->id;
+}
+
+int process_start_task(const char *cmd, WorkerFunction fn, void *arg, WorkerFunction cleanup) {
+    Job *job = job_alloc(JOB_TASK, cmd);
+    if (!job) return -1;
+
+    job->task = worker_start(fn, arg, cleanup);
+    if (!job->task) {
+        job_release(job);
+        errno = EAGAIN;
+        return -1;
+    }
+    return job->id;
+}
+
+int process_run(const char *cmd) {
+    pid_t pid;
+    int rc = spawn_shell(&pid, cmd, NULL, false);
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return status;
+}
+
+int process_run_cancellable(const char *cmd, int (*stop)(void)) {
+    pid_t pid;
+    // In its own process group so the whole pipeline can be stopped
+    int rc = spawn_shell(&pid, cmd, NULL, true);
+    if (rc != 0) {
+        errno = rc;
+        return -1;
+    }
+
+    struct timespec nap = {0, PROCESS_POLL_MS * 1000000L / 4};
+    bool killed = false;
+    int status;
+    while (1) {
+        pid_t r = waitpid(pid, &status, WNOHANG);
+        if (r == pid) break;
+        if (r < 0 && errno != EINTR) return -1;
+        if (!killed && stop()) {
+            kill(-pid, SIGTERM);
+            killed = true;
+        }
+        nanosleep(&nap, NULL);
+    }
+    return status;
+}
+
+Job *job_get(int id) {
+    if (id < 1 || id > MAX_JOBS || jobs[id - 1].id == 0) {
+        return NULL;
+    }
+    return &jobs[id - 1];
+}
+
+Job *job_at(int index) {
+    if (index < 0 || index >= MAX_JOBS || jobs[index].id == 0) {
+        return NULL;
+    }
+    return &jobs[index];
+}
+
+Job *job_latest(void) {
+    Job *latest = NULL;
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].id != 0 && (!latest || jobs[i].seq > latest->seq)) {
+            latest = &jobs[i];
+        }
+    }
+    return latest;
+}
+
+ssize_t job_read(Job *job, char *buf, size_t len) {
+    if (job->kind == JOB_TASK) {
+        if (!job->task) return -1;
+        worker_wake_clear();
+        return worker_read(job->task, buf, len);
+    }
+    if (job->master_fd < 0) return -1;
+
+    ssize_t n = read(job->master_fd, buf, len);
+    if (n > 0) return n;
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+    return -1;  // EIO once every slave descriptor is closed
+}
+
+int job_poll_fd(Job *job) {
+    return job->kind == JOB_TASK ? worker_wake_fd() : job->master_fd;
+}
+
+int job_send_input(Job *job, const char *data, size_t len) {
+    if (job->kind == JOB_TASK) {
+        // A builtin has no terminal input; Ctrl-C asks it to stop
+        if (job->task && job->state == JOB_RUNNING && memchr(data, 0x03, len)) {
+            worker_cancel(job->task);
+        }
+        return 0;
+    }
+    if (job->master_fd < 0 || job->state != JOB_RUNNING) return -1;
+
+#ifndef POSIX_SPAWN_SETSID
+    // Without a controlling terminal the line discipline can't raise SIGINT
+    if (memchr(data, 0x03, len)) {
+        kill(-job->pid, SIGINT);
+    }
+#endif
+
+    while (len > 0) {
+        ssize_t n = write(job->master_fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+void job_resize(Job *job, int rows, int cols) {
+    if (job->master_fd < 0) return;
+
+    struct winsize ws;
+    memset(&ws, 0, sizeof(ws));
+    ws.ws_row = rows > 0 ? rows : 24;
+    ws.ws_col = cols > 0 ? cols : 80;
+    ioctl(job->master_fd, TIOCSWINSZ, &ws);
+}
+
+int job_check_exit(Job *job) {
+    if (job->state == JOB_DONE) return 1;
+    if (job->kind == JOB_TASK) {
+        if (!job->task || !worker_finished(job->task)) return 0;
+        job->state = JOB_DONE;
+        // Report an interrupted builtin like a process killed by SIGINT
+        job->status = worker_was_cancelled(job->task) ? SIGINT : 0;
+        return 1;
+    }
+    if (job->pid <= 0) return 0;
+
+    int status;
+    pid_t r = waitpid(job->pid, &status, WNOHANG);
+    if (r == job->pid || (r < 0 && errno == ECHILD)) {
+        job->state = JOB_DONE;
+        job->status = (r == job->pid) ? status : 0;
+        return 1;
+    }
+    return 0;
+}
+
+static void backlog_append(Job *job, const char *data, size_t len) {
+    if (!job->backlog) {
+        job->backlog = (char *)malloc(JOB_BACKLOG_SIZE);
+        if (!job->backlog) {
+            job->backlog_dropped += len;
+            return;
+        }
+    }
+
+    // Keep the most recent output, dropping the oldest bytes first
+    if (len >= JOB_BACKLOG_SIZE) {
+        job->backlog_dropped += job->backlog_len + len - JOB_BACKLOG_SIZE;
+        memcpy(job->backlog, data + len - JOB_BACKLOG_SIZE, JOB_BACKLOG_SIZE);
+        job->backlog_len = JOB_BACKLOG_SIZE;
+        return;
+    }
+    if (job->backlog_len + len > JOB_BACKLOG_SIZE) {
+        size_t drop = job->backlog_len + len - JOB_BACKLOG_SIZE;
+        memmove(job->backlog, job->backlog + drop, job->backlog_len - drop);
+        job->backlog_len -= drop;
+        job->backlog_dropped += drop;
+    }
+    memcpy(job->backlog + job->backlog_len, data, len);
+    job->backlog_len += len;
+}
+
+static void drain_to_backlog(Job *job) {
+    char buf[4096];
+    ssize_t n;
+    while ((n = job_read(job, buf, sizeof(buf))) > 0) {
+        backlog_append(job, buf, n);
+    }
+}
+
+void job_clear_backlog(Job *job) {
+    job->backlog_len = 0;
+    job->backlog_dropped = 0;
+}
+
+void job_release(Job *job) {
+    close_pty(job);
+    worker_release(job->task);
+    free(job->backlog);
+    memset(job, 0, sizeof(*job));
+    job->master_fd = -1;
+    job->slave_fd = -1;
+}
+
+int jobs_poll(void) {
+    int finished = 0;
+    for (int i = 0; i < MAX_JOBS; i++) {
+        Job *job = &jobs[i];
+        if (job->id == 0 || job->state != JOB_RUNNING || job->foreground) continue;
+
+        drain_to_backlog(job);
+        if (job_check_exit(job)) {
+            // Pick up whatever was written between the last read and exit
+            drain_to_backlog(job);
+            close_pty(job);
+            finished++;
+        }
+    }
+    return finished;
+}
+
+int jobs_running(void) {
+    int count = 0;
+    for (int i = 0; i < MAX_JOBS; i++) {
+        if (jobs[i].id != 0 && jobs[i].state == JOB_RUNNING) count++;
+    }
+    return count;
+}
+
+void jobs_wait_all(void) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        Job *job = &jobs[i];
+        if (job->id == 0) continue;
+        if (job->state == JOB_RUNNING && job->pid > 0) {
+            int status;
+            while (waitpid(job->pid, &status, 0) < 0 && errno == EINTR) {}
+        }
+        while (job->task && !worker_finished(job->task)) {
+            drain_to_backlog(job);  // Keep the task from blocking on output
+            usleep(PROCESS_POLL_MS * 1000);
+        }
+        job_release(job);
+    }
+}
+
+void jobs_kill_all(void) {
+    for (int i = 0; i < MAX_JOBS; i++) {
+        Job *job = &jobs[i];
+        if (job->id == 0) continue;
+        if (job->state == JOB_RUNNING && job->pid > 0) {
+            // Each job leads its own session/process group
+            kill(-job->pid, SIGHUP);
+            waitpid(job->pid, NULL, WNOHANG);
+        }
+        job_release(job);
+    }
+}
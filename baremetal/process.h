@@ -0,0 +1,86 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+// Process launcher and job table for MINUX
+// Runs shell commands with posix_spawn, on a pseudo-terminal when the
+// output is shown inside the TUI, and tracks them as jobs alongside
+// builtins running on the worker pool
+
+#include <sys/types.h>
+#include <stddef.h>
+#include "worker.h"
+
+// Job settings
+#define MAX_JOBS 16
+#define JOB_COMMAND_LENGTH 256
+#define JOB_BACKLOG_SIZE 65536   // Output kept for a job that isn't in the foreground
+#define PROCESS_SHELL "/bin/sh"
+#define PROCESS_POLL_MS 50
+
+typedef enum {
+    JOB_PROCESS = 0,            // Shell command started by the launcher
+    JOB_TASK                    // Builtin running on the worker pool
+} JobKind;
+
+typedef enum {
+    JOB_RUNNING = 0,
+    JOB_DONE
+} JobState;
+
+typedef struct {
+    int id;                     // Job number shown to the user, 0 = free slot
+    JobKind kind;
+    JobState state;
+    pid_t pid;
+    int master_fd;              // pty master, -1 if the job has no pty
+    WorkerTask *task;           // Worker task for JOB_TASK jobs
+    int slave_fd;               // Held open so output isn't lost when the child exits
+    int status;                 // Wait status once the job is done
+    int foreground;             // Output is being consumed by the UI
+    int reported;               // Completion has been shown to the user
+    unsigned long seq;          // Start order, used to pick the default for 'fg'
+    char command[JOB_COMMAND_LENGTH];
+    char *backlog;              // Output collected while in the background
+    size_t backlog_len;
+    size_t backlog_dropped;     // Bytes discarded because the backlog was full
+} Job;
+
+// Launching - return the job id, or -1 with errno set
+int process_spawn_pty(const char *cmd, int rows, int cols);
+int process_spawn(const char *cmd);
+
+// Run fn(arg) on the worker pool as a job; see worker_start() for how arg
+// and cleanup are handled. Returns the job id, or -1 with errno set (arg
+// is then still owned by the caller).
+int process_start_task(const char *cmd, WorkerFunction fn, void *arg, WorkerFunction cleanup);
+
+// Run a command with the caller's stdio and wait for it (batch mode).
+// Returns the wait status, or -1 if it couldn't be started.
+int process_run(const char *cmd);
+
+// process_run() that kills the command once stop() returns true, e.g.
+// worker_cancelled() for a builtin the user interrupted
+int process_run_cancellable(const char *cmd, int (*stop)(void));
+
+// Job table access
+Job *job_get(int id);
+Job *job_at(int index);         // Slot access for iteration, NULL if free
+Job *job_latest(void);          // Most recently started job, NULL if none
+
+// Per-job I/O
+ssize_t job_read(Job *job, char *buf, size_t len);  // >0 data, 0 nothing pending, -1 closed
+int job_poll_fd(Job *job);      // Readable when the job may have output, -1 if none
+int job_send_input(Job *job, const char *data, size_t len);  // Ctrl-C cancels a task
+void job_resize(Job *job, int rows, int cols);
+int job_check_exit(Job *job);   // Returns 1 once the job has finished
+void job_clear_backlog(Job *job);
+void job_release(Job *job);
+
+// Drain background output and reap finished jobs.
+// Returns the number of jobs that finished during this call.
+int jobs_poll(void);
+int jobs_running(void);
+void jobs_wait_all(void);
+void jobs_kill_all(void);
+
+#endif // PROCESS_H
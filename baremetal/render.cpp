@@ -0,0 +1,190 @@
+#include "render.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static bool active = false;
+static long frame_ns = 1000000000L / RENDER_DEFAULT_FPS;
+static int fps = RENDER_DEFAULT_FPS;
+static struct timespec last_frame;
+static bool pending = false;
+static pthread_t ui_thread;         // Only this thread may touch the screen
+
+static unsigned long total_marks = 0;
+static unsigned long total_frames = 0;
+static long long start_bytes = -1;
+
+// Process write counter. ncurses writes straight to the terminal's file
+// descriptor and offers no hook to count what it writes there, so this is
+// every byte the process writes - the history log, saved files and worker
+// output too - and is reported as such.
+static int io_fd = -1;
+
+static RenderCommandStats stats[RENDER_STATS_HISTORY];
+static int stats_next = 0;
+static int stats_used = 0;
+
+static RenderCommandStats current;
+static bool in_command = false;
+static long long current_start_bytes = -1;
+static struct timespec current_start;
+
+static long elapsed_ns(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000000000L + (to->tv_nsec - from->tv_nsec);
+}
+
+static long long bytes_written(void) {
+    if (io_fd < 0) {
+        return -1;
+    }
+    char buf[512];
+    ssize_t n = pread(io_fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    const char *wchar = strstr(buf, "wchar:");
+    return wchar ? strtoll(wchar + 6, NULL, 10) : -1;
+}
+
+static void flush_frame(void) {
+    doupdate();
+    clock_gettime(CLOCK_MONOTONIC, &last_frame);
+    pending = false;
+    total_frames++;
+    if (in_command) {
+        current.frames++;
+    }
+}
+
+void render_init(void) {
+    const char *env = getenv(RENDER_FPS_ENV);
+    if (env && *env) {
+        fps = atoi(env);
+        if (fps < 0) fps = 0;
+        if (fps > RENDER_MAX_FPS) fps = RENDER_MAX_FPS;
+    }
+    frame_ns = fps > 0 ? 1000000000L / fps : 0;
+
+#ifdef __linux__
+    io_fd = open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+#endif
+    start_bytes = bytes_written();
+
+    last_frame.tv_sec = 0;
+    last_frame.tv_nsec = 0;
+    ui_thread = pthread_self();
+    active = true;
+}
+
+void render_shutdown(void) {
+    if (active) {
+        render_flush();
+    }
+    if (io_fd >= 0) {
+        close(io_fd);
+        io_fd = -1;
+    }
+    active = false;
+}
+
+void render_mark(WINDOW *win) {
+    if (!win) {
+        return;  // No screen (batch mode)
+    }
+    if (active && !pthread_equal(pthread_self(), ui_thread)) {
+        return;  // Worker thread - its output reaches the screen through the UI
+    }
+    if (!active) {
+        wrefresh(win);
+        return;
+    }
+
+    wnoutrefresh(win);
+    pending = true;
+    total_marks++;
+    if (in_command) {
+        current.marks++;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (elapsed_ns(&last_frame, &now) >= frame_ns) {
+        flush_frame();
+    } else {
+        // Leave a line touched so a wgetch() on this window flushes the
+        // frame before it blocks
+        touchline(win, 0, 1);
+    }
+}
+
+void render_flush(void) {
+    if (active && pending && pthread_equal(pthread_self(), ui_thread)) {
+        flush_frame();
+    }
+}
+
+void render_command_begin(const char *cmd) {
+    if (!active) {
+        return;
+    }
+    memset(&current, 0, sizeof(current));
+    snprintf(current.command, sizeof(current.command), "%s", cmd);
+    current_start_bytes = bytes_written();
+    clock_gettime(CLOCK_MONOTONIC, &current_start);
+    in_command = true;
+}
+
+void render_command_end(void) {
+    if (!active || !in_command) {
+        return;
+    }
+    render_flush();
+    in_command = false;
+
+    long long now_bytes = bytes_written();
+    current.bytes = (now_bytes >= 0 && current_start_bytes >= 0) ? now_bytes - current_start_bytes : -1;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    current.seconds = elapsed_ns(&current_start, &now) / 1e9;
+
+    stats[stats_next] = current;
+    stats_next = (stats_next + 1) % RENDER_STATS_HISTORY;
+    if (stats_used < RENDER_STATS_HISTORY) {
+        stats_used++;
+    }
+}
+
+int render_stats_count(void) {
+    return stats_used;
+}
+
+const RenderCommandStats *render_stats_at(int index) {
+    if (index < 0 || index >= stats_used) {
+        return NULL;
+    }
+    int slot = (stats_next - 1 - index + RENDER_STATS_HISTORY) % RENDER_STATS_HISTORY;
+    return &stats[slot];
+}
+
+int render_fps(void) {
+    return fps;
+}
+
+long long render_total_bytes(void) {
+    long long now_bytes = bytes_written();
+    return (now_bytes >= 0 && start_bytes >= 0) ? now_bytes - start_bytes : -1;
+}
+
+unsigned long render_total_frames(void) {
+    return total_frames;
+}
+
+unsigned long render_total_marks(void) {
+    return total_marks;
+}
@@ -0,0 +1,54 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+// Render scheduler for MINUX
+// Windows are marked dirty with wnoutrefresh() and the terminal is brought
+// up to date with one doupdate() per frame, capped at a configurable rate,
+// so bursts of output reach the terminal as a few large writes instead of
+// one write per printw. Per-command statistics back the 'stats' command;
+// their byte counts are everything the process wrote (terminal output
+// included), as curses can't count its own.
+
+#include <ncurses.h>
+
+// Render settings
+#define RENDER_FPS_ENV "MINUX_FPS"      // Frame cap override (0 = flush on every mark)
+#define RENDER_DEFAULT_FPS 30
+#define RENDER_MAX_FPS 1000
+#define RENDER_STATS_HISTORY 16         // Commands kept for 'stats'
+
+// Output statistics for one command
+typedef struct {
+    char command[64];
+    long long bytes;            // Bytes the process wrote, anywhere, while the command ran (-1 if unknown)
+    unsigned long marks;        // Refresh requests made by the command
+    unsigned long frames;       // Terminal updates they were coalesced into
+    double seconds;
+} RenderCommandStats;
+
+// Scheduler lifecycle - call after the screen is initialized
+void render_init(void);
+void render_shutdown(void);
+
+// Queue a window for the next frame; the terminal is updated right away if
+// the previous frame is older than the frame interval. Ignored on worker
+// threads.
+void render_mark(WINDOW *win);
+
+// Push any queued updates to the terminal now (before sleeping, blocking
+// on input or handing the terminal to another program)
+void render_flush(void);
+
+// Per-command accounting
+void render_command_begin(const char *cmd);
+void render_command_end(void);
+
+// Statistics - index 0 is the most recent command
+int render_stats_count(void);
+const RenderCommandStats *render_stats_at(int index);
+int render_fps(void);
+long long render_total_bytes(void);
+unsigned long render_total_frames(void);
+unsigned long render_total_marks(void);
+
+#endif // RENDER_H
@@ -0,0 +1,310 @@
+#include "scrollback.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+// A sealed run of lines, each terminated by '\n'
+typedef struct {
+    long first_line;
+    long line_count;
+    size_t raw_len;
+    bool compressed;        // False if deflate failed and the text is stored as-is
+    std::vector<unsigned char> data;
+} Chunk;
+
+// Decompressed copy of a sealed chunk
+typedef struct {
+    long first_line;
+    bool valid;
+    std::string text;
+    std::vector<uint32_t> starts;
+} ChunkCache;
+
+static bool enabled = false;
+static size_t memory_limit = SCROLLBACK_DEFAULT_MEMORY;
+
+static std::deque<Chunk> chunks;
+static size_t sealed_bytes = 0;
+
+// Chunk still being filled
+static std::string open_text;
+static std::vector<uint32_t> open_starts;
+static long open_first = 0;
+
+// Line still being written and a '\r' that may be the start of "\r\n"
+static std::string partial;
+static bool pending_cr = false;
+
+// Two slots so a viewport straddling a chunk boundary doesn't thrash
+static ChunkCache cache[2];
+static int cache_next = 0;
+
+static void index_lines(const std::string &text, std::vector<uint32_t> &starts) {
+    starts.clear();
+    size_t pos = 0;
+    while (pos < text.size()) {
+        starts.push_back((uint32_t)pos);
+        const char *nl = (const char *)memchr(text.data() + pos, '\n', text.size() - pos);
+        pos = nl ? (size_t)(nl - text.data()) + 1 : text.size();
+    }
+}
+
+static void drop_oldest(void) {
+    long first = chunks.front().first_line;
+    for (int i = 0; i < 2; i++) {
+        if (cache[i].valid && cache[i].first_line == first) {
+            cache[i].valid = false;
+        }
+    }
+    sealed_bytes -= chunks.front().data.size();
+    chunks.pop_front();
+}
+
+static void seal_chunk(void) {
+    if (open_starts.empty()) {
+        return;
+    }
+
+    Chunk chunk;
+    chunk.first_line = open_first;
+    chunk.line_count = (long)open_starts.size();
+    chunk.raw_len = open_text.size();
+
+    uLongf packed_len = compressBound(open_text.size());
+    chunk.data.resize(packed_len);
+    chunk.compressed = compress2(&chunk.data[0], &packed_len, (const Bytef *)open_text.data(),
+                                 open_text.size(), Z_BEST_SPEED) == Z_OK;
+    if (chunk.compressed) {
+        chunk.data.resize(packed_len);
+    } else {
+        chunk.data.assign(open_text.begin(), open_text.end());
+    }
+    std::vector<unsigned char>(chunk.data).swap(chunk.data);  // Release the slack
+
+    sealed_bytes += chunk.data.size();
+    chunks.push_back(chunk);
+
+    open_first += chunk.line_count;
+    open_text.clear();
+    open_starts.clear();
+
+    while (!chunks.empty() && sealed_bytes + SCROLLBACK_CHUNK_BYTES > memory_limit) {
+        drop_oldest();
+    }
+}
+
+static void finish_line(void) {
+    open_starts.push_back((uint32_t)open_text.size());
+    open_text += partial;
+    open_text += '\n';
+    partial.clear();
+    if (open_text.size() >= SCROLLBACK_CHUNK_BYTES) {
+        seal_chunk();
+    }
+}
+
+static const ChunkCache *load_chunk(const Chunk &chunk) {
+    for (int i = 0; i < 2; i++) {
+        if (cache[i].valid && cache[i].first_line == chunk.first_line) {
+            return &cache[i];
+        }
+    }
+
+    ChunkCache *slot = &cache[cache_next];
+    cache_next ^= 1;
+    slot->valid = false;
+    slot->first_line = chunk.first_line;
+    slot->text.resize(chunk.raw_len);
+
+    if (chunk.compressed) {
+        uLongf raw_len = chunk.raw_len;
+        if (uncompress((Bytef *)&slot->text[0], &raw_len, &chunk.data[0], chunk.data.size()) != Z_OK ||
+            raw_len != chunk.raw_len) {
+            return NULL;
+        }
+    } else {
+        memcpy(&slot->text[0], &chunk.data[0], chunk.raw_len);
+    }
+
+    index_lines(slot->text, slot->starts);
+    slot->valid = true;
+    return slot;
+}
+
+// Case-insensitive substring test; the query is already lowercase
+static bool line_contains(const char *text, size_t len, const std::string &query) {
+    if (query.size() > len) {
+        return false;
+    }
+    for (size_t i = 0; i + query.size() <= len; i++) {
+        size_t j = 0;
+        while (j < query.size() && tolower((unsigned char)text[i + j]) == query[j]) {
+            j++;
+        }
+        if (j == query.size()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void scrollback_init(size_t limit) {
+    scrollback_shutdown();
+    memory_limit = limit < SCROLLBACK_MIN_MEMORY ? SCROLLBACK_MIN_MEMORY : limit;
+    enabled = true;
+}
+
+void scrollback_shutdown(void) {
+    chunks.clear();
+    sealed_bytes = 0;
+    open_text.clear();
+    open_starts.clear();
+    open_first = 0;
+    partial.clear();
+    pending_cr = false;
+    for (int i = 0; i < 2; i++) {
+        cache[i].valid = false;
+        std::string().swap(cache[i].text);
+        std::vector<uint32_t>().swap(cache[i].starts);
+    }
+    enabled = false;
+}
+
+size_t scrollback_memory_limit_from_env(void) {
+    const char *value = getenv(SCROLLBACK_MEMORY_ENV);
+    if (!value || !*value) {
+        return SCROLLBACK_DEFAULT_MEMORY;
+    }
+
+    char *suffix;
+    unsigned long long bytes = strtoull(value, &suffix, 10);
+    if (*suffix == 'k' || *suffix == 'K') bytes *= 1024;
+    else if (*suffix == 'm' || *suffix == 'M') bytes *= 1024 * 1024;
+    else if (*suffix == 'g' || *suffix == 'G') bytes *= 1024ULL * 1024 * 1024;
+
+    if (bytes == 0 || bytes > SIZE_MAX) {
+        return SCROLLBACK_DEFAULT_MEMORY;
+    }
+    return (size_t)bytes;
+}
+
+void scrollback_append(const char *text, size_t len) {
+    if (!enabled) {
+        return;
+    }
+
+    size_t i = 0;
+    while (i < len) {
+        unsigned char c = text[i];
+
+        if (pending_cr) {
+            pending_cr = false;
+            if (c != '\n') {
+                partial.clear();  // Bare '\r' - the line is being redrawn
+            }
+        }
+
+        if (c >= 0x20 || c == '\t') {
+            // Copy the whole run of ordinary characters at once
+            size_t run = i + 1;
+            while (run < len && ((unsigned char)text[run] >= 0x20 || text[run] == '\t')) {
+                run++;
+            }
+            size_t room = SCROLLBACK_MAX_LINE - partial.size();
+            size_t n = run - i < room ? run - i : room;
+            partial.append(text + i, n);
+            i += n;
+            if (partial.size() >= SCROLLBACK_MAX_LINE) {
+                finish_line();
+            }
+            continue;
+        }
+
+        if (c == '\n') {
+            finish_line();
+        } else if (c == '\r') {
+            pending_cr = true;
+        } else if (c == '\b' && !partial.empty()) {
+            partial.erase(partial.size() - 1);
+        }
+        i++;
+    }
+}
+
+long scrollback_first(void) {
+    return chunks.empty() ? open_first : chunks.front().first_line;
+}
+
+long scrollback_end(void) {
+    return open_first + (long)open_starts.size() + (partial.empty() ? 0 : 1);
+}
+
+const char *scrollback_line(long id, size_t *len) {
+    *len = 0;
+    if (id < scrollback_first() || id >= scrollback_end()) {
+        return NULL;
+    }
+
+    if (id >= open_first) {
+        size_t index = id - open_first;
+        if (index == open_starts.size()) {
+            *len = partial.size();
+            return partial.data();
+        }
+        size_t start = open_starts[index];
+        size_t next = index + 1 < open_starts.size() ? open_starts[index + 1] : open_text.size();
+        *len = next - start - 1;
+        return open_text.data() + start;
+    }
+
+    // Sealed chunks are in line order - find the last one starting at or before id
+    size_t lo = 0, hi = chunks.size();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (chunks[mid].first_line <= id) lo = mid;
+        else hi = mid;
+    }
+
+    const ChunkCache *chunk = load_chunk(chunks[lo]);
+    if (!chunk) {
+        return NULL;
+    }
+    size_t index = id - chunk->first_line;
+    size_t start = chunk->starts[index];
+    size_t next = index + 1 < chunk->starts.size() ? chunk->starts[index + 1] : chunk->text.size();
+    *len = next - start - 1;
+    return chunk->text.data() + start;
+}
+
+size_t scrollback_partial_length(void) {
+    return partial.size();
+}
+
+long scrollback_search(const char *query, long from, int direction) {
+    std::string lower;
+    for (const char *p = query; *p; p++) {
+        lower += (char)tolower((unsigned char)*p);
+    }
+    if (lower.empty()) {
+        return -1;
+    }
+
+    int step = direction < 0 ? -1 : 1;
+    for (long id = from; id >= scrollback_first() && id < scrollback_end(); id += step) {
+        size_t len;
+        const char *text = scrollback_line(id, &len);
+        if (text && line_contains(text, len, lower)) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+size_t scrollback_memory_used(void) {
+    return sealed_bytes + open_text.size() + partial.size();
+}
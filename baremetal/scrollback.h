@@ -0,0 +1,46 @@
+#ifndef SCROLLBACK_H
+#define SCROLLBACK_H
+
+// Scrollback buffer for MINUX
+// Keeps command output as lines in fixed-size chunks. Full chunks are
+// deflate-compressed and the oldest are dropped once the total passes the
+// memory bound. Lines are read back one chunk at a time, so showing a
+// screenful only decompresses the chunks that hold the visible lines.
+
+#include <stddef.h>
+
+// Scrollback settings
+#define SCROLLBACK_MEMORY_ENV "MINUX_SCROLLBACK_BYTES"    // Overrides the memory bound (K/M suffixes allowed)
+#define SCROLLBACK_DEFAULT_MEMORY (4 * 1024 * 1024)
+#define SCROLLBACK_MIN_MEMORY (256 * 1024)
+#define SCROLLBACK_CHUNK_BYTES (64 * 1024)                // Raw text per chunk before compression
+#define SCROLLBACK_MAX_LINE 4096                          // Longer lines are split
+
+// Buffer lifecycle - nothing is recorded until scrollback_init()
+void scrollback_init(size_t memory_limit);
+void scrollback_shutdown(void);
+size_t scrollback_memory_limit_from_env(void);
+
+// Record output text. '\r' returns to the start of the line and '\b'
+// deletes the previous character, so progress bars keep their last state.
+void scrollback_append(const char *text, size_t len);
+
+// Lines are addressed by increasing ids in [first, end). The unfinished
+// last line is included while it is not empty. Text is not NUL-terminated
+// and stays valid until the next scrollback call.
+long scrollback_first(void);
+long scrollback_end(void);
+const char *scrollback_line(long id, size_t *len);
+
+// Length of the unfinished last line
+size_t scrollback_partial_length(void);
+
+// Case-insensitive search starting at 'from' and moving towards older
+// lines (direction < 0) or newer ones (direction > 0). Returns the id of
+// the first matching line, or -1.
+long scrollback_search(const char *query, long from, int direction);
+
+// Compressed + uncompressed bytes currently held
+size_t scrollback_memory_used(void);
+
+#endif // SCROLLBACK_H
@@ -0,0 +1,309 @@
+#include "text_search.h"
+#include <stdio.h>
+#include <string.h>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+static unsigned char fold(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// OR-ing 0x20 turns an upper case letter into its lower case, and no other
+// byte into a lower case letter, so one compare covers both cases
+static unsigned char fold_mask(unsigned char c, bool icase) {
+    return (icase && c >= 'a' && c <= 'z') ? 0x20 : 0;
+}
+
+static bool equal_at(const char *text, const char *needle, size_t len, bool icase) {
+    if (!icase) {
+        return memcmp(text, needle, len) == 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (fold((unsigned char)text[i]) != (unsigned char)needle[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+long text_find(const char *text, size_t len, const char *needle, size_t needle_len, bool icase) {
+    if (needle_len == 0) {
+        return 0;
+    }
+    if (needle_len > len) {
+        return -1;
+    }
+
+    // Candidates are where both the first and the last byte of the needle
+    // line up; only those are compared in full
+    const size_t end = len - needle_len + 1;  // One past the last possible start
+    const unsigned char first = (unsigned char)needle[0];
+    const unsigned char last = (unsigned char)needle[needle_len - 1];
+    const unsigned char first_mask = fold_mask(first, icase);
+    const unsigned char last_mask = fold_mask(last, icase);
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    {
+        const __m256i want_first = _mm256_set1_epi8((char)first);
+        const __m256i want_last = _mm256_set1_epi8((char)last);
+        const __m256i or_first = _mm256_set1_epi8((char)first_mask);
+        const __m256i or_last = _mm256_set1_epi8((char)last_mask);
+        for (; i + 32 <= end; i += 32) {
+            __m256i a = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(text + i)), or_first);
+            __m256i b = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(text + i + needle_len - 1)), or_last);
+            unsigned mask = (unsigned)_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(a, want_first), _mm256_cmpeq_epi8(b, want_last)));
+            while (mask) {
+                size_t at = i + __builtin_ctz(mask);
+                if (equal_at(text + at, needle, needle_len, icase)) {
+                    return (long)at;
+                }
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128i want_first = _mm_set1_epi8((char)first);
+        const __m128i want_last = _mm_set1_epi8((char)last);
+        const __m128i or_first = _mm_set1_epi8((char)first_mask);
+        const __m128i or_last = _mm_set1_epi8((char)last_mask);
+        for (; i + 16 <= end; i += 16) {
+            __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i *)(text + i)), or_first);
+            __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i *)(text + i + needle_len - 1)), or_last);
+            unsigned mask = (unsigned)_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(a, want_first), _mm_cmpeq_epi8(b, want_last)));
+            while (mask) {
+                size_t at = i + __builtin_ctz(mask);
+                if (equal_at(text + at, needle, needle_len, icase)) {
+                    return (long)at;
+                }
+                mask &= mask - 1;
+            }
+        }
+    }
+#elif defined(__ARM_NEON)
+    {
+        const uint8x16_t want_first = vdupq_n_u8(first);
+        const uint8x16_t want_last = vdupq_n_u8(last);
+        const uint8x16_t or_first = vdupq_n_u8(first_mask);
+        const uint8x16_t or_last = vdupq_n_u8(last_mask);
+        for (; i + 16 <= end; i += 16) {
+            uint8x16_t a = vorrq_u8(vld1q_u8((const uint8_t *)(text + i)), or_first);
+            uint8x16_t b = vorrq_u8(vld1q_u8((const uint8_t *)(text + i + needle_len - 1)), or_last);
+            uint8x16_t hits = vandq_u8(vceqq_u8(a, want_first), vceqq_u8(b, want_last));
+
+            // No movemask on NEON - narrow to 4 bits per byte instead
+            uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(hits), 4);
+            uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+            while (mask) {
+                size_t at = i + (__builtin_ctzll(mask) >> 2);
+                if (equal_at(text + at, needle, needle_len, icase)) {
+                    return (long)at;
+                }
+                mask &= ~(0xFULL << ((at - i) * 4));
+            }
+        }
+    }
+#endif
+
+    // The rest, or all of it without vector support
+    if (!icase) {
+        while (i < end) {
+            const char *hit = (const char *)memchr(text + i, first, end - i);
+            if (!hit) {
+                return -1;
+            }
+            i = hit - text;
+            if (equal_at(text + i, needle, needle_len, false)) {
+                return (long)i;
+            }
+            i++;
+        }
+        return -1;
+    }
+    for (; i < end; i++) {
+        if (((unsigned char)text[i] | first_mask) == first &&
+            ((unsigned char)text[i + needle_len - 1] | last_mask) == last &&
+            equal_at(text + i, needle, needle_len, true)) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+bool text_is_binary(const char *text, size_t len) {
+    return memchr(text, '\0', len < TEXT_BINARY_PROBE ? len : TEXT_BINARY_PROBE) != NULL;
+}
+
+static bool has_regex_syntax(const char *text) {
+    return strpbrk(text, ".[]()*+?{}|^$\\") != NULL;
+}
+
+// "*.c" -> "^.*\.c$"
+static std::string glob_to_regex(const char *glob) {
+    std::string regex = "^";
+    for (const char *p = glob; *p; p++) {
+        if (*p == '*') {
+            regex += ".*";
+        } else if (*p == '?') {
+            regex += '.';
+        } else if (*p == '[') {
+            // Bracket expressions mean the same in both, apart from '!'. As
+            // with fnmatch(), a ']' first in the set is part of it, and a
+            // '[' that is never closed is literal.
+            const char *set = p + 1;
+            if (*set == '!') {
+                set++;
+            }
+            const char *close = *set ? strchr(set + 1, ']') : NULL;
+            if (!close) {
+                regex += "\\[";
+                continue;
+            }
+            regex += p[1] == '!' ? "[^" : "[";
+            regex.append(set, close - set);
+            regex += ']';
+            p = close;
+        } else {
+            if (strchr(".[]()*+?{}|^$\\", *p)) {
+                regex += '\\';
+            }
+            regex += *p;
+        }
+    }
+    return regex + "$";
+}
+
+int text_pattern_compile(TextPattern *pattern, const char *text, int flags, char *err, size_t err_len) {
+    if (text[0] == '\0') {
+        snprintf(err, err_len, "empty pattern");
+        return -1;
+    }
+
+    std::string glob;
+    if (flags & TEXT_GLOB) {
+        glob = glob_to_regex(text);
+        text = glob.c_str();
+        flags |= TEXT_REGEX;
+    }
+
+    pattern->flags = flags;
+    pattern->literal = (flags & TEXT_FIXED) || (!(flags & TEXT_REGEX) && !has_regex_syntax(text));
+    pattern->needle = text;
+    if (!pattern->literal) {
+        int cflags = REG_EXTENDED | ((flags & TEXT_ICASE) ? REG_ICASE : 0);
+        int rc = regcomp(&pattern->regex, text, cflags);
+        if (rc == 0) {
+            return 0;
+        }
+        if (flags & TEXT_REGEX) {
+            regerror(rc, &pattern->regex, err, err_len);
+            return -1;
+        }
+        pattern->literal = true;  // "f(x" was meant as it is
+    }
+
+    if (flags & TEXT_ICASE) {
+        for (size_t i = 0; i < pattern->needle.size(); i++) {
+            pattern->needle[i] = (char)fold((unsigned char)pattern->needle[i]);
+        }
+    }
+    return 0;
+}
+
+void text_pattern_free(TextPattern *pattern) {
+    if (!pattern->literal) {
+        regfree(&pattern->regex);
+    }
+}
+
+bool text_pattern_match(const TextPattern *pattern, const char *text, size_t len,
+                        size_t *match_start, size_t *match_len) {
+    if (pattern->literal) {
+        long at = text_find(text, len, pattern->needle.data(), pattern->needle.size(),
+                            (pattern->flags & TEXT_ICASE) != 0);
+        if (at < 0) {
+            return false;
+        }
+        *match_start = (size_t)at;
+        *match_len = pattern->needle.size();
+        return true;
+    }
+
+    // regexec() wants a C string
+    std::string line(text, len);
+    regmatch_t match;
+    if (regexec(&pattern->regex, line.c_str(), 1, &match, 0) != 0) {
+        return false;
+    }
+    *match_start = (size_t)match.rm_so;
+    *match_len = (size_t)(match.rm_eo - match.rm_so);
+    return true;
+}
+
+static long count_lines(const char *text, size_t len) {
+    long count = 0;
+    const char *end = text + len;
+    while ((text = (const char *)memchr(text, '\n', end - text)) != NULL) {
+        count++;
+        text++;
+    }
+    return count;
+}
+
+long text_pattern_scan(const TextPattern *pattern, const char *text, size_t len,
+                       TextLineVisitor visit, void *ctx) {
+    long visited = 0;
+    long line_no = 1;
+    size_t counted = 0;  // Newlines before this offset are in line_no
+    size_t pos = 0;      // Always the start of a line
+
+    while (pos < len) {
+        size_t line_start, line_end, match_start, match_len;
+        if (pattern->literal) {
+            // Search the rest of the text at once, then find the line around the hit
+            long hit = text_find(text + pos, len - pos, pattern->needle.data(), pattern->needle.size(),
+                                 (pattern->flags & TEXT_ICASE) != 0);
+            if (hit < 0) {
+                break;
+            }
+            size_t at = pos + (size_t)hit;
+            line_start = at;
+            while (line_start > pos && text[line_start - 1] != '\n') {
+                line_start--;
+            }
+            const char *newline = (const char *)memchr(text + at, '\n', len - at);
+            line_end = newline ? (size_t)(newline - text) : len;
+            if (line_end < at + pattern->needle.size()) {
+                // The needle spans a newline; carry on from the next line
+                pos = line_end + 1;
+                continue;
+            }
+            match_start = at - line_start;
+            match_len = pattern->needle.size();
+        } else {
+            line_start = pos;
+            const char *newline = (const char *)memchr(text + pos, '\n', len - pos);
+            line_end = newline ? (size_t)(newline - text) : len;
+            if (!text_pattern_match(pattern, text + line_start, line_end - line_start, &match_start, &match_len)) {
+                pos = line_end + 1;
+                continue;
+            }
+        }
+
+        line_no += count_lines(text + counted, line_start - counted);
+        counted = line_start;
+        visited++;
+        if (visit(line_no, text + line_start, line_end - line_start, match_start, match_len, ctx)) {
+            break;
+        }
+        pos = line_end + 1;
+    }
+    return visited;
+}
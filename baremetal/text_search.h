@@ -0,0 +1,54 @@
+#ifndef TEXT_SEARCH_H
+#define TEXT_SEARCH_H
+
+// Text search for MINUX
+// Finds a pattern line by line in a buffer that need not be NUL-terminated
+// (a mapped file, say). Plain strings are found with a vector scan for the
+// first and last byte of the needle (SSE2/AVX2 on x86, NEON on ARM, memchr
+// elsewhere), so most of the text is never compared byte by byte. Patterns
+// with regex syntax fall back to POSIX extended regexes, one line at a time.
+
+#include <stddef.h>
+#include <regex.h>
+#include <string>
+
+// Text search settings
+#define TEXT_BINARY_PROBE 8192          // Bytes checked for a NUL to call a file binary
+
+// Flags for text_pattern_compile()
+#define TEXT_ICASE 0x1                  // Ignore case (ASCII letters for plain strings)
+#define TEXT_FIXED 0x2                  // Always a plain string
+#define TEXT_REGEX 0x4                  // Always a regex
+#define TEXT_GLOB 0x8                   // Shell wildcards (*, ?, [...]) matched against the whole text
+
+typedef struct {
+    int flags;
+    bool literal;
+    std::string needle;                 // Lowercased for TEXT_ICASE
+    regex_t regex;
+} TextPattern;
+
+// Called for every line with a match: its number (from 1), text without
+// the newline, and where the first match is. Return nonzero to stop.
+typedef int (*TextLineVisitor)(long line_no, const char *line, size_t line_len,
+                               size_t match_start, size_t match_len, void *ctx);
+
+// Returns 0, or -1 with a message in err for a bad regex or empty pattern
+int text_pattern_compile(TextPattern *pattern, const char *text, int flags, char *err, size_t err_len);
+void text_pattern_free(TextPattern *pattern);
+
+// Visit each matching line of text. Returns the number of lines visited.
+long text_pattern_scan(const TextPattern *pattern, const char *text, size_t len,
+                       TextLineVisitor visit, void *ctx);
+
+// First match in one line, or false. Used for names as well as lines.
+bool text_pattern_match(const TextPattern *pattern, const char *text, size_t len,
+                        size_t *match_start, size_t *match_len);
+
+// Offset of needle in text, or -1. With icase, needle must be lowercase.
+long text_find(const char *text, size_t len, const char *needle, size_t needle_len, bool icase);
+
+// A NUL in the first TEXT_BINARY_PROBE bytes
+bool text_is_binary(const char *text, size_t len);
+
+#endif // TEXT_SEARCH_H
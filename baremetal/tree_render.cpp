@@ -0,0 +1,274 @@
+#include "tree_render.h"
+#include "output.h"
+#include "render.h"
+#include "worker.h"
+#include <ncurses.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *type_name(const FsEntry *entry) {
+    switch (entry->type) {
+        case DT_DIR: return "directory";
+        case DT_REG: return "file";
+        case DT_LNK: return "link";
+        case DT_FIFO: return "fifo";
+        case DT_SOCK: return "socket";
+        case DT_CHR: return "char";
+        case DT_BLK: return "block";
+        default: return "unknown";
+    }
+}
+
+// Append text as a JSON string literal. Bytes >= 0x80 are passed through,
+// so names that are valid UTF-8 stay readable.
+static void json_string(std::string *out, const char *text) {
+    out->push_back('"');
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            out->push_back('\\');
+            out->push_back((char)*p);
+        } else if (*p < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", *p);
+            out->append(esc);
+        } else {
+            out->push_back((char)*p);
+        }
+    }
+    out->push_back('"');
+}
+
+static bool has_contents(const TreeRender *tree, int depth) {
+    return tree->max_depth <= 0 || depth < tree->max_depth;
+}
+
+void tree_render_init(TreeRender *tree, TreeFormat format, int max_depth) {
+    tree->format = format;
+    tree->max_depth = max_depth;
+    tree->dir_count = 0;
+    tree->file_count = 0;
+    tree->seen = 0;
+    tree->y = -1;
+    tree->top = 0;
+    tree->prefix.clear();
+    tree->first.clear();
+    tree->scratch.clear();
+}
+
+void tree_render_header(TreeRender *tree, const char *root) {
+    std::string &out = tree->scratch;
+    out.clear();
+    switch (tree->format) {
+        case TREE_TEXT:
+            out_attron(COLOR_PAIR(1) | A_BOLD);
+            out_printw("%s\n", root);
+            out_attroff(COLOR_PAIR(1) | A_BOLD);
+            out_printw(".\n");
+            return;
+        case TREE_JSON:
+            out = "[{\"type\":\"directory\",\"name\":";
+            json_string(&out, root);
+            out += ",\"contents\":[\n";
+            tree->first = "1";
+            break;
+        case TREE_NDJSON:
+            out = "{\"path\":";
+            json_string(&out, root);
+            out += ",\"type\":\"directory\",\"depth\":0}\n";
+            break;
+    }
+    out_printw("%s", out.c_str());
+}
+
+void tree_render_footer(TreeRender *tree) {
+    switch (tree->format) {
+        case TREE_TEXT:
+            out_printw("\n%d directories, %d files\n", tree->dir_count, tree->file_count);
+            break;
+        case TREE_JSON:
+            out_printw("\n]},\n{\"type\":\"report\",\"directories\":%d,\"files\":%d}]\n",
+                       tree->dir_count, tree->file_count);
+            break;
+        case TREE_NDJSON:
+            out_printw("{\"type\":\"report\",\"directories\":%d,\"files\":%d}\n",
+                       tree->dir_count, tree->file_count);
+            break;
+    }
+}
+
+void tree_render_page(TreeRender *tree, int top) {
+    tree->format = TREE_TEXT;
+    tree->top = top;
+    tree->y = top;
+}
+
+// Bottom of a page: wait for the user, then start a fresh page. Returns
+// false to end the walk.
+static bool next_page(TreeRender *tree) {
+    attron(A_REVERSE);
+    mvprintw(LINES - 1, 0, "-- More -- %d directories, %d files so far (Space: next page, q: quit)",
+             tree->dir_count, tree->file_count);
+    attroff(A_REVERSE);
+    clrtoeol();
+    render_mark(stdscr);
+
+    int ch = getch();
+    clear();
+    tree->y = tree->top;
+    return ch != 'q' && ch != 'Q' && ch != 27;
+}
+
+int tree_render_page_end(TreeRender *tree, int rows) {
+    if (tree->y + rows > LINES) {
+        next_page(tree);
+    }
+    return tree->y;
+}
+
+static int visit_text(TreeRender *tree, const WalkItem *item) {
+    if (item->event != WALK_ENTRY) {
+        return WALK_CONTINUE;  // Unreadable directories are shown without children
+    }
+    if (tree->y >= 0 && tree->y >= LINES - 1 && !next_page(tree)) {
+        return WALK_STOP;
+    }
+
+    tree->prefix.resize(4 * (item->depth - 1));
+    const char *connector = item->is_last ? "`-- " : "|-- ";
+    const FsEntry *entry = item->entry;
+    bool is_directory = fs_entry_is_dir(entry);
+
+    int attrs = 0;
+    if (is_directory) {
+        attrs = COLOR_PAIR(1) | A_BOLD;
+    } else if (entry->type == DT_LNK) {
+        attrs = COLOR_PAIR(3) | A_BOLD;
+    } else if (entry->has_stat && (entry->st.st_mode & S_IXUSR)) {
+        attrs = COLOR_PAIR(2) | A_BOLD;
+    }
+
+    if (tree->y >= 0) {
+        mvprintw(tree->y, 1, "%s%s", tree->prefix.c_str(), connector);
+        attron(attrs);
+        printw("%s", item->name);
+        attroff(attrs);
+        tree->y++;
+    } else {
+        out_printw("%s%s", tree->prefix.c_str(), connector);
+        out_attron(attrs);
+        out_printw("%s\n", item->name);
+        out_attroff(attrs);
+    }
+
+    if (is_directory) {
+        tree->prefix += item->is_last ? "    " : "|   ";
+    }
+    return WALK_CONTINUE;
+}
+
+// Nested document - a directory opens its contents array on WALK_ENTRY and
+// closes it on WALK_LEAVE, unless the depth limit means it has none
+static int visit_json(TreeRender *tree, const WalkItem *item) {
+    std::string &out = tree->scratch;
+    out.clear();
+
+    if (item->event == WALK_LEAVE) {
+        tree->first.resize(tree->first.size() - 1);
+        out_printw("]}");
+        return WALK_CONTINUE;
+    }
+
+    // One element of the innermost open array
+    if (tree->first[tree->first.size() - 1] == '1') {
+        tree->first[tree->first.size() - 1] = '0';
+    } else {
+        out += ",\n";
+    }
+
+    if (item->event == WALK_ERROR) {
+        out += "{\"type\":\"error\",\"error\":";
+        json_string(&out, strerror(item->error));
+        out += "}";
+        out_printw("%s", out.c_str());
+        return WALK_CONTINUE;
+    }
+
+    const FsEntry *entry = item->entry;
+    out += "{\"type\":\"";
+    out += type_name(entry);
+    out += "\",\"name\":";
+    json_string(&out, item->name);
+    if (entry->has_stat && !fs_entry_is_dir(entry)) {
+        char size[32];
+        snprintf(size, sizeof(size), ",\"size\":%lld", (long long)entry->st.st_size);
+        out += size;
+    }
+    if (fs_entry_is_dir(entry) && has_contents(tree, item->depth)) {
+        out += ",\"contents\":[";
+        tree->first += '1';
+    } else {
+        out += "}";
+    }
+    out_printw("%s", out.c_str());
+    return WALK_CONTINUE;
+}
+
+static int visit_ndjson(TreeRender *tree, const WalkItem *item) {
+    if (item->event == WALK_LEAVE) {
+        return WALK_CONTINUE;
+    }
+
+    std::string &out = tree->scratch;
+    out = "{\"path\":";
+    json_string(&out, item->path);
+    char fields[96];
+    if (item->event == WALK_ERROR) {
+        out += ",\"type\":\"error\",\"error\":";
+        json_string(&out, strerror(item->error));
+        snprintf(fields, sizeof(fields), ",\"depth\":%d}\n", item->depth);
+    } else {
+        const FsEntry *entry = item->entry;
+        out += ",\"type\":\"";
+        out += type_name(entry);
+        out += "\"";
+        if (entry->has_stat && !fs_entry_is_dir(entry)) {
+            snprintf(fields, sizeof(fields), ",\"depth\":%d,\"size\":%lld}\n",
+                     item->depth, (long long)entry->st.st_size);
+        } else {
+            snprintf(fields, sizeof(fields), ",\"depth\":%d}\n", item->depth);
+        }
+    }
+    out += fields;
+    out_printw("%s", out.c_str());
+    return WALK_CONTINUE;
+}
+
+int tree_render_visit(const WalkItem *item, void *ctx) {
+    TreeRender *tree = (TreeRender *)ctx;
+
+    int result;
+    switch (tree->format) {
+        case TREE_JSON: result = visit_json(tree, item); break;
+        case TREE_NDJSON: result = visit_ndjson(tree, item); break;
+        default: result = visit_text(tree, item); break;
+    }
+    if (result != WALK_CONTINUE || item->event != WALK_ENTRY) {
+        return result;
+    }
+
+    if (fs_entry_is_dir(item->entry)) {
+        tree->dir_count++;
+    } else {
+        tree->file_count++;
+    }
+
+    // A running count for the status bar while the output is held back
+    if (++tree->seen % TREE_PROGRESS_EVERY == 0) {
+        char progress[WORKER_PROGRESS_LEN];
+        snprintf(progress, sizeof(progress), "tree: %d directories, %d files scanned",
+                 tree->dir_count, tree->file_count);
+        worker_set_progress(progress);
+    }
+    return result;
+}
@@ -0,0 +1,51 @@
+#ifndef TREE_RENDER_H
+#define TREE_RENDER_H
+
+// Tree renderer for MINUX
+// Turns directory walker events into output as they arrive: the classic
+// indented tree, one nested JSON document, or one JSON object per line.
+// Nothing is kept per entry, so memory stays flat however large the tree.
+// The full-screen view pages instead of cutting the listing off.
+
+#include "walker.h"
+#include <string>
+
+// Renderer settings
+#define TREE_PROGRESS_EVERY 256         // Entries between progress updates on a worker
+
+typedef enum {
+    TREE_TEXT,
+    TREE_JSON,                          // [{"type":"directory","name":...,"contents":[...]},{"type":"report",...}]
+    TREE_NDJSON                         // {"path":...,"type":...,"depth":...} per line, then a report line
+} TreeFormat;
+
+typedef struct {
+    TreeFormat format;
+    int max_depth;                      // Same as the walk's, to know which directories get contents
+    int dir_count;
+    int file_count;
+    unsigned long seen;
+    int y;                              // Next row of the paged view, -1 when printing
+    int top;                            // First row of each page
+    std::string prefix;                 // Text: "|   " or "    " for each level above the entry
+    std::string first;                  // JSON: '1' per open array that has no element yet
+    std::string scratch;
+} TreeRender;
+
+void tree_render_init(TreeRender *tree, TreeFormat format, int max_depth);
+
+// Print through out_printw (works on a worker and in batch mode)
+void tree_render_header(TreeRender *tree, const char *root);
+void tree_render_footer(TreeRender *tree);
+
+// Draw text straight to stdscr from row 'top', waiting for a key at the
+// bottom of each page. UI thread only.
+void tree_render_page(TreeRender *tree, int top);
+// Row where the caller can draw 'rows' lines of summary, turning the page
+// first if they don't fit
+int tree_render_page_end(TreeRender *tree, int rows);
+
+// WalkVisitor - ctx is the TreeRender
+int tree_render_visit(const WalkItem *item, void *ctx);
+
+#endif // TREE_RENDER_H
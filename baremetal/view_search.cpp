@@ -0,0 +1,221 @@
+#include "view_search.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+
+struct ViewSearchIndex {
+    int fd;                             // A duplicate of the caller's, read with pread()
+    uint64_t size;
+    const TextPattern *pattern;
+    long *blocks[VIEW_SEARCH_BLOCKS];   // Matching line k at [k / BLOCK][k % BLOCK]
+    std::atomic<long> count;
+    std::atomic<uint64_t> scanned;
+    std::atomic<bool> done;
+    std::atomic<bool> stop;
+    pthread_t thread;
+};
+
+// Where the searching thread is
+typedef struct {
+    ViewSearchIndex *index;
+    long base;                          // Line the text searched starts on
+    long last;                          // Last line recorded, which a cut line may match again
+} SearchScan;
+
+static long count_newlines(const char *text, size_t len) {
+    long count = 0;
+    const char *end = text + len;
+    while ((text = (const char *)memchr(text, '\n', end - text)) != NULL) {
+        count++;
+        text++;
+    }
+    return count;
+}
+
+// Only the line number is kept; the screen finds the match again
+static int record_match(long line_no, const char *, size_t, size_t, size_t, void *ctx) {
+    SearchScan *scan = (SearchScan *)ctx;
+    ViewSearchIndex *index = scan->index;
+    long line = scan->base + line_no - 1;
+    if (line == scan->last) {
+        return 0;
+    }
+    long k = index->count.load(std::memory_order_relaxed);
+    long block = k / VIEW_SEARCH_BLOCK;
+    if (block >= VIEW_SEARCH_BLOCKS) {
+        return 1;  // Full - what was found is kept
+    }
+    if (!index->blocks[block]) {
+        index->blocks[block] = new long[VIEW_SEARCH_BLOCK];
+    }
+    index->blocks[block][k % VIEW_SEARCH_BLOCK] = line;
+    index->count.store(k + 1, std::memory_order_release);
+    scan->last = line;
+    return index->stop.load(std::memory_order_relaxed) ? 1 : 0;
+}
+
+// Search the file a chunk at a time. A line cut by the end of a chunk is
+// carried over to the next one, unless it fills the chunk by itself; then
+// it is searched in pieces and a match across a cut is missed.
+static void *search_thread(void *arg) {
+    ViewSearchIndex *index = (ViewSearchIndex *)arg;
+    char *buffer = new char[VIEW_SEARCH_CHUNK];
+    SearchScan scan = { index, 0, -1 };
+    uint64_t offset = 0;  // Where buffer starts in the file
+    size_t held = 0;
+
+    while (!index->stop.load(std::memory_order_relaxed) && offset + held < index->size) {
+        uint64_t left = index->size - offset - held;
+        size_t want = VIEW_SEARCH_CHUNK - held;
+        if (want > left) {
+            want = (size_t)left;
+        }
+        ssize_t got = pread(index->fd, buffer + held, want, (off_t)(offset + held));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            break;  // Shorter than it was
+        }
+        held += (size_t)got;
+
+        size_t len = held;
+        if (offset + held < index->size) {
+            const char *newline = (const char *)memrchr(buffer, '\n', held);
+            if (newline) {
+                len = newline - buffer + 1;
+            }
+        }
+        text_pattern_scan(index->pattern, buffer, len, record_match, &scan);
+        scan.base += count_newlines(buffer, len);
+
+        memmove(buffer, buffer + len, held - len);
+        held -= len;
+        offset += len;
+        index->scanned.store(offset, std::memory_order_release);
+    }
+    index->done.store(true, std::memory_order_release);
+
+    delete[] buffer;
+    return NULL;
+}
+
+void view_search_init(ViewSearch *search) {
+    search->flags = 0;
+    search->index = NULL;
+}
+
+int view_search_start(ViewSearch *search, int fd, uint64_t size, const char *text, int flags,
+                      char *err, size_t err_len) {
+    // A bad pattern leaves the search before alone
+    TextPattern check;
+    if (text_pattern_compile(&check, text, flags, err, err_len) != 0) {
+        return -1;
+    }
+    text_pattern_free(&check);
+    std::string wanted = text;  // text may be search->text
+    view_search_stop(search);
+    text_pattern_compile(&search->pattern, wanted.c_str(), flags, err, err_len);
+    search->text = wanted;
+    search->flags = flags;
+
+    ViewSearchIndex *index = new ViewSearchIndex();
+    index->fd = dup(fd);
+    index->size = size;
+    index->pattern = &search->pattern;
+    index->count.store(0);
+    index->scanned.store(0);
+    index->done.store(false);
+    index->stop.store(false);
+    if (index->fd < 0 || pthread_create(&index->thread, NULL, search_thread, index) != 0) {
+        // Nothing will be found, but n and N still know what was asked for
+        if (index->fd >= 0) {
+            close(index->fd);
+        }
+        delete index;
+        return 0;
+    }
+    search->index = index;
+    return 0;
+}
+
+void view_search_restart(ViewSearch *search, int fd, uint64_t size) {
+    if (search->text.empty()) {
+        return;
+    }
+    char err[256];
+    view_search_start(search, fd, size, search->text.c_str(), search->flags, err, sizeof(err));
+}
+
+void view_search_stop(ViewSearch *search) {
+    ViewSearchIndex *index = search->index;
+    if (index) {
+        index->stop.store(true);
+        pthread_join(index->thread, NULL);
+        for (int i = 0; i < VIEW_SEARCH_BLOCKS && index->blocks[i]; i++) {
+            delete[] index->blocks[i];
+        }
+        close(index->fd);
+        delete index;
+        search->index = NULL;
+    }
+    if (!search->text.empty()) {
+        text_pattern_free(&search->pattern);
+        search->text.clear();
+    }
+}
+
+long view_search_count(const ViewSearch *search, bool *complete) {
+    if (!search->index) {
+        *complete = true;
+        return 0;
+    }
+    *complete = search->index->done.load(std::memory_order_acquire);
+    return search->index->count.load(std::memory_order_acquire);
+}
+
+int view_search_progress(const ViewSearch *search) {
+    if (!search->index || search->index->done.load(std::memory_order_acquire) || search->index->size == 0) {
+        return 100;
+    }
+    return (int)(search->index->scanned.load(std::memory_order_acquire) * 100 / search->index->size);
+}
+
+static long match_line(const ViewSearchIndex *index, long k) {
+    return index->blocks[k / VIEW_SEARCH_BLOCK][k % VIEW_SEARCH_BLOCK];
+}
+
+long view_search_next(const ViewSearch *search, long line, bool forward) {
+    bool complete;
+    long count = view_search_count(search, &complete);
+
+    // Matching lines are found in order; the first one past line is found
+    // by bisection
+    long low = 0;
+    long high = count;
+    while (low < high) {
+        long mid = low + (high - low) / 2;
+        long at = match_line(search->index, mid);
+        if (forward ? at <= line : at < line) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (forward) {
+        // Lines are found in order, so the first one found is the first there is
+        if (low < count) {
+            return match_line(search->index, low);
+        }
+        return complete ? VIEW_SEARCH_NONE : VIEW_SEARCH_PENDING;
+    }
+
+    // Backward, the last one found is only the last there is once the
+    // search has got past line
+    if (!complete && low == count) {
+        return VIEW_SEARCH_PENDING;
+    }
+    return low > 0 ? match_line(search->index, low - 1) : VIEW_SEARCH_NONE;
+}
@@ -0,0 +1,63 @@
+#ifndef VIEW_SEARCH_H
+#define VIEW_SEARCH_H
+
+// In-file search for MINUX
+// Finds the lines of a viewed file that match a pattern (text_search.h)
+// on a background thread, so the viewer keeps scrolling while a file of
+// any size is searched. The thread reads the file in chunks cut at line
+// ends, counting lines as it goes, and appends the number of each
+// matching line to a list kept in blocks that never move - the scheme of
+// file_map.h's line index - so the list is read without a lock while it
+// grows. Plain strings are found with text_search's vector scan, so text
+// without a match costs little more than reading it.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "text_search.h"
+
+// In-file search settings
+#define VIEW_SEARCH_CHUNK (4 << 20)     // Bytes searched at a time
+#define VIEW_SEARCH_BLOCK 16384         // Matching lines per block
+#define VIEW_SEARCH_BLOCKS 4096         // Blocks at most; the search stops when they are full
+#define VIEW_SEARCH_REDRAW_MS 100       // Redraw interval for callers while a search runs
+
+// view_search_next() results besides a line
+#define VIEW_SEARCH_NONE -1             // No matching line that way
+#define VIEW_SEARCH_PENDING -2          // Not searched that far yet
+
+typedef struct ViewSearchIndex ViewSearchIndex;
+
+typedef struct {
+    std::string text;                   // What is searched for, empty if nothing
+    int flags;                          // text_pattern_compile() flags
+    TextPattern pattern;                // For marking matches on screen too
+    ViewSearchIndex *index;             // Shared with the searching thread
+} ViewSearch;
+
+void view_search_init(ViewSearch *search);
+
+// Search size bytes of fd (which is duplicated, so the caller may close it)
+// for text, replacing any search before. search must not move until it is
+// stopped. Returns 0, or -1 with a message in err for a bad pattern (and
+// the search before carries on).
+int view_search_start(ViewSearch *search, int fd, uint64_t size, const char *text, int flags,
+                      char *err, size_t err_len);
+
+// Search again for the same text, after the file changed
+void view_search_restart(ViewSearch *search, int fd, uint64_t size);
+
+// Stop searching and forget the matches and the pattern
+void view_search_stop(ViewSearch *search);
+
+// Matching lines found so far; *complete is set once the file is done
+long view_search_count(const ViewSearch *search, bool *complete);
+
+// Percent of the file searched
+int view_search_progress(const ViewSearch *search);
+
+// The first matching line (from 0) after line, or with forward false the
+// last one before it, or VIEW_SEARCH_NONE or VIEW_SEARCH_PENDING
+long view_search_next(const ViewSearch *search, long line, bool forward);
+
+#endif // VIEW_SEARCH_H
@@ -0,0 +1,443 @@
+#include "walker.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <deque>
+#include <string>
+
+// Directory states - a directory is read by whoever moves it out of
+// DIR_QUEUED first, a pool thread or the visitor itself
+enum { DIR_QUEUED, DIR_READING, DIR_READ, DIR_DROPPED };
+
+struct WalkDir {
+    std::atomic<int> state;
+    std::atomic<int> refs;      // One for the parent (or walk_tree), one per queue holding it
+    WalkDir *parent;            // Stays open until every child has been read or dropped
+    const char *name;           // Points into the parent's listing (the root path for the root)
+    int depth;                  // Level of this directory; its entries are one deeper
+    bool pushed;                // Counted in Walk.ahead until visited or dropped
+    int fd;
+    int error;
+    dev_t dev;
+    ino_t ino;
+    FsListing list;
+    WalkDir **children;         // Per entry in display order, NULL where there's nothing to descend into
+};
+
+typedef struct {
+    pthread_mutex_t lock;
+    std::deque<WalkDir *> items;
+} WalkQueue;
+
+struct Walk {
+    int flags;
+    int max_depth;
+    WalkReader reader;
+    void *ctx;
+    WalkQueue queues[WALK_THREADS + 1];     // Queue 0 belongs to the visiting thread
+    pthread_t threads[WALK_THREADS];
+    int thread_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // Something was queued, or the walk is over
+    pthread_cond_t ready;       // A directory finished reading
+    std::atomic<int> queued;
+    std::atomic<int> ahead;
+    std::atomic<bool> done;
+};
+
+typedef struct {
+    Walk *walk;
+    int slot;
+} WalkThread;
+
+static WalkDir *dir_new(WalkDir *parent, const char *name, int depth) {
+    WalkDir *d = new WalkDir;
+    d->state.store(DIR_QUEUED);
+    d->refs.store(1);
+    d->parent = parent;
+    d->name = name;
+    d->depth = depth;
+    d->pushed = false;
+    d->fd = -1;
+    d->error = 0;
+    d->dev = 0;
+    d->ino = 0;
+    memset(&d->list, 0, sizeof(d->list));
+    d->children = NULL;
+    return d;
+}
+
+static void dir_unref(WalkDir *d) {
+    if (d->refs.fetch_sub(1) == 1) {
+        delete d;
+    }
+}
+
+// Queue a directory for the pool unless enough have been read ahead already;
+// anything not queued is read by the visitor when it gets there
+static void push(Walk *w, int slot, WalkDir *d) {
+    if (w->thread_count == 0 || w->ahead.load() >= WALK_READ_AHEAD) {
+        return;
+    }
+    d->refs++;
+    d->pushed = true;
+    w->ahead++;
+
+    WalkQueue *q = &w->queues[slot];
+    pthread_mutex_lock(&q->lock);
+    q->items.push_back(d);
+    pthread_mutex_unlock(&q->lock);
+
+    w->queued++;
+    pthread_mutex_lock(&w->lock);
+    pthread_cond_signal(&w->work);
+    pthread_mutex_unlock(&w->lock);
+}
+
+// A thread takes the newest entry from its own queue and steals the oldest
+// from the others, which are the directories the visitor needs soonest
+static WalkDir *take(Walk *w, int slot) {
+    for (int i = 0; i <= WALK_THREADS; i++) {
+        int s = (slot + i) % (WALK_THREADS + 1);
+        WalkQueue *q = &w->queues[s];
+        pthread_mutex_lock(&q->lock);
+        WalkDir *d = NULL;
+        if (!q->items.empty()) {
+            if (i == 0) {
+                d = q->items.back();
+                q->items.pop_back();
+            } else {
+                d = q->items.front();
+                q->items.pop_front();
+            }
+        }
+        pthread_mutex_unlock(&q->lock);
+        if (d) {
+            w->queued--;
+            return d;
+        }
+    }
+    return NULL;
+}
+
+static void read_dir(Walk *w, WalkDir *d, int slot) {
+    int open_flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    if (!(w->flags & WALK_FOLLOW_LINKS) && d->parent) {
+        open_flags |= O_NOFOLLOW;
+    }
+    int list_flags = FS_LIST_FOLLOW * !!(w->flags & WALK_FOLLOW_LINKS) |
+                     FS_LIST_HIDDEN * !!(w->flags & WALK_HIDDEN) |
+                     FS_LIST_STAT * !!(w->flags & WALK_STAT);
+
+    d->fd = openat(d->parent ? d->parent->fd : AT_FDCWD, d->name, open_flags);
+    if (d->fd < 0) {
+        d->error = errno;
+    } else if (w->flags & WALK_FOLLOW_LINKS) {
+        // A link back to an ancestor would otherwise never end
+        struct stat st;
+        if (fstat(d->fd, &st) == 0) {
+            d->dev = st.st_dev;
+            d->ino = st.st_ino;
+            for (WalkDir *up = d->parent; up; up = up->parent) {
+                if (up->dev == d->dev && up->ino == d->ino) {
+                    d->error = ELOOP;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (!d->error) {
+        int read = w->reader ? w->reader(d->fd, list_flags, &d->list, w->ctx)
+                             : fs_list_read_fd(d->fd, list_flags, &d->list);
+        if (read != 0) {
+            d->error = errno;
+        }
+    }
+
+    if (!d->error) {
+        fs_list_sort(&d->list);
+        bool descend = w->max_depth <= 0 || d->depth + 2 <= w->max_depth;
+        if (descend && d->list.count > 0) {
+            d->children = (WalkDir **)calloc(d->list.count, sizeof(WalkDir *));
+        }
+        if (d->children) {
+            for (size_t i = 0; i < d->list.count; i++) {
+                const FsEntry *entry = fs_list_at(&d->list, i);
+                if (fs_entry_is_dir(entry)) {
+                    d->children[i] = dir_new(d, fs_entry_name(&d->list, entry), d->depth + 1);
+                }
+            }
+            // The visitor's queue is only stolen from, oldest first, so it
+            // gets the children in order; a pool thread pops its own newest
+            // first, so they go in backwards
+            for (size_t i = 0; i < d->list.count; i++) {
+                size_t at = slot == 0 ? i : d->list.count - 1 - i;
+                if (d->children[at]) {
+                    push(w, slot, d->children[at]);
+                }
+            }
+        }
+    }
+
+    pthread_mutex_lock(&w->lock);
+    d->state.store(DIR_READ);
+    pthread_cond_broadcast(&w->ready);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void *walk_thread(void *arg) {
+    Walk *w = ((WalkThread *)arg)->walk;
+    int slot = ((WalkThread *)arg)->slot;
+
+    while (1) {
+        WalkDir *d = take(w, slot);
+        if (!d) {
+            pthread_mutex_lock(&w->lock);
+            while (!w->done.load() && w->queued.load() == 0) {
+                pthread_cond_wait(&w->work, &w->lock);
+            }
+            bool finished = w->done.load();
+            pthread_mutex_unlock(&w->lock);
+            if (finished) {
+                break;
+            }
+            continue;
+        }
+
+        int expected = DIR_QUEUED;
+        if (!w->done.load() && d->state.compare_exchange_strong(expected, DIR_READING)) {
+            read_dir(w, d, slot);
+        }
+        dir_unref(d);
+    }
+    return NULL;
+}
+
+// Read d now if nobody has started, otherwise wait for whoever did
+static void claim(Walk *w, WalkDir *d) {
+    int expected = DIR_QUEUED;
+    if (d->state.compare_exchange_strong(expected, DIR_READING)) {
+        read_dir(w, d, 0);
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    while (d->state.load() != DIR_READ) {
+        pthread_cond_wait(&w->ready, &w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void settle(Walk *w, WalkDir *d) {
+    if (d->pushed) {
+        d->pushed = false;
+        w->ahead--;
+    }
+}
+
+static void drop(Walk *w, WalkDir *d);
+
+// Free a directory the visitor is done with; children it never got to are
+// dropped first, since a thread reading one still needs our descriptor
+static void release(Walk *w, WalkDir *d) {
+    if (d->children) {
+        for (size_t i = 0; i < d->list.count; i++) {
+            if (d->children[i]) {
+                drop(w, d->children[i]);
+            }
+        }
+        free(d->children);
+        d->children = NULL;
+    }
+    fs_list_free(&d->list);
+    if (d->fd >= 0) {
+        close(d->fd);
+        d->fd = -1;
+    }
+    dir_unref(d);
+}
+
+static void drop(Walk *w, WalkDir *d) {
+    int expected = DIR_QUEUED;
+    if (!d->state.compare_exchange_strong(expected, DIR_DROPPED) && expected == DIR_READING) {
+        pthread_mutex_lock(&w->lock);
+        while (d->state.load() != DIR_READ) {
+            pthread_cond_wait(&w->ready, &w->lock);
+        }
+        pthread_mutex_unlock(&w->lock);
+    }
+    settle(w, d);
+    release(w, d);
+}
+
+typedef struct {
+    Walk *walk;
+    WalkVisitor visit;
+    void *ctx;
+    int (*stop)(void);
+    std::string path;
+} Visit;
+
+static int visit_dir(Visit *v, WalkDir *d);
+
+// Descend into a directory entry the visitor has just seen
+static int visit_child(Visit *v, WalkDir *child, const WalkItem *entry_item) {
+    settle(v->walk, child);
+    claim(v->walk, child);
+
+    int result;
+    if (child->error) {
+        WalkItem item = *entry_item;
+        item.event = WALK_ERROR;
+        item.entry = NULL;
+        item.error = child->error;
+        result = v->visit(&item, v->ctx) == WALK_STOP ? WALK_STOP : WALK_CONTINUE;
+    } else {
+        result = visit_dir(v, child);
+    }
+
+    if (result != WALK_STOP) {
+        WalkItem item = *entry_item;
+        item.event = WALK_LEAVE;
+        result = v->visit(&item, v->ctx) == WALK_STOP ? WALK_STOP : WALK_CONTINUE;
+    }
+    release(v->walk, child);
+    return result;
+}
+
+static int visit_dir(Visit *v, WalkDir *d) {
+    for (size_t i = 0; i < d->list.count; i++) {
+        if (v->stop && v->stop()) {
+            return WALK_STOP;
+        }
+
+        const FsEntry *entry = fs_list_at(&d->list, i);
+        const char *name = fs_entry_name(&d->list, entry);
+        size_t base = v->path.size();
+        if (base > 0 && v->path[base - 1] != '/') {
+            v->path += '/';
+        }
+        v->path += name;
+
+        WalkItem item;
+        item.event = WALK_ENTRY;
+        item.path = v->path.c_str();
+        item.name = name;
+        item.depth = d->depth + 1;
+        item.is_last = i + 1 == d->list.count;
+        item.entry = entry;
+        item.error = 0;
+        int result = v->visit(&item, v->ctx);
+
+        WalkDir *child = d->children ? d->children[i] : NULL;
+        if (child) {
+            d->children[i] = NULL;
+            if (result == WALK_CONTINUE) {
+                result = visit_child(v, child, &item);
+            } else {
+                drop(v->walk, child);
+            }
+        }
+        v->path.resize(base);
+
+        if (result == WALK_STOP) {
+            return WALK_STOP;
+        }
+    }
+    return WALK_CONTINUE;
+}
+
+static void start_threads(Walk *w, WalkThread *args) {
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    for (int i = 0; i < WALK_THREADS; i++) {
+        args[w->thread_count].walk = w;
+        args[w->thread_count].slot = w->thread_count + 1;
+        if (pthread_create(&w->threads[w->thread_count], NULL, walk_thread, &args[w->thread_count]) == 0) {
+            w->thread_count++;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+}
+
+int walk_tree(const char *root, const WalkOptions *options, WalkVisitor visit, void *ctx) {
+    Walk *w = new Walk;
+    w->flags = options->flags;
+    w->max_depth = options->max_depth;
+    w->reader = options->reader;
+    w->ctx = ctx;
+    w->thread_count = 0;
+    for (int i = 0; i <= WALK_THREADS; i++) {
+        pthread_mutex_init(&w->queues[i].lock, NULL);
+    }
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->work, NULL);
+    pthread_cond_init(&w->ready, NULL);
+    w->queued.store(0);
+    w->ahead.store(0);
+    w->done.store(false);
+
+    WalkDir *top = dir_new(NULL, root, 0);
+    top->state.store(DIR_READING);
+    read_dir(w, top, 0);
+
+    int result = -1;
+    int saved_errno = top->error;
+    WalkThread args[WALK_THREADS];
+    if (!top->error) {
+        // Only pay for threads when there is somewhere to go
+        bool has_dirs = false;
+        for (size_t i = 0; top->children && i < top->list.count && !has_dirs; i++) {
+            has_dirs = top->children[i] != NULL;
+        }
+        if (has_dirs) {
+            start_threads(w, args);
+            for (size_t i = 0; i < top->list.count; i++) {
+                if (top->children[i]) {
+                    push(w, 0, top->children[i]);
+                }
+            }
+        }
+
+        Visit v;
+        v.walk = w;
+        v.visit = visit;
+        v.ctx = ctx;
+        v.stop = options->stop;
+        v.path = root;
+        result = visit_dir(&v, top) == WALK_STOP ? 1 : 0;
+    }
+    release(w, top);
+
+    pthread_mutex_lock(&w->lock);
+    w->done.store(true);
+    pthread_cond_broadcast(&w->work);
+    pthread_mutex_unlock(&w->lock);
+    for (int i = 0; i < w->thread_count; i++) {
+        pthread_join(w->threads[i], NULL);
+    }
+
+    // Whatever is still queued was dropped with its parent
+    for (int i = 0; i <= WALK_THREADS; i++) {
+        for (size_t j = 0; j < w->queues[i].items.size(); j++) {
+            dir_unref(w->queues[i].items[j]);
+        }
+        pthread_mutex_destroy(&w->queues[i].lock);
+    }
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->work);
+    pthread_cond_destroy(&w->ready);
+    delete w;
+
+    if (result < 0) {
+        errno = saved_errno;
+    }
+    return result;
+}
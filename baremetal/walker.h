@@ -0,0 +1,59 @@
+#ifndef WALKER_H
+#define WALKER_H
+
+// Directory walker for MINUX
+// Walks a tree with openat() relative to each parent's descriptor, reading
+// subdirectories ahead of the visitor on a small work-stealing pool. The
+// visitor still sees every entry on the calling thread, in the same order
+// as a serial depth-first walk (directories first, then by name).
+
+#include "fs_list.h"
+
+// Walker settings
+#define WALK_THREADS 4                  // Threads reading ahead of the visitor
+#define WALK_READ_AHEAD 64              // Directories read but not yet visited (bounds memory and descriptors)
+
+// Flags for WalkOptions
+#define WALK_HIDDEN 0x1                 // Include names starting with '.'
+#define WALK_FOLLOW_LINKS 0x2           // Describe and descend into what symlinks point to
+#define WALK_STAT 0x4                   // Fill in st for every entry, not just the type
+
+// Visitor return values
+#define WALK_CONTINUE 0
+#define WALK_SKIP 1                     // Don't descend into this directory
+#define WALK_STOP 2                     // End the walk
+
+typedef enum {
+    WALK_ENTRY,                         // An entry of the directory being walked
+    WALK_LEAVE,                         // All entries below this directory have been visited
+    WALK_ERROR                          // This directory could not be read (error holds errno)
+} WalkEvent;
+
+typedef struct {
+    WalkEvent event;
+    const char *path;                   // Root path as given, then "/name" per level
+    const char *name;
+    int depth;                          // 1 for the root's own entries
+    int is_last;                        // Last entry of its directory
+    const FsEntry *entry;               // NULL for WALK_ERROR
+    int error;
+} WalkItem;
+
+typedef int (*WalkVisitor)(const WalkItem *item, void *ctx);
+
+// Replacement for fs_list_read_fd(), called on any walk thread with the
+// walk's ctx - lets a caller answer from a cache instead of reading
+typedef int (*WalkReader)(int fd, int list_flags, FsListing *list, void *ctx);
+
+typedef struct {
+    int flags;                          // WALK_* flags
+    int max_depth;                      // Deepest level reported, 0 = unlimited
+    int (*stop)(void);                  // Polled between entries on the calling thread, may be NULL
+    WalkReader reader;                  // NULL to read directories normally
+} WalkOptions;
+
+// Walk everything below root. Returns 0 when done, 1 if the visitor or
+// stop() ended the walk early, or -1 with errno set if root can't be read.
+int walk_tree(const char *root, const WalkOptions *options, WalkVisitor visit, void *ctx);
+
+#endif // WALKER_H
@@ -0,0 +1,272 @@
+#include "worker.h"
+#include "output.h"
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <deque>
+
+struct WorkerTask {
+    WorkerFunction fn;
+    WorkerFunction cleanup;
+    void *arg;
+
+    // Output queue - the worker only advances tail and the UI thread only
+    // advances head, so neither side takes a lock. Both count bytes ever
+    // written/read; the difference is what is queued.
+    char ring[WORKER_QUEUE_BYTES];
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+
+    std::atomic<bool> cancel;
+    std::atomic<bool> finished;
+    std::atomic<int> refs;      // One for the UI, one until the pool is done with it
+
+    pthread_mutex_t progress_lock;
+    char progress[WORKER_PROGRESS_LEN];
+};
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static std::deque<WorkerTask *> pending;
+static pthread_t threads[WORKER_THREADS];
+static int thread_count = 0;
+static bool stopping = false;
+
+static int wake_pipe[2] = {-1, -1};
+static std::atomic<bool> wake_pending(false);
+
+// Task being run by the calling thread
+static thread_local WorkerTask *current_task = NULL;
+
+static void task_unref(WorkerTask *task) {
+    if (task->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        pthread_mutex_destroy(&task->progress_lock);
+        delete task;
+    }
+}
+
+// One byte in the pipe is enough however many tasks have news
+static void wake_ui(void) {
+    if (!wake_pending.exchange(true) && wake_pipe[1] >= 0) {
+        ssize_t ignored = write(wake_pipe[1], "", 1);
+        (void)ignored;
+    }
+}
+
+// Output sink for worker threads - waits while the queue is full unless
+// the task has been cancelled, in which case the text is dropped
+static void task_output(const char *text, size_t len, void *ctx) {
+    WorkerTask *task = (WorkerTask *)ctx;
+
+    while (len > 0) {
+        size_t tail = task->tail.load(std::memory_order_relaxed);
+        size_t head = task->head.load(std::memory_order_acquire);
+        size_t room = WORKER_QUEUE_BYTES - (tail - head);
+        if (room == 0) {
+            if (task->cancel.load(std::memory_order_relaxed)) {
+                return;
+            }
+            wake_ui();
+            usleep(WORKER_WAIT_US);
+            continue;
+        }
+
+        size_t n = len < room ? len : room;
+        size_t at = tail & (WORKER_QUEUE_BYTES - 1);
+        size_t first = n < WORKER_QUEUE_BYTES - at ? n : WORKER_QUEUE_BYTES - at;
+        memcpy(task->ring + at, text, first);
+        memcpy(task->ring, text + first, n - first);
+        task->tail.store(tail + n, std::memory_order_release);
+
+        text += n;
+        len -= n;
+        wake_ui();
+    }
+}
+
+static void *worker_main(void *) {
+    while (1) {
+        pthread_mutex_lock(&pool_lock);
+        while (pending.empty() && !stopping) {
+            pthread_cond_wait(&pool_cond, &pool_lock);
+        }
+        if (pending.empty()) {
+            pthread_mutex_unlock(&pool_lock);
+            break;
+        }
+        WorkerTask *task = pending.front();
+        pending.pop_front();
+        pthread_mutex_unlock(&pool_lock);
+
+        current_task = task;
+        output_set_thread_sink(task_output, task);
+        if (!task->cancel.load(std::memory_order_relaxed)) {
+            task->fn(task->arg);
+        }
+        if (task->cleanup) {
+            task->cleanup(task->arg);
+        }
+        output_set_thread_sink(NULL, NULL);
+        current_task = NULL;
+
+        task->finished.store(true, std::memory_order_release);
+        wake_ui();
+        task_unref(task);
+    }
+    return NULL;
+}
+
+// Start the threads with every signal blocked so SIGINT and SIGWINCH keep
+// going to the UI thread
+static bool pool_start(void) {
+    if (thread_count > 0) {
+        return true;
+    }
+
+    if (wake_pipe[0] < 0) {
+        if (pipe(wake_pipe) != 0) {
+            return false;
+        }
+        for (int i = 0; i < 2; i++) {
+            fcntl(wake_pipe[i], F_SETFL, fcntl(wake_pipe[i], F_GETFL) | O_NONBLOCK);
+            fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC);
+        }
+    }
+
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    stopping = false;
+    for (int i = 0; i < WORKER_THREADS; i++) {
+        if (pthread_create(&threads[thread_count], NULL, worker_main, NULL) == 0) {
+            thread_count++;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    return thread_count > 0;
+}
+
+WorkerTask *worker_start(WorkerFunction fn, void *arg, WorkerFunction cleanup) {
+    if (!pool_start()) {
+        return NULL;
+    }
+
+    WorkerTask *task = new WorkerTask;
+    task->fn = fn;
+    task->cleanup = cleanup;
+    task->arg = arg;
+    task->head.store(0);
+    task->tail.store(0);
+    task->cancel.store(false);
+    task->finished.store(false);
+    task->refs.store(2);
+    pthread_mutex_init(&task->progress_lock, NULL);
+    task->progress[0] = '\0';
+
+    pthread_mutex_lock(&pool_lock);
+    pending.push_back(task);
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+    return task;
+}
+
+void worker_pool_shutdown(void) {
+    if (thread_count == 0) {
+        return;
+    }
+
+    // Queued tasks still pass through a worker so their cleanup runs
+    pthread_mutex_lock(&pool_lock);
+    for (size_t i = 0; i < pending.size(); i++) {
+        pending[i]->cancel.store(true);
+    }
+    stopping = true;
+    pthread_cond_broadcast(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    thread_count = 0;
+
+    for (int i = 0; i < 2; i++) {
+        close(wake_pipe[i]);
+        wake_pipe[i] = -1;
+    }
+}
+
+ssize_t worker_read(WorkerTask *task, char *buf, size_t len) {
+    // Check for completion before looking at the queue so output written
+    // just before the task finished is never missed
+    bool done = task->finished.load(std::memory_order_acquire);
+    size_t head = task->head.load(std::memory_order_relaxed);
+    size_t tail = task->tail.load(std::memory_order_acquire);
+    if (head == tail) {
+        return done ? -1 : 0;
+    }
+
+    size_t n = tail - head < len ? tail - head : len;
+    size_t at = head & (WORKER_QUEUE_BYTES - 1);
+    size_t first = n < WORKER_QUEUE_BYTES - at ? n : WORKER_QUEUE_BYTES - at;
+    memcpy(buf, task->ring + at, first);
+    memcpy(buf + first, task->ring, n - first);
+    task->head.store(head + n, std::memory_order_release);
+    return (ssize_t)n;
+}
+
+void worker_cancel(WorkerTask *task) {
+    task->cancel.store(true);
+}
+
+int worker_finished(WorkerTask *task) {
+    return task->finished.load(std::memory_order_acquire);
+}
+
+int worker_was_cancelled(WorkerTask *task) {
+    return task->cancel.load();
+}
+
+void worker_release(WorkerTask *task) {
+    if (!task) {
+        return;
+    }
+    // Nobody will read the output any more, so don't let the task wait on it
+    task->cancel.store(true);
+    task_unref(task);
+}
+
+size_t worker_progress(WorkerTask *task, char *buf, size_t len) {
+    pthread_mutex_lock(&task->progress_lock);
+    snprintf(buf, len, "%s", task->progress);
+    pthread_mutex_unlock(&task->progress_lock);
+    return strlen(buf);
+}
+
+int worker_wake_fd(void) {
+    return wake_pipe[0];
+}
+
+void worker_wake_clear(void) {
+    // Clear the flag first: a task that writes after this wakes us again
+    wake_pending.store(false);
+    char buf[64];
+    while (wake_pipe[0] >= 0 && read(wake_pipe[0], buf, sizeof(buf)) > 0) {
+    }
+}
+
+int worker_cancelled(void) {
+    return current_task && current_task->cancel.load(std::memory_order_relaxed);
+}
+
+void worker_set_progress(const char *text) {
+    if (!current_task) {
+        return;
+    }
+    pthread_mutex_lock(&current_task->progress_lock);
+    snprintf(current_task->progress, sizeof(current_task->progress), "%s", text);
+    pthread_mutex_unlock(&current_task->progress_lock);
+}
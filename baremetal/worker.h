@@ -0,0 +1,53 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+// Worker pool for MINUX
+// Runs builtin commands on a small pool of threads so the prompt stays
+// responsive. Each task streams its output to the UI thread through a
+// lock-free single-producer/single-consumer byte queue and can be
+// cancelled from the UI.
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Worker settings
+#define WORKER_THREADS 4
+#define WORKER_QUEUE_BYTES 65536        // Output buffered per task (power of two)
+#define WORKER_WAIT_US 1000             // Nap while a task's queue is full
+#define WORKER_PROGRESS_LEN 96          // Longest progress line a task can report
+
+typedef struct WorkerTask WorkerTask;
+typedef void (*WorkerFunction)(void *arg);
+
+// Queue fn(arg) on the pool, starting the threads on first use. cleanup(arg)
+// runs on the worker after fn, or instead of it if the task is cancelled
+// before it starts. Returns NULL if the pool can't run it (the caller keeps
+// arg in that case).
+WorkerTask *worker_start(WorkerFunction fn, void *arg, WorkerFunction cleanup);
+
+// Cancel everything still queued and join the threads
+void worker_pool_shutdown(void);
+
+// Task control from the UI thread
+ssize_t worker_read(WorkerTask *task, char *buf, size_t len);  // >0 data, 0 nothing pending, -1 finished and drained
+void worker_cancel(WorkerTask *task);
+int worker_finished(WorkerTask *task);
+int worker_was_cancelled(WorkerTask *task);
+void worker_release(WorkerTask *task);  // Drop the UI's reference, cancelling the task if it's still running
+
+// Latest progress line set by the task; returns its length, 0 if none
+size_t worker_progress(WorkerTask *task, char *buf, size_t len);
+
+// Readable whenever a task has written output or finished
+int worker_wake_fd(void);
+void worker_wake_clear(void);
+
+// Called from inside a task: true once the user has cancelled it.
+// Always false on the UI thread, so shared code can check it freely.
+int worker_cancelled(void);
+
+// Called from inside a task: replace its progress line (e.g. a running
+// count), which the UI may show while the task works. No-op elsewhere.
+void worker_set_progress(const char *text);
+
+#endif // WORKER_H